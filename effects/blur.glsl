@@ -8,7 +8,7 @@ uniform vec2 mouse;
 uniform sampler2D prev_layer;
 uniform float time;
 
-#define BLUR_POWER 8.0
+#define BLUR_POWER 8.0 // @knob 0.0 32.0 0.5
 
 void main(void)
 {
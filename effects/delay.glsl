@@ -8,7 +8,7 @@ uniform vec2 resolution;
 uniform sampler2D backbuffer;
 uniform sampler2D prev_layer;
 
-#define DELAY_FACTOR 0.9
+#define DELAY_FACTOR 0.9 // @knob 0.0 0.99 0.01
 
 void main(void) {
     vec2 uv = (gl_FragCoord.xy + vec2(0.5, 0.5)) / resolution.xy;
@@ -1,12 +1,6 @@
 /* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
 
-#ifdef GL_ES
-precision mediump float;
-#endif
-
-uniform vec2 resolution;
-uniform sampler2D prev_layer;
-uniform sampler2D backbuffer;
+#include "../include/pj.glsl"
 
 void main(void)
 {
@@ -0,0 +1,15 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* what pj gives every layer. #include "../include/pj.glsl", unused
+ * uniforms cost nothing */
+
+#ifdef GL_ES
+precision mediump float;
+#endif
+
+uniform float time;
+uniform vec2 mouse;
+uniform vec2 resolution;
+uniform float rand;
+uniform sampler2D backbuffer;
+uniform sampler2D prev_layer;       /* output of the layer before */
@@ -1,17 +1,8 @@
 /* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
 
-#ifdef GL_ES
-precision mediump float;
-#endif
-
-uniform float time;
-uniform vec2 mouse;
-uniform vec2 resolution;
-uniform float rand;
-uniform sampler2D backbuffer;
+#include "../include/pj.glsl"
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / resolution.xy;
     gl_FragColor = vec4(uv.xy, 0.0, 1.0);
 }
-
@@ -0,0 +1,537 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef USE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+#include "config.h"
+#include "base.h"
+#include "fft.h"
+#include "audio.h"
+
+
+enum {
+    FFT_SIZE = 1024,
+    HOP_SIZE = 512,             /* capture read, and how often a file looks at the time */
+    CAPTURE_RATE = 44100,
+    FRESH = 4                   /* middle of the triple buffer not taken yet */
+};
+
+#define MIN_HZ 20.0
+#define BASS_HZ 250.0
+#define HIGH_HZ 4000.0
+#define FLOOR_DB -80.0
+#define BEAT_RATIO 1.5          /* bass power over its average */
+#define BEAT_HOLD 0.25          /* seconds between onsets at least */
+#define BEAT_DECAY 0.1
+#define BASS_AVERAGE 1.0
+
+typedef enum {
+    SAMPLE_U8,
+    SAMPLE_S16,
+    SAMPLE_S24,
+    SAMPLE_S32,
+    SAMPLE_F32
+} SampleFormat;
+
+struct Audio_ {
+    int rate;
+    /* file */
+    int fd;
+    const unsigned char *map;
+    size_t map_size;
+    const unsigned char *data;  /* first frame */
+    long num_frame;
+    int channels;
+    int block_align;            /* bytes of a frame */
+    SampleFormat format;
+    /* capture */
+    int is_capture;
+#ifdef USE_ALSA
+    snd_pcm_t *pcm;
+#endif
+    /* analysis, worker only */
+    Fft *fft;
+    float window[FFT_SIZE];
+    float history[FFT_SIZE];    /* oldest first */
+    float re[FFT_SIZE];
+    float im[FFT_SIZE];
+    int bin_lo[Audio_NUM_BIN];  /* FFT bins of each spectrum bin */
+    int bin_hi[Audio_NUM_BIN];
+    int bass_bin;
+    int high_bin;
+    double bass_average;
+    double since_beat;
+    double beat;
+    unsigned long sequence;
+    /* hand over */
+    Audio_Frame frame[3];
+    int back;                   /* worker only */
+    int middle;                 /* index | FRESH, exchanged atomically */
+    int front;                  /* reader only */
+    long long time_us;          /* atomic. position requested, -1: none */
+    long long done_us;          /* under mutex. position analysed last */
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_wake;
+    pthread_cond_t cond_done;
+    int quit;                   /* atomic */
+};
+
+
+static unsigned int ReadLE16(const unsigned char *p)
+{
+    return (unsigned int)p[0] | ((unsigned int)p[1] << 8);
+}
+
+static unsigned int ReadLE32(const unsigned char *p)
+{
+    return ReadLE16(p) | (ReadLE16(p + 2) << 16);
+}
+
+/* channels mixed down */
+static float Audio_SampleAt(Audio *a, long index)
+{
+    const unsigned char *p = a->data + (size_t)index * (size_t)a->block_align;
+    float sum = 0.0f;
+    int c;
+    for (c = 0; c < a->channels; c++) {
+        switch (a->format) {
+        case SAMPLE_U8:
+            sum += ((int)p[0] - 128) / 128.0f;
+            p += 1;
+            break;
+        case SAMPLE_S16:
+            sum += (int16_t)ReadLE16(p) / 32768.0f;
+            p += 2;
+            break;
+        case SAMPLE_S24:
+            sum += (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16)
+                             | ((uint32_t)p[2] << 24)) / 2147483648.0f;
+            p += 3;
+            break;
+        case SAMPLE_S32:
+            sum += (int32_t)ReadLE32(p) / 2147483648.0f;
+            p += 4;
+            break;
+        case SAMPLE_F32:
+            {
+                uint32_t bits = ReadLE32(p);
+                float f;
+                memcpy(&f, &bits, sizeof(f));
+                sum += f;
+            }
+            p += 4;
+            break;
+        }
+    }
+    return sum / a->channels;
+}
+
+/* "RIFF" <size> "WAVE", then chunks. only "fmt " and "data" matter */
+static int Audio_ParseWAV(Audio *a)
+{
+    const unsigned char *p = a->map, *end = a->map + a->map_size;
+    int format_tag = -1, bits = 0;
+
+    if (a->map_size < 12 || memcmp(p, "RIFF", 4) != 0 || memcmp(p + 8, "WAVE", 4) != 0) {
+        printf("not a WAV file\r\n");
+        return 1;
+    }
+    for (p += 12; end - p >= 8; ) {
+        size_t size = ReadLE32(p + 4);
+        const unsigned char *body = p + 8;
+        if (size > (size_t)(end - body)) {
+            size = (size_t)(end - body); /* truncated, take what is there */
+        }
+        if (memcmp(p, "fmt ", 4) == 0 && size >= 16) {
+            format_tag = (int)ReadLE16(body);
+            a->channels = (int)ReadLE16(body + 2);
+            a->rate = (int)ReadLE32(body + 4);
+            a->block_align = (int)ReadLE16(body + 12);
+            bits = (int)ReadLE16(body + 14);
+            if (format_tag == 0xfffe && size >= 26) {
+                format_tag = (int)ReadLE16(body + 24); /* WAVE_FORMAT_EXTENSIBLE sub format */
+            }
+        } else if (memcmp(p, "data", 4) == 0 && format_tag >= 0) {
+            a->data = body;
+            a->num_frame = (a->block_align > 0) ? (long)(size / (size_t)a->block_align) : 0;
+            break;
+        }
+        p = body + size + (size & 1);
+    }
+    if (format_tag == 1 && bits == 8) {
+        a->format = SAMPLE_U8;
+    } else if (format_tag == 1 && bits == 16) {
+        a->format = SAMPLE_S16;
+    } else if (format_tag == 1 && bits == 24) {
+        a->format = SAMPLE_S24;
+    } else if (format_tag == 1 && bits == 32) {
+        a->format = SAMPLE_S32;
+    } else if (format_tag == 3 && bits == 32) {
+        a->format = SAMPLE_F32;
+    } else {
+        printf("WAV: format %d with %d bit samples is not supported\r\n", format_tag, bits);
+        return 2;
+    }
+    if (a->channels <= 0 || a->rate <= 0 || a->block_align != a->channels * ((bits + 7) / 8)) {
+        printf("WAV: broken fmt chunk\r\n");
+        return 3;
+    }
+    if (a->data == NULL || a->num_frame <= 0) {
+        printf("WAV: no samples\r\n");
+        return 4;
+    }
+    return 0;
+}
+
+static float Level(double power)
+{
+    double db = 10.0 * log10(power + 1e-12);
+    double level = (db - FLOOR_DB) / -FLOOR_DB;
+    return (float)((level < 0.0) ? 0.0 : (level > 1.0) ? 1.0 : level);
+}
+
+static double MeanPower(const float *power, int lo, int hi)
+{
+    double sum = 0.0;
+    int i;
+    if (hi <= lo) {
+        return 0.0;
+    }
+    for (i = lo; i < hi; i++) {
+        sum += power[i];
+    }
+    return sum / (hi - lo);
+}
+
+/* history -> back buffer, then swapped to the middle. dt: seconds since the
+ * last analysis, < 0 after a jump */
+static void Audio_Analyse(Audio *a, double dt)
+{
+    Audio_Frame *out = &a->frame[a->back];
+    float *power = a->re;       /* reused once transformed */
+    double norm, bass;
+    int i, k;
+
+    for (k = 0; k < Audio_NUM_BIN; k++) {
+        out->waveform[k] = a->history[k * (FFT_SIZE / Audio_NUM_BIN)];
+    }
+    for (i = 0; i < FFT_SIZE; i++) {
+        a->re[i] = a->history[i] * a->window[i];
+        a->im[i] = 0.0f;
+    }
+    Fft_Forward(a->fft, a->re, a->im);
+    /* full scale sine: 1.0. Hann halves the amplitude */
+    norm = 1.0 / ((FFT_SIZE / 4.0) * (FFT_SIZE / 4.0));
+    for (i = 0; i < FFT_SIZE / 2; i++) {
+        power[i] = (float)((a->re[i] * a->re[i] + a->im[i] * a->im[i]) * norm);
+    }
+    for (k = 0; k < Audio_NUM_BIN; k++) {
+        float peak = 0.0f;
+        for (i = a->bin_lo[k]; i < a->bin_hi[k]; i++) {
+            peak = (power[i] > peak) ? power[i] : peak;
+        }
+        out->spectrum[k] = Level(peak);
+    }
+    bass = MeanPower(power, 1, a->bass_bin);
+    out->bass = Level(bass);
+    out->mid = Level(MeanPower(power, a->bass_bin, a->high_bin));
+    out->high = Level(MeanPower(power, a->high_bin, FFT_SIZE / 2));
+
+    if (dt < 0.0) {
+        a->bass_average = bass;
+        a->since_beat = BEAT_HOLD;
+        a->beat = 0.0;
+        dt = 0.0;
+    }
+    a->since_beat += dt;
+    a->beat *= exp(-dt / BEAT_DECAY);
+    if (bass > BEAT_RATIO * a->bass_average && bass > 1e-6 && a->since_beat >= BEAT_HOLD) {
+        a->beat = 1.0;
+        a->since_beat = 0.0;
+    }
+    a->bass_average += (bass - a->bass_average) * (1.0 - exp(-dt / BASS_AVERAGE));
+    out->beat = (float)a->beat;
+
+    a->sequence += 1;
+    out->sequence = a->sequence;
+    a->back = __atomic_exchange_n(&a->middle, a->back | FRESH, __ATOMIC_ACQ_REL) & ~FRESH;
+}
+
+/* window ending at 't', wrapping around the file */
+static void Audio_AnalyseFileAt(Audio *a, long long t_us, long long last_us)
+{
+    long end = (long)((double)t_us * a->rate / 1000000.0);
+    double dt = (last_us < 0 || t_us < last_us || t_us - last_us > 1000000)
+        ? -1.0 : (t_us - last_us) / 1000000.0;
+    int i;
+    for (i = 0; i < FFT_SIZE; i++) {
+        long index = (end - FFT_SIZE + i) % a->num_frame;
+        if (index < 0) {
+            index += a->num_frame;
+        }
+        a->history[i] = Audio_SampleAt(a, index);
+    }
+    Audio_Analyse(a, dt);
+}
+
+/* file worker: wakes a few times per frame, analyses when the time moved */
+static void *Audio_FileMain(void *arg)
+{
+    Audio *a = arg;
+    long long last_us = -1;
+
+    pthread_mutex_lock(&a->mutex);
+    while (!__atomic_load_n(&a->quit, __ATOMIC_ACQUIRE)) {
+        long long t_us = __atomic_load_n(&a->time_us, __ATOMIC_ACQUIRE);
+        if (t_us == last_us) {
+            struct timespec deadline;
+            long ns = (long)(1000000000.0 * HOP_SIZE / a->rate);
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += ns;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&a->cond_wake, &a->mutex, &deadline);
+            continue;
+        }
+        pthread_mutex_unlock(&a->mutex);
+        Audio_AnalyseFileAt(a, t_us, last_us);
+        last_us = t_us;
+        pthread_mutex_lock(&a->mutex);
+        a->done_us = t_us;
+        pthread_cond_broadcast(&a->cond_done);
+    }
+    pthread_mutex_unlock(&a->mutex);
+    return NULL;
+}
+
+#ifdef USE_ALSA
+/* capture worker: the device paces it */
+static void *Audio_CaptureMain(void *arg)
+{
+    Audio *a = arg;
+    int16_t buf[HOP_SIZE];
+
+    while (!__atomic_load_n(&a->quit, __ATOMIC_ACQUIRE)) {
+        snd_pcm_sframes_t n;
+        int i;
+        n = snd_pcm_readi(a->pcm, buf, HOP_SIZE);
+        if (n < 0) {
+            /* overrun: the render side was never in the way, just resume */
+            if (snd_pcm_recover(a->pcm, (int)n, 1) < 0) {
+                printf("audio capture: %s\r\n", snd_strerror((int)n));
+                break;
+            }
+            continue;
+        }
+        memmove(a->history, a->history + n, sizeof(float) * (size_t)(FFT_SIZE - n));
+        for (i = 0; i < n; i++) {
+            a->history[FFT_SIZE - n + i] = buf[i] / 32768.0f;
+        }
+        Audio_Analyse(a, (double)n / a->rate);
+    }
+    return NULL;
+}
+#endif
+
+static void Audio_Release(Audio *a)
+{
+    if (a->fft) {
+        Fft_Delete(a->fft);
+    }
+#ifdef USE_ALSA
+    if (a->pcm) {
+        snd_pcm_close(a->pcm);
+    }
+#endif
+    if (a->map) {
+        munmap((void *)a->map, a->map_size);
+    }
+    if (a->fd >= 0) {
+        close(a->fd);
+    }
+    free(a);
+}
+
+static Audio *Audio_Allocate(void)
+{
+    Audio *a = calloc(1, sizeof(*a));
+    if (!a) {
+        return NULL;
+    }
+    a->fd = -1;
+    return a;
+}
+
+/* source is open: tables, hand over and the worker */
+static int Audio_Start(Audio *a, void *(*worker)(void *))
+{
+    double nyquist = a->rate / 2.0;
+    int i, k;
+
+    a->fft = Fft_Create(FFT_SIZE);
+    if (!a->fft) {
+        return 1;
+    }
+    for (i = 0; i < FFT_SIZE; i++) {
+        a->window[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * i / FFT_SIZE));
+    }
+    for (k = 0; k < Audio_NUM_BIN; k++) {
+        double f0 = MIN_HZ * pow(nyquist / MIN_HZ, (double)k / Audio_NUM_BIN);
+        double f1 = MIN_HZ * pow(nyquist / MIN_HZ, (double)(k + 1) / Audio_NUM_BIN);
+        int lo = (int)(f0 * FFT_SIZE / a->rate);
+        int hi = (int)(f1 * FFT_SIZE / a->rate);
+        lo = (lo < 1) ? 1 : (lo > FFT_SIZE / 2 - 1) ? FFT_SIZE / 2 - 1 : lo;
+        hi = (hi <= lo) ? lo + 1 : (hi > FFT_SIZE / 2) ? FFT_SIZE / 2 : hi;
+        a->bin_lo[k] = lo;
+        a->bin_hi[k] = hi;
+    }
+    a->bass_bin = (int)(BASS_HZ * FFT_SIZE / a->rate) + 1;
+    a->high_bin = (int)(HIGH_HZ * FFT_SIZE / a->rate);
+    if (a->high_bin > FFT_SIZE / 2) {
+        a->high_bin = FFT_SIZE / 2;
+    }
+    a->back = 0;
+    a->middle = 1;
+    a->front = 2;
+    a->time_us = -1;
+    a->done_us = -1;
+    a->quit = 0;
+    pthread_mutex_init(&a->mutex, NULL);
+    pthread_cond_init(&a->cond_wake, NULL);
+    pthread_cond_init(&a->cond_done, NULL);
+    if (pthread_create(&a->thread, NULL, worker, a)) {
+        pthread_cond_destroy(&a->cond_done);
+        pthread_cond_destroy(&a->cond_wake);
+        pthread_mutex_destroy(&a->mutex);
+        return 2;
+    }
+    printf("audio: %d Hz, fft %d (%s)\r\n", a->rate, FFT_SIZE, Fft_GetMethodName());
+    return 0;
+}
+
+Audio *Audio_OpenFile(const char *path)
+{
+    Audio *a;
+    struct stat st;
+
+    a = Audio_Allocate();
+    if (!a) {
+        return NULL;
+    }
+    a->fd = open(path, O_RDONLY);
+    if (a->fd < 0 || fstat(a->fd, &st) != 0 || st.st_size == 0) {
+        printf("audio open failed: %s\r\n", path);
+        Audio_Release(a);
+        return NULL;
+    }
+    a->map_size = (size_t)st.st_size;
+    a->map = mmap(NULL, a->map_size, PROT_READ, MAP_PRIVATE, a->fd, 0);
+    if (a->map == MAP_FAILED) {
+        printf("audio mmap failed: %s\r\n", path);
+        a->map = NULL;
+        Audio_Release(a);
+        return NULL;
+    }
+    if (Audio_ParseWAV(a) || Audio_Start(a, Audio_FileMain)) {
+        Audio_Release(a);
+        return NULL;
+    }
+    return a;
+}
+
+#ifdef USE_ALSA
+Audio *Audio_OpenCapture(const char *device)
+{
+    Audio *a;
+    int err;
+
+    a = Audio_Allocate();
+    if (!a) {
+        return NULL;
+    }
+    a->is_capture = 1;
+    a->rate = CAPTURE_RATE;
+    err = snd_pcm_open(&a->pcm, device, SND_PCM_STREAM_CAPTURE, 0);
+    if (err < 0) {
+        printf("audio capture %s: %s\r\n", device, snd_strerror(err));
+        a->pcm = NULL;
+        Audio_Release(a);
+        return NULL;
+    }
+    /* mono, resampled by ALSA when the device differs. 50 ms of buffering */
+    err = snd_pcm_set_params(a->pcm, SND_PCM_FORMAT_S16, SND_PCM_ACCESS_RW_INTERLEAVED,
+                             1, CAPTURE_RATE, 1, 50000);
+    if (err < 0 || Audio_Start(a, Audio_CaptureMain)) {
+        printf("audio capture %s: %s\r\n", device, (err < 0) ? snd_strerror(err) : "no thread");
+        Audio_Release(a);
+        return NULL;
+    }
+    return a;
+}
+#else
+Audio *Audio_OpenCapture(const char *device)
+{
+    printf("audio capture %s: built without ALSA\r\n", device);
+    return NULL;
+}
+#endif
+
+void Audio_Close(Audio *a)
+{
+    __atomic_store_n(&a->quit, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&a->mutex);
+    pthread_cond_signal(&a->cond_wake);
+    pthread_mutex_unlock(&a->mutex);
+    pthread_join(a->thread, NULL);
+
+    pthread_cond_destroy(&a->cond_done);
+    pthread_cond_destroy(&a->cond_wake);
+    pthread_mutex_destroy(&a->mutex);
+    Audio_Release(a);
+}
+
+void Audio_SetTime(Audio *a, double t)
+{
+    __atomic_store_n(&a->time_us, (long long)(t * 1000000.0), __ATOMIC_RELEASE);
+}
+
+void Audio_Wait(Audio *a)
+{
+    long long t_us;
+    if (a->is_capture) {
+        return;
+    }
+    pthread_mutex_lock(&a->mutex);
+    t_us = __atomic_load_n(&a->time_us, __ATOMIC_ACQUIRE);
+    while (a->done_us != t_us) {
+        pthread_cond_signal(&a->cond_wake);
+        pthread_cond_wait(&a->cond_done, &a->mutex);
+    }
+    pthread_mutex_unlock(&a->mutex);
+}
+
+const Audio_Frame *Audio_Acquire(Audio *a)
+{
+    if (__atomic_load_n(&a->middle, __ATOMIC_ACQUIRE) & FRESH) {
+        a->front = __atomic_exchange_n(&a->middle, a->front, __ATOMIC_ACQ_REL) & ~FRESH;
+    }
+    return &a->frame[a->front];
+}
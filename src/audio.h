@@ -0,0 +1,43 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* sound analysed on its own thread: spectrum, waveform and levels.
+ * the newest result is handed over through a triple buffer, lock-free */
+
+#ifndef INCLUDED_AUDIO_H
+#define INCLUDED_AUDIO_H
+
+
+#include "base.h"
+
+typedef struct Audio_ Audio;
+
+enum {
+    Audio_NUM_BIN = 256
+};
+
+typedef struct {
+    unsigned long sequence;     /* count of analyses, 0: none yet */
+    float spectrum[Audio_NUM_BIN]; /* 0..1 for -80..0 dB, 20 Hz to nyquist in log steps */
+    float waveform[Audio_NUM_BIN]; /* -1..1, newest analysis window decimated */
+    float bass;                 /* 0..1 like spectrum, below 250 Hz */
+    float mid;                  /* 250 Hz to 4 kHz */
+    float high;                 /* above 4 kHz */
+    float beat;                 /* 1 at an onset in bass, decays in about 0.1 s */
+} Audio_Frame;
+
+
+/* WAV (PCM 8/16/24/32 bit or float), played along Audio_SetTime, looping */
+Audio *Audio_OpenFile(const char *path);
+/* ALSA capture device, e.g. "default" or "hw:1". NULL when built without ALSA */
+Audio *Audio_OpenCapture(const char *device);
+void Audio_Close(Audio *a);
+
+/* file: position to analyse, seconds. non-blocking, capture ignores it */
+void Audio_SetTime(Audio *a, double t);
+/* file: block until the position last set is analysed. capture returns at once */
+void Audio_Wait(Audio *a);
+/* newest analysis, never blocks. valid until the next call */
+const Audio_Frame *Audio_Acquire(Audio *a);
+
+
+#endif
@@ -0,0 +1,204 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <errno.h>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "base.h"
+#include "event_loop.h"
+
+
+enum {
+    MAX_WATCH = 16,
+    WATCH_ID_TIMER = MAX_WATCH  /* epoll_event.data.u32 for frame timer */
+};
+
+typedef struct {
+    int fd;
+    EventLoop_HANDLER handler;
+    void *aux;
+} Watch;
+
+struct EventLoop_ {
+    int epoll_fd;
+    int timer_fd;
+    int fps;
+    int hold;                   /* no frame until released */
+    Watch watch[MAX_WATCH];
+};
+
+
+size_t EventLoop_InstanceSize(void)
+{
+    return sizeof(EventLoop);
+}
+
+int EventLoop_Construct(EventLoop *el)
+{
+    int i;
+
+    el->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (el->epoll_fd < 0) {
+        return 1;
+    }
+    el->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (el->timer_fd < 0) {
+        close(el->epoll_fd);
+        return 2;
+    }
+    {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = WATCH_ID_TIMER;
+        if (epoll_ctl(el->epoll_fd, EPOLL_CTL_ADD, el->timer_fd, &ev) < 0) {
+            close(el->timer_fd);
+            close(el->epoll_fd);
+            return 3;
+        }
+    }
+    el->fps = 0;
+    el->hold = 0;
+    for (i = 0; i < MAX_WATCH; i++) {
+        el->watch[i].fd = -1;
+        el->watch[i].handler = NULL;
+        el->watch[i].aux = NULL;
+    }
+    return 0;
+}
+
+void EventLoop_Destruct(EventLoop *el)
+{
+    close(el->timer_fd);
+    close(el->epoll_fd);
+    memset(el, 0, sizeof(*el));
+}
+
+int EventLoop_AddWatch(EventLoop *el, int fd, EventLoop_HANDLER handler, OPTIONAL void *aux)
+{
+    int i;
+    struct epoll_event ev;
+
+    for (i = 0; i < MAX_WATCH; i++) {
+        if (el->watch[i].fd < 0) {
+            break;
+        }
+    }
+    if (i == MAX_WATCH) {
+        return 1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = (uint32_t)i;
+    if (epoll_ctl(el->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        /* EPERM: regular file (e.g. stdin redirected), not pollable */
+        return 2;
+    }
+    el->watch[i].fd = fd;
+    el->watch[i].handler = handler;
+    el->watch[i].aux = aux;
+    return 0;
+}
+
+void EventLoop_RemoveWatch(EventLoop *el, int fd)
+{
+    int i;
+    for (i = 0; i < MAX_WATCH; i++) {
+        if (el->watch[i].fd == fd) {
+            epoll_ctl(el->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            el->watch[i].fd = -1;
+            el->watch[i].handler = NULL;
+            el->watch[i].aux = NULL;
+            return;
+        }
+    }
+}
+
+int EventLoop_SetFrameRate(EventLoop *el, int fps)
+{
+    struct itimerspec its;
+
+    assert(fps >= 0);
+    memset(&its, 0, sizeof(its));
+    if (fps > 0) {
+        long interval_ns = 1000000000L / fps;
+        its.it_interval.tv_sec = interval_ns / 1000000000L;
+        its.it_interval.tv_nsec = interval_ns % 1000000000L;
+        its.it_value = its.it_interval;
+    }
+    /* all zero disarms the timer */
+    if (timerfd_settime(el->timer_fd, 0, &its, NULL) < 0) {
+        return 1;
+    }
+    el->fps = fps;
+    return 0;
+}
+
+int EventLoop_GetFrameRate(EventLoop *el)
+{
+    return el->fps;
+}
+
+void EventLoop_HoldFrame(EventLoop *el, int hold)
+{
+    el->hold = hold;
+}
+
+static int EventLoop_Dispatch(EventLoop *el, int timeout_ms, int *out_frame_due)
+{
+    int i, n;
+    struct epoll_event events[MAX_WATCH + 1];
+
+    n = epoll_wait(el->epoll_fd, events, ARRAY_SIZEOF(events), timeout_ms);
+    if (n < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        printf("epoll_wait: %s\r\n", strerror(errno));
+        return 2;
+    }
+    for (i = 0; i < n; i++) {
+        uint32_t id = events[i].data.u32;
+        if (id == WATCH_ID_TIMER) {
+            uint64_t expirations;
+            /* missed ticks are dropped: render once, not catch up */
+            if (read(el->timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                *out_frame_due = 1;
+            }
+        } else if (el->watch[id].fd >= 0) {
+            Watch *w = &el->watch[id];
+            if (w->handler(w->aux, w->fd)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int EventLoop_WaitFrame(EventLoop *el)
+{
+    int ret;
+    int frame_due;
+
+    frame_due = 0;
+    if (el->fps == 0 && !el->hold) {
+        /* paced by swap: only drain what is already pending */
+        return EventLoop_Dispatch(el, 0, &frame_due);
+    }
+    do {
+        ret = EventLoop_Dispatch(el, -1, &frame_due);
+        if (ret) {
+            return ret;
+        }
+    } while (el->hold || (el->fps > 0 && !frame_due));
+    return 0;
+}
@@ -0,0 +1,39 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* epoll based main loop: fd watchers + frame pacing timer */
+
+#ifndef INCLUDED_EVENT_LOOP_H
+#define INCLUDED_EVENT_LOOP_H
+
+
+#include <stddef.h>
+#include "base.h"
+
+typedef struct EventLoop_ EventLoop;
+
+/* called when fd is readable (level triggered), should drain the fd.
+ * return non-zero to stop the loop */
+typedef int (*EventLoop_HANDLER)(void *aux, int fd);
+
+
+size_t EventLoop_InstanceSize(void);
+int EventLoop_Construct(EventLoop *el);
+void EventLoop_Destruct(EventLoop *el);
+
+int EventLoop_AddWatch(EventLoop *el, int fd, EventLoop_HANDLER handler, OPTIONAL void *aux);
+void EventLoop_RemoveWatch(EventLoop *el, int fd);
+
+/* fps = 0: no timer, frames are paced by buffer swap */
+int EventLoop_SetFrameRate(EventLoop *el, int fps);
+int EventLoop_GetFrameRate(EventLoop *el);
+
+/* the display paces frames (page flip events): while held, no frame is due
+ * whatever the timer says, events are dispatched until a handler releases */
+void EventLoop_HoldFrame(EventLoop *el, int hold);
+
+/* dispatch every pending event, then block until the next frame is due.
+ * return 0: render a frame, 1: stop requested by handler, 2: error */
+int EventLoop_WaitFrame(EventLoop *el);
+
+
+#endif
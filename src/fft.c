@@ -0,0 +1,148 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "config.h"
+#include "base.h"
+#include "fft.h"
+
+
+/* 4 lanes through gcc vector extensions, NEON or SSE whichever is enabled */
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define FFT_VECTOR "neon"
+#elif defined(__SSE__)
+# define FFT_VECTOR "sse"
+#endif
+
+#ifdef FFT_VECTOR
+typedef float v4f __attribute__((vector_size(16)));
+#endif
+
+struct Fft_ {
+    int size;
+    int *reverse;               /* bit reversed index */
+    float *twiddle_re;          /* [half + j] for the stage of span 2 * half */
+    float *twiddle_im;
+};
+
+
+Fft *Fft_Create(int size)
+{
+    Fft *f;
+    int bits, half, i;
+
+    if (size < 8 || (size & (size - 1)) != 0) {
+        return NULL;
+    }
+    f = malloc(sizeof(*f));
+    if (!f) {
+        return NULL;
+    }
+    f->size = size;
+    f->reverse = malloc(sizeof(int) * (size_t)size);
+    f->twiddle_re = malloc(sizeof(float) * (size_t)size);
+    f->twiddle_im = malloc(sizeof(float) * (size_t)size);
+    if (!f->reverse || !f->twiddle_re || !f->twiddle_im) {
+        Fft_Delete(f);
+        return NULL;
+    }
+    for (bits = 0; (1 << bits) < size; bits++) {
+    }
+    for (i = 0; i < size; i++) {
+        int r = 0, b;
+        for (b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        f->reverse[i] = r;
+    }
+    f->twiddle_re[0] = f->twiddle_im[0] = 0.0f; /* unused */
+    for (half = 1; half < size; half *= 2) {
+        int j;
+        for (j = 0; j < half; j++) {
+            double a = M_PI * j / half;
+            f->twiddle_re[half + j] = (float)cos(a);
+            f->twiddle_im[half + j] = (float)-sin(a);
+        }
+    }
+    return f;
+}
+
+void Fft_Delete(Fft *f)
+{
+    free(f->reverse);
+    free(f->twiddle_re);
+    free(f->twiddle_im);
+    free(f);
+}
+
+static void Butterflies(float *re, float *im, const float *wr, const float *wi,
+                        int size, int half)
+{
+    int b, j;
+    for (b = 0; b < size; b += 2 * half) {
+        float *re0 = re + b, *im0 = im + b;
+        float *re1 = re0 + half, *im1 = im0 + half;
+        j = 0;
+#ifdef FFT_VECTOR
+        /* spans of 8 and more: 4 butterflies at once, loads by memcpy
+         * so nothing assumes alignment */
+        for (; j + 4 <= half; j += 4) {
+            v4f xr, xi, yr, yi, cr, ci, tr, ti;
+            memcpy(&xr, re0 + j, sizeof(xr));
+            memcpy(&xi, im0 + j, sizeof(xi));
+            memcpy(&yr, re1 + j, sizeof(yr));
+            memcpy(&yi, im1 + j, sizeof(yi));
+            memcpy(&cr, wr + j, sizeof(cr));
+            memcpy(&ci, wi + j, sizeof(ci));
+            tr = yr * cr - yi * ci;
+            ti = yr * ci + yi * cr;
+            yr = xr - tr;
+            yi = xi - ti;
+            xr = xr + tr;
+            xi = xi + ti;
+            memcpy(re0 + j, &xr, sizeof(xr));
+            memcpy(im0 + j, &xi, sizeof(xi));
+            memcpy(re1 + j, &yr, sizeof(yr));
+            memcpy(im1 + j, &yi, sizeof(yi));
+        }
+#endif
+        for (; j < half; j++) {
+            float tr = re1[j] * wr[j] - im1[j] * wi[j];
+            float ti = re1[j] * wi[j] + im1[j] * wr[j];
+            re1[j] = re0[j] - tr;
+            im1[j] = im0[j] - ti;
+            re0[j] += tr;
+            im0[j] += ti;
+        }
+    }
+}
+
+/* iterative radix 2, decimation in time */
+void Fft_Forward(Fft *f, float *re, float *im)
+{
+    int i, half;
+
+    for (i = 0; i < f->size; i++) {
+        int r = f->reverse[i];
+        if (i < r) {
+            float t;
+            t = re[i]; re[i] = re[r]; re[r] = t;
+            t = im[i]; im[i] = im[r]; im[r] = t;
+        }
+    }
+    for (half = 1; half < f->size; half *= 2) {
+        Butterflies(re, im, f->twiddle_re + half, f->twiddle_im + half, f->size, half);
+    }
+}
+
+const char *Fft_GetMethodName(void)
+{
+#ifdef FFT_VECTOR
+    return FFT_VECTOR;
+#else
+    return "scalar";
+#endif
+}
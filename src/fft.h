@@ -0,0 +1,22 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* in-place complex FFT of a power of two, real and imaginary parts apart */
+
+#ifndef INCLUDED_FFT_H
+#define INCLUDED_FFT_H
+
+
+typedef struct Fft_ Fft;
+
+
+/* NULL: size not a power of two (>= 8), or out of memory */
+Fft *Fft_Create(int size);
+void Fft_Delete(Fft *f);
+
+/* 're' and 'im' are 'size' long. forward, not normalized */
+void Fft_Forward(Fft *f, float *re, float *im);
+/* "neon", "sse" or "scalar" */
+const char *Fft_GetMethodName(void);
+
+
+#endif
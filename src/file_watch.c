@@ -0,0 +1,196 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "base.h"
+#include "file_watch.h"
+
+
+typedef struct {
+    char *dir;
+    char *name;                 /* basename, points into path storage */
+    int wd;
+    void *aux;
+    int pending;
+    double deadline_ms;
+} WatchEntry;
+
+struct FileWatch_ {
+    int fd;
+    int debounce_ms;
+    int num_pending;
+    WatchEntry *entry;
+    int num_entry;
+    int max_entry;
+};
+
+
+size_t FileWatch_InstanceSize(void)
+{
+    return sizeof(FileWatch);
+}
+
+int FileWatch_Construct(FileWatch *fw, int debounce_ms)
+{
+    fw->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fw->fd < 0) {
+        return 1;
+    }
+    fw->debounce_ms = debounce_ms;
+    fw->num_pending = 0;
+    fw->entry = NULL;
+    fw->num_entry = 0;
+    fw->max_entry = 0;
+    return 0;
+}
+
+void FileWatch_Destruct(FileWatch *fw)
+{
+    int i;
+    for (i = 0; i < fw->num_entry; i++) {
+        free(fw->entry[i].dir);
+    }
+    free(fw->entry);
+    close(fw->fd);
+    memset(fw, 0, sizeof(*fw));
+}
+
+int FileWatch_GetFd(FileWatch *fw)
+{
+    return fw->fd;
+}
+
+int FileWatch_Add(FileWatch *fw, const char *path, void *aux)
+{
+    WatchEntry *e;
+    char *dir;
+    char *slash;
+    int wd;
+    const uint32_t mask = IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE;
+
+    assert(aux != NULL);
+
+    /* "dir\0name" in one allocation */
+    dir = malloc(strlen(path) + 3);
+    if (!dir) {
+        return 1;
+    }
+    slash = strrchr(path, '/');
+    if (slash == NULL) {
+        strcpy(dir, ".");
+        strcpy(dir + 2, path);
+    } else if (slash == path) {
+        strcpy(dir, "/");
+        strcpy(dir + 2, path + 1);
+    } else {
+        size_t len = (size_t)(slash - path);
+        memcpy(dir, path, len);
+        dir[len] = '\0';
+        strcpy(dir + len + 1, slash + 1);
+    }
+
+    /* same directory returns same wd, inotify handles the sharing */
+    wd = inotify_add_watch(fw->fd, dir, mask);
+    if (wd < 0) {
+        printf("inotify_add_watch %s: %s\r\n", dir, strerror(errno));
+        free(dir);
+        return 2;
+    }
+
+    if (fw->num_entry == fw->max_entry) {
+        int n = (fw->max_entry == 0) ? 8 : fw->max_entry * 2;
+        WatchEntry *p = realloc(fw->entry, sizeof(*p) * n);
+        if (!p) {
+            free(dir);
+            return 3;
+        }
+        fw->entry = p;
+        fw->max_entry = n;
+    }
+    e = &fw->entry[fw->num_entry];
+    e->dir = dir;
+    e->name = dir + strlen(dir) + 1;
+    e->wd = wd;
+    e->aux = aux;
+    e->pending = 0;
+    e->deadline_ms = 0.0;
+    fw->num_entry += 1;
+    return 0;
+}
+
+static void FileWatch_MarkPending(FileWatch *fw, int wd, const char *name, double now_ms)
+{
+    int i;
+    for (i = 0; i < fw->num_entry; i++) {
+        WatchEntry *e = &fw->entry[i];
+        if (e->wd == wd && strcmp(e->name, name) == 0) {
+            if (!e->pending) {
+                e->pending = 1;
+                fw->num_pending += 1;
+            }
+            /* burst of writes pushes the deadline */
+            e->deadline_ms = now_ms + fw->debounce_ms;
+        }
+    }
+}
+
+int FileWatch_ReadEvents(FileWatch *fw, double now_ms)
+{
+    for (;;) {
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t len;
+        char *p;
+
+        len = read(fw->fd, buf, sizeof(buf));
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return 0;
+            }
+            printf("inotify read: %s\r\n", strerror(errno));
+            return 1;
+        }
+        for (p = buf; p < buf + len; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)(void *)p;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                /* lost events: treat everything as changed */
+                int i;
+                for (i = 0; i < fw->num_entry; i++) {
+                    FileWatch_MarkPending(fw, fw->entry[i].wd, fw->entry[i].name, now_ms);
+                }
+            } else if (ev->len > 0) {
+                FileWatch_MarkPending(fw, ev->wd, ev->name, now_ms);
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
+
+int FileWatch_HasPending(FileWatch *fw)
+{
+    return fw->num_pending > 0;
+}
+
+void *FileWatch_NextChanged(FileWatch *fw, double now_ms)
+{
+    int i;
+    if (fw->num_pending == 0) {
+        return NULL;
+    }
+    for (i = 0; i < fw->num_entry; i++) {
+        WatchEntry *e = &fw->entry[i];
+        if (e->pending && e->deadline_ms <= now_ms) {
+            e->pending = 0;
+            fw->num_pending -= 1;
+            return e->aux;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,33 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* inotify based file change notification.
+ * the containing directory is watched, so atomic-rename saves are caught too */
+
+#ifndef INCLUDED_FILE_WATCH_H
+#define INCLUDED_FILE_WATCH_H
+
+
+#include <stddef.h>
+#include "base.h"
+
+typedef struct FileWatch_ FileWatch;
+
+
+size_t FileWatch_InstanceSize(void);
+int FileWatch_Construct(FileWatch *fw, int debounce_ms);
+void FileWatch_Destruct(FileWatch *fw);
+
+/* pollable fd, readable when events are queued */
+int FileWatch_GetFd(FileWatch *fw);
+
+int FileWatch_Add(FileWatch *fw, const char *path, void *aux);
+
+/* drain inotify fd, changed files become pending until debounce expires */
+int FileWatch_ReadEvents(FileWatch *fw, double now_ms);
+int FileWatch_HasPending(FileWatch *fw);
+
+/* return aux of a file settled since last change, NULL if none */
+void *FileWatch_NextChanged(FileWatch *fw, double now_ms);
+
+
+#endif
@@ -0,0 +1,333 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+
+#ifdef USE_LIBPNG
+#include <png.h>
+#endif
+
+#include "config.h"
+#include "base.h"
+#include "frame_writer.h"
+
+
+enum {
+    NUM_BUFFER = 4,             /* frames between readback and disk */
+    MAX_PATH_LENGTH = 1024
+};
+
+typedef enum {
+    FORMAT_Y4M,
+    FORMAT_PPM,
+    FORMAT_PNG
+} Format;
+
+struct FrameWriter_ {
+    Format format;
+    char *path;                 /* sequence: printf format with one %d */
+    FILE *fp;                   /* Y4M only */
+    int width;
+    int height;
+    unsigned char *buffer[NUM_BUFFER]; /* frame n in buffer[n % NUM_BUFFER] */
+    unsigned char *scratch;     /* converted frame, writer thread only */
+    unsigned long submitted;
+    unsigned long written;
+    int error;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_frame;
+    pthread_cond_t cond_free;
+    int quit;
+};
+
+
+static int HasSuffix(const char *s, const char *suffix)
+{
+    size_t n = strlen(s), m = strlen(suffix);
+    return (n >= m && strcasecmp(s + n - m, suffix) == 0) ? 1 : 0;
+}
+
+/* exactly one conversion and it is %d, %5d or %05d: the path goes to snprintf */
+static int IsSequencePattern(const char *path)
+{
+    const char *p;
+    int conversions = 0;
+    for (p = path; *p; p++) {
+        if (*p != '%') {
+            continue;
+        }
+        p += 1;
+        if (*p == '%') {
+            continue;
+        }
+        while (isdigit((unsigned char)*p)) {
+            p += 1;
+        }
+        if (*p != 'd') {
+            return 0;
+        }
+        conversions += 1;
+    }
+    return (conversions == 1) ? 1 : 0;
+}
+
+/* BT.601 limited range, chroma from 2x2 averages. rows flipped to top down */
+static void ConvertToI420(const unsigned char *rgba, int width, int height, unsigned char *out)
+{
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    unsigned char *y_plane = out;
+    unsigned char *u_plane = out + (size_t)width * height;
+    unsigned char *v_plane = u_plane + (size_t)chroma_width * chroma_height;
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        const unsigned char *src = rgba + (size_t)(height - 1 - y) * width * 4;
+        unsigned char *dst = y_plane + (size_t)y * width;
+        for (x = 0; x < width; x++) {
+            int r = src[x * 4], g = src[x * 4 + 1], b = src[x * 4 + 2];
+            dst[x] = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        }
+    }
+    for (y = 0; y < chroma_height; y++) {
+        int y0 = 2 * y, y1 = (2 * y + 1 < height) ? 2 * y + 1 : 2 * y;
+        const unsigned char *row0 = rgba + (size_t)(height - 1 - y0) * width * 4;
+        const unsigned char *row1 = rgba + (size_t)(height - 1 - y1) * width * 4;
+        for (x = 0; x < chroma_width; x++) {
+            int x0 = 2 * x * 4, x1 = ((2 * x + 1 < width) ? 2 * x + 1 : 2 * x) * 4;
+            int r = (row0[x0] + row0[x1] + row1[x0] + row1[x1] + 2) >> 2;
+            int g = (row0[x0 + 1] + row0[x1 + 1] + row1[x0 + 1] + row1[x1 + 1] + 2) >> 2;
+            int b = (row0[x0 + 2] + row0[x1 + 2] + row1[x0 + 2] + row1[x1 + 2] + 2) >> 2;
+            u_plane[(size_t)y * chroma_width + x] =
+                (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            v_plane[(size_t)y * chroma_width + x] =
+                (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+}
+
+static int WriteY4MFrame(FrameWriter *w, const unsigned char *rgba)
+{
+    size_t size = (size_t)w->width * w->height
+        + 2 * (size_t)((w->width + 1) / 2) * ((w->height + 1) / 2);
+    ConvertToI420(rgba, w->width, w->height, w->scratch);
+    if (fputs("FRAME\n", w->fp) < 0 || fwrite(w->scratch, 1, size, w->fp) != size) {
+        return 1;
+    }
+    return 0;
+}
+
+static int WritePPM(FrameWriter *w, const char *path, const unsigned char *rgba)
+{
+    FILE *fp;
+    int x, y, err;
+
+    for (y = 0; y < w->height; y++) {
+        const unsigned char *src = rgba + (size_t)(w->height - 1 - y) * w->width * 4;
+        unsigned char *dst = w->scratch + (size_t)y * w->width * 3;
+        for (x = 0; x < w->width; x++) {
+            dst[x * 3] = src[x * 4];
+            dst[x * 3 + 1] = src[x * 4 + 1];
+            dst[x * 3 + 2] = src[x * 4 + 2];
+        }
+    }
+    fp = fopen(path, "wb");
+    if (fp == NULL) {
+        return 1;
+    }
+    err = (fprintf(fp, "P6\n%d %d\n255\n", w->width, w->height) < 0);
+    err |= (fwrite(w->scratch, 3, (size_t)w->width * w->height, fp)
+            != (size_t)w->width * w->height);
+    err |= (fclose(fp) != 0);
+    return err;
+}
+
+#ifdef USE_LIBPNG
+static int WritePNG(FrameWriter *w, const char *path, const unsigned char *rgba)
+{
+    png_image image;
+    int stride = w->width * 4;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width = (png_uint_32)w->width;
+    image.height = (png_uint_32)w->height;
+    image.format = PNG_FORMAT_RGBA;
+    /* negative stride: the last row of the buffer is the top. libpng finds
+     * that row itself, the buffer goes in as it is */
+    if (!png_image_write_to_file(&image, path, 0, rgba, -stride, NULL)) {
+        return 1;
+    }
+    return 0;
+}
+#endif
+
+static int FrameWriter_Write(FrameWriter *w, unsigned long index, const unsigned char *rgba)
+{
+    char path[MAX_PATH_LENGTH];
+
+    if (w->format == FORMAT_Y4M) {
+        return WriteY4MFrame(w, rgba);
+    }
+    snprintf(path, sizeof(path), w->path, (int)index);
+#ifdef USE_LIBPNG
+    if (w->format == FORMAT_PNG) {
+        return WritePNG(w, path, rgba);
+    }
+#endif
+    return WritePPM(w, path, rgba);
+}
+
+/* writer thread */
+static void *FrameWriter_WriterMain(void *arg)
+{
+    FrameWriter *w = arg;
+
+    pthread_mutex_lock(&w->mutex);
+    for (;;) {
+        unsigned long index;
+        while (!w->quit && w->written == w->submitted) {
+            pthread_cond_wait(&w->cond_frame, &w->mutex);
+        }
+        if (w->written == w->submitted) {
+            break;              /* quit, and everything is out */
+        }
+        index = w->written;
+        pthread_mutex_unlock(&w->mutex);
+
+        if (!w->error && FrameWriter_Write(w, index, w->buffer[index % NUM_BUFFER])) {
+            printf("render: write failed at frame %lu: %s\r\n", index, strerror(errno));
+            w->error = 1;
+        }
+
+        pthread_mutex_lock(&w->mutex);
+        w->written += 1;
+        pthread_cond_signal(&w->cond_free);
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return NULL;
+}
+
+static void FrameWriter_Release(FrameWriter *w)
+{
+    int i;
+    for (i = 0; i < NUM_BUFFER; i++) {
+        free(w->buffer[i]);
+    }
+    free(w->scratch);
+    free(w->path);
+    free(w);
+}
+
+FrameWriter *FrameWriter_Create(const char *path, int width, int height,
+                                int fps_numer, int fps_denom)
+{
+    FrameWriter *w;
+    size_t frame_size = (size_t)width * height * 4;
+    int i;
+
+    w = calloc(1, sizeof(*w));
+    if (!w) {
+        return NULL;
+    }
+    if (IsSequencePattern(path)) {
+        w->format = HasSuffix(path, ".png") ? FORMAT_PNG : FORMAT_PPM;
+#ifndef USE_LIBPNG
+        if (w->format == FORMAT_PNG) {
+            printf("render: built without libpng, use .ppm\r\n");
+            free(w);
+            return NULL;
+        }
+#endif
+    } else if (HasSuffix(path, ".y4m")) {
+        w->format = FORMAT_Y4M;
+    } else {
+        printf("render: %s: expected .y4m, or a sequence like out%%05d.ppm\r\n", path);
+        free(w);
+        return NULL;
+    }
+    w->width = width;
+    w->height = height;
+    w->path = strdup(path);
+    w->scratch = malloc(frame_size); /* I420 and RGB both fit */
+    for (i = 0; i < NUM_BUFFER; i++) {
+        w->buffer[i] = malloc(frame_size);
+        if (!w->buffer[i]) {
+            break;
+        }
+    }
+    if (!w->path || !w->scratch || i < NUM_BUFFER) {
+        FrameWriter_Release(w);
+        return NULL;
+    }
+    if (w->format == FORMAT_Y4M) {
+        w->fp = fopen(path, "wb");
+        if (w->fp == NULL) {
+            printf("render: cannot open %s: %s\r\n", path, strerror(errno));
+            FrameWriter_Release(w);
+            return NULL;
+        }
+        fprintf(w->fp, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg\n",
+                width, height, fps_numer, fps_denom);
+    }
+    pthread_mutex_init(&w->mutex, NULL);
+    pthread_cond_init(&w->cond_frame, NULL);
+    pthread_cond_init(&w->cond_free, NULL);
+    if (pthread_create(&w->thread, NULL, FrameWriter_WriterMain, w)) {
+        pthread_cond_destroy(&w->cond_free);
+        pthread_cond_destroy(&w->cond_frame);
+        pthread_mutex_destroy(&w->mutex);
+        if (w->fp) {
+            fclose(w->fp);
+        }
+        FrameWriter_Release(w);
+        return NULL;
+    }
+    return w;
+}
+
+int FrameWriter_Close(FrameWriter *w)
+{
+    int error;
+
+    pthread_mutex_lock(&w->mutex);
+    w->quit = 1;
+    pthread_cond_signal(&w->cond_frame);
+    pthread_mutex_unlock(&w->mutex);
+    pthread_join(w->thread, NULL);
+
+    error = w->error;
+    if (w->fp && fclose(w->fp) != 0) {
+        error = 1;
+    }
+    pthread_cond_destroy(&w->cond_free);
+    pthread_cond_destroy(&w->cond_frame);
+    pthread_mutex_destroy(&w->mutex);
+    FrameWriter_Release(w);
+    return error;
+}
+
+unsigned char *FrameWriter_GetBuffer(FrameWriter *w)
+{
+    unsigned char *buffer;
+    pthread_mutex_lock(&w->mutex);
+    while (w->submitted - w->written >= NUM_BUFFER) {
+        pthread_cond_wait(&w->cond_free, &w->mutex);
+    }
+    buffer = w->buffer[w->submitted % NUM_BUFFER];
+    pthread_mutex_unlock(&w->mutex);
+    return buffer;
+}
+
+void FrameWriter_Submit(FrameWriter *w)
+{
+    pthread_mutex_lock(&w->mutex);
+    w->submitted += 1;
+    pthread_cond_signal(&w->cond_frame);
+    pthread_mutex_unlock(&w->mutex);
+}
@@ -0,0 +1,28 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* rendered frames to disk on a writer thread: one Y4M stream, or a file per
+ * frame (PPM, PNG with libpng) when the path has a printf style %d */
+
+#ifndef INCLUDED_FRAME_WRITER_H
+#define INCLUDED_FRAME_WRITER_H
+
+
+#include "base.h"
+
+typedef struct FrameWriter_ FrameWriter;
+
+
+/* NULL on failure, reason is printed */
+FrameWriter *FrameWriter_Create(const char *path, int width, int height,
+                                int fps_numer, int fps_denom);
+/* drain the queue. nonzero when some write failed */
+int FrameWriter_Close(FrameWriter *w);
+
+/* free buffer for the next frame: RGBA, width * height * 4, rows bottom up.
+ * blocks while every buffer is queued for the disk */
+unsigned char *FrameWriter_GetBuffer(FrameWriter *w);
+/* the buffer from FrameWriter_GetBuffer, frames in submit order */
+void FrameWriter_Submit(FrameWriter *w);
+
+
+#endif
@@ -0,0 +1,49 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <GLES2/gl2.h>
+#include <EGL/egl.h>
+
+#include "config.h"
+#include "base.h"
+#include "gl_ext.h"
+
+
+static int HasToken(const char *all, const char *name)
+{
+    const char *ext;
+    size_t len;
+
+    if (all == NULL) {
+        return 0;
+    }
+    len = strlen(name);
+    for (ext = all; (ext = strstr(ext, name)) != NULL; ) {
+        if ((ext == all || ext[-1] == ' ') && (ext[len] == ' ' || ext[len] == '\0')) {
+            return 1;
+        }
+        ext += len;
+    }
+    return 0;
+}
+
+int GLExt_Has(const char *name)
+{
+    return HasToken((const char *)glGetString(GL_EXTENSIONS), name);
+}
+
+int GLExt_HasEGL(const char *name)
+{
+    EGLDisplay display = eglGetCurrentDisplay();
+    if (display == EGL_NO_DISPLAY) {
+        return 0;
+    }
+    return HasToken(eglQueryString(display, EGL_EXTENSIONS), name);
+}
+
+void *GLExt_GetProcAddress(const char *name)
+{
+    return (void *)eglGetProcAddress(name);
+}
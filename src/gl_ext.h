@@ -0,0 +1,17 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* OpenGL|ES extension query */
+
+#ifndef INCLUDED_GL_EXT_H
+#define INCLUDED_GL_EXT_H
+
+
+/* whole-token match against GL_EXTENSIONS of the current context */
+int GLExt_Has(const char *name);
+/* same for EGL_EXTENSIONS of the current display */
+int GLExt_HasEGL(const char *name);
+/* NULL if not available */
+void *GLExt_GetProcAddress(const char *name);
+
+
+#endif
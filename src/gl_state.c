@@ -0,0 +1,264 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <GLES2/gl2.h>
+
+#include "config.h"
+#include "base.h"
+#include "gl_state.h"
+
+
+#define UNKNOWN ((GLuint)-1)    /* not a valid object name */
+
+struct GLState_ {
+    GLuint program;
+    GLuint framebuffer;
+    GLuint array_buffer;
+    int active_unit;            /* -1: unknown */
+    GLuint texture[GLState_MAX_TEXTURE_UNIT];
+    int num_unit;
+    unsigned int unit_use[GLState_MAX_TEXTURE_UNIT]; /* clock of the last use, 0: free */
+    unsigned int unit_set[GLState_MAX_TEXTURE_UNIT]; /* texture set that took it */
+    unsigned int clock;
+    unsigned int set;
+    GLint viewport[4];
+    int viewport_valid;
+    GLState_Stats current;
+    GLState_Stats last;
+};
+
+
+GLState *GLState_Create(void)
+{
+    GLState *s;
+    GLint units;
+    s = malloc(sizeof(*s));
+    if (!s) {
+        return NULL;
+    }
+    units = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &units);
+    if (units < 1) {
+        units = 8;              /* GLES2 minimum */
+    }
+    if (units > GLState_MAX_TEXTURE_UNIT) {
+        units = GLState_MAX_TEXTURE_UNIT;
+    }
+    s->num_unit = units;
+    s->clock = 0;
+    s->set = 1;                 /* units of set 0 are free */
+    memset(&s->current, 0, sizeof(s->current));
+    memset(&s->last, 0, sizeof(s->last));
+    GLState_Invalidate(s);
+    return s;
+}
+
+void GLState_Delete(GLState *s)
+{
+    free(s);
+}
+
+void GLState_Invalidate(GLState *s)
+{
+    int i;
+    s->program = UNKNOWN;
+    s->framebuffer = UNKNOWN;
+    s->array_buffer = UNKNOWN;
+    s->active_unit = -1;
+    for (i = 0; i < GLState_MAX_TEXTURE_UNIT; i++) {
+        s->texture[i] = UNKNOWN;
+        s->unit_use[i] = 0;
+        s->unit_set[i] = 0;
+    }
+    s->viewport_valid = 0;
+}
+
+void GLState_UseProgram(GLState *s, GLuint program)
+{
+    if (s->program == program) {
+        s->current.elided += 1;
+        return;
+    }
+    s->program = program;
+    glUseProgram(program);
+    s->current.issued += 1;
+}
+
+void GLState_ActiveTexture(GLState *s, int unit)
+{
+    assert(unit >= 0 && unit < GLState_MAX_TEXTURE_UNIT);
+    if (s->active_unit == unit) {
+        return;
+    }
+    s->active_unit = unit;
+    glActiveTexture(GL_TEXTURE0 + unit);
+    s->current.issued += 1;
+}
+
+void GLState_BindTexture(GLState *s, int unit, GLuint texture)
+{
+    assert(unit >= 0 && unit < GLState_MAX_TEXTURE_UNIT);
+    s->unit_use[unit] = (texture != 0) ? ++s->clock : 0;
+    if (s->texture[unit] == texture) {
+        s->current.elided += 1;
+        return;
+    }
+    GLState_ActiveTexture(s, unit);
+    s->texture[unit] = texture;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    s->current.issued += 1;
+}
+
+int GLState_GetTextureUnitCount(GLState *s)
+{
+    return s->num_unit;
+}
+
+void GLState_BeginTextureSet(GLState *s)
+{
+    s->set += 1;
+}
+
+int GLState_AcquireTextureUnit(GLState *s, GLuint texture)
+{
+    int i;
+    int victim;
+
+    victim = -1;
+    for (i = 0; i < s->num_unit; i++) {
+        if (s->texture[i] == texture) {
+            victim = i;
+            break;
+        }
+        if (s->unit_set[i] == s->set) {
+            continue;           /* holds another texture of this draw */
+        }
+        if (victim < 0 || s->unit_use[i] < s->unit_use[victim]) {
+            victim = i;
+        }
+    }
+    if (victim < 0) {
+        return -1;
+    }
+    s->unit_set[victim] = s->set;
+    GLState_BindTexture(s, victim, texture);
+    return victim;
+}
+
+void GLState_UnbindTexture(GLState *s, GLuint texture)
+{
+    int i;
+    if (texture == 0) {
+        return;
+    }
+    for (i = 0; i < GLState_MAX_TEXTURE_UNIT; i++) {
+        if (s->texture[i] == texture) {
+            GLState_BindTexture(s, i, 0);
+        }
+    }
+}
+
+void GLState_BindFramebuffer(GLState *s, GLuint framebuffer)
+{
+    if (s->framebuffer == framebuffer) {
+        s->current.elided += 1;
+        return;
+    }
+    s->framebuffer = framebuffer;
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    s->current.issued += 1;
+}
+
+void GLState_BindArrayBuffer(GLState *s, GLuint buffer)
+{
+    if (s->array_buffer == buffer) {
+        s->current.elided += 1;
+        return;
+    }
+    s->array_buffer = buffer;
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    s->current.issued += 1;
+}
+
+void GLState_Viewport(GLState *s, GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    if (s->viewport_valid
+        && s->viewport[0] == x && s->viewport[1] == y
+        && s->viewport[2] == width && s->viewport[3] == height) {
+        s->current.elided += 1;
+        return;
+    }
+    s->viewport[0] = x;
+    s->viewport[1] = y;
+    s->viewport[2] = width;
+    s->viewport[3] = height;
+    s->viewport_valid = 1;
+    glViewport(x, y, width, height);
+    s->current.issued += 1;
+}
+
+void GLState_DeleteProgram(GLState *s, GLuint program)
+{
+    if (program == 0) {
+        return;
+    }
+    if (s->program == program) {
+        /* stays in use until the next glUseProgram */
+        s->program = UNKNOWN;
+    }
+    glDeleteProgram(program);
+    s->current.issued += 1;
+}
+
+void GLState_DeleteTexture(GLState *s, GLuint texture)
+{
+    int i;
+    if (texture == 0) {
+        return;
+    }
+    for (i = 0; i < GLState_MAX_TEXTURE_UNIT; i++) {
+        if (s->texture[i] == texture) {
+            s->texture[i] = 0;
+            s->unit_use[i] = 0;
+        }
+    }
+    glDeleteTextures(1, &texture);
+    s->current.issued += 1;
+}
+
+void GLState_DeleteFramebuffer(GLState *s, GLuint framebuffer)
+{
+    if (framebuffer == 0) {
+        return;
+    }
+    if (s->framebuffer == framebuffer) {
+        s->framebuffer = 0;
+    }
+    glDeleteFramebuffers(1, &framebuffer);
+    s->current.issued += 1;
+}
+
+void GLState_CountCall(GLState *s)
+{
+    s->current.issued += 1;
+}
+
+void GLState_CountElided(GLState *s)
+{
+    s->current.elided += 1;
+}
+
+void GLState_EndFrame(GLState *s)
+{
+    s->last = s->current;
+    memset(&s->current, 0, sizeof(s->current));
+}
+
+void GLState_GetFrameStats(GLState *s, GLState_Stats *out)
+{
+    *out = s->last;
+}
@@ -0,0 +1,58 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* shadow of the GL binding state of one context, elides redundant calls */
+
+#ifndef INCLUDED_GL_STATE_H
+#define INCLUDED_GL_STATE_H
+
+
+#include <GLES2/gl2.h>
+
+typedef struct GLState_ GLState;
+
+enum {
+    GLState_MAX_TEXTURE_UNIT = 32
+};
+
+typedef struct {
+    int issued;                 /* GL calls that reached the driver */
+    int elided;                 /* redundant ones skipped */
+} GLState_Stats;
+
+
+GLState *GLState_Create(void);
+void GLState_Delete(GLState *s);
+/* forget everything, next call of each kind always reaches the driver */
+void GLState_Invalidate(GLState *s);
+
+void GLState_UseProgram(GLState *s, GLuint program);
+void GLState_BindTexture(GLState *s, int unit, GLuint texture);
+/* units of the context, at most GLState_MAX_TEXTURE_UNIT */
+int GLState_GetTextureUnitCount(GLState *s);
+/* start of the textures of one draw, units they take are not evicted until the next */
+void GLState_BeginTextureSet(GLState *s);
+/* unit with 'texture' bound: where it already is, else the least recently
+ * used one not taken by the current set. -1: every unit is taken */
+int GLState_AcquireTextureUnit(GLState *s, GLuint texture);
+/* from every unit it is known to be on, before drawing into it */
+void GLState_UnbindTexture(GLState *s, GLuint texture);
+/* glTexImage2D and friends act on the active unit, call this before them */
+void GLState_ActiveTexture(GLState *s, int unit);
+void GLState_BindFramebuffer(GLState *s, GLuint framebuffer);
+void GLState_BindArrayBuffer(GLState *s, GLuint buffer);
+void GLState_Viewport(GLState *s, GLint x, GLint y, GLsizei width, GLsizei height);
+
+/* delete and drop from the shadow (GL unbinds deleted objects itself) */
+void GLState_DeleteProgram(GLState *s, GLuint program);
+void GLState_DeleteTexture(GLState *s, GLuint texture);
+void GLState_DeleteFramebuffer(GLState *s, GLuint framebuffer);
+
+/* for calls made outside this module (draw, uniform...) */
+void GLState_CountCall(GLState *s);
+void GLState_CountElided(GLState *s);
+/* close the frame, stats of it are kept until the next one */
+void GLState_EndFrame(GLState *s);
+void GLState_GetFrameStats(GLState *s, GLState_Stats *out);
+
+
+#endif
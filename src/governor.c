@@ -0,0 +1,151 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "config.h"
+#include "base.h"
+#include "histogram.h"
+#include "governor.h"
+
+
+/*
+ * coarser as soon as a full window misses the budget, finer only by probing:
+ * after holding a good window for hold_ms try one step finer, and if that
+ * window misses the budget step back and double hold_ms.
+ * the gap between the two thresholds is the hysteresis.
+ */
+enum {
+    WINDOW_FRAMES = 30,
+    SETTLE_FRAMES = 4           /* surfaces are reallocated on change */
+};
+#define MISS_RATIO 1.20         /* p95 above this: coarser */
+#define GOOD_RATIO 1.05         /* p95 below this: candidate for finer */
+#define HOLD_MIN_MS 2000.0
+#define HOLD_MAX_MS 32000.0
+
+struct Governor_ {
+    double budget_ms;
+    int min_denom;
+    int max_denom;
+    Histogram *window;
+    int num_sample;
+    int settle;                 /* frames to ignore */
+    double good_since_ms;       /* < 0: not good */
+    double hold_ms;
+    int probing;                /* last step was a finer probe */
+    double last_p95;
+};
+
+
+static void Governor_Restart(Governor *gv)
+{
+    Histogram_Clear(gv->window);
+    gv->num_sample = 0;
+    gv->settle = SETTLE_FRAMES;
+}
+
+Governor *Governor_Create(double target_fps, int min_denom, int max_denom)
+{
+    Governor *gv;
+    assert(target_fps > 0.0);
+    assert(min_denom >= 1 && min_denom <= max_denom);
+    gv = malloc(sizeof(*gv));
+    if (!gv) {
+        return NULL;
+    }
+    gv->window = Histogram_Create(WINDOW_FRAMES);
+    if (!gv->window) {
+        free(gv);
+        return NULL;
+    }
+    gv->budget_ms = 1000.0 / target_fps;
+    gv->min_denom = min_denom;
+    gv->max_denom = max_denom;
+    gv->hold_ms = HOLD_MIN_MS;
+    gv->good_since_ms = -1.0;
+    gv->probing = 0;
+    gv->last_p95 = 0.0;
+    Governor_Restart(gv);
+    return gv;
+}
+
+void Governor_Delete(Governor *gv)
+{
+    Histogram_Delete(gv->window);
+    free(gv);
+}
+
+double Governor_GetTargetFps(Governor *gv)
+{
+    return 1000.0 / gv->budget_ms;
+}
+
+void Governor_Reset(Governor *gv, double now_ms)
+{
+    (void)now_ms;
+    gv->good_since_ms = -1.0;
+    gv->probing = 0;
+    Governor_Restart(gv);
+}
+
+double Governor_GetFrameTime(Governor *gv)
+{
+    return gv->last_p95;
+}
+
+Governor_ACTION Governor_Update(Governor *gv, double frame_ms, double now_ms, int denom)
+{
+    Histogram_Summary hs;
+
+    if (gv->settle > 0) {
+        gv->settle -= 1;
+        return Governor_ACTION_KEEP;
+    }
+    Histogram_Push(gv->window, frame_ms);
+    gv->num_sample += 1;
+    if (gv->num_sample < WINDOW_FRAMES) {
+        return Governor_ACTION_KEEP;
+    }
+    Histogram_Summarize(gv->window, &hs);
+    gv->last_p95 = hs.p95;
+
+    if (hs.p95 > gv->budget_ms * MISS_RATIO) {
+        gv->good_since_ms = -1.0;
+        if (gv->probing) {
+            /* the finer step did not fit, wait longer before the next try */
+            gv->hold_ms *= 2.0;
+            if (gv->hold_ms > HOLD_MAX_MS) {
+                gv->hold_ms = HOLD_MAX_MS;
+            }
+        }
+        gv->probing = 0;
+        if (denom < gv->max_denom) {
+            Governor_Restart(gv);
+            return Governor_ACTION_COARSER;
+        }
+        return Governor_ACTION_KEEP;
+    }
+
+    if (gv->probing) {
+        /* a full window at the finer step fit the budget */
+        gv->probing = 0;
+        gv->hold_ms = HOLD_MIN_MS;
+    }
+    if (hs.p95 > gv->budget_ms * GOOD_RATIO) {
+        gv->good_since_ms = -1.0;   /* in between: stay */
+        return Governor_ACTION_KEEP;
+    }
+    if (gv->good_since_ms < 0.0) {
+        gv->good_since_ms = now_ms;
+    }
+    if (denom > gv->min_denom && now_ms - gv->good_since_ms >= gv->hold_ms) {
+        gv->good_since_ms = -1.0;
+        gv->probing = 1;
+        Governor_Restart(gv);
+        return Governor_ACTION_FINER;
+    }
+    return Governor_ACTION_KEEP;
+}
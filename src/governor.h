@@ -0,0 +1,33 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* picks the offscreen scaling step from measured frame intervals */
+
+#ifndef INCLUDED_GOVERNOR_H
+#define INCLUDED_GOVERNOR_H
+
+
+typedef struct Governor_ Governor;
+
+typedef enum {
+    Governor_ACTION_KEEP,
+    Governor_ACTION_COARSER,    /* denom + 1 */
+    Governor_ACTION_FINER,      /* denom - 1 */
+    Governor_ACTION_ENUMS
+} Governor_ACTION;
+
+
+/* denom is kept in [min_denom, max_denom] */
+Governor *Governor_Create(double target_fps, int min_denom, int max_denom);
+void Governor_Delete(Governor *gv);
+double Governor_GetTargetFps(Governor *gv);
+
+/* one call per frame with the interval since the previous one.
+ * after an action is applied the window restarts */
+Governor_ACTION Governor_Update(Governor *gv, double frame_ms, double now_ms, int denom);
+/* scaling changed from outside (key, reload), forget the window */
+void Governor_Reset(Governor *gv, double now_ms);
+/* p95 of the current window, for reporting */
+double Governor_GetFrameTime(Governor *gv);
+
+
+#endif
@@ -0,0 +1,295 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <time.h>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "config.h"
+#include "base.h"
+#include "gl_ext.h"
+#include "histogram.h"
+#include "gpu_timer.h"
+
+
+/* from GL_EXT_disjoint_timer_query, old gl2ext.h may not have it */
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_QUERY_RESULT_EXT
+#define GL_QUERY_RESULT_EXT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE_EXT
+#define GL_QUERY_RESULT_AVAILABLE_EXT 0x8867
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+typedef void (GL_APIENTRY *GenQueriesEXTProc)(GLsizei n, GLuint *ids);
+typedef void (GL_APIENTRY *DeleteQueriesEXTProc)(GLsizei n, const GLuint *ids);
+typedef void (GL_APIENTRY *BeginQueryEXTProc)(GLenum target, GLuint id);
+typedef void (GL_APIENTRY *EndQueryEXTProc)(GLenum target);
+typedef void (GL_APIENTRY *GetQueryObjectuivEXTProc)(GLuint id, GLenum pname, GLuint *params);
+typedef void (GL_APIENTRY *GetQueryObjectui64vEXTProc)(GLuint id, GLenum pname, uint64_t *params);
+
+enum {
+    QUERY_LATENCY = 4,          /* frames before a query result is read */
+    HISTOGRAM_CAPACITY = 512,
+    CALIBRATION_ROUNDS = 16
+};
+
+struct GpuTimer_ {
+    GpuTimer_METHOD method;
+    int num_slot;
+    Histogram **histogram;
+    unsigned int frame;
+    struct {
+        GLuint *object;         /* [QUERY_LATENCY][num_slot] */
+        unsigned char *issued;
+        GenQueriesEXTProc gen;
+        DeleteQueriesEXTProc del;
+        BeginQueryEXTProc begin;
+        EndQueryEXTProc end;
+        GetQueryObjectuivEXTProc get_uiv;
+        GetQueryObjectui64vEXTProc get_ui64v;
+    } query;
+    struct {
+        EGLDisplay display;
+        PFNEGLCREATESYNCKHRPROC create;
+        PFNEGLDESTROYSYNCKHRPROC destroy;
+        PFNEGLCLIENTWAITSYNCKHRPROC client_wait;
+    } fence;
+    double overhead_ms;         /* of one CPU-side GPU round trip */
+    double begin_ms;
+};
+
+
+static double GetMonotonicTimeInMilliSecond(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int CompareDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+static int GpuTimer_SetupTimerQuery(GpuTimer *t)
+{
+    if (!GLExt_Has("GL_EXT_disjoint_timer_query")) {
+        return 1;
+    }
+    t->query.gen = (GenQueriesEXTProc)GLExt_GetProcAddress("glGenQueriesEXT");
+    t->query.del = (DeleteQueriesEXTProc)GLExt_GetProcAddress("glDeleteQueriesEXT");
+    t->query.begin = (BeginQueryEXTProc)GLExt_GetProcAddress("glBeginQueryEXT");
+    t->query.end = (EndQueryEXTProc)GLExt_GetProcAddress("glEndQueryEXT");
+    t->query.get_uiv = (GetQueryObjectuivEXTProc)GLExt_GetProcAddress("glGetQueryObjectuivEXT");
+    t->query.get_ui64v = (GetQueryObjectui64vEXTProc)GLExt_GetProcAddress("glGetQueryObjectui64vEXT");
+    if (!t->query.gen || !t->query.del || !t->query.begin || !t->query.end
+        || !t->query.get_uiv || !t->query.get_ui64v) {
+        return 2;
+    }
+    t->query.object = calloc(QUERY_LATENCY * t->num_slot, sizeof(GLuint));
+    t->query.issued = calloc(QUERY_LATENCY * t->num_slot, 1);
+    if (!t->query.object || !t->query.issued) {
+        free(t->query.object);
+        free(t->query.issued);
+        t->query.object = NULL;
+        t->query.issued = NULL;
+        return 3;
+    }
+    t->query.gen(QUERY_LATENCY * t->num_slot, t->query.object);
+    {
+        GLint disjoint;
+        glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint); /* clear */
+    }
+    return 0;
+}
+
+static int GpuTimer_SetupFence(GpuTimer *t)
+{
+    t->fence.display = eglGetCurrentDisplay();
+    if (!GLExt_HasEGL("EGL_KHR_fence_sync")) {
+        return 1;
+    }
+    t->fence.create = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+    t->fence.destroy = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+    t->fence.client_wait = (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+    if (!t->fence.create || !t->fence.destroy || !t->fence.client_wait) {
+        return 2;
+    }
+    return 0;
+}
+
+/* block until the GPU drained everything submitted so far */
+static void GpuTimer_Drain(GpuTimer *t)
+{
+    if (t->method == GpuTimer_METHOD_FENCE) {
+        EGLSyncKHR sync = t->fence.create(t->fence.display, EGL_SYNC_FENCE_KHR, NULL);
+        if (sync != EGL_NO_SYNC_KHR) {
+            t->fence.client_wait(t->fence.display, sync,
+                                 EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+            t->fence.destroy(t->fence.display, sync);
+            return;
+        }
+    }
+    glFinish();
+}
+
+/* round trip cost on an idle GPU, subtracted from every sample */
+static void GpuTimer_Calibrate(GpuTimer *t)
+{
+    double sample[CALIBRATION_ROUNDS];
+    int i;
+
+    GpuTimer_Drain(t);
+    for (i = 0; i < CALIBRATION_ROUNDS; i++) {
+        double begin = GetMonotonicTimeInMilliSecond();
+        GpuTimer_Drain(t);
+        sample[i] = GetMonotonicTimeInMilliSecond() - begin;
+    }
+    qsort(sample, CALIBRATION_ROUNDS, sizeof(sample[0]), CompareDouble);
+    t->overhead_ms = sample[CALIBRATION_ROUNDS / 2];
+}
+
+
+GpuTimer *GpuTimer_Create(int num_slot)
+{
+    GpuTimer *t;
+    int i;
+
+    t = calloc(1, sizeof(*t));
+    if (!t) {
+        return NULL;
+    }
+    t->num_slot = num_slot;
+    t->histogram = calloc(num_slot, sizeof(Histogram *));
+    if (!t->histogram) {
+        free(t);
+        return NULL;
+    }
+    for (i = 0; i < num_slot; i++) {
+        t->histogram[i] = Histogram_Create(HISTOGRAM_CAPACITY);
+        if (!t->histogram[i]) {
+            GpuTimer_Delete(t);
+            return NULL;
+        }
+    }
+
+    if (GpuTimer_SetupTimerQuery(t) == 0) {
+        t->method = GpuTimer_METHOD_TIMER_QUERY;
+    } else {
+        t->method = (GpuTimer_SetupFence(t) == 0) ? GpuTimer_METHOD_FENCE : GpuTimer_METHOD_FINISH;
+        GpuTimer_Calibrate(t);
+    }
+    return t;
+}
+
+void GpuTimer_Delete(GpuTimer *t)
+{
+    int i;
+    if (t->method == GpuTimer_METHOD_TIMER_QUERY && t->query.object) {
+        t->query.del(QUERY_LATENCY * t->num_slot, t->query.object);
+    }
+    free(t->query.object);
+    free(t->query.issued);
+    for (i = 0; i < t->num_slot; i++) {
+        if (t->histogram[i]) {
+            Histogram_Delete(t->histogram[i]);
+        }
+    }
+    free(t->histogram);
+    free(t);
+}
+
+GpuTimer_METHOD GpuTimer_GetMethod(GpuTimer *t)
+{
+    return t->method;
+}
+
+const char *GpuTimer_GetMethodName(GpuTimer_METHOD method)
+{
+    switch (method) {
+    case GpuTimer_METHOD_TIMER_QUERY:
+        return "EXT_disjoint_timer_query";
+    case GpuTimer_METHOD_FENCE:
+        return "EGL_KHR_fence_sync (serializing)";
+    case GpuTimer_METHOD_FINISH:
+        return "glFinish (serializing)";
+    default:
+        assert(0);
+        return "?";
+    }
+}
+
+void GpuTimer_Begin(GpuTimer *t, int slot)
+{
+    assert(slot >= 0 && slot < t->num_slot);
+    if (t->method == GpuTimer_METHOD_TIMER_QUERY) {
+        int index = (t->frame % QUERY_LATENCY) * t->num_slot + slot;
+        t->query.begin(GL_TIME_ELAPSED_EXT, t->query.object[index]);
+        t->query.issued[index] = 1;
+    } else {
+        GpuTimer_Drain(t);
+        t->begin_ms = GetMonotonicTimeInMilliSecond();
+    }
+}
+
+void GpuTimer_End(GpuTimer *t, int slot)
+{
+    if (t->method == GpuTimer_METHOD_TIMER_QUERY) {
+        t->query.end(GL_TIME_ELAPSED_EXT);
+    } else {
+        double ms;
+        GpuTimer_Drain(t);
+        ms = GetMonotonicTimeInMilliSecond() - t->begin_ms - t->overhead_ms;
+        Histogram_Push(t->histogram[slot], (ms > 0.0) ? ms : 0.0);
+    }
+}
+
+void GpuTimer_EndFrame(GpuTimer *t)
+{
+    if (t->method == GpuTimer_METHOD_TIMER_QUERY) {
+        int slot;
+        int base;
+        GLint disjoint;
+
+        /* oldest frame in the ring, it is reused by the next frame */
+        t->frame += 1;
+        base = (t->frame % QUERY_LATENCY) * t->num_slot;
+        disjoint = 0;
+        glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+        for (slot = 0; slot < t->num_slot; slot++) {
+            GLuint available;
+            uint64_t ns;
+            if (!t->query.issued[base + slot]) {
+                continue;
+            }
+            t->query.issued[base + slot] = 0;
+            available = 0;
+            t->query.get_uiv(t->query.object[base + slot], GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+            if (!available || disjoint) {
+                continue;       /* dropped rather than stall */
+            }
+            t->query.get_ui64v(t->query.object[base + slot], GL_QUERY_RESULT_EXT, &ns);
+            Histogram_Push(t->histogram[slot], ns / 1000000.0);
+        }
+    }
+}
+
+Histogram *GpuTimer_GetHistogram(GpuTimer *t, int slot)
+{
+    assert(slot >= 0 && slot < t->num_slot);
+    return t->histogram[slot];
+}
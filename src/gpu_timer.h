@@ -0,0 +1,36 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* per-slot (layer) GPU time measurement into rolling histograms */
+
+#ifndef INCLUDED_GPU_TIMER_H
+#define INCLUDED_GPU_TIMER_H
+
+
+#include "histogram.h"
+
+typedef struct GpuTimer_ GpuTimer;
+
+typedef enum {
+    GpuTimer_METHOD_TIMER_QUERY,    /* EXT_disjoint_timer_query, no stall */
+    GpuTimer_METHOD_FENCE,          /* EGL_KHR_fence_sync, waits at end of frame */
+    GpuTimer_METHOD_FINISH,         /* glFinish per slot, last resort */
+    GpuTimer_METHOD_ENUMS
+} GpuTimer_METHOD;
+
+
+/* needs a current context */
+GpuTimer *GpuTimer_Create(int num_slot);
+void GpuTimer_Delete(GpuTimer *t);
+GpuTimer_METHOD GpuTimer_GetMethod(GpuTimer *t);
+const char *GpuTimer_GetMethodName(GpuTimer_METHOD method);
+
+/* Begin/End pairs must not nest */
+void GpuTimer_Begin(GpuTimer *t, int slot);
+void GpuTimer_End(GpuTimer *t, int slot);
+void GpuTimer_EndFrame(GpuTimer *t);
+
+/* milliseconds */
+Histogram *GpuTimer_GetHistogram(GpuTimer *t, int slot);
+
+
+#endif
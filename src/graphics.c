@@ -3,92 +3,347 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
 #include <assert.h>
 
-#include <bcm_host.h>
 #include <GLES2/gl2.h>
 
 #include "config.h"
 #include "base.h"
+#include "hash.h"
 #include "video.h"
 #include "video_egl.h"
+#include "shader_builder.h"
+#include "histogram.h"
+#include "gpu_timer.h"
+#include "gl_state.h"
+#include "render_target.h"
+#include "image.h"
+#include "image_loader.h"
+#include "movie_reader.h"
+#include "audio.h"
+#include "readback.h"
 #include "graphics.h"
 
 
 enum {
-    MAX_RENDER_LAYER = 8,
-    MAX_STATIC_IMAGE = 8
+    MAX_STATIC_IMAGE = 8,
+    MAX_MOVIE = 4,
+    MAX_LAYER_INPUT = 4,        /* #pragma input per layer */
+    MAX_PYRAMID_LEVEL = 6,      /* prev_layer_lod1 .. lod6 */
+    MAX_LAYER_NAME = 64,
+    MAX_LAYER_VARIANT = 8,      /* programs kept per layer besides the one on screen */
+    IMAGE_UPLOAD_BYTES_PER_FRAME = 1024 * 1024 /* glTexSubImage2D budget of a frame */
     /* MAX_SCENE = 6 */
 };
 
+/* "#pragma input <sampler> <layer name or index>" */
+typedef struct {
+    char sampler[MAX_LAYER_NAME];
+    char source[MAX_LAYER_NAME];
+    int source_index;           /* resolved at install, -1: unresolved */
+    GLint location;
+    GLint resolution_location;  /* <sampler>_resolution */
+    GLfloat shadow_resolution[2];
+} LayerInput;
+
+/* a program of a source seen before, switched back to without a build */
+typedef struct {
+    uint64_t key;               /* hash of the source */
+    GLuint program;             /* 0: free slot */
+    unsigned int last_use;      /* generation it was parked at */
+} LayerVariant;
+
+/* float uniform given by name, it outlives program changes */
+typedef struct {
+    char name[MAX_LAYER_NAME];
+    GLfloat value;
+    GLint location;             /* in the installed program */
+    GLfloat shadow;
+} LayerUniform;
+
+/* what a sampler uniform of a layer program reads, by reflection */
+typedef enum {
+    SAMPLER_UNKNOWN,            /* none of ours, left alone */
+    SAMPLER_BACKBUFFER,
+    SAMPLER_PREV_LAYER,
+    SAMPLER_PREV_LAYER_LOD,     /* index: level - 1 */
+    SAMPLER_INPUT,              /* index: of input[] */
+    SAMPLER_IMAGE,              /* index: of static_image[] */
+    SAMPLER_MOVIE,              /* index: of movie[] */
+    SAMPLER_AUDIO               /* "audio": spectrum and waveform */
+} SamplerRole;
+
+typedef struct {
+    GLint location;
+    SamplerRole role;
+    int index;
+    GLint shadow_unit;          /* -1: not given yet */
+    GLint resolution_location;  /* image and movie: <sampler>_resolution */
+    GLfloat shadow_resolution[2];
+} LayerSampler;
+
+/* "--image <sampler>=<path>", decoded by the loader, uploaded a slice per frame */
+typedef struct {
+    char name[MAX_LAYER_NAME];
+    char *path;
+    void *auxptr;
+    unsigned int generation;    /* of last submitted load */
+    GLuint texture;             /* sampled. 1x1 black until the first load is in */
+    int width;
+    int height;
+    struct {
+        Image image;            /* pixels NULL: nothing in flight */
+        GLuint texture;         /* swapped in when the last row is there */
+        int row;                /* next to upload */
+    } upload;
+} StaticImage;
+
+/* "--video <sampler>=<path>": planes uploaded as they are, RGB made on the GPU
+ * once per new frame */
+typedef struct {
+    char name[MAX_LAYER_NAME];
+    MovieReader *reader;
+    MovieReader_Info info;
+    GLuint plane[3];            /* Y, U, V luminance, rows top down */
+    GLuint texture;             /* sampled, RGB rows bottom up like images */
+    GLuint framebuffer;
+    long shown;                 /* frame in texture, -1: none yet */
+    long repeated;              /* renders where the due frame was not read yet */
+    long dropped;               /* frames never shown, renderer behind */
+} Movie;
+
 typedef struct {
     int numer;
     int denom;
 } Scaling;
 
+/* one of our own fragment programs: a source sampler and one vec2 */
+typedef struct {
+    GLuint program;
+    GLint source;
+    GLint param;
+    GLint shadow_source;
+    GLfloat shadow_param[2];
+    int valid;                  /* shadow is in sync with the program */
+} BuiltinProgram;
+
+/* planes to RGB: three samplers and the range of the movie */
+typedef struct {
+    GLuint program;
+    GLint plane[3];
+    GLint resolution;
+    GLint range;
+    GLint shadow_plane[3];
+    GLfloat shadow_resolution[2];
+    GLfloat shadow_range[3];
+    int valid;
+} YUVProgram;
+
+/* half size downsamples of the output, for the next layer */
+typedef struct {
+    int levels;                 /* 0: no pyramid */
+    RenderTarget *target[MAX_PYRAMID_LEVEL];
+    GLuint texture[MAX_PYRAMID_LEVEL];
+    GLuint framebuffer[MAX_PYRAMID_LEVEL];
+    int width[MAX_PYRAMID_LEVEL];
+    int height[MAX_PYRAMID_LEVEL];
+} LayerPyramid;
+
+/* what Graphics_ScheduleLayers decides for a layer, kept when it fails */
+typedef struct {
+    int width;
+    int height;
+    LayerPyramid pyramid;
+    int scheduled;
+    int last_use;
+    RenderTarget *target;
+    GLuint texture_object;
+    GLuint framebuffer;
+} LayerSchedule;
+
 struct RenderLayer_ {
-    GLuint fragment_shader;
+    char name[MAX_LAYER_NAME];
+    Source *source;             /* NULL: none yet */
+    unsigned int generation;    /* of last submitted build */
+    double build_submit_ms;     /* of last submitted build */
+    uint64_t pending_key;       /* hash of the submitted source */
     GLuint program;
+    uint64_t program_key;       /* hash of the source of the program */
+    int program_stale;          /* of an edited source, deleted when replaced */
+    LayerVariant variant[MAX_LAYER_VARIANT];
+    LayerUniform *uniform;      /* RenderLayer_SetUniform */
+    int num_uniform;
+    int max_uniform;
+    LayerInput input[MAX_LAYER_INPUT]; /* of the installed program */
+    int num_input;
+    LayerInput pending_input[MAX_LAYER_INPUT]; /* of the submitted source */
+    int num_pending_input;
+    int pragma_error;           /* a pragma of the installed program is wrong */
+    int pending_pragma_error;
+    LayerSampler *sampler;      /* active sampler2D uniforms of the program */
+    int num_sampler;
+    Scaling scale;              /* #pragma scale of the installed program */
+    Scaling pending_scale;
+    Scaling forced_scale;       /* from command line, wins over the pragma. denom 0: none */
+    int width;                  /* of the current schedule */
+    int height;
+    LayerPyramid pyramid;
+    int scheduled;              /* 0: output reaches nothing, culled */
+    int last_use;               /* index of the last layer reading the output */
+    RenderTarget *target;       /* NULL: final layer, draws to window */
     GLuint texture_object;
-    GLuint texture_unit;
     GLuint framebuffer;
     struct {
-        GLuint vertex_coord;
-        GLuint mouse;
-        GLuint time;
-        GLuint resolution;
-        GLuint backbuffer;
-        GLuint rand;
-        GLuint prev_layer;
-        GLuint prev_layer_resolution;
+        GLint mouse;
+        GLint time;
+        GLint resolution;
+        GLint backbuffer;
+        GLint rand;
+        GLint prev_layer;
+        GLint prev_layer_resolution;
+        GLint prev_layer_lod[MAX_PYRAMID_LEVEL]; /* [0]: prev_layer_lod1 */
+        GLint audio_level[4];   /* audio_bass, audio_mid, audio_high, audio_beat */
     } attr;
+    struct {
+        int valid;              /* 0: new program, upload everything */
+        GLfloat time;
+        GLfloat resolution[2];
+        GLfloat mouse[2];
+        GLfloat rand;
+        GLfloat prev_layer_resolution[2];
+        GLfloat audio_level[4];
+    } shadow;                   /* last values given to the program */
     void *auxptr;
 };
 
 /*
 struct Scene_ {
-    RenderLayer render_layer[MAX_RENDER_LAYER];
+    RenderLayer **render_layer;
     int num_render_layer;
 };
 */
 
 struct Graphics_ {
-    Video *video;
+    Video *video;               /* display backend */
     VideoEGL *video_egl;
     Graphics_LAYOUT layout;
     GLuint array_buffer_fullscene_quad;
     GLuint vertex_shader;
+    ShaderBuilder *builder;
+    GpuTimer *gpu_timer;        /* NULL: profiling OFF */
+    GLState *gl;                /* every bind of the render context goes through this */
+    RenderTargetPool *target_pool;
+    int schedule_dirty;         /* inputs changed, graph and targets are stale */
     Graphics_WRAP_MODE texture_wrap_mode;
     Graphics_INTERPOLATION_MODE texture_interpolation_mode;
     Graphics_PIXELFORMAT texture_pixel_format;
-    RenderLayer render_layer[MAX_RENDER_LAYER];
+    RenderLayer **render_layer; /* grows by append, a layer never moves */
     int num_render_layer;
-    struct {
-        GLuint texture;
-    } static_image[MAX_STATIC_IMAGE]; /* TODO */
+    int max_render_layer;       /* allocated slots of render_layer */
+    StaticImage static_image[MAX_STATIC_IMAGE];
     int num_static_image;
+    ImageLoader *image_loader;
+    Movie movie[MAX_MOVIE];
+    int num_movie;
+    int movie_wait;             /* block for late frames instead of repeating */
+    Readback *readback;         /* NULL: frames are not captured */
+    GLuint black_texture;       /* 1x1, for samplers with nothing to read. 0: not yet */
+    struct {
+        Audio_Frame frame;      /* newest given, levels are uniforms */
+        int dirty;              /* frame not in texture yet */
+        GLuint texture;         /* 256x2, spectrum then waveform. 0: no audio */
+    } audio;
     int enable_backbuffer;
-    GLuint backbuffer_texture_object;
-    GLuint backbuffer_texture_unit;
+    struct {
+        RenderTarget *target[2];
+        GLuint texture[2];
+        GLuint framebuffer[2];
+        int read;               /* sampled as backbuffer, the other is drawn by the final layer */
+    } feedback;
+    BuiltinProgram blit;        /* feedback texture to window */
+    BuiltinProgram downsample;  /* pyramid level from the one above */
+    YUVProgram yuv;             /* movie frame to RGB, built with the first movie */
     Scaling window_scaling;
     Scaling primary_framebuffer; /* TODO */
+    struct {
+        GLfloat time;
+        GLfloat mouse[2];
+        GLfloat rand;
+    } uniform;                  /* for the next Graphics_Render */
 };
 
 
 static void DeterminePixelFormat(Graphics_PIXELFORMAT pixel_format,
                                  GLint *out_internal_format,
                                  GLenum *out_format, GLenum *out_type);
+static void DetermineTargetDesc(Graphics *g, int width, int height,
+                                RenderTarget_Desc *out_desc);
+static void StaticImage_Destruct(StaticImage *im, GLState *gl);
+static void Movie_Destruct(Movie *m, GLState *gl);
 static void DetermineLayoutPosition(Graphics_LAYOUT layout,
                                     int screen_width, int screen_height,
                                     int *out_x, int *out_y,
                                     int *out_width, int *out_height);
 
+/* attribute 0 is bound to vertex_coord in every program */
+static const GLchar *vertex_shader_source =
+    "attribute vec4 vertex_coord;"
+    "void main(void) { gl_Position = vertex_coord; }";
+
+/* texel centers only, exact copy even with linear filter */
+static const GLchar *blit_fragment_shader_source =
+    "precision mediump float;"
+    "uniform sampler2D source;"
+    "uniform vec2 resolution;"
+    "void main(void) { gl_FragColor = texture2D(source, gl_FragCoord.xy / resolution); }";
+
+/* 2x2 box around the corner shared by the four source texels. taps sit on
+ * texel centers, so the result is the same for nearest and linear sources */
+static const GLchar *downsample_fragment_shader_source =
+    "precision mediump float;"
+    "uniform sampler2D source;"
+    "uniform vec2 texel;"
+    "void main(void) {"
+    "  vec2 uv = gl_FragCoord.xy * 2.0 * texel;"
+    "  gl_FragColor = 0.25 * (texture2D(source, uv + vec2(-0.5, -0.5) * texel)"
+    "                       + texture2D(source, uv + vec2( 0.5, -0.5) * texel)"
+    "                       + texture2D(source, uv + vec2(-0.5,  0.5) * texel)"
+    "                       + texture2D(source, uv + vec2( 0.5,  0.5) * texel));"
+    "}";
+
+/* BT.601. range: luma offset, luma scale, chroma scale. vertical flip, the
+ * planes come top down */
+static const GLchar *yuv_fragment_shader_source =
+    "precision mediump float;"
+    "uniform sampler2D plane_y;"
+    "uniform sampler2D plane_u;"
+    "uniform sampler2D plane_v;"
+    "uniform vec2 resolution;"
+    "uniform vec3 range;"
+    "void main(void) {"
+    "  vec2 uv = vec2(gl_FragCoord.x, resolution.y - gl_FragCoord.y) / resolution;"
+    "  float y = (texture2D(plane_y, uv).r - range.x) * range.y;"
+    "  float u = (texture2D(plane_u, uv).r - 128.0 / 255.0) * range.z;"
+    "  float v = (texture2D(plane_v, uv).r - 128.0 / 255.0) * range.z;"
+    "  gl_FragColor = vec4(y + 1.402 * v, y - 0.344136 * u - 0.714136 * v, y + 1.772 * u, 1.0);"
+    "}";
+
 #ifdef NDEBUG
 # define CHECK_GL()
 #else
 # define CHECK_GL() CheckGLError(__FILE__, __LINE__, __func__)
 #endif
 
+static double GetMonotonicTimeInMilliSecond(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
 #ifndef NDEBUG
 static void CheckGLError(const char *file, int line, const char *func)
 {
@@ -121,7 +376,6 @@ static void CheckGLError(const char *file, int line, const char *func)
 
 void Graphics_HostInitialize(void)
 {
-    bcm_host_init();
 }
 
 void Graphics_HostDeinitialize(void)
@@ -135,13 +389,6 @@ static void PrintShaderLog(const char *message, GLuint shader)
     printf("%s %d: %s\r\n", message, shader, build_log);
 }
 
-static void PrintProgramLog(const char *message, GLuint program)
-{
-    GLchar build_log[512];
-    glGetProgramInfoLog(program, sizeof(build_log), NULL, build_log);
-    printf("%s %d: %s\r\n", message, program, build_log);
-}
-
 
 static void Scaling_Apply(Scaling *sc, int *inout_width, int *inout_height)
 {
@@ -149,11 +396,6 @@ static void Scaling_Apply(Scaling *sc, int *inout_width, int *inout_height)
     *inout_height = (*inout_height * sc->numer) / sc->denom;
 }
 
-static int Scaling_IsOne(Scaling *sc)
-{
-    return (sc->numer == sc->denom) ? 1 : 0;
-}
-
 
 /* RenderLayer */
 static int RenderLayer_Construct(RenderLayer *layer,
@@ -161,16 +403,31 @@ static int RenderLayer_Construct(RenderLayer *layer,
 {
     memset(layer, 0, sizeof(*layer));
     layer->auxptr = auxptr;
-    layer->fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    return (layer->fragment_shader == 0) ? 1 : 0;
+    layer->scale.numer = layer->scale.denom = 1;
+    layer->pending_scale = layer->scale;
+    return 0;
 }
 
-static void RenderLayer_Destruct(RenderLayer *layer)
+static void RenderLayer_Destruct(RenderLayer *layer, GLState *gl)
 {
-    glDeleteProgram(layer->program);
+    int i;
+    GLState_DeleteProgram(gl, layer->program);
     layer->program = 0;
-    glDeleteShader(layer->fragment_shader);
-    layer->fragment_shader = 0;
+    for (i = 0; i < MAX_LAYER_VARIANT; i++) {
+        GLState_DeleteProgram(gl, layer->variant[i].program);
+        layer->variant[i].program = 0;
+    }
+    if (layer->source) {
+        Source_Release(layer->source);
+        layer->source = NULL;
+    }
+    free(layer->sampler);
+    layer->sampler = NULL;
+    layer->num_sampler = 0;
+    free(layer->uniform);
+    layer->uniform = NULL;
+    layer->num_uniform = 0;
+    layer->max_uniform = 0;
     assert(layer->texture_object == 0);
 }
 
@@ -179,272 +436,780 @@ void *RenderLayer_GetAux(RenderLayer *layer)
     return layer->auxptr;
 }
 
-int RenderLayer_UpdateShaderSource(RenderLayer *layer,
-                                   const char *source,
-                                   OPTIONAL int source_length)
+int RenderLayer_UpdateShaderSource(RenderLayer *layer, Source *source)
+{
+    /* kept until build, compile runs on another thread */
+    Source_Retain(source);
+    if (layer->source) {
+        Source_Release(layer->source);
+    }
+    layer->source = source;
+    return 0;
+}
+
+int RenderLayer_SetUniform(RenderLayer *layer, const char *name, float value)
 {
-    glShaderSource(layer->fragment_shader, 1, &source, &source_length);
-    if (glGetError() != 0) {
+    LayerUniform *u;
+    int i;
+
+    for (i = 0; i < layer->num_uniform; i++) {
+        if (strcmp(layer->uniform[i].name, name) == 0) {
+            layer->uniform[i].value = value;
+            return 0;
+        }
+    }
+    if (strlen(name) >= sizeof(u->name)) {
         return 1;
     }
+    if (layer->num_uniform == layer->max_uniform) {
+        int n = (layer->max_uniform == 0) ? 8 : layer->max_uniform * 2;
+        LayerUniform *p = realloc(layer->uniform, sizeof(*p) * n);
+        if (!p) {
+            return 1;
+        }
+        layer->uniform = p;
+        layer->max_uniform = n;
+    }
+    u = &layer->uniform[layer->num_uniform++];
+    strcpy(u->name, name);
+    u->value = value;
+    /* the render context is current on the caller's thread */
+    u->location = layer->program ? glGetUniformLocation(layer->program, name) : -1;
+    u->shadow = value;
+    layer->shadow.valid = 0;
     return 0;
 }
 
-static int RenderLayer_AllocateOffscreen(RenderLayer *layer,
-                                         int is_final_layer, int tex_unit,
-                                         int tex_width, int tex_height,
-                                         Graphics_PIXELFORMAT pixel_format,
-                                         Graphics_INTERPOLATION_MODE interpolation_mode,
-                                         Graphics_WRAP_MODE wrap_mode)
+void RenderLayer_ClearUniforms(RenderLayer *layer)
 {
-    /* TODO: handle error */
-    GLint internal_format;
-    GLenum format;
-    GLenum type;
-    GLint interpolation;
-    GLint wrap;
+    layer->num_uniform = 0;
+}
 
-    CHECK_GL();
+int RenderLayer_SetName(RenderLayer *layer, const char *name)
+{
+    if (strlen(name) >= sizeof(layer->name)) {
+        return 1;
+    }
+    strcpy(layer->name, name);
+    return 0;
+}
 
-    DeterminePixelFormat(pixel_format, &internal_format, &format, &type);
+int RenderLayer_IsCulled(RenderLayer *layer)
+{
+    return !layer->scheduled;
+}
 
-    switch (interpolation_mode) {
-    case Graphics_INTERPOLATION_MODE_NEARESTNEIGHBOR:
-        interpolation = GL_NEAREST;
-        break;
-    case Graphics_INTERPOLATION_MODE_BILINEAR:
-        interpolation = GL_LINEAR;
-        break;
-    default:
-        assert(0);
-        interpolation = GL_NEAREST;
-        break;
+int RenderLayer_SetScale(RenderLayer *layer, int numer, int denom)
+{
+    if (numer <= 0 || denom <= 0 || numer > denom) {
+        return 1;
     }
+    layer->forced_scale.numer = numer;
+    layer->forced_scale.denom = denom;
+    return 0;
+}
 
-    switch (wrap_mode) {
-    case Graphics_WRAP_MODE_CLAMP_TO_EDGE:
-        wrap = GL_CLAMP_TO_EDGE;
-        break;
-    case Graphics_WRAP_MODE_REPEAT:
-        wrap = GL_REPEAT;
-        break;
-    case Graphics_WRAP_MODE_MIRRORED_REPEAT:
-        wrap = GL_MIRRORED_REPEAT;
-        break;
-    default:
-        assert(0);
-        wrap = GL_REPEAT;
-        break;
+void RenderLayer_GetSize(RenderLayer *layer, int *out_width, int *out_height)
+{
+    *out_width = layer->width;
+    *out_height = layer->height;
+}
+
+static const char *SkipSpace(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    return p;
+}
+
+/* copy one token, return NULL when missing or too long */
+static const char *ReadToken(const char *p, const char *end, char *out, size_t out_size)
+{
+    size_t n;
+    p = SkipSpace(p, end);
+    for (n = 0; p + n < end && p[n] != ' ' && p[n] != '\t'
+             && p[n] != '\r' && p[n] != '\n'; n++) {
+    }
+    if (n == 0 || n >= out_size) {
+        return NULL;
+    }
+    memcpy(out, p, n);
+    out[n] = '\0';
+    return p + n;
+}
+
+/* "N/D", 0 < N <= D */
+static int ParseScale(const char *str, Scaling *out)
+{
+    int numer, denom;
+    char tail;
+    if (sscanf(str, "%d/%d%c", &numer, &denom, &tail) != 2
+        || numer <= 0 || denom <= 0 || numer > denom) {
+        return 1;
+    }
+    out->numer = numer;
+    out->denom = denom;
+    return 0;
+}
+
+static void RenderLayer_ParseInputPragma(RenderLayer *layer, const char *p, const char *end)
+{
+    LayerInput *in = &layer->pending_input[layer->num_pending_input];
+    if (layer->num_pending_input >= MAX_LAYER_INPUT) {
+        printf("#pragma input: too many inputs, max %d\r\n", MAX_LAYER_INPUT);
+        layer->pending_pragma_error = 1;
+    } else if ((p = ReadToken(p, end, in->sampler, sizeof(in->sampler))) == NULL
+               || ReadToken(p, end, in->source, sizeof(in->source)) == NULL) {
+        printf("#pragma input: expected <sampler> <layer>\r\n");
+        layer->pending_pragma_error = 1;
+    } else {
+        layer->num_pending_input += 1;
+    }
+}
+
+static void RenderLayer_ParseScalePragma(RenderLayer *layer, const char *p, const char *end)
+{
+    char token[16];
+    if (ReadToken(p, end, token, sizeof(token)) == NULL
+        || ParseScale(token, &layer->pending_scale)) {
+        printf("#pragma scale: expected N/D, N <= D\r\n");
+        layer->pending_pragma_error = 1;
+    }
+}
+
+/* past spaces and whole block comments. 'in_comment': inside one, on entry
+ * and on return */
+static const char *SkipSpaceAndComment(const char *p, const char *end, int *in_comment)
+{
+    for (;;) {
+        if (*in_comment) {
+            while (p + 1 < end && !(p[0] == '*' && p[1] == '/')) {
+                p++;
+            }
+            if (p + 1 >= end) {
+                return end;
+            }
+            p += 2;
+            *in_comment = 0;
+        }
+        p = SkipSpace(p, end);
+        if (p + 1 < end && p[0] == '/' && p[1] == '*') {
+            p += 2;
+            *in_comment = 1;
+            continue;
+        }
+        return p;
+    }
+}
+
+/* the rest of a line: does a block comment stay open past it */
+static void TrackComment(const char *p, const char *end, int *in_comment)
+{
+    while (p < end) {
+        p = SkipSpaceAndComment(p, end, in_comment);
+        if (p + 1 < end && p[0] == '/' && p[1] == '/') {
+            return;
+        }
+        if (p < end) {
+            p++;
+        }
     }
+}
+
+/* GLSL ignores pragmas it does not know, they are ours to read. the ones in
+ * block comments and in "#if 0" are not, any other #if is not evaluated */
+static void RenderLayer_ParsePragmas(RenderLayer *layer)
+{
+    const char *p = Source_GetText(layer->source);
+    const char *end = p + Source_GetLength(layer->source);
+    int in_comment = 0;
+    int disabled = 0;           /* #if nesting inside an "#if 0" */
+
+    layer->num_pending_input = 0;
+    layer->pending_pragma_error = 0;
+    layer->pending_scale.numer = 1;
+    layer->pending_scale.denom = 1;
+    while (p < end) {
+        const char *line_end = memchr(p, '\n', (size_t)(end - p));
+        const char *q, *r;
+        char word[8];
+        if (!line_end) {
+            line_end = end;
+        }
+        q = SkipSpaceAndComment(p, line_end, &in_comment);
+        r = (q < line_end && *q == '#') ? ReadToken(q + 1, line_end, word, sizeof(word)) : NULL;
+        if (r) {
+            q = r;
+            if (strncmp(word, "if", 2) == 0) {
+                char value[4];
+                if (disabled > 0) {
+                    disabled += 1;
+                } else if (strcmp(word, "if") == 0
+                           && ReadToken(q, line_end, value, sizeof(value))
+                           && strcmp(value, "0") == 0) {
+                    disabled = 1;
+                }
+            } else if (strcmp(word, "endif") == 0) {
+                disabled -= (disabled > 0) ? 1 : 0;
+            } else if (strcmp(word, "else") == 0 || strcmp(word, "elif") == 0) {
+                disabled = (disabled == 1) ? 0 : disabled;
+            } else if (disabled == 0 && strcmp(word, "pragma") == 0) {
+                r = ReadToken(q, line_end, word, sizeof(word));
+                if (r && strcmp(word, "input") == 0) {
+                    RenderLayer_ParseInputPragma(layer, r, line_end);
+                } else if (r && strcmp(word, "scale") == 0) {
+                    RenderLayer_ParseScalePragma(layer, r, line_end);
+                }
+            }
+        }
+        TrackComment(q, line_end, &in_comment);
+        p = line_end + 1;
+    }
+}
+
+static int FindLayerByName(Graphics *g, const char *name, int before)
+{
+    int i;
+    char *end;
+    long index;
+
+    index = strtol(name, &end, 10);
+    if (*end == '\0') {
+        return (index >= 0 && index < before) ? (int)index : -1;
+    }
+    for (i = 0; i < before; i++) {
+        if (strcmp(g->render_layer[i]->name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-    if (is_final_layer) {
-        /* use FRAMEBUFFER = 0 */
-        layer->texture_unit = 0; /* not use */
+static int RenderLayer_AllocateOffscreen(RenderLayer *layer, RenderTargetPool *pool,
+                                         int to_window, const RenderTarget_Desc *desc)
+{
+    if (to_window) {
+        /* use FRAMEBUFFER = 0, or not drawn at all */
+        layer->target = NULL;
         layer->texture_object = 0;
         layer->framebuffer = 0;
-    } else {
-        layer->texture_unit = tex_unit;
-        glGenTextures(1, &layer->texture_object);
-        glBindTexture(GL_TEXTURE_2D, layer->texture_object);
-        glTexImage2D(GL_TEXTURE_2D,
-                     0,             /* level */
-                     internal_format,
-                     tex_width, tex_height,
-                     0,             /* border */
-                     format,
-                     type,
-                     NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, interpolation);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, interpolation);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        glGenFramebuffers(1, &layer->framebuffer);
-        glBindFramebuffer(GL_FRAMEBUFFER, layer->framebuffer);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, layer->texture_object, 0);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return 0;
     }
-    CHECK_GL();
+    layer->target = RenderTargetPool_Acquire(pool, desc);
+    if (!layer->target) {
+        return 1;
+    }
+    layer->texture_object = RenderTarget_GetTexture(layer->target);
+    layer->framebuffer = RenderTarget_GetFramebuffer(layer->target);
     return 0;
 }
 
-static void RenderLayer_DeallocateOffscreen(RenderLayer *layer)
+/* levels share the layer format, filtered so that readers can upscale smoothly */
+static int RenderLayer_AllocatePyramid(RenderLayer *layer, RenderTargetPool *pool,
+                                       const RenderTarget_Desc *layer_desc)
 {
-    glBindTexture(GL_TEXTURE_2D, 0);
-    if (layer->texture_object) {
-        glDeleteTextures(1, &layer->texture_object);
-        layer->texture_object = 0;
+    RenderTarget_Desc desc;
+    int l;
+
+    if (!layer->target) {
+        layer->pyramid.levels = 0;
+        return 0;
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    if (layer->framebuffer) {
-        glDeleteFramebuffers(1, &layer->framebuffer);
-        layer->framebuffer = 0;
+    desc = *layer_desc;
+    desc.filter = GL_LINEAR;
+    desc.wrap = GL_CLAMP_TO_EDGE;
+    for (l = 0; l < layer->pyramid.levels; l++) {
+        desc.width = (desc.width + 1) / 2;
+        desc.height = (desc.height + 1) / 2;
+        layer->pyramid.target[l] = RenderTargetPool_Acquire(pool, &desc);
+        if (!layer->pyramid.target[l]) {
+            layer->pyramid.levels = l;
+            return 1;
+        }
+        layer->pyramid.texture[l] = RenderTarget_GetTexture(layer->pyramid.target[l]);
+        layer->pyramid.framebuffer[l] = RenderTarget_GetFramebuffer(layer->pyramid.target[l]);
+        layer->pyramid.width[l] = desc.width;
+        layer->pyramid.height[l] = desc.height;
     }
+    return 0;
 }
 
-static int RenderLayer_BuildProgram(RenderLayer *layer,
-                                    GLuint vertex_shader,
-                                    GLuint array_buffer_fullscene_quad)
+/* output read for the last time: the pool may hand its targets out again */
+static void RenderLayer_ReleaseTargets(RenderLayer *layer, RenderTargetPool *pool)
 {
-    GLint param;
-    GLuint new_program;
+    int l;
+    RenderTargetPool_Release(pool, layer->target);
+    for (l = 0; l < layer->pyramid.levels; l++) {
+        RenderTargetPool_Release(pool, layer->pyramid.target[l]);
+    }
+}
 
-    CHECK_GL();
-    glCompileShader(layer->fragment_shader);
-    glGetShaderiv(layer->fragment_shader, GL_COMPILE_STATUS, &param);
-    if (param != GL_TRUE) {
-        PrintShaderLog("fragment_shader", layer->fragment_shader);
-        return 2;
+static void RenderLayer_SaveSchedule(const RenderLayer *layer, LayerSchedule *out)
+{
+    out->width = layer->width;
+    out->height = layer->height;
+    out->pyramid = layer->pyramid;
+    out->scheduled = layer->scheduled;
+    out->last_use = layer->last_use;
+    out->target = layer->target;
+    out->texture_object = layer->texture_object;
+    out->framebuffer = layer->framebuffer;
+}
+
+static void RenderLayer_RestoreSchedule(RenderLayer *layer, const LayerSchedule *saved)
+{
+    layer->width = saved->width;
+    layer->height = saved->height;
+    layer->pyramid = saved->pyramid;
+    layer->scheduled = saved->scheduled;
+    layer->last_use = saved->last_use;
+    layer->target = saved->target;
+    layer->texture_object = saved->texture_object;
+    layer->framebuffer = saved->framebuffer;
+}
+
+/* GL objects stay in the pool */
+static void RenderLayer_DeallocateOffscreen(RenderLayer *layer)
+{
+    layer->target = NULL;
+    layer->texture_object = 0;
+    layer->framebuffer = 0;
+    memset(&layer->pyramid, 0, sizeof(layer->pyramid));
+}
+
+/* the least recently parked variant makes room */
+static void RenderLayer_ParkProgram(RenderLayer *layer, GLState *gl)
+{
+    LayerVariant *slot = &layer->variant[0];
+    int i;
+
+    if (layer->program == 0) {
+        return;
     }
+    for (i = 0; i < MAX_LAYER_VARIANT; i++) {
+        LayerVariant *v = &layer->variant[i];
+        if (v->program == 0) {
+            slot = v;
+            break;
+        }
+        if (v->last_use - slot->last_use > UINT_MAX / 2) {
+            slot = v;           /* older, wrap safe */
+        }
+    }
+    GLState_DeleteProgram(gl, slot->program);
+    slot->key = layer->program_key;
+    slot->program = layer->program;
+    slot->last_use = layer->generation;
+}
 
-    new_program = glCreateProgram();
-    glAttachShader(new_program, vertex_shader);
-    glAttachShader(new_program, layer->fragment_shader);
-    glLinkProgram(new_program);
-    glGetProgramiv(new_program, GL_LINK_STATUS, &param);
-    if (param != GL_TRUE) {
-        PrintProgramLog("program", new_program);
-        return 3;
+/* 0: not kept */
+static GLuint RenderLayer_TakeVariant(RenderLayer *layer, uint64_t key)
+{
+    int i;
+    for (i = 0; i < MAX_LAYER_VARIANT; i++) {
+        LayerVariant *v = &layer->variant[i];
+        if (v->program != 0 && v->key == key) {
+            GLuint program = v->program;
+            v->program = 0;
+            return program;
+        }
+    }
+    return 0;
+}
+
+/* swap in a linked program, at frame boundary. the one replaced is kept,
+ * unless its source was edited since */
+static void RenderLayer_SetProgram(RenderLayer *layer, GLState *gl,
+                                   GLuint new_program, uint64_t key)
+{
+    int i;
+    CHECK_GL();
+    if (layer->program_stale) {
+        GLState_DeleteProgram(gl, layer->program);
+        layer->program_stale = 0;
+    } else {
+        RenderLayer_ParkProgram(layer, gl);
     }
-    glDeleteProgram(layer->program);
     layer->program = new_program;
+    layer->program_key = key;
 
-    glUseProgram(layer->program);
-    layer->attr.vertex_coord = glGetAttribLocation(layer->program, "vertex_coord");
     layer->attr.time = glGetUniformLocation(layer->program, "time");
     layer->attr.mouse = glGetUniformLocation(layer->program, "mouse");
     layer->attr.resolution = glGetUniformLocation(layer->program, "resolution");
     layer->attr.backbuffer = glGetUniformLocation(layer->program, "backbuffer");
     layer->attr.rand = glGetUniformLocation(layer->program, "rand");
+    layer->attr.audio_level[0] = glGetUniformLocation(layer->program, "audio_bass");
+    layer->attr.audio_level[1] = glGetUniformLocation(layer->program, "audio_mid");
+    layer->attr.audio_level[2] = glGetUniformLocation(layer->program, "audio_high");
+    layer->attr.audio_level[3] = glGetUniformLocation(layer->program, "audio_beat");
 
     /* no need for 0 layer */
     layer->attr.prev_layer = glGetUniformLocation(layer->program, "prev_layer");
     layer->attr.prev_layer_resolution = glGetUniformLocation(layer->program, "prev_layer_resolution");
+    for (i = 0; i < MAX_PYRAMID_LEVEL; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "prev_layer_lod%d", i + 1);
+        layer->attr.prev_layer_lod[i] = glGetUniformLocation(layer->program, name);
+    }
+    for (i = 0; i < layer->num_uniform; i++) {
+        layer->uniform[i].location = glGetUniformLocation(layer->program, layer->uniform[i].name);
+    }
+    layer->shadow.valid = 0;
+    CHECK_GL();
+}
+
+static SamplerRole RenderLayer_SamplerRole(RenderLayer *layer, GLint location, const char *name,
+                                           Graphics *g, int *out_index)
+{
+    int i;
+    *out_index = 0;
+    if (location == layer->attr.backbuffer) {
+        return SAMPLER_BACKBUFFER;
+    }
+    if (location == layer->attr.prev_layer) {
+        return SAMPLER_PREV_LAYER;
+    }
+    for (i = 0; i < MAX_PYRAMID_LEVEL; i++) {
+        if (location == layer->attr.prev_layer_lod[i]) {
+            *out_index = i;
+            return SAMPLER_PREV_LAYER_LOD;
+        }
+    }
+    for (i = 0; i < layer->num_input; i++) {
+        if (location == layer->input[i].location) {
+            *out_index = i;
+            return SAMPLER_INPUT;
+        }
+    }
+    for (i = 0; i < g->num_static_image; i++) {
+        if (strcmp(name, g->static_image[i].name) == 0) {
+            *out_index = i;
+            return SAMPLER_IMAGE;
+        }
+    }
+    for (i = 0; i < g->num_movie; i++) {
+        if (strcmp(name, g->movie[i].name) == 0) {
+            *out_index = i;
+            return SAMPLER_MOVIE;
+        }
+    }
+    if (strcmp(name, "audio") == 0) {
+        return SAMPLER_AUDIO;
+    }
+    return SAMPLER_UNKNOWN;
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, array_buffer_fullscene_quad);
-    glVertexAttribPointer(layer->attr.vertex_coord,
-                          4,
-                          GL_FLOAT,
-                          GL_FALSE, /* normalize */
-                          16,
-                          NULL);
-    glEnableVertexAttribArray(layer->attr.vertex_coord);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glUseProgram(0);
+/* units are handed out per draw to the samplers the program really has,
+ * so the count of layers and inputs is not bound by the hardware units */
+static int RenderLayer_ReflectSamplers(RenderLayer *layer, Graphics *g)
+{
+    GLint num_uniform, max_length;
+    GLchar *name;
+    LayerSampler *sampler;
+    int i;
 
+    layer->num_sampler = 0;
+    num_uniform = max_length = 0;
+    glGetProgramiv(layer->program, GL_ACTIVE_UNIFORMS, &num_uniform);
+    glGetProgramiv(layer->program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    if (num_uniform <= 0) {
+        return 0;
+    }
+    name = malloc((size_t)max_length + 1);
+    sampler = realloc(layer->sampler, sizeof(*sampler) * (size_t)num_uniform);
+    if (!name || !sampler) {
+        free(name);
+        return 1;
+    }
+    layer->sampler = sampler;
+    for (i = 0; i < num_uniform; i++) {
+        LayerSampler *ls = &layer->sampler[layer->num_sampler];
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(layer->program, (GLuint)i, max_length + 1, NULL, &size, &type, name);
+        if (type != GL_SAMPLER_2D) {
+            continue;
+        }
+        /* arrays of samplers get their first element only */
+        ls->location = glGetUniformLocation(layer->program, name);
+        if (ls->location < 0) {
+            continue;
+        }
+        ls->role = RenderLayer_SamplerRole(layer, ls->location, name, g, &ls->index);
+        ls->shadow_unit = -1;
+        ls->resolution_location = -1;
+        if (ls->role == SAMPLER_IMAGE || ls->role == SAMPLER_MOVIE) {
+            char resolution[MAX_LAYER_NAME + sizeof("_resolution")];
+            snprintf(resolution, sizeof(resolution), "%s_resolution", name);
+            ls->resolution_location = glGetUniformLocation(layer->program, resolution);
+            ls->shadow_resolution[0] = ls->shadow_resolution[1] = -1.0f;
+        }
+        layer->num_sampler += 1;
+    }
+    free(name);
     CHECK_GL();
     return 0;
 }
 
+/* uniform values live in the program object, so only changes reach the driver */
+static void Uniform1f(GLState *gl, GLint location, GLfloat *shadow, GLfloat value, int force)
+{
+    if (location < 0) {
+        return;
+    }
+    if (!force && memcmp(shadow, &value, sizeof(value)) == 0) {
+        GLState_CountElided(gl);
+        return;
+    }
+    *shadow = value;
+    glUniform1f(location, value);
+    GLState_CountCall(gl);
+}
+
+static void Uniform2f(GLState *gl, GLint location, GLfloat *shadow, GLfloat x, GLfloat y, int force)
+{
+    GLfloat value[2];
+    if (location < 0) {
+        return;
+    }
+    value[0] = x;
+    value[1] = y;
+    if (!force && memcmp(shadow, value, sizeof(value)) == 0) {
+        GLState_CountElided(gl);
+        return;
+    }
+    memcpy(shadow, value, sizeof(value));
+    glUniform2f(location, x, y);
+    GLState_CountCall(gl);
+}
+
+static void Uniform3f(GLState *gl, GLint location, GLfloat *shadow,
+                      GLfloat x, GLfloat y, GLfloat z, int force)
+{
+    GLfloat value[3];
+    if (location < 0) {
+        return;
+    }
+    value[0] = x;
+    value[1] = y;
+    value[2] = z;
+    if (!force && memcmp(shadow, value, sizeof(value)) == 0) {
+        GLState_CountElided(gl);
+        return;
+    }
+    memcpy(shadow, value, sizeof(value));
+    glUniform3f(location, x, y, z);
+    GLState_CountCall(gl);
+}
+
+static void Uniform1i(GLState *gl, GLint location, GLint *shadow, GLint value, int force)
+{
+    if (location < 0) {
+        return;
+    }
+    if (!force && *shadow == value) {
+        GLState_CountElided(gl);
+        return;
+    }
+    *shadow = value;
+    glUniform1i(location, value);
+    GLState_CountCall(gl);
+}
 
 /* Graphics */
 static int Graphics_SetupInitialState(Graphics *g);
+static int Graphics_ScheduleLayers(Graphics *g);
 
 
-Graphics *Graphics_Create(Graphics_LAYOUT layout,
-                          int scaling_numer, int scaling_denom)
+static Graphics *Graphics_Setup(Graphics *g, Video *v, VideoEGL *ve,
+                                Graphics_LAYOUT layout, Scaling sc);
+static void Graphics_ReleaseVideo(Graphics *g);
+static int Graphics_CreateWindowSurface(Graphics *g);
+
+/* takes 'v', closed on failure */
+static Graphics *Graphics_CreateOnVideo(Video *v, Graphics_LAYOUT layout, Scaling sc)
 {
     Graphics *g;
-    Video *v;
     VideoEGL *ve;
-    int width, height;
-    int scaled_width, scaled_height;
-    Scaling sc;
 
-    v = NULL;
     ve = NULL;
-
     g = malloc(sizeof(*g));
     if (!g) {
         goto damn;
     }
-    v = malloc(Video_InstanceSize());
-    if (!v) {
-        goto damn;
-    }
-
-    sc.numer = scaling_numer;
-    sc.denom = scaling_denom;
-    {
-        int x, y;
-        int screen_width, screen_height;
-        /* prevent warning */
-        screen_width = screen_height = 0;
-        width = height = 0;
-        x = y = 0;
-        Video_GetScreenSize(Video_DEVICE_ID_MAIN_LCD, &screen_width, &screen_height);
-        DetermineLayoutPosition(layout, screen_width, screen_height,
-                                &x, &y, &width, &height);
-        if (Video_ConstructWindow(v, Video_DEVICE_ID_MAIN_LCD,
-                                  x, y, width, height, 0)) {
-            goto damn;
-        }
-        scaled_width = width;
-        scaled_height = height;
-        Scaling_Apply(&sc, &scaled_width, &scaled_height);
-        if (!Scaling_IsOne(&sc)) {
-            Video_SetSourceRect(v, 0, 0, scaled_width, scaled_height);
-            Video_ApplyChange(v);
-        }
-    }
-
     ve = malloc(VideoEGL_InstanceSize());
     if (!ve) {
-        Video_DestructWindow(v);
         goto damn;
-
     }
-    if (VideoEGL_Construct(ve)) {
-        Video_DestructWindow(v);
+    if (Video_ConstructEGL(v, ve)) {
+        goto damn;
+    }
+    g->video = v;
+    g->video_egl = ve;
+    g->layout = layout;
+    g->window_scaling = sc;
+    if (Graphics_CreateWindowSurface(g)) {
+        VideoEGL_Destruct(ve);
         goto damn;
     }
+    printf("display: %s\r\n", Video_GetBackendName(v));
 
-    {
-        unsigned int native_window_element = Video_GetNativeWindowElement(v);
-        if (VideoEGL_CreateSurface(ve, native_window_element, scaled_width, scaled_height)) {
-            VideoEGL_Destruct(ve);
-            Video_DestructWindow(v);
-            goto damn;
-        }
+    return Graphics_Setup(g, v, ve, layout, sc);
+
+  damn:
+    if (ve) free(ve);
+    if (g) free(g);
+    Video_Close(v);
+    return NULL;
+}
+
+Graphics *Graphics_Create(const Graphics_DisplayConfig *config,
+                          Graphics_LAYOUT layout,
+                          int scaling_numer, int scaling_denom)
+{
+    Video *v;
+    Video_Config vc;
+    Scaling sc;
+
+    switch (config->format) {
+    case Graphics_PIXELFORMAT_RGBA8888:
+        vc.format = VideoEGL_FORMAT_RGBA8888;
+        break;
+    case Graphics_PIXELFORMAT_RGB888:
+        vc.format = VideoEGL_FORMAT_RGB888;
+        break;
+    case Graphics_PIXELFORMAT_RGB565:
+        vc.format = VideoEGL_FORMAT_RGB565;
+        break;
+    default:
+        printf("window format must be RGBA8888, RGB888 or RGB565\r\n");
+        return NULL;
     }
+    vc.swap_interval = config->swap_interval;
+    vc.buffers = config->buffers;
+    v = Video_Open(config->display, &vc);
+    if (!v) {
+        return NULL;
+    }
+    sc.numer = scaling_numer;
+    sc.denom = scaling_denom;
+    return Graphics_CreateOnVideo(v, layout, sc);
+}
 
-    if (VideoEGL_MakeCurrent(ve)) {
-        VideoEGL_DestroySurface(ve);
-        VideoEGL_Destruct(ve);
-        Video_DestructWindow(v);
-        goto damn;
+Graphics *Graphics_CreateHeadless(int width, int height,
+                                  int scaling_numer, int scaling_denom)
+{
+    Video *v;
+    Video_Config vc;
+    Scaling sc;
+
+    vc.format = VideoEGL_FORMAT_RGBA8888;
+    vc.swap_interval = 0;
+    vc.buffers = 2;
+    v = Video_Open("headless", &vc);
+    if (!v) {
+        return NULL;
     }
+    Video_SetScreenSize(v, width, height);
+    sc.numer = scaling_numer;
+    sc.denom = scaling_denom;
+    return Graphics_CreateOnVideo(v, Graphics_LAYOUT_FULLSCREEN, sc);
+}
 
+static Graphics *Graphics_Setup(Graphics *g, Video *v, VideoEGL *ve,
+                                Graphics_LAYOUT layout, Scaling sc)
+{
     g->video = v;
     g->video_egl = ve;
+    g->gl = GLState_Create();
+    if (!g->gl) {
+        Graphics_ReleaseVideo(g);
+        return NULL;
+    }
+    g->target_pool = RenderTargetPool_Create(g->gl);
+    if (!g->target_pool) {
+        GLState_Delete(g->gl);
+        Graphics_ReleaseVideo(g);
+        return NULL;
+    }
     g->layout = layout;
     g->array_buffer_fullscene_quad = 0;
     g->vertex_shader = 0;
+    g->builder = NULL;
+    g->gpu_timer = NULL;
     g->texture_wrap_mode = Graphics_WRAP_MODE_REPEAT;
     g->texture_interpolation_mode = Graphics_INTERPOLATION_MODE_NEARESTNEIGHBOR;
     g->texture_pixel_format = Graphics_PIXELFORMAT_RGBA8888;
+    g->render_layer = NULL;
     g->num_render_layer = 0;
+    g->max_render_layer = 0;
     g->window_scaling = sc;
     g->enable_backbuffer = 0;
-    g->backbuffer_texture_object = 0;
-    g->backbuffer_texture_unit = 0;
+    g->schedule_dirty = 0;
+    g->num_static_image = 0;
+    g->image_loader = NULL;
+    g->num_movie = 0;
+    g->movie_wait = 0;
+    memset(&g->audio, 0, sizeof(g->audio));
+    g->readback = NULL;
+    g->black_texture = 0;
+    memset(&g->feedback, 0, sizeof(g->feedback));
+    memset(&g->blit, 0, sizeof(g->blit));
+    memset(&g->downsample, 0, sizeof(g->downsample));
+    memset(&g->yuv, 0, sizeof(g->yuv));
+    memset(&g->uniform, 0, sizeof(g->uniform));
 
     Graphics_SetupInitialState(g);
-    return g;
 
-  damn:
-    if (ve) free(ve);
-    if (v) free(v);
-    if (g) free(g);
-    return NULL;
+    g->builder = malloc(ShaderBuilder_InstanceSize());
+    if (!g->builder || ShaderBuilder_Construct(g->builder, ve, vertex_shader_source)) {
+        free(g->builder);
+        g->builder = NULL;
+        Graphics_Delete(g);
+        return NULL;
+    }
+    printf("shader build: %s\r\n", ShaderBuilder_GetModeName(ShaderBuilder_GetMode(g->builder)));
+    return g;
 }
 
 void Graphics_Delete(Graphics *g)
 {
+    int i;
+
     Graphics_DeallocateOffscreen(g);
 
+    if (g->gpu_timer) {
+        GpuTimer_Delete(g->gpu_timer);
+    }
+    if (g->builder) {
+        ShaderBuilder_Destruct(g->builder);
+        free(g->builder);
+    }
+    for (i = 0; i < g->num_render_layer; i++) {
+        RenderLayer_Destruct(g->render_layer[i], g->gl);
+        free(g->render_layer[i]);
+    }
+    free(g->render_layer);
+    if (g->image_loader) {
+        ImageLoader_Delete(g->image_loader);
+    }
+    for (i = 0; i < g->num_static_image; i++) {
+        StaticImage_Destruct(&g->static_image[i], g->gl);
+    }
+    for (i = 0; i < g->num_movie; i++) {
+        Movie_Destruct(&g->movie[i], g->gl);
+    }
+    GLState_DeleteTexture(g->gl, g->audio.texture);
+    GLState_DeleteTexture(g->gl, g->black_texture);
+    if (g->readback) {
+        Readback_Delete(g->readback);
+    }
+
     CHECK_GL();
+    GLState_DeleteProgram(g->gl, g->blit.program);
+    GLState_DeleteProgram(g->gl, g->downsample.program);
+    GLState_DeleteProgram(g->gl, g->yuv.program);
     if (g->vertex_shader) {
         glDeleteShader(g->vertex_shader);
     }
@@ -453,22 +1218,91 @@ void Graphics_Delete(Graphics *g)
         glDeleteBuffers(1, &g->array_buffer_fullscene_quad);
     }
     CHECK_GL();
-    
+
+    RenderTargetPool_Delete(g->target_pool);
+    GLState_Delete(g->gl);
+    Graphics_ReleaseVideo(g);
+}
+
+static void Graphics_ReleaseVideo(Graphics *g)
+{
     VideoEGL_UnmakeCurrent(g->video_egl);
-    VideoEGL_DestroySurface(g->video_egl);
+    Video_DestroySurface(g->video, g->video_egl);
     VideoEGL_Destruct(g->video_egl);
-
-    Video_DestructWindow(g->video);
+    Video_Close(g->video);
 
     free(g->video_egl);
-    free(g->video);
     free(g);
 }
 
+/* tiny and needed before the first frame, not worth the builder. 0: failed */
+static GLuint Graphics_LinkBuiltinProgram(Graphics *g, const char *name,
+                                          const GLchar *fragment_source)
+{
+    GLuint shader, program;
+    GLint status;
+
+    shader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(shader, 1, &fragment_source, NULL);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+        PrintShaderLog(name, shader);
+        glDeleteShader(shader);
+        return 0;
+    }
+    program = glCreateProgram();
+    glAttachShader(program, g->vertex_shader);
+    glAttachShader(program, shader);
+    glBindAttribLocation(program, 0, "vertex_coord");
+    glLinkProgram(program);
+    glDeleteShader(shader);     /* flagged, freed with the program */
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+static int Graphics_BuildBuiltinProgram(Graphics *g, BuiltinProgram *bp, const char *name,
+                                        const GLchar *fragment_source, const char *param)
+{
+    GLuint program = Graphics_LinkBuiltinProgram(g, name, fragment_source);
+    if (program == 0) {
+        return 1;
+    }
+    bp->program = program;
+    bp->source = glGetUniformLocation(program, "source");
+    bp->param = glGetUniformLocation(program, param);
+    bp->valid = 0;
+    return 0;
+}
+
+/* draw 'texture' through a builtin program into the current framebuffer */
+static void Graphics_DrawBuiltin(Graphics *g, BuiltinProgram *bp,
+                                 GLuint texture, GLfloat param_x, GLfloat param_y)
+{
+    GLState *gl = g->gl;
+    int force = !bp->valid;
+    int unit;
+    GLState_UseProgram(gl, bp->program);
+    GLState_BeginTextureSet(gl);
+    unit = GLState_AcquireTextureUnit(gl, texture);
+    Uniform1i(gl, bp->source, &bp->shadow_source, unit, force);
+    Uniform2f(gl, bp->param, bp->shadow_param, param_x, param_y, force);
+    bp->valid = 1;
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    GLState_CountCall(gl);
+}
+
 static int Graphics_SetupInitialState(Graphics *g)
 {
     CHECK_GL();
 
+    /* surface may be new, do not trust anything */
+    GLState_Invalidate(g->gl);
+
     if (g->array_buffer_fullscene_quad == 0) {
         static const GLfloat fullscene_quad[] = {
             -1.0, -1.0, 1.0, 1.0,
@@ -477,19 +1311,23 @@ static int Graphics_SetupInitialState(Graphics *g)
             -1.0,  1.0, 1.0, 1.0
         };
         glGenBuffers(1, &g->array_buffer_fullscene_quad);
-        glBindBuffer(GL_ARRAY_BUFFER, g->array_buffer_fullscene_quad);
+        GLState_BindArrayBuffer(g->gl, g->array_buffer_fullscene_quad);
         glBufferData(GL_ARRAY_BUFFER, sizeof(fullscene_quad),
                      fullscene_quad, GL_STATIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        /* context state, shared by every program through attribute 0 */
+        glVertexAttribPointer(0,
+                              4,
+                              GL_FLOAT,
+                              GL_FALSE, /* normalize */
+                              16,
+                              NULL);
+        glEnableVertexAttribArray(0);
         CHECK_GL();
     }
 
 
     if (g->vertex_shader == 0) {
         GLint param;
-        static const GLchar *vertex_shader_source =
-            "attribute vec4 vertex_coord;"
-            "void main(void) { gl_Position = vertex_coord; }";
         g->vertex_shader = glCreateShader(GL_VERTEX_SHADER);
         glShaderSource(g->vertex_shader, 1, &vertex_shader_source, NULL);
         glCompileShader(g->vertex_shader);
@@ -502,7 +1340,24 @@ static int Graphics_SetupInitialState(Graphics *g)
         CHECK_GL();
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (g->blit.program == 0) {
+        if (Graphics_BuildBuiltinProgram(g, &g->blit, "blit_shader",
+                                         blit_fragment_shader_source, "resolution")) {
+            return 2;
+        }
+        CHECK_GL();
+    }
+    if (g->downsample.program == 0) {
+        if (Graphics_BuildBuiltinProgram(g, &g->downsample, "downsample_shader",
+                                         downsample_fragment_shader_source, "texel")) {
+            return 3;
+        }
+        CHECK_GL();
+    }
+
+    GLState_BindFramebuffer(g->gl, 0);
+    /* image rows are tightly packed */
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glDisable(GL_CULL_FACE);
     glDisable(GL_BLEND);
     glDisable(GL_DEPTH_TEST);
@@ -513,48 +1368,36 @@ static int Graphics_SetupInitialState(Graphics *g)
 
     {
         int width, height;
-        Video_GetSourceSize(g->video, &width, &height);
-        glViewport(0, 0, width, height);
+        Graphics_GetSourceSize(g, &width, &height);
+        GLState_Viewport(g->gl, 0, 0, width, height);
     }
     return 0;
 }
 
-static int Graphics_ApplyWindowChange(Graphics *g)
+/* window placed by layout on the backend's screen, surface scaled from it */
+static int Graphics_CreateWindowSurface(Graphics *g)
 {
-    int width, height;
+    int x, y, width, height;
+    int screen_width, screen_height;
     int scaled_width, scaled_height;
 
+    Video_GetScreenSize(g->video, &screen_width, &screen_height);
+    DetermineLayoutPosition(g->layout, screen_width, screen_height,
+                            &x, &y, &width, &height);
+    scaled_width = width;
+    scaled_height = height;
+    Scaling_Apply(&g->window_scaling, &scaled_width, &scaled_height);
+    return Video_CreateSurface(g->video, g->video_egl, x, y, width, height,
+                               scaled_width, scaled_height);
+}
+
+static int Graphics_ApplyWindowChange(Graphics *g)
+{
     /* TODO handle error */
     VideoEGL_UnmakeCurrent(g->video_egl);
-    VideoEGL_DestroySurface(g->video_egl);
-
-    {
-        int x, y;
-        int screen_width, screen_height;
-        /* prevent warning */
-        screen_width = screen_height = 0;
-        width = height = 0;
-        x = y = 0;
-        Video_GetScreenSize(Video_DEVICE_ID_MAIN_LCD, &screen_width, &screen_height);
-        DetermineLayoutPosition(g->layout, screen_width, screen_height,
-                                &x, &y, &width, &height);
-        scaled_width = width;
-        scaled_height = height;
-        Scaling_Apply(&g->window_scaling, &scaled_width, &scaled_height);
-        Video_SetWindowRect(g->video, x, y, width, height);
-        Video_SetSourceRect(g->video, 0, 0, scaled_width, scaled_height);
-        Video_ApplyChange(g->video);
-    }
+    Video_DestroySurface(g->video, g->video_egl);
 
-    {
-        unsigned int native_window_element = Video_GetNativeWindowElement(g->video);
-        if (VideoEGL_CreateSurface(g->video_egl, native_window_element, scaled_width, scaled_height)) {
-            /* TODO */
-            goto damn;
-        }
-    }
-
-    if (VideoEGL_MakeCurrent(g->video_egl)) {
+    if (Graphics_CreateWindowSurface(g)) {
         /* TODO */
         goto damn;
     }
@@ -562,43 +1405,445 @@ static int Graphics_ApplyWindowChange(Graphics *g)
 
     Graphics_SetupInitialState(g);
     Graphics_DeallocateOffscreen(g);
-    Graphics_AllocateOffscreen(g);
+    if (Graphics_AllocateOffscreen(g)) {
+        goto damn;
+    }
     return 0;
   damn:
     return 1;
 }
 
 int Graphics_AppendRenderLayer(Graphics *g,
-                               const char *source,
-                               OPTIONAL int source_length,
+                               Source *source,
                                OPTIONAL void *auxptr)
 {
     RenderLayer *layer;
 
-    if (g->num_render_layer >= MAX_RENDER_LAYER) {
-        return 1;
+    if (g->num_render_layer >= g->max_render_layer) {
+        int max = (g->max_render_layer > 0) ? g->max_render_layer * 2 : 8;
+        RenderLayer **p = realloc(g->render_layer, sizeof(*p) * (size_t)max);
+        if (!p) {
+            return 1;
+        }
+        g->render_layer = p;
+        g->max_render_layer = max;
+    }
+
+    layer = malloc(sizeof(*layer));
+    if (!layer || RenderLayer_Construct(layer, auxptr)) {
+        free(layer);
+        return 2;
+    }
+
+    if (RenderLayer_UpdateShaderSource(layer, source)) {
+        RenderLayer_Destruct(layer, g->gl);
+        free(layer);
+        return 3;
+    }
+    g->render_layer[g->num_render_layer] = layer;
+    g->num_render_layer += 1;
+    if (g->gpu_timer) {
+        /* a slot per layer, start over with the new count */
+        Graphics_SetProfiling(g, 0);
+        Graphics_SetProfiling(g, 1);
+    }
+    return 0;
+}
+
+RenderLayer *Graphics_GetRenderLayer(Graphics *g, int layer_index)
+{
+    assert(layer_index >= 0);
+    if (layer_index >= g->num_render_layer) {
+        return NULL;
+    }
+    return g->render_layer[layer_index];
+}
+
+/* bound on some unit, made active: glTex* calls go to it */
+static void Graphics_BindForUpload(Graphics *g, GLuint texture)
+{
+    GLState_BeginTextureSet(g->gl);
+    GLState_ActiveTexture(g->gl, GLState_AcquireTextureUnit(g->gl, texture));
+}
+
+/* no mipmap and no repeat, so any size works on GLES2 */
+static GLuint Graphics_CreateImageTexture(Graphics *g, int width, int height,
+                                          GLenum format, OPTIONAL const void *pixels)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    Graphics_BindForUpload(g, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    CHECK_GL();
+    return texture;
+}
+
+static void StaticImage_AbortUpload(StaticImage *im, GLState *gl)
+{
+    Image_Release(&im->upload.image);
+    GLState_DeleteTexture(gl, im->upload.texture);
+    im->upload.texture = 0;
+    im->upload.row = 0;
+}
+
+static void StaticImage_Destruct(StaticImage *im, GLState *gl)
+{
+    StaticImage_AbortUpload(im, gl);
+    GLState_DeleteTexture(gl, im->texture);
+    im->texture = 0;
+    free(im->path);
+    im->path = NULL;
+}
+
+/* a named texture was added: programs already installed learn the sampler */
+static void Graphics_ReflectInstalledSamplers(Graphics *g)
+{
+    int i;
+    for (i = 0; i < g->num_render_layer; i++) {
+        RenderLayer *layer = g->render_layer[i];
+        if (layer->program) {
+            RenderLayer_ReflectSamplers(layer, g);
+        }
+    }
+}
+
+int Graphics_AddImage(Graphics *g, const char *name, const char *path,
+                      OPTIONAL void *auxptr)
+{
+    static const GLubyte black[4] = { 0, 0, 0, 255 };
+    StaticImage *im;
+
+    if (g->num_static_image >= MAX_STATIC_IMAGE) {
+        return 1;
+    }
+    im = &g->static_image[g->num_static_image];
+    if (strlen(name) >= sizeof(im->name)) {
+        return 2;
+    }
+    if (g->image_loader == NULL) {
+        g->image_loader = ImageLoader_Create(g->video_egl);
+        if (g->image_loader == NULL) {
+            return 3;
+        }
+    }
+    memset(im, 0, sizeof(*im));
+    strcpy(im->name, name);
+    im->path = strdup(path);
+    if (!im->path) {
+        return 4;
+    }
+    im->auxptr = auxptr;
+    im->texture = Graphics_CreateImageTexture(g, 1, 1, GL_RGBA, black);
+    im->width = im->height = 1;
+    g->num_static_image += 1;
+
+    Graphics_ReflectInstalledSamplers(g);
+    return Graphics_ReloadImage(g, g->num_static_image - 1);
+}
+
+int Graphics_ReloadImage(Graphics *g, int image_index)
+{
+    StaticImage *im;
+    assert(image_index >= 0 && image_index < g->num_static_image);
+    im = &g->static_image[image_index];
+    im->generation += 1;
+    return ImageLoader_Submit(g->image_loader, image_index, im->generation, im->path);
+}
+
+void *Graphics_GetImageAux(Graphics *g, int image_index)
+{
+    assert(image_index >= 0);
+    if (image_index >= g->num_static_image) {
+        return NULL;
+    }
+    return g->static_image[image_index].auxptr;
+}
+
+/* take decoded images, then upload rows of those in flight while 'budget'
+ * bytes last. the current texture is sampled until its successor is complete */
+static void Graphics_UploadImages(Graphics *g, size_t budget)
+{
+    int id;
+    unsigned int generation;
+    Image image;
+    GLuint texture;
+    int i;
+
+    if (g->image_loader == NULL) {
+        return;
+    }
+    while (ImageLoader_Poll(g->image_loader, &id, &generation, &image, &texture)) {
+        StaticImage *im = &g->static_image[id];
+        if (generation != im->generation || image.pixels == NULL) {
+            /* superseded, or failed and the last good one stays */
+            GLState_DeleteTexture(g->gl, texture);
+            Image_Release(&image);
+            continue;
+        }
+        StaticImage_AbortUpload(im, g->gl);
+        im->upload.image = image;
+        im->upload.texture = texture;
+    }
+
+    for (i = 0; i < g->num_static_image && budget > 0; i++) {
+        StaticImage *im = &g->static_image[i];
+        Image *src = &im->upload.image;
+        GLenum format;
+        size_t row_size, rows;
+
+        if (src->pixels == NULL) {
+            continue;
+        }
+        format = (src->channels == 4) ? GL_RGBA : GL_RGB;
+        if (im->upload.texture == 0) {
+            /* not made by the loader, storage only */
+            im->upload.texture = Graphics_CreateImageTexture(g, src->width, src->height, format, NULL);
+        } else {
+            Graphics_BindForUpload(g, im->upload.texture);
+        }
+        row_size = Image_GetRowSize(src);
+        rows = budget / row_size;
+        if (rows < 1) {
+            rows = 1;           /* a row per frame at least */
+        }
+        if (rows > (size_t)(src->height - im->upload.row)) {
+            rows = (size_t)(src->height - im->upload.row);
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, im->upload.row, src->width, (GLsizei)rows,
+                        format, GL_UNSIGNED_BYTE, src->pixels + row_size * im->upload.row);
+        GLState_CountCall(g->gl);
+        im->upload.row += (int)rows;
+        budget = (budget > rows * row_size) ? budget - rows * row_size : 0;
+
+        if (im->upload.row == src->height) {
+            GLState_DeleteTexture(g->gl, im->texture);
+            im->texture = im->upload.texture;
+            im->width = src->width;
+            im->height = src->height;
+            im->upload.texture = 0;
+            im->upload.row = 0;
+            Image_Release(src);
+            printf("image %s: %dx%d\r\n", im->name, im->width, im->height);
+        }
+    }
+    CHECK_GL();
+}
+
+void Graphics_FinishImageLoads(Graphics *g)
+{
+    if (g->image_loader == NULL) {
+        return;
+    }
+    ImageLoader_Wait(g->image_loader);
+    Graphics_UploadImages(g, (size_t)-1);
+}
+
+static void Movie_Destruct(Movie *m, GLState *gl)
+{
+    int i;
+    if (m->reader) {
+        MovieReader_Close(m->reader);
+        m->reader = NULL;
+    }
+    for (i = 0; i < 3; i++) {
+        GLState_DeleteTexture(gl, m->plane[i]);
+        m->plane[i] = 0;
+    }
+    GLState_DeleteFramebuffer(gl, m->framebuffer);
+    GLState_DeleteTexture(gl, m->texture);
+    m->framebuffer = 0;
+    m->texture = 0;
+}
+
+static int Graphics_BuildYUVProgram(Graphics *g)
+{
+    YUVProgram *yp = &g->yuv;
+    yp->program = Graphics_LinkBuiltinProgram(g, "yuv_shader", yuv_fragment_shader_source);
+    if (yp->program == 0) {
+        return 1;
+    }
+    yp->plane[0] = glGetUniformLocation(yp->program, "plane_y");
+    yp->plane[1] = glGetUniformLocation(yp->program, "plane_u");
+    yp->plane[2] = glGetUniformLocation(yp->program, "plane_v");
+    yp->resolution = glGetUniformLocation(yp->program, "resolution");
+    yp->range = glGetUniformLocation(yp->program, "range");
+    yp->valid = 0;
+    CHECK_GL();
+    return 0;
+}
+
+int Graphics_AddMovie(Graphics *g, const char *name, const char *path)
+{
+    Movie *m;
+    GLenum status;
+
+    if (g->num_movie >= MAX_MOVIE) {
+        return 1;
+    }
+    m = &g->movie[g->num_movie];
+    if (strlen(name) >= sizeof(m->name)) {
+        return 2;
+    }
+    if (g->yuv.program == 0 && Graphics_BuildYUVProgram(g)) {
+        return 3;
+    }
+    memset(m, 0, sizeof(*m));
+    strcpy(m->name, name);
+    m->reader = MovieReader_Open(path);
+    if (m->reader == NULL) {
+        return 4;
+    }
+    MovieReader_GetInfo(m->reader, &m->info);
+    m->plane[0] = Graphics_CreateImageTexture(g, m->info.width, m->info.height, GL_LUMINANCE, NULL);
+    m->plane[1] = Graphics_CreateImageTexture(g, m->info.chroma_width, m->info.chroma_height,
+                                              GL_LUMINANCE, NULL);
+    m->plane[2] = Graphics_CreateImageTexture(g, m->info.chroma_width, m->info.chroma_height,
+                                              GL_LUMINANCE, NULL);
+    m->texture = Graphics_CreateImageTexture(g, m->info.width, m->info.height, GL_RGBA, NULL);
+    glGenFramebuffers(1, &m->framebuffer);
+    GLState_BindFramebuffer(g->gl, m->framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m->texture, 0);
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    /* black until the first frame is in */
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    GLState_BindFramebuffer(g->gl, 0);
+    CHECK_GL();
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        printf("movie %s: target %dx%d incomplete: 0x%x\r\n",
+               name, m->info.width, m->info.height, status);
+        Movie_Destruct(m, g->gl);
+        return 5;
+    }
+    m->shown = -1;
+    g->num_movie += 1;
+    printf("movie %s: %dx%d %d/%d fps, %d frames\r\n", m->name, m->info.width, m->info.height,
+           m->info.fps_numer, m->info.fps_denom, m->info.num_frame);
+
+    Graphics_ReflectInstalledSamplers(g);
+    return 0;
+}
+
+void Graphics_SetMovieWait(Graphics *g, int enable)
+{
+    g->movie_wait = enable;
+}
+
+/* frame due at the time uniform. a frame still being read is never waited
+ * for (unless movie_wait): the last one is shown again */
+static void Graphics_UpdateMovies(Graphics *g)
+{
+    GLState *gl = g->gl;
+    YUVProgram *yp = &g->yuv;
+    int i, j;
+
+    for (i = 0; i < g->num_movie; i++) {
+        Movie *m = &g->movie[i];
+        MovieReader_Frame frame;
+        int width[3], height[3];
+        int force;
+        long seq;
+
+        seq = (long)((double)g->uniform.time * m->info.fps_numer / m->info.fps_denom);
+        if (seq < 0) {
+            seq = 0;
+        }
+        if (seq == m->shown) {
+            continue;
+        }
+        if (!MovieReader_Acquire(m->reader, seq, g->movie_wait, &frame)) {
+            m->repeated += 1;
+            continue;
+        }
+        if (m->shown >= 0 && seq > m->shown + 1) {
+            m->dropped += seq - m->shown - 1;
+        }
+        m->shown = seq;
+
+        width[0] = m->info.width;
+        height[0] = m->info.height;
+        width[1] = width[2] = m->info.chroma_width;
+        height[1] = height[2] = m->info.chroma_height;
+        for (j = 0; j < 3; j++) {
+            Graphics_BindForUpload(g, m->plane[j]);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width[j], height[j],
+                            GL_LUMINANCE, GL_UNSIGNED_BYTE, frame.plane[j]);
+            GLState_CountCall(gl);
+        }
+
+        GLState_UnbindTexture(gl, m->texture);
+        GLState_BindFramebuffer(gl, m->framebuffer);
+        GLState_Viewport(gl, 0, 0, m->info.width, m->info.height);
+        GLState_UseProgram(gl, yp->program);
+        GLState_BeginTextureSet(gl);
+        force = !yp->valid;
+        for (j = 0; j < 3; j++) {
+            Uniform1i(gl, yp->plane[j], &yp->shadow_plane[j],
+                      GLState_AcquireTextureUnit(gl, m->plane[j]), force);
+        }
+        Uniform2f(gl, yp->resolution, yp->shadow_resolution,
+                  (GLfloat)m->info.width, (GLfloat)m->info.height, force);
+        if (m->info.full_range) {
+            Uniform3f(gl, yp->range, yp->shadow_range, 0.0f, 1.0f, 1.0f, force);
+        } else {
+            /* luma 16..235, chroma 16..240 */
+            Uniform3f(gl, yp->range, yp->shadow_range,
+                      16.0f / 255.0f, 255.0f / 219.0f, 255.0f / 224.0f, force);
+        }
+        yp->valid = 1;
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        GLState_CountCall(gl);
+    }
+    CHECK_GL();
+}
+
+void Graphics_SetAudio(Graphics *g, const Audio_Frame *frame)
+{
+    if (frame->sequence == g->audio.frame.sequence) {
+        return;
+    }
+    g->audio.frame = *frame;
+    g->audio.dirty = 1;
+}
+
+/* 512 bytes when the analysis moved on, nothing otherwise */
+static void Graphics_UploadAudio(Graphics *g)
+{
+    GLubyte texel[2 * Audio_NUM_BIN];
+    int i;
+
+    if (!g->audio.dirty) {
+        return;
     }
-
-    layer = &g->render_layer[g->num_render_layer];
-    if (RenderLayer_Construct(layer, auxptr)) {
-        return 2;
+    for (i = 0; i < Audio_NUM_BIN; i++) {
+        float w = 0.5f + 0.5f * g->audio.frame.waveform[i];
+        w = (w < 0.0f) ? 0.0f : (w > 1.0f) ? 1.0f : w;
+        texel[i] = (GLubyte)(g->audio.frame.spectrum[i] * 255.0f + 0.5f);
+        texel[Audio_NUM_BIN + i] = (GLubyte)(w * 255.0f + 0.5f);
     }
-
-    if (RenderLayer_UpdateShaderSource(layer, source, source_length)) {
-        RenderLayer_Destruct(layer);
-        return 3;
+    if (g->audio.texture == 0) {
+        g->audio.texture = Graphics_CreateImageTexture(g, Audio_NUM_BIN, 2, GL_LUMINANCE, texel);
+    } else {
+        Graphics_BindForUpload(g, g->audio.texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, Audio_NUM_BIN, 2,
+                        GL_LUMINANCE, GL_UNSIGNED_BYTE, texel);
+        GLState_CountCall(g->gl);
     }
-    g->num_render_layer += 1;
-    return 0;
+    g->audio.dirty = 0;
+    CHECK_GL();
 }
 
-RenderLayer *Graphics_GetRenderLayer(Graphics *g, int layer_index)
+void Graphics_PrintMovieStats(Graphics *g)
 {
-    assert(layer_index >= 0);
-    if (layer_index >= g->num_render_layer) {
-        return NULL;
+    int i;
+    for (i = 0; i < g->num_movie; i++) {
+        Movie *m = &g->movie[i];
+        printf("movie %s: %ld repeated, %ld dropped\r\n", m->name, m->repeated, m->dropped);
     }
-    return &g->render_layer[layer_index];
 }
 
 void Graphics_SetLayout(Graphics *g, Graphics_LAYOUT layout)
@@ -651,44 +1896,183 @@ int Graphics_AllocateOffscreen(Graphics *g)
 {
     int i;
     int source_width, source_height;
+    RenderTarget_Desc desc;
 
-    Video_GetSourceSize(g->video, &source_width, &source_height);
+    Graphics_GetSourceSize(g, &source_width, &source_height);
     //printf("Graphics_AllocateOffscreen: width=%d, height=%d\r\n", source_width, source_height);
 
     CHECK_GL();
+    if (g->enable_backbuffer) {
+        /* alive the whole frame, RGBA8888 like the window whatever the offscreen format is */
+        memset(&desc, 0, sizeof(desc));
+        desc.width = source_width;
+        desc.height = source_height;
+        desc.internal_format = GL_RGBA;
+        desc.format = GL_RGBA;
+        desc.type = GL_UNSIGNED_BYTE;
+        desc.filter = GL_LINEAR;
+        desc.wrap = GL_CLAMP_TO_EDGE;
+        for (i = 0; i < 2; i++) {
+            g->feedback.target[i] = RenderTargetPool_Acquire(g->target_pool, &desc);
+            if (!g->feedback.target[i]) {
+                return 1;
+            }
+            g->feedback.texture[i] = RenderTarget_GetTexture(g->feedback.target[i]);
+            g->feedback.framebuffer[i] = RenderTarget_GetFramebuffer(g->feedback.target[i]);
+            /* the first frame samples defined black */
+            GLState_BindFramebuffer(g->gl, g->feedback.framebuffer[i]);
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+        g->feedback.read = 0;
+    }
+
+    return Graphics_ScheduleLayers(g);
+}
+
+/* not built yet: assume it does */
+static int RenderLayer_ReadsPrevLayer(RenderLayer *layer)
+{
+    int l;
+    if (layer->program == 0 || layer->attr.prev_layer >= 0) {
+        return 1;
+    }
+    for (l = 0; l < MAX_PYRAMID_LEVEL; l++) {
+        if (layer->attr.prev_layer_lod[l] >= 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void RenderLayer_MarkRead(RenderLayer *layer, int reader_index)
+{
+    layer->scheduled = 1;
+    if (reader_index > layer->last_use) {
+        layer->last_use = reader_index;
+    }
+}
+
+/* a schedule failed at layer 'failed': its targets go back to the pool and the
+ * layers to the previous schedule. that one's targets are not trimmed until
+ * a schedule succeeds */
+static void Graphics_AbandonSchedule(Graphics *g, int failed, const LayerSchedule *saved)
+{
+    int i;
+    for (i = 0; i <= failed; i++) {
+        RenderLayer *layer = g->render_layer[i];
+        /* outputs with a reader past 'failed' were not released yet */
+        if (layer->target && (i == failed || layer->last_use >= failed)) {
+            RenderLayer_ReleaseTargets(layer, g->target_pool);
+        }
+    }
     for (i = 0; i < g->num_render_layer; i++) {
-        RenderLayer *layer = &g->render_layer[i];
-        int texture_unit = i;
-        int is_final_layer = (i == (g->num_render_layer - 1)) ? 1 : 0;
-        RenderLayer_AllocateOffscreen(layer, is_final_layer, texture_unit,
-                                      source_width, source_height,
-                                      g->texture_pixel_format,
-                                      g->texture_interpolation_mode,
-                                      g->texture_wrap_mode);
-        /* TODO: handle error */
+        RenderLayer_RestoreSchedule(g->render_layer[i], &saved[i]);
     }
-    if (g->enable_backbuffer) {
-        GLint internal_format;
-        GLenum format;
-        GLenum type;
-        DeterminePixelFormat(g->texture_pixel_format, &internal_format, &format, &type);
-        g->backbuffer_texture_unit = g->num_render_layer;
-        glGenTextures(1, &g->backbuffer_texture_object);
-        glBindTexture(GL_TEXTURE_2D, g->backbuffer_texture_object);
-        glTexImage2D(GL_TEXTURE_2D,
-                     0,             /* level */
-                     internal_format,
-                     source_width, source_height,
-                     0,             /* border */
-                     format,
-                     type,
-                     NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/* walk back from the final layer: a layer is drawn only when its output is
+ * read. then give targets in index order, releasing each output right after
+ * its last reader took its own target so later layers can reuse it */
+static int Graphics_ScheduleLayers(Graphics *g)
+{
+    int final_index = g->num_render_layer - 1;
+    int source_width, source_height;
+    RenderTarget_Desc desc;
+    LayerSchedule *saved;
+    int i, j;
+
+    g->schedule_dirty = 0;
+    if (final_index < 0) {
+        return 0;
+    }
+    saved = malloc(sizeof(*saved) * (size_t)g->num_render_layer);
+    if (!saved) {
+        printf("render graph: out of memory, previous one kept\r\n");
+        return 2;
+    }
+    for (i = 0; i <= final_index; i++) {
+        RenderLayer *layer = g->render_layer[i];
+        RenderLayer_SaveSchedule(layer, &saved[i]);
+        layer->scheduled = 0;
+        layer->last_use = -1;
+    }
+    g->render_layer[final_index]->scheduled = 1;
+    for (i = final_index; i >= 0; i--) {
+        RenderLayer *layer = g->render_layer[i];
+        if (!layer->scheduled) {
+            continue;
+        }
+        if (i > 0 && RenderLayer_ReadsPrevLayer(layer)) {
+            RenderLayer_MarkRead(g->render_layer[i - 1], i);
+        }
+        for (j = 0; j < layer->num_input; j++) {
+            if (layer->input[j].source_index >= 0) {
+                RenderLayer_MarkRead(g->render_layer[layer->input[j].source_index], i);
+            }
+        }
+    }
+
+    /* pyramid depth: deepest prev_layer_lodN the next layer samples */
+    for (i = 0; i < final_index; i++) {
+        RenderLayer *layer = g->render_layer[i];
+        RenderLayer *reader = g->render_layer[i + 1];
+        layer->pyramid.levels = 0;
+        if (!layer->scheduled || !reader->scheduled || reader->program == 0) {
+            continue;
+        }
+        for (j = 0; j < MAX_PYRAMID_LEVEL; j++) {
+            if (reader->attr.prev_layer_lod[j] >= 0) {
+                layer->pyramid.levels = j + 1;
+            }
+        }
+    }
+    g->render_layer[final_index]->pyramid.levels = 0;
+
+    Graphics_GetSourceSize(g, &source_width, &source_height);
+    printf("render graph:");
+    for (i = 0; i <= final_index; i++) {
+        RenderLayer *layer = g->render_layer[i];
+        int to_window = (i == final_index || !layer->scheduled) ? 1 : 0;
+        Scaling sc = (layer->forced_scale.denom > 0) ? layer->forced_scale : layer->scale;
+        layer->width = source_width;
+        layer->height = source_height;
+        if (i < final_index) {
+            /* the final layer is the window */
+            Scaling_Apply(&sc, &layer->width, &layer->height);
+            if (layer->width < 1) {
+                layer->width = 1;
+            }
+            if (layer->height < 1) {
+                layer->height = 1;
+            }
+        }
+        DetermineTargetDesc(g, layer->width, layer->height, &desc);
+        if (RenderLayer_AllocateOffscreen(layer, g->target_pool, to_window, &desc)
+            || RenderLayer_AllocatePyramid(layer, g->target_pool, &desc)) {
+            printf("\r\nrender graph: layer %d: allocation failed, previous one kept\r\n", i);
+            Graphics_AbandonSchedule(g, i, saved);
+            free(saved);
+            return 2;
+        }
+        for (j = 0; j < i; j++) {
+            RenderLayer *source = g->render_layer[j];
+            if (source->target && source->last_use == i) {
+                RenderLayer_ReleaseTargets(source, g->target_pool);
+            }
+        }
+        if (layer->scheduled) {
+            printf(" %d:%dx%d", i, layer->width, layer->height);
+            if (layer->pyramid.levels > 0) {
+                printf("+lod%d", layer->pyramid.levels);
+            }
+        } else {
+            printf(" %d:culled", i);
+        }
     }
+    printf("\r\n");
+    free(saved);
+    RenderTargetPool_Trim(g->target_pool);
     CHECK_GL();
     return 0;
 }
@@ -696,116 +2080,518 @@ int Graphics_AllocateOffscreen(Graphics *g)
 void Graphics_DeallocateOffscreen(Graphics *g)
 {
     int i;
-    if (g->backbuffer_texture_object) {
-        glDeleteTextures(1, &g->backbuffer_texture_object);
-        g->backbuffer_texture_object = 0;
+    for (i = 0; i < 2; i++) {
+        g->feedback.target[i] = NULL;
+        g->feedback.framebuffer[i] = 0;
+        g->feedback.texture[i] = 0;
     }
     for (i = g->num_render_layer - 1; i >= 0; i--) {
-        RenderLayer_DeallocateOffscreen(&g->render_layer[i]);
+        RenderLayer_DeallocateOffscreen(g->render_layer[i]);
+    }
+    RenderTargetPool_ReleaseAll(g->target_pool);
+}
+
+/* pragmas come along with the program they were parsed for.
+ * only earlier layers can be read, so index order stays a valid schedule */
+static void Graphics_InstallPragmas(Graphics *g, int layer_index)
+{
+    RenderLayer *layer = g->render_layer[layer_index];
+    int i;
+
+    layer->scale = layer->pending_scale;
+    memcpy(layer->input, layer->pending_input, sizeof(layer->input));
+    layer->num_input = layer->num_pending_input;
+    layer->pragma_error = layer->pending_pragma_error;
+    for (i = 0; i < layer->num_input; i++) {
+        LayerInput *in = &layer->input[i];
+        char name[MAX_LAYER_NAME + sizeof("_resolution")];
+        in->source_index = FindLayerByName(g, in->source, layer_index);
+        in->location = glGetUniformLocation(layer->program, in->sampler);
+        snprintf(name, sizeof(name), "%s_resolution", in->sampler);
+        in->resolution_location = glGetUniformLocation(layer->program, name);
+        if (in->source_index < 0) {
+            printf("layer %d: #pragma input %s: no earlier layer '%s'\r\n",
+                   layer_index, in->sampler, in->source);
+            layer->pragma_error = 1;
+        } else if (in->location < 0) {
+            /* optimized out or misspelled, the edge is kept anyway */
+            printf("layer %d: #pragma input: sampler '%s' not used\r\n",
+                   layer_index, in->sampler);
+        }
+    }
+    if (RenderLayer_ReflectSamplers(layer, g)) {
+        printf("layer %d: out of memory for samplers\r\n", layer_index);
     }
 }
 
 int Graphics_BuildRenderLayer(Graphics *g, int layer_index)
 {
-    RenderLayer_BuildProgram(&g->render_layer[layer_index],
-                             g->vertex_shader,
-                             g->array_buffer_fullscene_quad);
-    /* TODO: handle error */
-    return 0;
+    RenderLayer *layer = g->render_layer[layer_index];
+    uint64_t key;
+    GLuint program;
+
+    /* a build still running for the layer is superseded either way */
+    layer->generation += 1;
+    layer->build_submit_ms = GetMonotonicTimeInMilliSecond();
+    RenderLayer_ParsePragmas(layer);
+    key = Hash_Update(Hash_INITIAL, Source_GetText(layer->source),
+                      (size_t)Source_GetLength(layer->source));
+    if (layer->program != 0 && key == layer->program_key) {
+        layer->program_stale = 0;
+        return 0;               /* on screen already */
+    }
+    program = RenderLayer_TakeVariant(layer, key);
+    if (program != 0) {
+        printf("layer %d (%s): switched in %.1f ms, kept variant\r\n", layer_index, layer->name,
+               GetMonotonicTimeInMilliSecond() - layer->build_submit_ms);
+        RenderLayer_SetProgram(layer, g->gl, program, key);
+        Graphics_InstallPragmas(g, layer_index);
+        g->schedule_dirty = 1;
+        return 0;
+    }
+    layer->pending_key = key;
+    return ShaderBuilder_Submit(g->builder, layer_index, layer->generation, layer->source);
+}
+
+/* last good program keeps drawing until its replacement links */
+static void Graphics_InstallBuiltPrograms(Graphics *g)
+{
+    int id;
+    unsigned int generation;
+    unsigned int program;
+
+    while (ShaderBuilder_Poll(g->builder, &id, &generation, &program)) {
+        RenderLayer *layer = g->render_layer[id];
+        if (program == 0) {
+            continue;           /* build error, already reported */
+        }
+        if (generation != layer->generation) {
+            GLState_DeleteProgram(g->gl, program); /* superseded by newer source */
+            continue;
+        }
+        if (layer->program != 0) {
+            /* source change to new program on screen */
+            printf("layer %d (%s): rebuilt in %.1f ms\r\n", id, layer->name,
+                   GetMonotonicTimeInMilliSecond() - layer->build_submit_ms);
+        }
+        RenderLayer_SetProgram(layer, g->gl, program, layer->pending_key);
+        Graphics_InstallPragmas(g, id);
+        g->schedule_dirty = 1;
+    }
+}
+
+void Graphics_FinishBuild(Graphics *g)
+{
+    ShaderBuilder_Wait(g->builder);
+    Graphics_InstallBuiltPrograms(g);
+}
+
+void Graphics_DropVariants(Graphics *g, int layer_index)
+{
+    RenderLayer *layer = g->render_layer[layer_index];
+    int i;
+
+    for (i = 0; i < MAX_LAYER_VARIANT; i++) {
+        GLState_DeleteProgram(g->gl, layer->variant[i].program);
+        layer->variant[i].program = 0;
+    }
+    layer->program_stale = (layer->program != 0);
+}
+
+int Graphics_IsLayerBuilt(Graphics *g, int layer_index)
+{
+    RenderLayer *layer = g->render_layer[layer_index];
+    return layer->program != 0 && !layer->pragma_error;
+}
+
+void Graphics_SetProgramCache(Graphics *g, int enable)
+{
+    ShaderBuilder_Wait(g->builder);
+    ShaderBuilder_SetProgramCache(g->builder, enable);
+}
+
+void Graphics_PrintBuildStats(Graphics *g)
+{
+    ShaderBuilder_PrintStats(g->builder);
 }
 
 void Graphics_SetUniforms(Graphics *g, double t,
                           double mouse_x, double mouse_y,
                           double random)
 {
+    /* uploaded while each layer is bound for drawing */
+    g->uniform.time = t;
+    g->uniform.mouse[0] = mouse_x;
+    g->uniform.mouse[1] = mouse_y;
+    g->uniform.rand = random;
+}
+
+/* prev == NULL: first layer */
+static void Graphics_UploadUniforms(Graphics *g, RenderLayer *p,
+                                    OPTIONAL RenderLayer *prev)
+{
+    GLState *gl = g->gl;
+    int force = !p->shadow.valid;
     int i;
-    int width, height;
+    Uniform1f(gl, p->attr.time, &p->shadow.time, g->uniform.time, force);
+    Uniform2f(gl, p->attr.resolution, p->shadow.resolution, (GLfloat)p->width, (GLfloat)p->height, force);
+    Uniform2f(gl, p->attr.mouse, p->shadow.mouse, g->uniform.mouse[0], g->uniform.mouse[1], force);
+    Uniform1f(gl, p->attr.rand, &p->shadow.rand, g->uniform.rand, force);
+    Uniform1f(gl, p->attr.audio_level[0], &p->shadow.audio_level[0], g->audio.frame.bass, force);
+    Uniform1f(gl, p->attr.audio_level[1], &p->shadow.audio_level[1], g->audio.frame.mid, force);
+    Uniform1f(gl, p->attr.audio_level[2], &p->shadow.audio_level[2], g->audio.frame.high, force);
+    Uniform1f(gl, p->attr.audio_level[3], &p->shadow.audio_level[3], g->audio.frame.beat, force);
+    for (i = 0; i < p->num_uniform; i++) {
+        LayerUniform *u = &p->uniform[i];
+        Uniform1f(gl, u->location, &u->shadow, u->value, force);
+    }
+    if (prev) {
+        Uniform2f(gl, p->attr.prev_layer_resolution, p->shadow.prev_layer_resolution,
+                  (GLfloat)prev->width, (GLfloat)prev->height, force);
+    }
+    for (i = 0; i < p->num_input; i++) {
+        LayerInput *in = &p->input[i];
+        RenderLayer *source;
+        if (in->source_index < 0) {
+            continue;
+        }
+        source = g->render_layer[in->source_index];
+        Uniform2f(gl, in->resolution_location, in->shadow_resolution,
+                  (GLfloat)source->width, (GLfloat)source->height, force);
+    }
+    for (i = 0; i < p->num_sampler; i++) {
+        LayerSampler *ls = &p->sampler[i];
+        if (ls->role == SAMPLER_IMAGE) {
+            StaticImage *im = &g->static_image[ls->index];
+            Uniform2f(gl, ls->resolution_location, ls->shadow_resolution,
+                      (GLfloat)im->width, (GLfloat)im->height, force);
+        } else if (ls->role == SAMPLER_MOVIE) {
+            Movie *m = &g->movie[ls->index];
+            Uniform2f(gl, ls->resolution_location, ls->shadow_resolution,
+                      (GLfloat)m->info.width, (GLfloat)m->info.height, force);
+        }
+    }
+    p->shadow.valid = 1;
+}
 
-    CHECK_GL();
-    Video_GetSourceSize(g->video, &width, &height);
+void Graphics_Finish(Graphics *g)
+{
+    (void)g;
+    glFinish();
+}
+
+/* feedback pair is drawn and blitted only while some layer samples it */
+static int Graphics_IsFeedbackUsed(Graphics *g)
+{
+    int i;
+    if (!g->enable_backbuffer || g->feedback.texture[0] == 0) {
+        return 0;
+    }
     for (i = 0; i < g->num_render_layer; i++) {
-        RenderLayer *p;
-        p = &g->render_layer[i];
-        glUseProgram(p->program);
-        glUniform1f(p->attr.time, t);
-        glUniform2f(p->attr.resolution, (double)width, (double)height);
-        glUniform2f(p->attr.mouse, mouse_x, mouse_y);
-        glUniform1f(p->attr.rand, random);
-        glUseProgram(0);
+        RenderLayer *p = g->render_layer[i];
+        if (p->program && p->attr.backbuffer >= 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void Graphics_BlitFeedback(Graphics *g, int width, int height)
+{
+    GLState_BindFramebuffer(g->gl, 0);
+    GLState_Viewport(g->gl, 0, 0, width, height);
+    /* stays resident, the next frame samples it as backbuffer */
+    Graphics_DrawBuiltin(g, &g->blit, g->feedback.texture[g->feedback.read ^ 1],
+                         (GLfloat)width, (GLfloat)height);
+}
+
+/* each level from the one above, starting at the layer output */
+static void Graphics_BuildPyramid(Graphics *g, RenderLayer *p)
+{
+    GLuint source = p->texture_object;
+    int source_width = p->width;
+    int source_height = p->height;
+    int l;
+
+    for (l = 0; l < p->pyramid.levels; l++) {
+        GLState_UnbindTexture(g->gl, p->pyramid.texture[l]);
+        GLState_BindFramebuffer(g->gl, p->pyramid.framebuffer[l]);
+        GLState_Viewport(g->gl, 0, 0, p->pyramid.width[l], p->pyramid.height[l]);
+        Graphics_DrawBuiltin(g, &g->downsample, source, 1.0f / source_width, 1.0f / source_height);
+        source = p->pyramid.texture[l];
+        source_width = p->pyramid.width[l];
+        source_height = p->pyramid.height[l];
+    }
+}
+
+/* texture of each sampler the program has, on any unit. 0: nothing to read */
+static void Graphics_BindSamplers(Graphics *g, RenderLayer *p, OPTIONAL RenderLayer *prev,
+                                  int use_feedback)
+{
+    static const GLubyte black[4] = { 0, 0, 0, 255 };
+    int i;
+    if (g->black_texture == 0) {
+        /* before the set, the upload takes a unit of its own */
+        g->black_texture = Graphics_CreateImageTexture(g, 1, 1, GL_RGBA, black);
+    }
+    GLState_BeginTextureSet(g->gl);
+    for (i = 0; i < p->num_sampler; i++) {
+        LayerSampler *ls = &p->sampler[i];
+        GLuint texture = 0;
+        int unit;
+        switch (ls->role) {
+        case SAMPLER_BACKBUFFER:
+            if (use_feedback) {
+                texture = g->feedback.texture[g->feedback.read];
+            }
+            break;
+        case SAMPLER_PREV_LAYER:
+            if (prev) {
+                texture = prev->texture_object;
+            }
+            break;
+        case SAMPLER_PREV_LAYER_LOD:
+            if (prev && ls->index < prev->pyramid.levels) {
+                texture = prev->pyramid.texture[ls->index];
+            }
+            break;
+        case SAMPLER_INPUT:
+            if (p->input[ls->index].source_index >= 0) {
+                texture = g->render_layer[p->input[ls->index].source_index]->texture_object;
+            }
+            break;
+        case SAMPLER_IMAGE:
+            texture = g->static_image[ls->index].texture;
+            break;
+        case SAMPLER_MOVIE:
+            texture = g->movie[ls->index].texture;
+            break;
+        case SAMPLER_AUDIO:
+            texture = g->audio.texture;
+            break;
+        default:
+            break;
+        }
+        if (texture == 0) {
+            /* not left on a unit some other texture took since */
+            texture = g->black_texture;
+        }
+        unit = GLState_AcquireTextureUnit(g->gl, texture);
+        if (unit < 0) {
+            continue;           /* the link would have failed first */
+        }
+        Uniform1i(g->gl, ls->location, &ls->shadow_unit, unit, 0);
     }
-    CHECK_GL();
 }
 
 void Graphics_Render(Graphics *g)
 {
     int i;
-    GLuint prev_layer_texture_unit;
-    GLuint prev_layer_texture_object;
+    int width, height;
+    int use_feedback;
+
+    Graphics_InstallBuiltPrograms(g);
+    Graphics_UploadImages(g, IMAGE_UPLOAD_BYTES_PER_FRAME);
+    Graphics_UpdateMovies(g);
+    Graphics_UploadAudio(g);
+    if (g->schedule_dirty) {
+        /* on failure the previous schedule stays, printed */
+        Graphics_ScheduleLayers(g);
+    }
+    use_feedback = Graphics_IsFeedbackUsed(g);
 
     CHECK_GL();
-    prev_layer_texture_unit = 0;
-    prev_layer_texture_object = 0;
+    Graphics_GetSourceSize(g, &width, &height);
     for (i = 0; i < g->num_render_layer; i++) {
         RenderLayer *p;
-        p = &g->render_layer[i];
-        glUseProgram(p->program);
-        if (g->enable_backbuffer) {
-            glUniform1i(p->attr.backbuffer, g->backbuffer_texture_unit);
-            glActiveTexture(GL_TEXTURE0 + g->backbuffer_texture_unit);
-            glBindTexture(GL_TEXTURE_2D, g->backbuffer_texture_object);
-        }
-        if (i == 0) {
-            /* primary layer */
-            glBindFramebuffer(GL_FRAMEBUFFER, p->framebuffer);
-            glActiveTexture(GL_TEXTURE0 + p->texture_unit);
-            glBindTexture(GL_TEXTURE_2D, 0);
-        } else if (i == (g->num_render_layer-1)) {
-            /* final layer */
-            glUniform1i(p->attr.prev_layer, prev_layer_texture_unit);
-            /* TODO: plav_layer_resolution */
-            glActiveTexture(GL_TEXTURE0 + prev_layer_texture_unit);
-            glBindTexture(GL_TEXTURE_2D, prev_layer_texture_object);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        RenderLayer *prev;
+        p = g->render_layer[i];
+        if (!p->scheduled || p->program == 0) {
+            /* culled, or first build not finished yet */
+            continue;
+        }
+        if (!p->target && i < g->num_render_layer - 1) {
+            /* no schedule could be allocated, it is not the window's to draw */
+            continue;
+        }
+        prev = (i > 0 && g->render_layer[i - 1]->target) ? g->render_layer[i - 1] : NULL;
+
+        /* the only bind of this program in the frame */
+        GLState_UseProgram(g->gl, p->program);
+        Graphics_UploadUniforms(g, p, prev);
+        Graphics_BindSamplers(g, p, prev, use_feedback);
+        /* no feedback loop: target off every unit while drawing into it,
+         * it may still sit where an earlier layer sharing it was sampled */
+        GLState_UnbindTexture(g->gl, p->texture_object);
+        if (use_feedback && i == g->num_render_layer - 1) {
+            GLState_UnbindTexture(g->gl, g->feedback.texture[g->feedback.read ^ 1]);
+            GLState_BindFramebuffer(g->gl, g->feedback.framebuffer[g->feedback.read ^ 1]);
         } else {
-            glUniform1i(p->attr.prev_layer, prev_layer_texture_unit);
-            /* TODO: plav_layer_resolution */
-            glActiveTexture(GL_TEXTURE0 + p->texture_unit);
-            glBindTexture(GL_TEXTURE_2D, 0);
-            glActiveTexture(GL_TEXTURE0 + prev_layer_texture_unit);
-            glBindTexture(GL_TEXTURE_2D, prev_layer_texture_object);
-            glBindFramebuffer(GL_FRAMEBUFFER, p->framebuffer);
+            GLState_BindFramebuffer(g->gl, p->framebuffer);
         }
 
-        glBindBuffer(GL_ARRAY_BUFFER, g->array_buffer_fullscene_quad);
-        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        GLState_Viewport(g->gl, 0, 0, p->width, p->height);
 
-        glFlush();
+        /* no glFlush between layers, the tiler batches the whole frame */
+        if (g->gpu_timer) {
+            GpuTimer_Begin(g->gpu_timer, i);
+        }
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        GLState_CountCall(g->gl);
+        if (p->pyramid.levels > 0) {
+            Graphics_BuildPyramid(g, p);
+        }
+        if (g->gpu_timer) {
+            /* pyramid is part of the layer cost */
+            GpuTimer_End(g->gpu_timer, i);
+        }
+    }
 
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glActiveTexture(GL_TEXTURE0);
-        glUseProgram(0);
+    if (use_feedback) {
+        Graphics_BlitFeedback(g, width, height);
+        g->feedback.read ^= 1;
+    }
+    GLState_BindFramebuffer(g->gl, 0);
+    if (g->readback) {
+        Readback_Capture(g->readback);
+    }
+    CHECK_GL();
 
-        prev_layer_texture_unit = p->texture_unit;
-        prev_layer_texture_object = p->texture_object;
+    if (g->gpu_timer) {
+        GpuTimer_EndFrame(g->gpu_timer);
     }
+    Video_SwapBuffers(g->video, g->video_egl);
+    GLState_CountCall(g->gl);
+    GLState_EndFrame(g->gl);
+}
 
-    if (g->enable_backbuffer) {
-        int width, height;
-        Video_GetSourceSize(g->video, &width, &height);
-        glActiveTexture(GL_TEXTURE0 + g->backbuffer_texture_unit);
-        glBindTexture(GL_TEXTURE_2D, g->backbuffer_texture_object); /* destination */
-        glBindFramebuffer(GL_FRAMEBUFFER, g->render_layer[g->num_render_layer-1].framebuffer); /* source */
+int Graphics_GetDisplayFd(Graphics *g)
+{
+    return Video_GetEventFd(g->video);
+}
+
+int Graphics_HandleDisplayEvents(Graphics *g, double *out_present_ms)
+{
+    return Video_HandleEvents(g->video, out_present_ms);
+}
+
+int Graphics_IsSwapPending(Graphics *g)
+{
+    return Video_IsSwapPending(g->video);
+}
+
+int Graphics_GetPresentLatency(Graphics *g, Histogram_Summary *out)
+{
+    return Video_GetLatency(g->video, out);
+}
+
+const char *Graphics_GetPresentLatencyMethod(Graphics *g)
+{
+    return Video_GetLatencyMethod(g->video);
+}
 
-        glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 0, 0, width, height, 0);
+void Graphics_ClearPresentLatency(Graphics *g)
+{
+    Video_ClearLatency(g->video);
+}
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, 0);
+int Graphics_SetCapture(Graphics *g, int depth)
+{
+    int width, height;
+    if (g->readback) {
+        Readback_Delete(g->readback);
+        g->readback = NULL;
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (depth <= 0) {
+        return 0;
+    }
+    Graphics_GetSourceSize(g, &width, &height);
+    g->readback = Readback_Create(g->gl, width, height, depth);
+    CHECK_GL();
+    return (g->readback) ? 0 : 1;
+}
+
+int Graphics_ReadCapture(Graphics *g, int flush, void *out_pixels)
+{
+    int ret;
+    assert(g->readback);
+    /* full: the next frame needs the slot, wait for the oldest */
+    ret = Readback_Read(g->readback, flush || Readback_IsFull(g->readback), out_pixels);
     CHECK_GL();
+    return ret;
+}
+
+const char *Graphics_GetCaptureMethod(Graphics *g)
+{
+    return (g->readback) ? Readback_GetMethodName(g->readback) : "none";
+}
+
+void Graphics_GetGLCallStats(Graphics *g, int *out_issued, int *out_elided)
+{
+    GLState_Stats stats;
+    GLState_GetFrameStats(g->gl, &stats);
+    *out_issued = stats.issued;
+    *out_elided = stats.elided;
+}
+
+int Graphics_SetProfiling(Graphics *g, int enable)
+{
+    if (!enable) {
+        if (g->gpu_timer) {
+            GpuTimer_Delete(g->gpu_timer);
+            g->gpu_timer = NULL;
+        }
+        return 0;
+    }
+    if (g->gpu_timer == NULL) {
+        g->gpu_timer = GpuTimer_Create((g->num_render_layer > 0) ? g->num_render_layer : 1);
+        if (g->gpu_timer == NULL) {
+            return 1;
+        }
+        printf("gpu timing: %s\r\n", GpuTimer_GetMethodName(GpuTimer_GetMethod(g->gpu_timer)));
+    }
+    return 0;
+}
+
+int Graphics_IsProfiling(Graphics *g)
+{
+    return (g->gpu_timer != NULL) ? 1 : 0;
+}
 
-    VideoEGL_SwapBuffers(g->video_egl);
+const char *Graphics_GetProfilingMethod(Graphics *g)
+{
+    if (g->gpu_timer == NULL) {
+        return "none";
+    }
+    return GpuTimer_GetMethodName(GpuTimer_GetMethod(g->gpu_timer));
+}
+
+int Graphics_GetLayerProfile(Graphics *g, int layer_index, Histogram_Summary *out_summary)
+{
+    assert(layer_index >= 0 && layer_index < g->num_render_layer);
+    if (g->gpu_timer == NULL) {
+        return 1;
+    }
+    return Histogram_Summarize(GpuTimer_GetHistogram(g->gpu_timer, layer_index), out_summary);
+}
+
+void Graphics_PrintProfile(Graphics *g)
+{
+    int i;
+    if (g->gpu_timer == NULL) {
+        return;
+    }
+    printf("gpu time [ms] (%s)\r\n", Graphics_GetProfilingMethod(g));
+    printf("  layer      min      p50      p95      p99      max  samples\r\n");
+    for (i = 0; i < g->num_render_layer; i++) {
+        Histogram_Summary hs;
+        if (Graphics_GetLayerProfile(g, i, &hs)) {
+            printf("  %5d        -\r\n", i);
+            continue;
+        }
+        printf("  %5d %8.2f %8.2f %8.2f %8.2f %8.2f %8d\r\n",
+               i, hs.min, hs.p50, hs.p95, hs.p99, hs.max, hs.count);
+    }
 }
 
 void Graphics_SetBackbuffer(Graphics *g, int enable)
@@ -823,6 +2609,24 @@ void Graphics_GetSourceSize(Graphics *g, int *out_width, int *out_height)
     Video_GetSourceSize(g->video, out_width, out_height);
 }
 
+void Graphics_SetHeadlessSize(Graphics *g, int width, int height)
+{
+    int error = Video_SetScreenSize(g->video, width, height);
+    assert(error == 0);
+    (void)error;
+}
+
+size_t Graphics_GetOffscreenMemorySize(Graphics *g)
+{
+    return RenderTargetPool_GetMemorySize(g->target_pool);
+}
+
+const char *Graphics_GetRenderer(Graphics *g)
+{
+    (void)g;
+    return (const char *)glGetString(GL_RENDERER);
+}
+
 Graphics_LAYOUT Graphics_GetCurrentLayout(Graphics *g)
 {
     return g->layout;
@@ -896,6 +2700,45 @@ static void DeterminePixelFormat(Graphics_PIXELFORMAT pixel_format,
     *out_type = type;
 }
 
+static void DetermineTargetDesc(Graphics *g, int width, int height,
+                                RenderTarget_Desc *out_desc)
+{
+    memset(out_desc, 0, sizeof(*out_desc)); /* compared by memcmp in the pool */
+    out_desc->width = width;
+    out_desc->height = height;
+    DeterminePixelFormat(g->texture_pixel_format, &out_desc->internal_format,
+                         &out_desc->format, &out_desc->type);
+
+    switch (g->texture_interpolation_mode) {
+    case Graphics_INTERPOLATION_MODE_NEARESTNEIGHBOR:
+        out_desc->filter = GL_NEAREST;
+        break;
+    case Graphics_INTERPOLATION_MODE_BILINEAR:
+        out_desc->filter = GL_LINEAR;
+        break;
+    default:
+        assert(0);
+        out_desc->filter = GL_NEAREST;
+        break;
+    }
+
+    switch (g->texture_wrap_mode) {
+    case Graphics_WRAP_MODE_CLAMP_TO_EDGE:
+        out_desc->wrap = GL_CLAMP_TO_EDGE;
+        break;
+    case Graphics_WRAP_MODE_REPEAT:
+        out_desc->wrap = GL_REPEAT;
+        break;
+    case Graphics_WRAP_MODE_MIRRORED_REPEAT:
+        out_desc->wrap = GL_MIRRORED_REPEAT;
+        break;
+    default:
+        assert(0);
+        out_desc->wrap = GL_REPEAT;
+        break;
+    }
+}
+
 static void DetermineLayoutPosition(Graphics_LAYOUT layout,
                                     int screen_width, int screen_height,
                                     int *out_x, int *out_y,
@@ -973,4 +2816,3 @@ static void DetermineLayoutPosition(Graphics_LAYOUT layout,
         break;
     }
 }
-
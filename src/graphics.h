@@ -5,6 +5,9 @@
 
 #include <stddef.h>
 #include "base.h"
+#include "histogram.h"
+#include "audio.h"
+#include "source_store.h"
 
 
 typedef enum {
@@ -31,6 +34,14 @@ typedef enum {
     Graphics_PIXELFORMAT_ENUMS
 } Graphics_PIXELFORMAT;
 
+/* the window and how frames reach it */
+typedef struct {
+    OPTIONAL const char *display; /* backend name, NULL: the default */
+    Graphics_PIXELFORMAT format;  /* RGBA8888, RGB888 or RGB565 */
+    int swap_interval;            /* 0, 1 or 2 vsyncs per frame */
+    int buffers;                  /* 2 or 3 */
+} Graphics_DisplayConfig;
+
 typedef enum {
     Graphics_INTERPOLATION_MODE_NEARESTNEIGHBOR,
     Graphics_INTERPOLATION_MODE_BILINEAR,
@@ -54,18 +65,33 @@ void Graphics_HostDeinitialize(void);
 
 
 void *RenderLayer_GetAux(RenderLayer *layer);
-int RenderLayer_UpdateShaderSource(RenderLayer *layer,
-                                   const char *source,
-                                   OPTIONAL int source_length);
-
-
-Graphics *Graphics_Create(Graphics_LAYOUT layout,
+/* for "#pragma input <sampler> <name>" of later layers, an index works too */
+int RenderLayer_SetName(RenderLayer *layer, const char *name);
+/* output reaches no later layer nor the window in the current schedule */
+int RenderLayer_IsCulled(RenderLayer *layer);
+/* render size relative to the source, wins over "#pragma scale N/D".
+ * not for the final layer, it always fills the window */
+int RenderLayer_SetScale(RenderLayer *layer, int numer, int denom);
+void RenderLayer_GetSize(RenderLayer *layer, int *out_width, int *out_height);
+/* 'source' is retained, built by the next Graphics_BuildRenderLayer */
+int RenderLayer_UpdateShaderSource(RenderLayer *layer, Source *source);
+/* float uniform 'name' of every program the layer gets from now on.
+ * 1: name too long or out of memory */
+int RenderLayer_SetUniform(RenderLayer *layer, const char *name, float value);
+void RenderLayer_ClearUniforms(RenderLayer *layer);
+
+
+/* window on the configured display backend */
+Graphics *Graphics_Create(const Graphics_DisplayConfig *config,
+                          Graphics_LAYOUT layout,
                           int scaling_numer, int scaling_denom);
+/* "headless" display of width x height, fullscreen (benchmark, off-device) */
+Graphics *Graphics_CreateHeadless(int width, int height,
+                                  int scaling_numer, int scaling_denom);
 void Graphics_Delete(Graphics *g);
 
 int Graphics_AppendRenderLayer(Graphics *g,
-                               const char *source,
-                               OPTIONAL int source_length,
+                               Source *source,
                                OPTIONAL void *auxptr);
 
 void Graphics_SetOffscreenPixelFormat(Graphics *g, Graphics_PIXELFORMAT pixel_format);
@@ -82,18 +108,93 @@ int Graphics_ApplyWindowScalingChange(Graphics *g);
 int Graphics_AllocateOffscreen(Graphics *g);
 void Graphics_DeallocateOffscreen(Graphics *g);
 RenderLayer *Graphics_GetRenderLayer(Graphics *g, int layer_index);
+
+/* still image (PNG, PPM, PAM) for every "uniform sampler2D <name>", with
+ * "uniform vec2 <name>_resolution". decoded on a worker, uploaded a slice per
+ * frame, the previous content is shown meanwhile */
+int Graphics_AddImage(Graphics *g, const char *name, const char *path,
+                      OPTIONAL void *auxptr);
+/* file changed: decode again */
+int Graphics_ReloadImage(Graphics *g, int image_index);
+/* NULL: no such image */
+void *Graphics_GetImageAux(Graphics *g, int image_index);
+/* block until every submitted image is decoded and uploaded */
+void Graphics_FinishImageLoads(Graphics *g);
+
+/* Y4M video for every "uniform sampler2D <name>", with <name>_resolution.
+ * the frame due at the time uniform is shown, looping. frames are read ahead
+ * by a thread; a late one is not waited for, the last is repeated */
+int Graphics_AddMovie(Graphics *g, const char *name, const char *path);
+/* wait for late frames instead (offline rendering, benchmark) */
+void Graphics_SetMovieWait(Graphics *g, int enable);
+void Graphics_PrintMovieStats(Graphics *g);
+
+/* analysis for the next Graphics_Render: "uniform sampler2D audio;" (row 0
+ * spectrum, row 1 waveform, 256 wide) and float audio_bass, audio_mid,
+ * audio_high, audio_beat. copied, cheap when nothing changed */
+void Graphics_SetAudio(Graphics *g, const Audio_Frame *frame);
+
+/* asynchronous, the new program is swapped in at a frame boundary. a source
+ * built before for the layer (one of its last few) is swapped in at once */
 int Graphics_BuildRenderLayer(Graphics *g, int layer_index);
+/* block until every submitted build is installed */
+void Graphics_FinishBuild(Graphics *g);
+/* the source of the layer was edited: the programs kept are deleted and
+ * the one on screen goes when replaced, instead of being kept */
+void Graphics_DropVariants(Graphics *g, int layer_index);
+/* a program is installed and its pragmas are right. after
+ * Graphics_FinishBuild: the build worked */
+int Graphics_IsLayerBuilt(Graphics *g, int layer_index);
+/* on-disk program binary cache (default: ON when supported) */
+void Graphics_SetProgramCache(Graphics *g, int enable);
+void Graphics_PrintBuildStats(Graphics *g);
 
 void Graphics_SetUniforms(Graphics *g, double t,
                           double mouse_x, double mouse_y,
                           double random);
 void Graphics_Render(Graphics *g);
+/* displays presenting asynchronously (KMS page flips): poll this fd, -1 when
+ * Graphics_Render blocks in the swap instead */
+int Graphics_GetDisplayFd(Graphics *g);
+/* drain the fd. 1 when a frame reached the screen, at *out_present_ms
+ * (monotonic clock) */
+int Graphics_HandleDisplayEvents(Graphics *g, double *out_present_ms);
+/* no room for another frame, rendering the next would block */
+int Graphics_IsSwapPending(Graphics *g);
+/* submit-to-present latency of the window, 1: no samples */
+int Graphics_GetPresentLatency(Graphics *g, Histogram_Summary *out);
+const char *Graphics_GetPresentLatencyMethod(Graphics *g);
+void Graphics_ClearPresentLatency(Graphics *g);
+/* block until the GPU finished every submitted frame */
+void Graphics_Finish(Graphics *g);
+
+/* per-layer GPU time into rolling histograms */
+int Graphics_SetProfiling(Graphics *g, int enable);
+int Graphics_IsProfiling(Graphics *g);
+void Graphics_PrintProfile(Graphics *g);
+const char *Graphics_GetProfilingMethod(Graphics *g);
+int Graphics_GetLayerProfile(Graphics *g, int layer_index, Histogram_Summary *out_summary);
+/* GL calls of the last frame: reached the driver / skipped as redundant */
+/* every rendered frame is copied into a ring of 'depth' frames of the
+ * current window size for readback. 0: off */
+int Graphics_SetCapture(Graphics *g, int depth);
+/* oldest captured frame into 'out_pixels' (RGBA, rows bottom up), once its
+ * copy is done, when the ring is full, or 'flush'. return 1 when read.
+ * call after every Graphics_Render */
+int Graphics_ReadCapture(Graphics *g, int flush, void *out_pixels);
+const char *Graphics_GetCaptureMethod(Graphics *g);
+
+void Graphics_GetGLCallStats(Graphics *g, int *out_issued, int *out_elided);
 
 void Graphics_SetBackbuffer(Graphics *g, int enable);
 Graphics_LAYOUT Graphics_GetCurrentLayout(Graphics *g);
 Graphics_LAYOUT Graphics_GetLayout(Graphics_LAYOUT layout, int forward);
 void Graphics_GetWindowSize(Graphics *g, int *out_width, int *out_height);
 void Graphics_GetSourceSize(Graphics *g, int *out_width, int *out_height);
+/* headless only, applied by the next Graphics_ApplyWindowScalingChange */
+void Graphics_SetHeadlessSize(Graphics *g, int width, int height);
+size_t Graphics_GetOffscreenMemorySize(Graphics *g);
+const char *Graphics_GetRenderer(Graphics *g);
 
 
 #endif
@@ -0,0 +1,25 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <string.h>
+
+#include "config.h"
+#include "base.h"
+#include "hash.h"
+
+
+uint64_t Hash_Update(uint64_t seed, const void *data, size_t length)
+{
+    const unsigned char *p = data;
+    uint64_t h = seed;
+    size_t i;
+    for (i = 0; i < length; i++) {
+        h ^= p[i];
+        h *= (uint64_t)0x100000001b3ULL;
+    }
+    return h;
+}
+
+uint64_t Hash_String(uint64_t seed, const char *str)
+{
+    return Hash_Update(seed, str, strlen(str));
+}
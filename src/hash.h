@@ -0,0 +1,17 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#ifndef INCLUDED_HASH_H
+#define INCLUDED_HASH_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define Hash_INITIAL ((uint64_t)0xcbf29ce484222325ULL)
+
+/* FNV-1a 64bit, chainable: pass previous result as seed */
+uint64_t Hash_Update(uint64_t seed, const void *data, size_t length);
+uint64_t Hash_String(uint64_t seed, const char *str);
+
+
+#endif
@@ -0,0 +1,88 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "config.h"
+#include "base.h"
+#include "histogram.h"
+
+
+struct Histogram_ {
+    int capacity;
+    unsigned int written;       /* total pushes, slot = written % capacity */
+    float sample[1];            /* capacity */
+};
+
+
+static int CompareFloat(const void *a, const void *b)
+{
+    float x = *(const float *)a;
+    float y = *(const float *)b;
+    return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+Histogram *Histogram_Create(int capacity)
+{
+    Histogram *h;
+    assert(capacity > 0);
+    h = malloc(sizeof(*h) + sizeof(h->sample[0]) * (capacity - 1));
+    if (!h) {
+        return NULL;
+    }
+    h->capacity = capacity;
+    h->written = 0;
+    return h;
+}
+
+void Histogram_Delete(Histogram *h)
+{
+    free(h);
+}
+
+void Histogram_Push(Histogram *h, double value)
+{
+    unsigned int n = __atomic_load_n(&h->written, __ATOMIC_RELAXED);
+    float v = (float)value;
+    __atomic_store(&h->sample[n % h->capacity], &v, __ATOMIC_RELAXED);
+    /* publish the sample */
+    __atomic_store_n(&h->written, n + 1, __ATOMIC_RELEASE);
+}
+
+void Histogram_Clear(Histogram *h)
+{
+    __atomic_store_n(&h->written, 0, __ATOMIC_RELEASE);
+}
+
+int Histogram_Summarize(Histogram *h, Histogram_Summary *out)
+{
+    unsigned int n;
+    int i, count;
+    float *sorted;
+
+    memset(out, 0, sizeof(*out));
+    n = __atomic_load_n(&h->written, __ATOMIC_ACQUIRE);
+    count = (n < (unsigned int)h->capacity) ? (int)n : h->capacity;
+    if (count == 0) {
+        return 1;
+    }
+    sorted = malloc(sizeof(*sorted) * count);
+    if (!sorted) {
+        return 1;
+    }
+    /* a slot overwritten meanwhile only swaps one sample for a newer one */
+    for (i = 0; i < count; i++) {
+        __atomic_load(&h->sample[(n - 1 - i) % h->capacity], &sorted[i], __ATOMIC_RELAXED);
+    }
+    qsort(sorted, count, sizeof(*sorted), CompareFloat);
+    out->count = count;
+    out->min = sorted[0];
+    out->p50 = sorted[(count * 50) / 100];
+    out->p95 = sorted[(count * 95) / 100];
+    out->p99 = sorted[(count * 99) / 100];
+    out->max = sorted[count - 1];
+    free(sorted);
+    return 0;
+}
@@ -0,0 +1,30 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* rolling window of samples, lock-free: one writer, any number of readers */
+
+#ifndef INCLUDED_HISTOGRAM_H
+#define INCLUDED_HISTOGRAM_H
+
+
+typedef struct Histogram_ Histogram;
+
+typedef struct {
+    int count;                  /* samples in window */
+    double min;
+    double p50;
+    double p95;
+    double p99;
+    double max;
+} Histogram_Summary;
+
+
+Histogram *Histogram_Create(int capacity);
+void Histogram_Delete(Histogram *h);
+
+void Histogram_Push(Histogram *h, double value);
+void Histogram_Clear(Histogram *h);
+/* return 1 when empty */
+int Histogram_Summarize(Histogram *h, Histogram_Summary *out);
+
+
+#endif
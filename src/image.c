@@ -0,0 +1,262 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef USE_LIBPNG
+#include <png.h>
+#endif
+
+#include "config.h"
+#include "base.h"
+#include "image.h"
+
+
+enum {
+    MAX_IMAGE_SIZE = 1 << 14    /* each side, beyond any GLES2 texture */
+};
+
+
+static int Image_Allocate(Image *image, int width, int height, int channels)
+{
+    if (width <= 0 || height <= 0 || width > MAX_IMAGE_SIZE || height > MAX_IMAGE_SIZE) {
+        return 1;
+    }
+    image->width = width;
+    image->height = height;
+    image->channels = channels;
+    image->pixels = malloc((size_t)width * height * channels);
+    return (image->pixels != NULL) ? 0 : 1;
+}
+
+void Image_Release(Image *image)
+{
+    free(image->pixels);
+    image->pixels = NULL;
+}
+
+size_t Image_GetRowSize(const Image *image)
+{
+    return (size_t)image->width * image->channels;
+}
+
+
+/* Netpbm: header tokens are separated by whitespace and '#' comments */
+static int ReadNetpbmToken(FILE *fp, char *out, size_t out_size)
+{
+    size_t n;
+    int c;
+
+    for (;;) {
+        c = getc(fp);
+        if (c == '#') {
+            while (c != EOF && c != '\n') {
+                c = getc(fp);
+            }
+        } else if (c == EOF || !isspace(c)) {
+            break;
+        }
+    }
+    for (n = 0; c != EOF && !isspace(c); c = getc(fp)) {
+        if (n + 1 >= out_size) {
+            return 1;
+        }
+        out[n++] = (char)c;
+    }
+    out[n] = '\0';
+    /* the single whitespace after the last header token is consumed here */
+    return (n > 0) ? 0 : 1;
+}
+
+static int ReadNetpbmInt(FILE *fp, int *out)
+{
+    char token[16];
+    char *end;
+    long value;
+    if (ReadNetpbmToken(fp, token, sizeof(token))) {
+        return 1;
+    }
+    value = strtol(token, &end, 10);
+    if (*end != '\0' || value < 0 || value > 65535) {
+        return 1;
+    }
+    *out = (int)value;
+    return 0;
+}
+
+/* P7: "KEY value" lines up to ENDHDR */
+static int ReadPAMHeader(FILE *fp, int *out_width, int *out_height,
+                         int *out_depth, int *out_maxval)
+{
+    char key[16];
+    *out_width = *out_height = *out_depth = *out_maxval = 0;
+    for (;;) {
+        if (ReadNetpbmToken(fp, key, sizeof(key))) {
+            return 1;
+        }
+        if (strcmp(key, "ENDHDR") == 0) {
+            return 0;
+        } else if (strcmp(key, "WIDTH") == 0) {
+            if (ReadNetpbmInt(fp, out_width)) {
+                return 1;
+            }
+        } else if (strcmp(key, "HEIGHT") == 0) {
+            if (ReadNetpbmInt(fp, out_height)) {
+                return 1;
+            }
+        } else if (strcmp(key, "DEPTH") == 0) {
+            if (ReadNetpbmInt(fp, out_depth)) {
+                return 1;
+            }
+        } else if (strcmp(key, "MAXVAL") == 0) {
+            if (ReadNetpbmInt(fp, out_maxval)) {
+                return 1;
+            }
+        } else if (strcmp(key, "TUPLTYPE") == 0) {
+            /* implied by DEPTH for the types we take */
+            char value[32];
+            if (ReadNetpbmToken(fp, value, sizeof(value))) {
+                return 1;
+            }
+        } else {
+            return 1;
+        }
+    }
+}
+
+/* depth 1: gray, 2: gray+alpha, 3: RGB, 4: RGBA. samples are 16 bit big endian above 255 */
+static int ReadNetpbmSamples(FILE *fp, Image *image, int width, int height,
+                             int depth, int maxval)
+{
+    int bytes_per_sample = (maxval > 255) ? 2 : 1;
+    size_t row_bytes = (size_t)width * depth * bytes_per_sample;
+    unsigned char *row;
+    int x, y;
+
+    if (depth < 1 || depth > 4 || maxval < 1) {
+        return 1;
+    }
+    if (Image_Allocate(image, width, height, (depth == 2 || depth == 4) ? 4 : 3)) {
+        return 1;
+    }
+    row = malloc(row_bytes);
+    if (!row) {
+        Image_Release(image);
+        return 1;
+    }
+    for (y = 0; y < height; y++) {
+        /* file is top down */
+        unsigned char *dst = image->pixels + (size_t)(height - 1 - y) * Image_GetRowSize(image);
+        const unsigned char *src = row;
+        if (fread(row, 1, row_bytes, fp) != row_bytes) {
+            free(row);
+            Image_Release(image);
+            return 1;
+        }
+        for (x = 0; x < width * depth; x++) {
+            int v = src[0];
+            if (bytes_per_sample == 2) {
+                v = (v << 8) | src[1];
+            }
+            src += bytes_per_sample;
+            v = (v >= maxval) ? 255 : (v * 255 + maxval / 2) / maxval;
+            if (depth <= 2 && (x % depth) == 0) {
+                /* gray to RGB */
+                *dst++ = (unsigned char)v;
+                *dst++ = (unsigned char)v;
+            }
+            *dst++ = (unsigned char)v;
+        }
+    }
+    free(row);
+    return 0;
+}
+
+static int LoadNetpbm(FILE *fp, int type, Image *out_image)
+{
+    int width, height, depth, maxval;
+
+    if (type == '7') {
+        if (ReadPAMHeader(fp, &width, &height, &depth, &maxval)) {
+            return 1;
+        }
+    } else {
+        depth = (type == '5') ? 1 : 3;
+        if (ReadNetpbmInt(fp, &width)
+            || ReadNetpbmInt(fp, &height)
+            || ReadNetpbmInt(fp, &maxval)) {
+            return 1;
+        }
+    }
+    return ReadNetpbmSamples(fp, out_image, width, height, depth, maxval);
+}
+
+#ifdef USE_LIBPNG
+static int LoadPNG(const char *path, Image *out_image)
+{
+    png_image png;
+    int channels;
+
+    memset(&png, 0, sizeof(png));
+    png.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&png, path)) {
+        printf("image %s: %s\r\n", path, png.message);
+        return 1;
+    }
+    /* every PNG flavour ends up 8 bit RGB or RGBA */
+    if (png.format & PNG_FORMAT_FLAG_ALPHA) {
+        png.format = PNG_FORMAT_RGBA;
+        channels = 4;
+    } else {
+        png.format = PNG_FORMAT_RGB;
+        channels = 3;
+    }
+    if (Image_Allocate(out_image, (int)png.width, (int)png.height, channels)) {
+        png_image_free(&png);
+        return 1;
+    }
+    /* negative stride: bottom up */
+    if (!png_image_finish_read(&png, NULL, out_image->pixels,
+                               -(png_int_32)Image_GetRowSize(out_image), NULL)) {
+        printf("image %s: %s\r\n", path, png.message);
+        Image_Release(out_image);
+        return 1;
+    }
+    return 0;
+}
+#endif
+
+int Image_Load(const char *path, Image *out_image)
+{
+    FILE *fp;
+    unsigned char magic[2];
+    int ret;
+
+    out_image->pixels = NULL;
+    fp = fopen(path, "rb");
+    if (!fp) {
+        return 1;
+    }
+    if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic)) {
+        fclose(fp);
+        return 1;
+    }
+    if (magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6' || magic[1] == '7')) {
+        ret = LoadNetpbm(fp, magic[1], out_image);
+        fclose(fp);
+        return ret;
+    }
+    fclose(fp);
+    if (magic[0] == 0x89 && magic[1] == 'P') {
+#ifdef USE_LIBPNG
+        return LoadPNG(path, out_image);
+#else
+        printf("image %s: built without libpng\r\n", path);
+        return 2;
+#endif
+    }
+    printf("image %s: unknown format\r\n", path);
+    return 3;
+}
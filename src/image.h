@@ -0,0 +1,26 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* still image decoding: PPM/PGM (P5, P6), PAM (P7), PNG with libpng */
+
+#ifndef INCLUDED_IMAGE_H
+#define INCLUDED_IMAGE_H
+
+
+#include <stddef.h>
+#include "base.h"
+
+typedef struct {
+    int width;
+    int height;
+    int channels;               /* 3: RGB, 4: RGBA */
+    unsigned char *pixels;      /* 8 bit, rows bottom up like GL, tightly packed */
+} Image;
+
+
+/* whole file at once, blocking. 0: success, out_image owns the pixels */
+int Image_Load(const char *path, Image *out_image);
+void Image_Release(Image *image);
+size_t Image_GetRowSize(const Image *image);
+
+
+#endif
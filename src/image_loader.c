@@ -0,0 +1,289 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <GLES2/gl2.h>
+
+#include "config.h"
+#include "base.h"
+#include "video_egl.h"
+#include "image.h"
+#include "image_loader.h"
+
+
+typedef struct Job_ {
+    struct Job_ *next;
+    int id;
+    unsigned int generation;
+    char *path;
+    Image image;
+    GLuint texture;
+} Job;
+
+typedef struct {
+    Job *head;
+    Job *tail;
+} JobQueue;
+
+struct ImageLoader_ {
+    VideoEGL *egl;              /* NULL: no texture storage on the worker */
+    JobQueue pending;           /* not started yet */
+    JobQueue done;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_job;
+    pthread_cond_t cond_idle;
+    int busy;
+    int quit;
+};
+
+
+static void Job_Delete(Job *job)
+{
+    free(job->path);
+    free(job);
+}
+
+static void JobQueue_Push(JobQueue *q, Job *job)
+{
+    job->next = NULL;
+    if (q->tail) {
+        q->tail->next = job;
+    } else {
+        q->head = job;
+    }
+    q->tail = job;
+}
+
+static Job *JobQueue_Pop(JobQueue *q)
+{
+    Job *job = q->head;
+    if (job) {
+        q->head = job->next;
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+        job->next = NULL;
+    }
+    return job;
+}
+
+static Job *JobQueue_Find(JobQueue *q, int id)
+{
+    Job *job;
+    for (job = q->head; job; job = job->next) {
+        if (job->id == id) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+
+/* allocating a big texture is slow on some drivers, keep it off the render thread */
+static GLuint CreateStorage(const Image *image)
+{
+    GLenum format = (image->channels == 4) ? GL_RGBA : GL_RGB;
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, image->width, image->height, 0,
+                 format, GL_UNSIGNED_BYTE, NULL);
+    /* no mipmap and no repeat, so any size works on GLES2 */
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    /* objects must be complete before the render context uses them */
+    glFinish();
+    return texture;
+}
+
+/* worker thread */
+static void *ImageLoader_WorkerMain(void *arg)
+{
+    ImageLoader *l = arg;
+
+    if (l->egl) {
+        VideoEGL_MakeCurrent(l->egl);
+    }
+    pthread_mutex_lock(&l->mutex);
+    for (;;) {
+        Job *job;
+        while (!l->quit && l->pending.head == NULL) {
+            pthread_cond_wait(&l->cond_job, &l->mutex);
+        }
+        if (l->quit) {
+            break;
+        }
+        job = JobQueue_Pop(&l->pending);
+        l->busy = 1;
+        pthread_mutex_unlock(&l->mutex);
+
+        if (Image_Load(job->path, &job->image)) {
+            printf("image load failed: %s\r\n", job->path);
+        } else if (l->egl) {
+            job->texture = CreateStorage(&job->image);
+        }
+
+        pthread_mutex_lock(&l->mutex);
+        JobQueue_Push(&l->done, job);
+        l->busy = 0;
+        pthread_cond_broadcast(&l->cond_idle);
+    }
+    pthread_mutex_unlock(&l->mutex);
+    if (l->egl) {
+        VideoEGL_UnmakeCurrent(l->egl);
+    }
+    return NULL;
+}
+
+
+static VideoEGL *CreateSharedContext(VideoEGL *share)
+{
+    VideoEGL *egl;
+    egl = malloc(VideoEGL_InstanceSize());
+    if (!egl) {
+        return NULL;
+    }
+    if (VideoEGL_ConstructShared(egl, share)) {
+        free(egl);
+        return NULL;
+    }
+    return egl;
+}
+
+static void DeleteSharedContext(VideoEGL *egl)
+{
+    if (egl) {
+        VideoEGL_Destruct(egl);
+        free(egl);
+    }
+}
+
+ImageLoader *ImageLoader_Create(OPTIONAL VideoEGL *share)
+{
+    ImageLoader *l;
+    l = malloc(sizeof(*l));
+    if (!l) {
+        return NULL;
+    }
+    l->egl = (share) ? CreateSharedContext(share) : NULL;
+    memset(&l->pending, 0, sizeof(l->pending));
+    memset(&l->done, 0, sizeof(l->done));
+    l->busy = 0;
+    l->quit = 0;
+    pthread_mutex_init(&l->mutex, NULL);
+    pthread_cond_init(&l->cond_job, NULL);
+    pthread_cond_init(&l->cond_idle, NULL);
+    if (pthread_create(&l->thread, NULL, ImageLoader_WorkerMain, l)) {
+        pthread_cond_destroy(&l->cond_idle);
+        pthread_cond_destroy(&l->cond_job);
+        pthread_mutex_destroy(&l->mutex);
+        DeleteSharedContext(l->egl);
+        free(l);
+        return NULL;
+    }
+    return l;
+}
+
+void ImageLoader_Delete(ImageLoader *l)
+{
+    Job *job;
+
+    pthread_mutex_lock(&l->mutex);
+    l->quit = 1;
+    pthread_cond_signal(&l->cond_job);
+    pthread_mutex_unlock(&l->mutex);
+    pthread_join(l->thread, NULL);
+
+    while ((job = JobQueue_Pop(&l->pending)) != NULL) {
+        Job_Delete(job);
+    }
+    while ((job = JobQueue_Pop(&l->done)) != NULL) {
+        /* names are shared, the calling context can delete it */
+        if (job->texture) {
+            glDeleteTextures(1, &job->texture);
+        }
+        Image_Release(&job->image);
+        Job_Delete(job);
+    }
+    DeleteSharedContext(l->egl);
+    pthread_cond_destroy(&l->cond_idle);
+    pthread_cond_destroy(&l->cond_job);
+    pthread_mutex_destroy(&l->mutex);
+    free(l);
+}
+
+int ImageLoader_Submit(ImageLoader *l, int id, unsigned int generation, const char *path)
+{
+    Job *job;
+    char *copy;
+
+    copy = strdup(path);
+    if (!copy) {
+        return 1;
+    }
+
+    pthread_mutex_lock(&l->mutex);
+    job = JobQueue_Find(&l->pending, id);
+    if (job) {
+        /* not started yet: decode only the latest */
+        free(job->path);
+        job->path = copy;
+        job->generation = generation;
+        pthread_mutex_unlock(&l->mutex);
+        return 0;
+    }
+    pthread_mutex_unlock(&l->mutex);
+
+    job = malloc(sizeof(*job));
+    if (!job) {
+        free(copy);
+        return 2;
+    }
+    job->next = NULL;
+    job->id = id;
+    job->generation = generation;
+    job->path = copy;
+    memset(&job->image, 0, sizeof(job->image));
+    job->texture = 0;
+
+    pthread_mutex_lock(&l->mutex);
+    JobQueue_Push(&l->pending, job);
+    pthread_cond_signal(&l->cond_job);
+    pthread_mutex_unlock(&l->mutex);
+    return 0;
+}
+
+int ImageLoader_Poll(ImageLoader *l, int *out_id, unsigned int *out_generation,
+                     Image *out_image, GLuint *out_texture)
+{
+    Job *job;
+
+    pthread_mutex_lock(&l->mutex);
+    job = JobQueue_Pop(&l->done);
+    pthread_mutex_unlock(&l->mutex);
+    if (job == NULL) {
+        return 0;
+    }
+    *out_id = job->id;
+    *out_generation = job->generation;
+    *out_image = job->image;
+    *out_texture = job->texture;
+    Job_Delete(job);
+    return 1;
+}
+
+void ImageLoader_Wait(ImageLoader *l)
+{
+    pthread_mutex_lock(&l->mutex);
+    while (l->pending.head || l->busy) {
+        pthread_cond_wait(&l->cond_idle, &l->mutex);
+    }
+    pthread_mutex_unlock(&l->mutex);
+}
@@ -0,0 +1,37 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* image file decoding off the render path, on one worker thread.
+ * with a context shared with the renderer, texture storage is made there too */
+
+#ifndef INCLUDED_IMAGE_LOADER_H
+#define INCLUDED_IMAGE_LOADER_H
+
+
+#include <GLES2/gl2.h>
+#include "base.h"
+#include "video_egl.h"
+#include "image.h"
+
+typedef struct ImageLoader_ ImageLoader;
+
+
+/* 'share' must be current on the calling thread. NULL, or no context can be
+ * shared: the caller allocates textures itself */
+ImageLoader *ImageLoader_Create(OPTIONAL VideoEGL *share);
+void ImageLoader_Delete(ImageLoader *l);
+
+/* path is copied. a job of the same id still waiting in queue is superseded */
+int ImageLoader_Submit(ImageLoader *l, int id, unsigned int generation, const char *path);
+
+/* non-blocking. return 1 and fill outputs when a job is finished.
+ * out_image->pixels is NULL when decoding failed, otherwise owned by caller.
+ * out_texture: storage of the image size and format, contents undefined,
+ * owned by caller. 0 when not made on the worker */
+int ImageLoader_Poll(ImageLoader *l, int *out_id, unsigned int *out_generation,
+                     Image *out_image, GLuint *out_texture);
+
+/* block until every submitted job is finished (results still come from Poll) */
+void ImageLoader_Wait(ImageLoader *l);
+
+
+#endif
@@ -0,0 +1,406 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "config.h"
+#include "base.h"
+#include "source_store.h"
+#include "knob_set.h"
+
+
+enum {
+    MAX_KNOB_NAME = 64,
+    MAX_NUMBER = 32,
+    DEFAULT_STEPS = 100         /* over the range, when no STEP is given */
+};
+
+typedef struct {
+    char name[MAX_KNOB_NAME];
+    float written;              /* in the source */
+    float value;
+    float min, max, step;
+    size_t line_start;          /* the #define line, '\n' excluded */
+    size_t line_end;
+    size_t value_start;         /* the value as written */
+    size_t value_end;
+} Knob;
+
+struct KnobSet_ {
+    Knob *knob;
+    int num_knob;
+    int max_knob;
+    size_t source_length;       /* of the source parsed */
+};
+
+
+static int FindKnob(const Knob *knob, int num_knob, const char *name)
+{
+    int i;
+    for (i = 0; i < num_knob; i++) {
+        if (strcmp(knob[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* bit exact, as written */
+static int IsSame(float a, float b)
+{
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static float Clamp(const Knob *k, float value)
+{
+    if (value < k->min) {
+        return k->min;
+    }
+    if (value > k->max) {
+        return k->max;
+    }
+    return value;
+}
+
+static const char *SkipSpace(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+/* after 'word', NULL: not there */
+static const char *MatchWord(const char *p, const char *end, const char *word)
+{
+    size_t n = strlen(word);
+    if ((size_t)(end - p) < n || strncmp(p, word, n) != 0) {
+        return NULL;
+    }
+    return p + n;
+}
+
+static int IsIdentifier(char c, int first)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'
+        || (!first && c >= '0' && c <= '9');
+}
+
+/* a whole token as a float. NULL: not a number */
+static const char *ReadNumber(const char *p, const char *end, float *out)
+{
+    char buf[MAX_NUMBER];
+    const char *token = p;
+    char *stop;
+
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r') {
+        p++;
+    }
+    if (p == token || (size_t)(p - token) >= sizeof(buf)) {
+        return NULL;
+    }
+    memcpy(buf, token, (size_t)(p - token));
+    buf[p - token] = '\0';
+    *out = strtof(buf, &stop);
+    return (*stop == '\0') ? p : NULL;
+}
+
+/* the "@knob" comment of a #define line, NULL: none */
+static const char *FindAnnotation(const char *p, const char *end)
+{
+    for (; p + 1 < end; p++) {
+        if (p[0] == '/' && p[1] == '/') {
+            const char *q = SkipSpace(p + 2, end);
+            return MatchWord(q, end, "@knob");
+        }
+    }
+    return NULL;
+}
+
+/* 1: a knob, 0: any other line, -1: annotated but malformed */
+static int ParseLine(const char *text, size_t start, size_t stop, Knob *out)
+{
+    const char *end = text + stop;
+    const char *p = SkipSpace(text + start, end);
+    const char *annotation;
+    const char *name;
+
+    if (p == end || *p != '#') {
+        return 0;
+    }
+    p = MatchWord(SkipSpace(p + 1, end), end, "define");
+    if (p == NULL || p == end || (*p != ' ' && *p != '\t')) {
+        return 0;
+    }
+    annotation = FindAnnotation(p, end);
+    if (annotation == NULL) {
+        return 0;
+    }
+    name = p = SkipSpace(p, end);
+    while (p < end && IsIdentifier(*p, p == name)) {
+        p++;
+    }
+    if (p == name || (size_t)(p - name) >= sizeof(out->name)
+        || p == end || (*p != ' ' && *p != '\t')) {
+        return -1;              /* function-like or no name */
+    }
+    memcpy(out->name, name, (size_t)(p - name));
+    out->name[p - name] = '\0';
+
+    p = SkipSpace(p, end);
+    out->value_start = (size_t)(p - text);
+    p = ReadNumber(p, end, &out->written);
+    if (p == NULL) {
+        return -1;
+    }
+    out->value_end = (size_t)(p - text);
+    p = SkipSpace(p, end);
+    if (MatchWord(p, end, "//") == NULL) {
+        return -1;              /* an expression, not a number */
+    }
+
+    p = ReadNumber(SkipSpace(annotation, end), end, &out->min);
+    p = p ? ReadNumber(SkipSpace(p, end), end, &out->max) : NULL;
+    if (p == NULL || !(out->min < out->max)) {
+        return -1;
+    }
+    out->step = (out->max - out->min) / DEFAULT_STEPS;
+    p = SkipSpace(p, end);
+    if (p < end) {
+        p = ReadNumber(p, end, &out->step);
+        if (p == NULL || !(out->step > 0.0f) || SkipSpace(p, end) != end) {
+            return -1;
+        }
+    }
+    out->value = out->written;
+    out->line_start = start;
+    out->line_end = stop;
+    return 1;
+}
+
+/* "#line N S" of the preprocessor, for messages */
+static void TrackLine(const char *p, const char *end, int *line_number, int *source_string)
+{
+    char buf[MAX_NUMBER * 2];
+    int n, s;
+
+    p = SkipSpace(p, end);
+    if (p == end || *p != '#') {
+        return;
+    }
+    p = MatchWord(SkipSpace(p + 1, end), end, "line");
+    if (p == NULL || (size_t)(end - p) >= sizeof(buf)) {
+        return;
+    }
+    memcpy(buf, p, (size_t)(end - p));
+    buf[end - p] = '\0';
+    switch (sscanf(buf, "%d %d", &n, &s)) {
+    case 2:
+        *source_string = s;
+        /* fall through */
+    case 1:
+        *line_number = n - 1;   /* of the next line */
+        break;
+    default:
+        break;
+    }
+}
+
+KnobSet *KnobSet_Create(void)
+{
+    KnobSet *ks = malloc(sizeof(*ks));
+    if (!ks) {
+        return NULL;
+    }
+    memset(ks, 0, sizeof(*ks));
+    return ks;
+}
+
+void KnobSet_Delete(KnobSet *ks)
+{
+    free(ks->knob);
+    free(ks);
+}
+
+int KnobSet_Parse(KnobSet *ks, const Source *source, const char *label)
+{
+    const char *text = Source_GetText(source);
+    size_t length = (size_t)Source_GetLength(source);
+    Knob *knob = NULL;
+    int num_knob = 0;
+    int max_knob = 0;
+    int line_number = 0;
+    int source_string = 0;
+    size_t start, stop;
+    int i, j;
+
+    for (start = 0; start < length; start = stop + 1) {
+        const char *eol = memchr(text + start, '\n', length - start);
+        Knob k;
+
+        stop = eol ? (size_t)(eol - text) : length;
+        line_number += 1;
+        switch (ParseLine(text, start, stop, &k)) {
+        case 0:
+            TrackLine(text + start, text + stop, &line_number, &source_string);
+            continue;
+        case 1:
+            break;
+        default:
+            printf("%s: %d:%d: expected #define NAME VALUE // @knob MIN MAX [STEP]\r\n",
+                   label, source_string, line_number);
+            continue;
+        }
+        if (FindKnob(knob, num_knob, k.name) >= 0) {
+            printf("%s: %d:%d: knob %s defined again, ignored\r\n",
+                   label, source_string, line_number, k.name);
+            continue;
+        }
+        if (num_knob == max_knob) {
+            int n = (max_knob == 0) ? 8 : max_knob * 2;
+            Knob *p = realloc(knob, sizeof(*p) * n);
+            if (!p) {
+                free(knob);
+                return -1;
+            }
+            knob = p;
+            max_knob = n;
+        }
+        knob[num_knob++] = k;
+    }
+
+    /* adjusted values survive edits elsewhere in the file */
+    for (i = 0; i < num_knob; i++) {
+        j = FindKnob(ks->knob, ks->num_knob, knob[i].name);
+        if (j >= 0 && IsSame(ks->knob[j].written, knob[i].written)) {
+            knob[i].value = Clamp(&knob[i], ks->knob[j].value);
+        }
+    }
+    free(ks->knob);
+    ks->knob = knob;
+    ks->num_knob = num_knob;
+    ks->max_knob = max_knob;
+    ks->source_length = length;
+    return num_knob;
+}
+
+int KnobSet_GetCount(KnobSet *ks)
+{
+    return ks->num_knob;
+}
+
+int KnobSet_Find(KnobSet *ks, const char *name)
+{
+    return FindKnob(ks->knob, ks->num_knob, name);
+}
+
+const char *KnobSet_GetName(KnobSet *ks, int index)
+{
+    assert(index >= 0 && index < ks->num_knob);
+    return ks->knob[index].name;
+}
+
+float KnobSet_GetValue(KnobSet *ks, int index)
+{
+    assert(index >= 0 && index < ks->num_knob);
+    return ks->knob[index].value;
+}
+
+void KnobSet_GetRange(KnobSet *ks, int index, float *out_min, float *out_max)
+{
+    assert(index >= 0 && index < ks->num_knob);
+    *out_min = ks->knob[index].min;
+    *out_max = ks->knob[index].max;
+}
+
+float KnobSet_SetValue(KnobSet *ks, int index, float value)
+{
+    Knob *k;
+    assert(index >= 0 && index < ks->num_knob);
+    k = &ks->knob[index];
+    k->value = Clamp(k, value);
+    return k->value;
+}
+
+float KnobSet_Step(KnobSet *ks, int index, int steps)
+{
+    assert(index >= 0 && index < ks->num_knob);
+    return KnobSet_SetValue(ks, index, ks->knob[index].value + ks->knob[index].step * steps);
+}
+
+float KnobSet_Reset(KnobSet *ks, int index)
+{
+    assert(index >= 0 && index < ks->num_knob);
+    ks->knob[index].value = ks->knob[index].written;
+    return ks->knob[index].value;
+}
+
+/* a GLSL float literal, negative ones in parentheses for "x-NAME" */
+static int FormatValue(char *buf, size_t size, float value)
+{
+    int n = snprintf(buf, size, "%.7g", (double)((value < 0.0f) ? -value : value));
+    if (strpbrk(buf, ".e") == NULL) {
+        n += snprintf(buf + n, size - (size_t)n, ".0");
+    }
+    if (value < 0.0f) {
+        memmove(buf + 2, buf, (size_t)n + 1);
+        buf[0] = '(';
+        buf[1] = '-';
+        n += 2;
+        n += snprintf(buf + n, size - (size_t)n, ")");
+    }
+    return n;
+}
+
+Source *KnobSet_Specialize(KnobSet *ks, Source *source, int live)
+{
+    const char *text = Source_GetText(source);
+    size_t length = (size_t)Source_GetLength(source);
+    size_t capacity, out_length, pos;
+    char *out;
+    Source *result;
+    int i;
+
+    assert(length == ks->source_length);
+    for (i = 0; i < ks->num_knob && !live; i++) {
+        if (!IsSame(ks->knob[i].value, ks->knob[i].written)) {
+            break;
+        }
+    }
+    if (ks->num_knob == 0 || (!live && i == ks->num_knob)) {
+        return Source_Retain(source);       /* as written */
+    }
+
+    /* a line is replaced by no more than its name and a fixed part */
+    capacity = length + (size_t)ks->num_knob * (MAX_KNOB_NAME + MAX_NUMBER * 2) + 1;
+    out = malloc(capacity);
+    if (!out) {
+        return NULL;
+    }
+    out_length = 0;
+    pos = 0;
+    for (i = 0; i < ks->num_knob; i++) {
+        const Knob *k = &ks->knob[i];
+        size_t from = live ? k->line_start : k->value_start;
+        memcpy(out + out_length, text + pos, from - pos);
+        out_length += from - pos;
+        if (live) {
+            out_length += (size_t)snprintf(out + out_length, capacity - out_length,
+                                           "uniform mediump float %s;", k->name);
+            pos = k->line_end;
+        } else {
+            out_length += (size_t)FormatValue(out + out_length, capacity - out_length, k->value);
+            pos = k->value_end;
+        }
+    }
+    memcpy(out + out_length, text + pos, length - pos);
+    out_length += length - pos;
+    out[out_length] = '\0';
+    result = Source_CreateFromBuffer(out, out_length);
+    if (!result) {
+        free(out);
+    }
+    return result;
+}
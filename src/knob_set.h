@@ -0,0 +1,44 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* "#define NAME 8.0 // @knob MIN MAX [STEP]": a float constant adjustable
+ * while running. live, the line becomes "uniform mediump float NAME;" so a
+ * change is only a uniform upload; frozen, the define again with the current
+ * value, a constant for the compiler. a knob is declared at global scope and
+ * not used in a constant expression or an #if */
+
+#ifndef INCLUDED_KNOB_SET_H
+#define INCLUDED_KNOB_SET_H
+
+
+#include <stddef.h>
+#include "base.h"
+#include "source_store.h"
+
+typedef struct KnobSet_ KnobSet;
+
+
+KnobSet *KnobSet_Create(void);
+void KnobSet_Delete(KnobSet *ks);
+
+/* the knobs of 'source', replacing the previous ones. a knob still written
+ * with the same value keeps its adjusted one. 'label' prefixes errors.
+ * return the count, -1: out of memory */
+int KnobSet_Parse(KnobSet *ks, const Source *source, const char *label);
+int KnobSet_GetCount(KnobSet *ks);
+/* -1: no such */
+int KnobSet_Find(KnobSet *ks, const char *name);
+const char *KnobSet_GetName(KnobSet *ks, int index);
+float KnobSet_GetValue(KnobSet *ks, int index);
+void KnobSet_GetRange(KnobSet *ks, int index, float *out_min, float *out_max);
+/* clamped to the range, return the value taken */
+float KnobSet_SetValue(KnobSet *ks, int index, float value);
+float KnobSet_Step(KnobSet *ks, int index, int steps);
+/* back to the value written in the source */
+float KnobSet_Reset(KnobSet *ks, int index);
+
+/* 'source', the one last parsed, with the knobs live or frozen. new
+ * reference, 'source' itself when nothing changes. NULL: out of memory */
+Source *KnobSet_Specialize(KnobSet *ks, Source *source, int live);
+
+
+#endif
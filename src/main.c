@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -28,6 +29,12 @@ static void PrintCommandUsage(void)
 {
     printf("usage: pj [options] <layer0.glsl> [layer1.glsl] [layer2.glsl] ...\r\n");
     printf("options:\r\n");
+    printf("  display:\r\n");
+    printf("    --display NAME   dispmanx, kms or headless (default: the first built in)\r\n");
+    printf("                     kms: PJ_DRM_DEVICE=/dev/dri/cardN picks the card\r\n");
+    printf("    --window-format F  RGBA8888 (default), RGB888 or RGB565\r\n");
+    printf("    --swap-interval N  vsyncs per frame: 0, 1 (default) or 2\r\n");
+    printf("    --buffers N        2 (default) or 3, kms only (3 with interval 0: mailbox)\r\n");
     printf("  offscreen format:\r\n");
     printf("    --RGB888\r\n");
     printf("    --RGBA8888 (default)\r\n");
@@ -41,21 +48,71 @@ static void PrintCommandUsage(void)
     printf("    --wrap-mirror_repeat\r\n");
     printf("  backbuffer:\r\n");
     printf("    --backbuffer   enable backbuffer(default:OFF)\r\n");
+    printf("  shader build:\r\n");
+    printf("    --include-path DIR  searched by #include, after the including file's directory\r\n");
+    printf("    --no-program-cache  do not load/store program binaries\r\n");
+    printf("  knobs (#define NAME 1.0 // @knob MIN MAX [STEP]):\r\n");
+    printf("    --control PATH  FIFO taking lines 'NAME VALUE', 'freeze' or 'live'\r\n");
+    printf("  frame pacing:\r\n");
+    printf("    --fps N[/D]    render at N fps by timer (default:0, paced by buffer swap),\r\n");
+    printf("                   with --render the frame rate of the output (default:60)\r\n");
+    printf("  offscreen scaling:\r\n");
+    printf("    --scaling N/D  (default:1/2)\r\n");
+    printf("    --governor FPS adjust scaling to hold FPS (key 'g' toggles)\r\n");
+    printf("  layer resolution:\r\n");
+    printf("    --layer-scale N/D  of the next layer only, relative to offscreen\r\n");
+    printf("                       (default: #pragma scale N/D in the shader, or 1/1)\r\n");
+    printf("  images:\r\n");
+    printf("    --image NAME=PATH  PNG, PPM or PAM as 'uniform sampler2D NAME'\r\n");
+    printf("                       (size in 'uniform vec2 NAME_resolution')\r\n");
+    printf("    --video NAME=PATH  Y4M (8 bit 4:2:0) the same way, played on 'time'\r\n");
+    printf("  audio:\r\n");
+    printf("    --audio PATH.wav         played along 'time', looping\r\n");
+    printf("    --audio-capture DEVICE   ALSA capture, e.g. default or hw:1\r\n");
+    printf("                       ('uniform sampler2D audio', float audio_bass, audio_mid,\r\n");
+    printf("                        audio_high and audio_beat)\r\n");
+    printf("  offline render (headless, fixed timestep):\r\n");
+    printf("    --render PATH   out.y4m, or a sequence like out%%05d.ppm (.png with libpng)\r\n");
+    printf("    --frames N      (default:600)\r\n");
+    printf("    --size WxH      (default:1280x720)\r\n");
+    printf("  benchmark (headless, no terminal):\r\n");
+    printf("    --bench FRAMES        render FRAMES frames on a simulated clock\r\n");
+    printf("    --bench-size WxH      window size (default:1280x720)\r\n");
+    printf("    --bench-output FILE   JSON result (default:pj-bench.json)\r\n");
+    printf("    format, interpolation and scaling options may be repeated,\r\n");
+    printf("    every combination is measured\r\n");
     printf("\r\n");
 }
 
+static int IsHeadless(int argc, char *argv[])
+{
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench") == 0 || strcmp(argv[i], "--render") == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     int ret;
+    int headless;
+
+    /* benchmark leaves the terminal alone */
+    headless = IsHeadless(argc, argv);
 
 #ifdef USE_TERMIOS
     struct termios ios_old, ios_new;
 
-    tcgetattr(STDIN_FILENO, &ios_old);
-    tcgetattr(STDIN_FILENO, &ios_new);
-    cfmakeraw(&ios_new);
-    tcsetattr(STDIN_FILENO, 0, &ios_new);
-    fcntl(0, F_SETFL, O_NONBLOCK);
+    if (!headless) {
+        tcgetattr(STDIN_FILENO, &ios_old);
+        tcgetattr(STDIN_FILENO, &ios_new);
+        cfmakeraw(&ios_new);
+        tcsetattr(STDIN_FILENO, 0, &ios_new);
+        fcntl(0, F_SETFL, O_NONBLOCK);
+    }
 #endif
 
     PJContext_HostInitialize();
@@ -68,9 +125,17 @@ int main(int argc, char *argv[])
     } else {
         PJContext *pj;
         pj = malloc(PJContext_InstanceSize());
-        PJContext_Construct(pj);
-        if (PJContext_ParseArgs(pj, argc, (const char **)argv) == 0) {
+        if (headless) {
+            ret = PJContext_ConstructHeadless(pj);
+        } else {
+            ret = PJContext_Construct(pj, argc, (const char **)argv);
+        }
+        if (ret != 0) {
+            ret = EXIT_FAILURE;
+        } else if (PJContext_ParseArgs(pj, argc, (const char **)argv) == 0) {
             ret = PJContext_Main(pj);
+        } else {
+            ret = EXIT_FAILURE;
         }
         PJContext_Destruct(pj);
         free(pj);
@@ -79,7 +144,9 @@ int main(int argc, char *argv[])
     PJContext_HostDeinitialize();
 
 #ifdef USE_TERMIOS
-    tcsetattr(STDIN_FILENO, 0, &ios_old);
+    if (!headless) {
+        tcsetattr(STDIN_FILENO, 0, &ios_old);
+    }
 #endif
     return ret;
 }
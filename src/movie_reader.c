@@ -0,0 +1,313 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "base.h"
+#include "movie_reader.h"
+
+
+enum {
+    RING_SIZE = 6,              /* frames read ahead */
+    MAX_HEADER_LENGTH = 256
+};
+
+typedef struct {
+    long sequence;              /* -1: empty or being filled */
+    unsigned char *data;
+} Slot;
+
+struct MovieReader_ {
+    int fd;
+    const unsigned char *map;
+    size_t map_size;
+    MovieReader_Info info;
+    size_t frame_size;          /* Y, U and V */
+    size_t *frame_offset;       /* of the planes of each frame */
+    Slot slot[RING_SIZE];       /* frame n lives in slot n % RING_SIZE */
+    long want;                  /* last acquired, read ahead from here */
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_want;
+    pthread_cond_t cond_ready;
+    int quit;
+};
+
+
+/* one header line, NUL terminated. NULL when there is no newline in reach */
+static const unsigned char *ReadLine(MovieReader *r, size_t offset, char *out, size_t out_size)
+{
+    size_t n;
+    for (n = 0; offset + n < r->map_size && r->map[offset + n] != '\n'; n++) {
+        if (n + 1 >= out_size) {
+            return NULL;
+        }
+        out[n] = (char)r->map[offset + n];
+    }
+    if (offset + n >= r->map_size) {
+        return NULL;
+    }
+    out[n] = '\0';
+    return r->map + offset + n + 1;
+}
+
+/* "YUV4MPEG2 W<w> H<h> F<n>:<d> I<i> A<a> C<c> X<x>" */
+static int MovieReader_ParseHeader(MovieReader *r, size_t *out_end)
+{
+    char line[MAX_HEADER_LENGTH];
+    const unsigned char *next;
+    char *token, *save;
+
+    next = ReadLine(r, 0, line, sizeof(line));
+    if (!next || strncmp(line, "YUV4MPEG2 ", 10) != 0) {
+        printf("not a Y4M file\r\n");
+        return 1;
+    }
+    r->info.fps_numer = 25;
+    r->info.fps_denom = 1;
+    for (token = strtok_r(line + 10, " ", &save); token; token = strtok_r(NULL, " ", &save)) {
+        switch (token[0]) {
+        case 'W':
+            r->info.width = atoi(token + 1);
+            break;
+        case 'H':
+            r->info.height = atoi(token + 1);
+            break;
+        case 'F':
+            if (sscanf(token + 1, "%d:%d", &r->info.fps_numer, &r->info.fps_denom) != 2
+                || r->info.fps_numer <= 0 || r->info.fps_denom <= 0) {
+                printf("Y4M: bad frame rate %s\r\n", token);
+                return 2;
+            }
+            break;
+        case 'C':
+            /* 420, 420jpeg, 420mpeg2, 420paldv: same layout, siting differs */
+            if (strncmp(token + 1, "420", 3) != 0 || (token[4] == 'p' && isdigit((unsigned char)token[5]))) {
+                printf("Y4M: only 8 bit 4:2:0 is supported, not %s\r\n", token);
+                return 3;
+            }
+            break;
+        case 'X':
+            if (strcmp(token + 1, "COLORRANGE=FULL") == 0) {
+                r->info.full_range = 1;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    if (r->info.width <= 0 || r->info.height <= 0) {
+        printf("Y4M: no size\r\n");
+        return 4;
+    }
+    r->info.chroma_width = (r->info.width + 1) / 2;
+    r->info.chroma_height = (r->info.height + 1) / 2;
+    r->frame_size = (size_t)r->info.width * r->info.height
+        + 2 * (size_t)r->info.chroma_width * r->info.chroma_height;
+    *out_end = (size_t)(next - r->map);
+    return 0;
+}
+
+/* "FRAME[ params]\n" before every frame, a truncated last one is ignored */
+static int MovieReader_IndexFrames(MovieReader *r, size_t offset)
+{
+    char line[MAX_HEADER_LENGTH];
+    int capacity = 0;
+
+    while (offset < r->map_size) {
+        const unsigned char *next = ReadLine(r, offset, line, sizeof(line));
+        size_t start;
+        if (!next || strncmp(line, "FRAME", 5) != 0) {
+            break;
+        }
+        start = (size_t)(next - r->map);
+        if (r->map_size - start < r->frame_size) {
+            break;
+        }
+        if (r->info.num_frame >= capacity) {
+            size_t *p;
+            capacity = (capacity > 0) ? capacity * 2 : 256;
+            p = realloc(r->frame_offset, sizeof(*p) * (size_t)capacity);
+            if (!p) {
+                return 1;
+            }
+            r->frame_offset = p;
+        }
+        r->frame_offset[r->info.num_frame++] = start;
+        offset = start + r->frame_size;
+    }
+    if (r->info.num_frame == 0) {
+        printf("Y4M: no frame\r\n");
+        return 2;
+    }
+    return 0;
+}
+
+/* first frame of the read-ahead window not in the ring yet, -1: all there */
+static long MovieReader_NextToRead(MovieReader *r)
+{
+    long seq;
+    for (seq = r->want; seq < r->want + RING_SIZE; seq++) {
+        if (r->slot[seq % RING_SIZE].sequence != seq) {
+            return seq;
+        }
+    }
+    return -1;
+}
+
+/* reader thread: copying out of the map takes the page faults off the render thread */
+static void *MovieReader_ReaderMain(void *arg)
+{
+    MovieReader *r = arg;
+    long seq;
+
+    pthread_mutex_lock(&r->mutex);
+    for (;;) {
+        Slot *slot;
+        while (!r->quit && (seq = MovieReader_NextToRead(r)) < 0) {
+            pthread_cond_wait(&r->cond_want, &r->mutex);
+        }
+        if (r->quit) {
+            break;
+        }
+        /* never the acquired frame: it is r->want and already in place */
+        slot = &r->slot[seq % RING_SIZE];
+        slot->sequence = -1;
+        pthread_mutex_unlock(&r->mutex);
+
+        memcpy(slot->data, r->map + r->frame_offset[seq % r->info.num_frame], r->frame_size);
+
+        pthread_mutex_lock(&r->mutex);
+        if (seq >= r->want) {
+            slot->sequence = seq;
+            pthread_cond_broadcast(&r->cond_ready);
+        }
+    }
+    pthread_mutex_unlock(&r->mutex);
+    return NULL;
+}
+
+static void MovieReader_Release(MovieReader *r)
+{
+    int i;
+    for (i = 0; i < RING_SIZE; i++) {
+        free(r->slot[i].data);
+    }
+    free(r->frame_offset);
+    if (r->map) {
+        munmap((void *)r->map, r->map_size);
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    free(r);
+}
+
+MovieReader *MovieReader_Open(const char *path)
+{
+    MovieReader *r;
+    struct stat st;
+    size_t offset;
+    int i;
+
+    r = calloc(1, sizeof(*r));
+    if (!r) {
+        return NULL;
+    }
+    r->fd = open(path, O_RDONLY);
+    if (r->fd < 0 || fstat(r->fd, &st) != 0 || st.st_size == 0) {
+        printf("movie open failed: %s\r\n", path);
+        MovieReader_Release(r);
+        return NULL;
+    }
+    r->map_size = (size_t)st.st_size;
+    r->map = mmap(NULL, r->map_size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+    if (r->map == MAP_FAILED) {
+        /* 32 bit address space runs out for files of a few GB */
+        printf("movie mmap failed: %s\r\n", path);
+        r->map = NULL;
+        MovieReader_Release(r);
+        return NULL;
+    }
+    madvise((void *)r->map, r->map_size, MADV_SEQUENTIAL);
+    if (MovieReader_ParseHeader(r, &offset) || MovieReader_IndexFrames(r, offset)) {
+        MovieReader_Release(r);
+        return NULL;
+    }
+    for (i = 0; i < RING_SIZE; i++) {
+        r->slot[i].sequence = -1;
+        r->slot[i].data = malloc(r->frame_size);
+        if (!r->slot[i].data) {
+            MovieReader_Release(r);
+            return NULL;
+        }
+    }
+    r->want = 0;
+    r->quit = 0;
+    pthread_mutex_init(&r->mutex, NULL);
+    pthread_cond_init(&r->cond_want, NULL);
+    pthread_cond_init(&r->cond_ready, NULL);
+    if (pthread_create(&r->thread, NULL, MovieReader_ReaderMain, r)) {
+        pthread_cond_destroy(&r->cond_ready);
+        pthread_cond_destroy(&r->cond_want);
+        pthread_mutex_destroy(&r->mutex);
+        MovieReader_Release(r);
+        return NULL;
+    }
+    return r;
+}
+
+void MovieReader_Close(MovieReader *r)
+{
+    pthread_mutex_lock(&r->mutex);
+    r->quit = 1;
+    pthread_cond_signal(&r->cond_want);
+    pthread_mutex_unlock(&r->mutex);
+    pthread_join(r->thread, NULL);
+
+    pthread_cond_destroy(&r->cond_ready);
+    pthread_cond_destroy(&r->cond_want);
+    pthread_mutex_destroy(&r->mutex);
+    MovieReader_Release(r);
+}
+
+void MovieReader_GetInfo(MovieReader *r, MovieReader_Info *out_info)
+{
+    *out_info = r->info;
+}
+
+int MovieReader_Acquire(MovieReader *r, long sequence, int wait, MovieReader_Frame *out_frame)
+{
+    Slot *slot = &r->slot[sequence % RING_SIZE];
+    size_t luma_size = (size_t)r->info.width * r->info.height;
+    size_t chroma_size = (size_t)r->info.chroma_width * r->info.chroma_height;
+
+    pthread_mutex_lock(&r->mutex);
+    if (r->want != sequence) {
+        r->want = sequence;
+        pthread_cond_signal(&r->cond_want);
+    }
+    while (wait && slot->sequence != sequence) {
+        pthread_cond_wait(&r->cond_ready, &r->mutex);
+    }
+    if (slot->sequence != sequence) {
+        pthread_mutex_unlock(&r->mutex);
+        return 0;
+    }
+    pthread_mutex_unlock(&r->mutex);
+
+    out_frame->plane[0] = slot->data;
+    out_frame->plane[1] = slot->data + luma_size;
+    out_frame->plane[2] = slot->data + luma_size + chroma_size;
+    return 1;
+}
@@ -0,0 +1,40 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* Y4M (8 bit 4:2:0) file, frames read ahead into a ring by a thread */
+
+#ifndef INCLUDED_MOVIE_READER_H
+#define INCLUDED_MOVIE_READER_H
+
+
+#include "base.h"
+
+typedef struct MovieReader_ MovieReader;
+
+typedef struct {
+    int width;                  /* of Y */
+    int height;
+    int chroma_width;           /* of U and V */
+    int chroma_height;
+    int fps_numer;
+    int fps_denom;
+    int num_frame;
+    int full_range;             /* XCOLORRANGE=FULL, otherwise 16..235 */
+} MovieReader_Info;
+
+typedef struct {
+    const unsigned char *plane[3]; /* Y, U, V. rows top down, tightly packed */
+} MovieReader_Frame;
+
+
+/* NULL on failure, reason is printed */
+MovieReader *MovieReader_Open(const char *path);
+void MovieReader_Close(MovieReader *r);
+void MovieReader_GetInfo(MovieReader *r, MovieReader_Info *out_info);
+
+/* frame number 'sequence' counted from the start, wrapping around the file.
+ * reading ahead follows it. return 1 when it is in the ring, 0 when not yet
+ * (unless 'wait'). the frame stays valid until the next call */
+int MovieReader_Acquire(MovieReader *r, long sequence, int wait, MovieReader_Frame *out_frame);
+
+
+#endif
@@ -20,39 +20,124 @@
 #include "base.h"
 #include "pj.h"
 #include "graphics.h"
+#include "event_loop.h"
+#include "file_watch.h"
+#include "hash.h"
+#include "histogram.h"
+#include "governor.h"
+#include "audio.h"
+#include "frame_writer.h"
+#include "preprocessor.h"
+#include "knob_set.h"
 
 
-#define MAX_SOURCE_BUF (1024*64)
 #define MOUSE_DEVICE_PATH "/dev/input/event0"
+#define RELOAD_DEBOUNCE_MS 30
+#define FRAME_TIME_SAMPLES 512
+#define MAX_SCALING_DENOM 16
+#define GOVERNOR_DEFAULT_FPS 60.0
+#define MAX_CONTROL_LINE 256
+#define BENCH_WARMUP_FRAMES 10
+#define BENCH_FRAME_RATE 60.0   /* simulated clock */
+#define BENCH_SEED 1
+#define BENCH_DEFAULT_WIDTH 1280
+#define BENCH_DEFAULT_HEIGHT 720
+#define BENCH_DEFAULT_OUTPUT "pj-bench.json"
+#define RENDER_DEFAULT_FRAMES 600
+#define RENDER_READBACK_DEPTH 3  /* frames in flight between render and glReadPixels */
 
 #define MAX(a, b) (((a) >= (b)) ? (a) : (b))
 #define MIN(a, b) (((a) <  (b)) ? (a) : (b))
 #define CLAMP(min, x, max) MIN(MAX(min, x), max)
 
-typedef struct {
+enum {
+    MAX_BENCH_SCALING = 16
+};
+
+typedef struct SourceObject_ {
     const char *path;
-    time_t last_modify_time;
+    int layer_index;            /* < 0 with image_index < 0: an #include */
+    int image_index;            /* >= 0: "--image", layer_index unused */
+    uint64_t hash;              /* of last loaded content */
+    int num_source;             /* itself and its #includes, last printed */
+    struct SourceObject_ *next; /* of the watched #include list */
+    Source *base;               /* layer: preprocessed, before its knobs */
+    KnobSet *knobs;             /* layer: @knob defines. NULL otherwise */
+    int frozen;                 /* layer: knobs left constants, no room for a uniform */
 } SourceObject;
 
+typedef struct {
+    int numer;
+    int denom;
+} BenchScaling;
+
 struct PJContext_ {
     Graphics *graphics;
+    EventLoop *loop;
+    FileWatch *watch;           /* NULL: hot reload disabled */
+    Preprocessor *preprocessor;
+    SourceObject *includes;     /* watched, each file once */
+    struct {
+        int live;               /* uniforms, else frozen into constants */
+        int layer;              /* selected for the keys */
+        int index;
+    } knob;
+    struct {
+        const char *path;       /* --control FIFO, NULL: none */
+        int fd;
+        char line[MAX_CONTROL_LINE];
+        int length;             /* of the line so far, -1: too long, skipped */
+    } control;
     Graphics_LAYOUT layout_backup;
     int is_fullscreen;
     int use_backbuffer;
+    int is_display_paced;       /* page flip events pace the loop */
     struct {
         int x, y;
         int fd;
     } mouse;
     double time_origin;
+    double fixed_step_ms;       /* simulated clock per frame, 0: wall clock */
     unsigned int frame;         /* TODO: move to graphics */
     struct {
         int debug;
         int render_time;
     } verbose;
+    struct {
+        Histogram *frame_time;  /* interval between frames */
+        double last_frame_ms;   /* rendered, or presented when display paced */
+        double next_report_ms;
+    } profile;
+    Audio *audio;               /* NULL: no --audio */
+    Governor *governor;         /* NULL: manual scaling */
+    double governor_fps;        /* 0: governor OFF at start */
     struct {
         int numer;
         int denom;
     } scaling;
+    struct {
+        int numer;
+        int denom;              /* 0: none */
+    } layer_scale;              /* for the next layer on the command line */
+    struct {
+        int frames;             /* 0: interactive */
+        const char *output;
+        int width, height;
+        /* every combination of these is measured */
+        Graphics_PIXELFORMAT format[Graphics_PIXELFORMAT_ENUMS];
+        int num_format;
+        Graphics_INTERPOLATION_MODE interpolation[Graphics_INTERPOLATION_MODE_ENUMS];
+        int num_interpolation;
+        BenchScaling scaling[MAX_BENCH_SCALING];
+        int num_scaling;
+    } bench;
+    struct {
+        const char *output;     /* NULL: interactive or bench */
+        int frames;
+        int fps_numer;
+        int fps_denom;
+        int width, height;
+    } render;
 };
 
 
@@ -66,72 +151,241 @@ static double GetCurrentTimeInMilliSecond(void)
     return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
 }
 
-static int GetLastFileModifyTime(const char *file_path, time_t *out_mod_time)
-{
-    struct stat sb;
-    if (stat(file_path, &sb) == -1) {
-        return 1;
-    }
-    *out_mod_time = sb.st_mtime;
-    return 0;
-}
-
 /* SourceObject */
-static SourceObject *SourceObject_Create(const char *path)
+static SourceObject *SourceObject_Create(const char *path, int layer_index)
 {
     SourceObject *so;
     so = malloc(sizeof(*so));
     so->path = path;
-    so->last_modify_time = 0;
+    so->layer_index = layer_index;
+    so->image_index = -1;
+    so->hash = 0;
+    so->num_source = 1;
+    so->next = NULL;
+    so->base = NULL;
+    so->knobs = NULL;
+    so->frozen = 0;
     return so;
 }
 
-static void SourceObject_Delete(void *so)
+static void SourceObject_Delete(void *p)
 {
+    SourceObject *so = p;
+    if (so->base) {
+        Source_Release(so->base);
+    }
+    if (so->knobs) {
+        KnobSet_Delete(so->knobs);
+    }
     free(so);
 }
 
+/* window options, taken before construction: the window comes first */
+static int ParseDisplayArgs(int argc, const char *argv[], Graphics_DisplayConfig *out)
+{
+    int i;
+
+    out->display = NULL;
+    out->format = Graphics_PIXELFORMAT_RGBA8888;
+    out->swap_interval = 1;
+    out->buffers = 2;
+    for (i = 1; i + 1 < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = argv[i + 1];
+        if (strcmp(arg, "--display") == 0) {
+            out->display = value;
+        } else if (strcmp(arg, "--swap-interval") == 0) {
+            out->swap_interval = atoi(value);
+            if (out->swap_interval < 0 || out->swap_interval > 2) {
+                fprintf(stderr, "invalid swap interval: %s (expected 0, 1 or 2)\r\n", value);
+                return 1;
+            }
+        } else if (strcmp(arg, "--buffers") == 0) {
+            out->buffers = atoi(value);
+            if (out->buffers < 2 || out->buffers > 3) {
+                fprintf(stderr, "invalid buffers: %s (expected 2 or 3)\r\n", value);
+                return 1;
+            }
+        } else if (strcmp(arg, "--window-format") == 0) {
+            if (strcmp(value, "RGBA8888") == 0) {
+                out->format = Graphics_PIXELFORMAT_RGBA8888;
+            } else if (strcmp(value, "RGB888") == 0) {
+                out->format = Graphics_PIXELFORMAT_RGB888;
+            } else if (strcmp(value, "RGB565") == 0) {
+                out->format = Graphics_PIXELFORMAT_RGB565;
+            } else {
+                fprintf(stderr, "invalid window format: %s (expected RGBA8888, RGB888 or RGB565)\r\n", value);
+                return 1;
+            }
+        } else {
+            continue;
+        }
+        i += 1;
+    }
+    return 0;
+}
+
 /* PJContext */
-int PJContext_Construct(PJContext *pj)
+/* argv: the window options, unused when headless */
+static int PJContext_ConstructInternal(PJContext *pj, int headless,
+                                       int argc, OPTIONAL const char *argv[])
 {
     int scaling_numer, scaling_denom;
+    pj->graphics = NULL;
+    pj->loop = NULL;
+    pj->watch = NULL;
+    pj->preprocessor = NULL;
+    pj->includes = NULL;
+    pj->mouse.fd = -1;
+    pj->knob.live = 0;
+    pj->knob.layer = 0;
+    pj->knob.index = 0;
+    pj->control.path = NULL;
+    pj->control.fd = -1;
+    pj->control.length = 0;
+    pj->profile.frame_time = NULL;
+    pj->governor = NULL;
+    pj->governor_fps = 0.0;
+    pj->audio = NULL;
     scaling_numer = 1;
     scaling_denom = 2;
-    pj->graphics = Graphics_Create(Graphics_LAYOUT_RIGHT_TOP,
-                                   scaling_numer, scaling_denom);
-    if (!pj->graphics) {
-        fprintf(stderr, "Graphics Initialize failed:\r\n");
-        fprintf(stderr, " maybe GPU memory allocation failed\r\n");
-        fprintf(stderr, " see: http://elinux.org/RPiconfig#Memory\r\n");
-        return 2;
+    if (headless) {
+        pj->graphics = Graphics_CreateHeadless(BENCH_DEFAULT_WIDTH, BENCH_DEFAULT_HEIGHT,
+                                               scaling_numer, scaling_denom);
+        if (!pj->graphics) {
+            fprintf(stderr, "Graphics Initialize failed: no EGL pbuffer support\r\n");
+            return 2;
+        }
+    } else {
+        Graphics_DisplayConfig display;
+        if (ParseDisplayArgs(argc, argv, &display)) {
+            return 1;
+        }
+        pj->graphics = Graphics_Create(&display, Graphics_LAYOUT_RIGHT_TOP,
+                                       scaling_numer, scaling_denom);
+        if (!pj->graphics) {
+            fprintf(stderr, "Graphics Initialize failed:\r\n");
+            fprintf(stderr, " maybe GPU memory allocation failed\r\n");
+            fprintf(stderr, " see: http://elinux.org/RPiconfig#Memory\r\n");
+            return 2;
+        }
     }
 
     pj->layout_backup = Graphics_LAYOUT_FULLSCREEN;
     pj->is_fullscreen = 0;
     pj->use_backbuffer = 0;
+    pj->is_display_paced = 0;
     pj->mouse.x = 0;
     pj->mouse.y = 0;
-    pj->mouse.fd = open(MOUSE_DEVICE_PATH, O_RDONLY | O_NONBLOCK);
+    if (!headless) {
+        pj->mouse.fd = open(MOUSE_DEVICE_PATH, O_RDONLY | O_NONBLOCK);
+    }
+    pj->loop = malloc(EventLoop_InstanceSize());
+    if (!pj->loop || EventLoop_Construct(pj->loop)) {
+        fprintf(stderr, "EventLoop Initialize failed\r\n");
+        free(pj->loop);
+        pj->loop = NULL;
+        return 3;
+    }
+    if (!headless) {
+        pj->watch = malloc(FileWatch_InstanceSize());
+        if (!pj->watch || FileWatch_Construct(pj->watch, RELOAD_DEBOUNCE_MS)) {
+            fprintf(stderr, "inotify unavailable, hot reload disabled\r\n");
+            free(pj->watch);
+            pj->watch = NULL;
+        }
+    }
     pj->time_origin = GetCurrentTimeInMilliSecond();
+    pj->fixed_step_ms = 0.0;
     pj->frame = 0;
     pj->verbose.render_time = 0;
+    pj->profile.frame_time = Histogram_Create(FRAME_TIME_SAMPLES);
+    pj->profile.last_frame_ms = 0.0;
+    pj->profile.next_report_ms = 0.0;
     pj->verbose.debug = 0;
     pj->scaling.numer = scaling_numer;
     pj->scaling.denom = scaling_denom;
+    pj->layer_scale.numer = 0;
+    pj->layer_scale.denom = 0;
+    pj->bench.frames = 0;
+    pj->bench.output = BENCH_DEFAULT_OUTPUT;
+    pj->bench.width = BENCH_DEFAULT_WIDTH;
+    pj->bench.height = BENCH_DEFAULT_HEIGHT;
+    pj->bench.num_format = 0;
+    pj->bench.num_interpolation = 0;
+    pj->bench.num_scaling = 0;
+    pj->render.output = NULL;
+    pj->render.frames = RENDER_DEFAULT_FRAMES;
+    pj->render.fps_numer = 60;
+    pj->render.fps_denom = 1;
+    pj->render.width = BENCH_DEFAULT_WIDTH;
+    pj->render.height = BENCH_DEFAULT_HEIGHT;
+    if (!pj->profile.frame_time) {
+        return 4;
+    }
+    pj->preprocessor = Preprocessor_Create();
+    if (!pj->preprocessor) {
+        return 5;
+    }
     return 0;
 }
 
+int PJContext_Construct(PJContext *pj, int argc, const char *argv[])
+{
+    return PJContext_ConstructInternal(pj, 0, argc, argv);
+}
+
+int PJContext_ConstructHeadless(PJContext *pj)
+{
+    return PJContext_ConstructInternal(pj, 1, 0, NULL);
+}
+
 void PJContext_Destruct(PJContext *pj)
 {
     int i;
     RenderLayer *layer;
+    void *aux;
 
+    if (pj->governor) {
+        Governor_Delete(pj->governor);
+    }
+    if (pj->audio) {
+        Audio_Close(pj->audio);
+    }
+    if (pj->profile.frame_time) {
+        Histogram_Delete(pj->profile.frame_time);
+    }
+    if (pj->watch) {
+        FileWatch_Destruct(pj->watch);
+        free(pj->watch);
+    }
+    while (pj->includes) {
+        SourceObject *next = pj->includes->next;
+        SourceObject_Delete(pj->includes);
+        pj->includes = next;
+    }
+    if (pj->preprocessor) {
+        Preprocessor_Delete(pj->preprocessor);
+    }
+    if (pj->loop) {
+        EventLoop_Destruct(pj->loop);
+        free(pj->loop);
+    }
     if (pj->mouse.fd >= 0) {
         close(pj->mouse.fd);
     }
+    if (pj->control.fd >= 0) {
+        close(pj->control.fd);
+    }
+    if (!pj->graphics) {
+        return;
+    }
     for (i = 0; (layer = Graphics_GetRenderLayer(pj->graphics, i)) != NULL; i++) {
         SourceObject_Delete(RenderLayer_GetAux(layer));
     }
+    for (i = 0; (aux = Graphics_GetImageAux(pj->graphics, i)) != NULL; i++) {
+        SourceObject_Delete(aux);
+    }
     Graphics_Delete(pj->graphics);
 }
 
@@ -185,14 +439,14 @@ static int PJContext_SwitchBackbuffer(PJContext *pj)
     return Graphics_ApplyOffscreenChange(pj->graphics);
 }
 
-static int PJContext_ChangeScaling(PJContext *pj, int add)
+static int PJContext_ApplyScaling(PJContext *pj, int add)
 {
     pj->scaling.denom += add;
     if (pj->scaling.denom <= 0) {
         pj->scaling.denom = 1;
     }
-    if (pj->scaling.denom >= 16) {
-        pj->scaling.denom = 16;
+    if (pj->scaling.denom >= MAX_SCALING_DENOM) {
+        pj->scaling.denom = MAX_SCALING_DENOM;
     }
     Graphics_SetWindowScaling(pj->graphics, pj->scaling.numer, pj->scaling.denom);
     Graphics_ApplyWindowScalingChange(pj->graphics);
@@ -205,58 +459,359 @@ static int PJContext_ChangeScaling(PJContext *pj, int add)
     return 0;
 }
 
-static int PJContext_ReloadAndRebuildShadersIfNeed(PJContext *pj)
+static int PJContext_ChangeScaling(PJContext *pj, int add)
 {
-    int i;
-    RenderLayer *layer;
+    int ret = PJContext_ApplyScaling(pj, add);
+    if (pj->governor) {
+        /* keep governing from the scale picked by hand */
+        Governor_Reset(pj->governor, GetCurrentTimeInMilliSecond());
+    }
+    return ret;
+}
 
-    /* PJDebug(pj, ("PJContext_ReloadAndRebuildShadersIfNeed\r\n")); */
-    for (i = 0; (layer = Graphics_GetRenderLayer(pj->graphics, i)) != NULL; i++) {
-        time_t t;
-        SourceObject *so;
-        so = RenderLayer_GetAux(layer);
-        if (GetLastFileModifyTime(so->path, &t)) {
-            fprintf(stderr, "file open failed: %s\r\n", so->path);
+static int PJContext_EnableGovernor(PJContext *pj, double target_fps)
+{
+    int min_denom = MAX(1, pj->scaling.numer);
+    pj->governor = Governor_Create(target_fps, min_denom, MAX_SCALING_DENOM);
+    if (!pj->governor) {
+        return 1;
+    }
+    printf("governor ON: target %.0f fps\r\n", target_fps);
+    return 0;
+}
+
+static void PJContext_SwitchGovernor(PJContext *pj)
+{
+    printf("\r\n");
+    if (pj->governor) {
+        Governor_Delete(pj->governor);
+        pj->governor = NULL;
+        printf("governor OFF\r\n");
+        return;
+    }
+    if (pj->governor_fps <= 0.0) {
+        int fps = EventLoop_GetFrameRate(pj->loop);
+        pj->governor_fps = (fps > 0) ? fps : GOVERNOR_DEFAULT_FPS;
+    }
+    PJContext_EnableGovernor(pj, pj->governor_fps);
+}
+
+static void PJContext_Govern(PJContext *pj, double frame_ms, double now)
+{
+    Governor_ACTION action;
+    action = Governor_Update(pj->governor, frame_ms, now, pj->scaling.denom);
+    if (action == Governor_ACTION_KEEP) {
+        return;
+    }
+    printf("\r\ngovernor: p95 %.1f ms for %.1f ms budget, %s\r\n",
+           Governor_GetFrameTime(pj->governor), 1000.0 / Governor_GetTargetFps(pj->governor),
+           (action == Governor_ACTION_COARSER) ? "coarser" : "trying finer");
+    PJContext_ApplyScaling(pj, (action == Governor_ACTION_COARSER) ? 1 : -1);
+}
+
+static const char *BaseName(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+/* source string numbers of the files in the compiler log, when they change */
+static void PJContext_PrintIncludes(PJContext *pj, SourceObject *so)
+{
+    int i, n;
+    n = Preprocessor_GetSourceCount(pj->preprocessor, so->path);
+    if (n == so->num_source) {
+        return;
+    }
+    so->num_source = n;
+    if (n <= 1) {
+        return;
+    }
+    printf("layer %d: #include", so->layer_index);
+    for (i = 1; i < n; i++) {
+        printf(" %d:%s", i, BaseName(Preprocessor_GetSourceName(pj->preprocessor, so->path, i)));
+    }
+    printf("\r\n");
+}
+
+/* every file a layer includes is watched too, once */
+static void PJContext_WatchIncludes(PJContext *pj, SourceObject *so)
+{
+    int i, n;
+
+    if (!pj->watch) {
+        return;
+    }
+    n = Preprocessor_GetSourceCount(pj->preprocessor, so->path);
+    for (i = 1; i < n; i++) {
+        const char *path = Preprocessor_GetSourceName(pj->preprocessor, so->path, i);
+        SourceObject *include;
+        for (include = pj->includes; include; include = include->next) {
+            if (strcmp(include->path, path) == 0) {
+                break;
+            }
+        }
+        if (include) {
             continue;
         }
-        if (so->last_modify_time != t) {
-            FILE *fp;
-            fp = fopen(so->path, "r");
-            if (fp == NULL) {
-                fprintf(stderr, "file open failed: %s\r\n", so->path);
-            } else {
-                size_t len;
-                char code[MAX_SOURCE_BUF]; /* hmm.. */
-                errno = 0;
-                len = fread(code, 1, sizeof(code), fp);
-                /* TODO: handle errno */
-                if (ferror(fp) != 0) {
-                    PJDebug(pj, ("ferror = %d\r\n", ferror(fp)));
-                }
-                fclose(fp);
-                if (errno != 0) {
-                    PJDebug(pj, ("errno = %d\r\n", errno));
-                }
-                PJDebug(pj, ("update: %s\r\n", so->path));
-                RenderLayer_UpdateShaderSource(layer, code, (int)len);
-                so->last_modify_time = t;
-                Graphics_BuildRenderLayer(pj->graphics, i);
+        include = SourceObject_Create(path, -1);
+        include->next = pj->includes;
+        pj->includes = include;
+        if (FileWatch_Add(pj->watch, path, include)) {
+            fprintf(stderr, "file watch failed: %s\r\n", path);
+        }
+    }
+}
+
+/* the knobs of a new base source, replacing the layer's */
+static void PJContext_ParseKnobs(PJContext *pj, SourceObject *so, Source *base)
+{
+    char label[32];
+    int i, n;
+
+    Source_Retain(base);
+    if (so->base) {
+        Source_Release(so->base);
+    }
+    so->base = base;
+    snprintf(label, sizeof(label), "layer %d", so->layer_index);
+    n = KnobSet_Parse(so->knobs, base, label);
+    for (i = 0; i < n; i++) {
+        float min, max;
+        KnobSet_GetRange(so->knobs, i, &min, &max);
+        PJDebug(pj, ("%s: knob %s = %g [%g .. %g]\r\n", label,
+                     KnobSet_GetName(so->knobs, i), KnobSet_GetValue(so->knobs, i), min, max));
+    }
+}
+
+/* the base source with the knobs live or frozen, for the next build */
+static int PJContext_SpecializeLayer(PJContext *pj, SourceObject *so)
+{
+    RenderLayer *layer = Graphics_GetRenderLayer(pj->graphics, so->layer_index);
+    Source *variant;
+    int frozen = 0;
+    int i;
+
+    /* a knob without its uniform would read 0, the layer stays frozen instead */
+    RenderLayer_ClearUniforms(layer);
+    for (i = 0; pj->knob.live && i < KnobSet_GetCount(so->knobs); i++) {
+        if (RenderLayer_SetUniform(layer, KnobSet_GetName(so->knobs, i), KnobSet_GetValue(so->knobs, i))) {
+            if (!so->frozen) {
+                printf("layer %d: no uniform for knob %s, knobs of the layer frozen\r\n",
+                       so->layer_index, KnobSet_GetName(so->knobs, i));
             }
+            RenderLayer_ClearUniforms(layer);
+            frozen = 1;
+            break;
         }
     }
+    so->frozen = frozen;
+    variant = KnobSet_Specialize(so->knobs, so->base, pj->knob.live && !so->frozen);
+    if (!variant) {
+        return 1;
+    }
+    RenderLayer_UpdateShaderSource(layer, variant);
+    Source_Release(variant);
     return 0;
 }
 
-static void PJContext_UpdateMousePosition(PJContext *pj)
+/* live: a uniform upload. frozen: a build, or a variant kept from before */
+static void PJContext_ApplyKnob(PJContext *pj, SourceObject *so, int index)
+{
+    RenderLayer *layer = Graphics_GetRenderLayer(pj->graphics, so->layer_index);
+    float min, max;
+
+    KnobSet_GetRange(so->knobs, index, &min, &max);
+    printf("layer %d %s = %g [%g .. %g]\r\n", so->layer_index, KnobSet_GetName(so->knobs, index),
+           KnobSet_GetValue(so->knobs, index), min, max);
+    if (pj->knob.live && !so->frozen) {
+        /* the uniform is there already, only the value changes */
+        RenderLayer_SetUniform(layer, KnobSet_GetName(so->knobs, index), KnobSet_GetValue(so->knobs, index));
+    } else if (PJContext_SpecializeLayer(pj, so) == 0) {
+        Graphics_BuildRenderLayer(pj->graphics, so->layer_index);
+    }
+}
+
+static SourceObject *PJContext_GetLayerSource(PJContext *pj, int layer_index)
+{
+    RenderLayer *layer = Graphics_GetRenderLayer(pj->graphics, layer_index);
+    return layer ? RenderLayer_GetAux(layer) : NULL;
+}
+
+/* every knob of every layer in a row, direction 0: print the selected one */
+static SourceObject *PJContext_SelectKnob(PJContext *pj, int direction)
+{
+    SourceObject *so;
+    int total, current, target;
+    int i, n;
+
+    total = 0;
+    current = -1;
+    for (i = 0; (so = PJContext_GetLayerSource(pj, i)) != NULL; i++) {
+        n = KnobSet_GetCount(so->knobs);
+        if (i == pj->knob.layer && pj->knob.index < n) {
+            current = total + pj->knob.index;
+        }
+        total += n;
+    }
+    if (total == 0) {
+        printf("no @knob in any layer\r\n");
+        return NULL;
+    }
+    target = (current < 0) ? 0 : (current + direction + total) % total;
+    for (i = 0; (so = PJContext_GetLayerSource(pj, i)) != NULL; i++) {
+        n = KnobSet_GetCount(so->knobs);
+        if (target < n) {
+            break;
+        }
+        target -= n;
+    }
+    pj->knob.layer = i;
+    pj->knob.index = target;
+    if (direction != 0 || current < 0) {
+        float min, max;
+        KnobSet_GetRange(so->knobs, target, &min, &max);
+        printf("layer %d %s = %g [%g .. %g]\r\n", i, KnobSet_GetName(so->knobs, target),
+               KnobSet_GetValue(so->knobs, target), min, max);
+    }
+    return so;
+}
+
+/* steps 0: back to the value in the source */
+static void PJContext_AdjustKnob(PJContext *pj, int steps)
+{
+    SourceObject *so = PJContext_SelectKnob(pj, 0);
+    if (!so) {
+        return;
+    }
+    if (steps == 0) {
+        KnobSet_Reset(so->knobs, pj->knob.index);
+    } else {
+        KnobSet_Step(so->knobs, pj->knob.index, steps);
+    }
+    PJContext_ApplyKnob(pj, so, pj->knob.index);
+}
+
+/* every layer with knobs changes variant, a switch back is instant */
+static void PJContext_SwitchKnobs(PJContext *pj, int live)
+{
+    SourceObject *so;
+    int i;
+
+    pj->knob.live = live;
+    for (i = 0; (so = PJContext_GetLayerSource(pj, i)) != NULL; i++) {
+        if (KnobSet_GetCount(so->knobs) > 0 && PJContext_SpecializeLayer(pj, so) == 0) {
+            Graphics_BuildRenderLayer(pj->graphics, i);
+        }
+    }
+    printf("knobs %s\r\n", live ? "live (uniforms)" : "frozen (constants)");
+}
+
+/* preprocess again and build when the result differs */
+static int PJContext_RebuildLayer(PJContext *pj, SourceObject *so)
+{
+    Source *source;
+    uint64_t hash;
+
+    if (Preprocessor_Process(pj->preprocessor, so->path, &source)) {
+        /* may be in the middle of atomic save, next event will retry */
+        return 1;
+    }
+    hash = Hash_Update(Hash_INITIAL, Source_GetText(source), (size_t)Source_GetLength(source));
+    if (hash == so->hash) {
+        PJDebug(pj, ("unchanged: %s\r\n", so->path));
+        Source_Release(source);
+        return 0;
+    }
+    PJDebug(pj, ("update: %s\r\n", so->path));
+    PJContext_ParseKnobs(pj, so, source);
+    Source_Release(source);
+    if (PJContext_SpecializeLayer(pj, so)) {
+        return 1;
+    }
+    so->hash = hash;
+    PJContext_WatchIncludes(pj, so);
+    /* programs of the old source are of no use, knob variants of it neither */
+    Graphics_DropVariants(pj->graphics, so->layer_index);
+    Graphics_BuildRenderLayer(pj->graphics, so->layer_index);
+    return 0;
+}
+
+/* only the layers including it are rebuilt */
+static int PJContext_ReloadInclude(PJContext *pj, SourceObject *so)
 {
+    RenderLayer *layer;
+    char list[256];
+    size_t len;
+    double t;
     int i;
-    const int max_zap_event = 16;
 
+    t = GetCurrentTimeInMilliSecond();
+    Preprocessor_Invalidate(pj->preprocessor, so->path);
+    len = 0;
+    list[0] = '\0';
+    for (i = 0; (layer = Graphics_GetRenderLayer(pj->graphics, i)) != NULL; i++) {
+        SourceObject *layer_so = RenderLayer_GetAux(layer);
+        if (Preprocessor_DependsOn(pj->preprocessor, layer_so->path, so->path)) {
+            PJContext_RebuildLayer(pj, layer_so);
+            if (len < sizeof(list)) {
+                len += (size_t)snprintf(list + len, sizeof(list) - len, " %d", i);
+            }
+        }
+    }
+    if (len == 0) {
+        printf("%s changed, no layer includes it\r\n", BaseName(so->path));
+        return 0;
+    }
+    printf("%s changed, rebuilding layer%s (preprocessed in %.2f ms)\r\n",
+           BaseName(so->path), list, GetCurrentTimeInMilliSecond() - t);
+    for (i = 0; (layer = Graphics_GetRenderLayer(pj->graphics, i)) != NULL; i++) {
+        PJContext_PrintIncludes(pj, RenderLayer_GetAux(layer));
+    }
+    return 0;
+}
+
+static int PJContext_ReloadSource(PJContext *pj, SourceObject *so)
+{
+    if (so->image_index >= 0) {
+        /* decoded and uploaded in the background */
+        PJDebug(pj, ("update: %s\r\n", so->path));
+        return Graphics_ReloadImage(pj->graphics, so->image_index);
+    }
+    if (so->layer_index < 0) {
+        return PJContext_ReloadInclude(pj, so);
+    }
+    Preprocessor_Invalidate(pj->preprocessor, so->path);
+    if (PJContext_RebuildLayer(pj, so)) {
+        return 1;
+    }
+    PJContext_PrintIncludes(pj, so);
+    return 0;
+}
+
+static int PJContext_ReloadAndRebuildShadersIfNeed(PJContext *pj)
+{
+    SourceObject *so;
+    double now;
+
+    /* nothing to do unless inotify reported something */
+    if (!pj->watch || !FileWatch_HasPending(pj->watch)) {
+        return 0;
+    }
+    now = GetCurrentTimeInMilliSecond();
+    while ((so = FileWatch_NextChanged(pj->watch, now)) != NULL) {
+        PJContext_ReloadSource(pj, so);
+    }
+    return 0;
+}
+
+static void PJContext_UpdateMousePosition(PJContext *pj)
+{
     if (pj->mouse.fd < 0) {
         return;
     }
 
-    for (i = 0; i < max_zap_event; i++) {
+    for (;;) {
         struct input_event ev;
         ssize_t len;
         int err;
@@ -265,17 +820,14 @@ static void PJContext_UpdateMousePosition(PJContext *pj)
         err = errno;
         errno = 0;
         if (len != sizeof(ev)) {
-            /* no more data */
-            break;
-        }
-        if (err != 0) {
-            if (err == EWOULDBLOCK || err == EAGAIN) {
-                /* ok... try again next time */
-                break;
-            } else {
+            if (len < 0 && err != EWOULDBLOCK && err != EAGAIN && err != EINTR) {
                 printf("error on mouse-read: code %d(%s)\r\n", err, strerror(err));
-                return;
+                EventLoop_RemoveWatch(pj->loop, pj->mouse.fd);
+                close(pj->mouse.fd);
+                pj->mouse.fd = -1;
             }
+            /* no more data */
+            break;
         }
         if (ev.type == EV_REL) { /* relative-move event */
             switch (ev.code) {
@@ -306,27 +858,103 @@ static void PJContext_SetUniforms(PJContext *pj)
     double mouse_x, mouse_y;
     int width, height;
 
-    t = GetCurrentTimeInMilliSecond() - pj->time_origin;
-
-    Graphics_GetWindowSize(pj->graphics, &width, &height);
-    mouse_x = (double)pj->mouse.x / width;
-    mouse_y = (double)pj->mouse.y / height;
+    if (pj->fixed_step_ms > 0.0) {
+        /* deterministic: fixed clock and mouse, rand seeded per run */
+        t = pj->frame * pj->fixed_step_ms;
+        mouse_x = 0.5;
+        mouse_y = 0.5;
+    } else {
+        t = GetCurrentTimeInMilliSecond() - pj->time_origin;
+        Graphics_GetWindowSize(pj->graphics, &width, &height);
+        mouse_x = (double)pj->mouse.x / width;
+        mouse_y = (double)pj->mouse.y / height;
+    }
 
     Graphics_SetUniforms(pj->graphics, t / 1000.0,
                          mouse_x, mouse_y, drand48());
+    if (pj->audio) {
+        Audio_SetTime(pj->audio, t / 1000.0);
+        if (pj->fixed_step_ms > 0.0) {
+            Audio_Wait(pj->audio); /* same analysis on every run */
+        }
+        Graphics_SetAudio(pj->graphics, Audio_Acquire(pj->audio));
+    }
 }
 
-static void PJContext_Render(PJContext *pj)
+static void PJContext_PrintProfile(PJContext *pj)
 {
+    Histogram_Summary hs;
+    int issued, elided;
+    printf("\r\n");
+    Graphics_PrintProfile(pj->graphics);
+    if (Histogram_Summarize(pj->profile.frame_time, &hs) == 0) {
+        printf("  frame %8.2f %8.2f %8.2f %8.2f %8.2f %8d\r\n",
+               hs.min, hs.p50, hs.p95, hs.p99, hs.max, hs.count);
+    }
+    if (Graphics_GetPresentLatency(pj->graphics, &hs) == 0) {
+        printf("  latency %6.2f %8.2f %8.2f %8.2f %8.2f %8d (%s)\r\n",
+               hs.min, hs.p50, hs.p95, hs.p99, hs.max, hs.count,
+               Graphics_GetPresentLatencyMethod(pj->graphics));
+    }
+    Graphics_GetGLCallStats(pj->graphics, &issued, &elided);
+    printf("  gl calls/frame: %d issued, %d elided\r\n", issued, elided);
+}
+
+static void PJContext_SwitchProfiling(PJContext *pj)
+{
+    pj->verbose.render_time ^= 1;
+    printf("\r\n");
+    if (Graphics_SetProfiling(pj->graphics, pj->verbose.render_time)) {
+        printf("profiling unavailable\r\n");
+        pj->verbose.render_time = 0;
+    }
+    Histogram_Clear(pj->profile.frame_time);
+    Graphics_ClearPresentLatency(pj->graphics);
+    pj->profile.last_frame_ms = 0.0;
+}
+
+static void PJContext_RecordFrameTime(PJContext *pj, double frame_ms)
+{
+    double now = GetCurrentTimeInMilliSecond();
+
+    if (pj->governor) {
+        PJContext_Govern(pj, frame_ms, now);
+    }
     if (pj->verbose.render_time) {
-        double t, ms;
-        t = GetCurrentTimeInMilliSecond();
-        Graphics_Render(pj->graphics);
-        ms = GetCurrentTimeInMilliSecond() - t;
-        printf("render time: %.1f ms (%.0f fps)    \r", ms, 1000.0 / ms);
-    } else {
-        Graphics_Render(pj->graphics);
+        Histogram_Push(pj->profile.frame_time, frame_ms);
+        /* once a second, not every frame */
+        if (now >= pj->profile.next_report_ms) {
+            Histogram_Summary hs;
+            Histogram_Summary latency;
+            if (Histogram_Summarize(pj->profile.frame_time, &hs) == 0) {
+                printf("frame time: p50 %.1f ms, p99 %.1f ms (%.0f fps)",
+                       hs.p50, hs.p99, 1000.0 / hs.p50);
+                if (Graphics_GetPresentLatency(pj->graphics, &latency) == 0) {
+                    printf(", latency p50 %.1f ms, p99 %.1f ms", latency.p50, latency.p99);
+                }
+                printf("    \r");
+                fflush(stdout);
+            }
+            pj->profile.next_report_ms = now + 1000.0;
+        }
+    }
+}
+
+static void PJContext_Render(PJContext *pj)
+{
+    double now;
+
+    Graphics_Render(pj->graphics);
+    if (pj->is_display_paced) {
+        /* timed by the page flip instead, the next frame waits for it */
+        EventLoop_HoldFrame(pj->loop, Graphics_IsSwapPending(pj->graphics));
+        return;
     }
+    now = GetCurrentTimeInMilliSecond();
+    if (pj->profile.last_frame_ms > 0.0) {
+        PJContext_RecordFrameTime(pj, now - pj->profile.last_frame_ms);
+    }
+    pj->profile.last_frame_ms = now;
 }
 
 static void PJContext_AdvanceFrame(PJContext *pj)
@@ -339,7 +967,6 @@ static int PJContext_Update(PJContext *pj)
     if (PJContext_ReloadAndRebuildShadersIfNeed(pj)) {
         return 1;
     }
-    PJContext_UpdateMousePosition(pj);
     PJContext_SetUniforms(pj);
     PJContext_Render(pj);
     PJContext_AdvanceFrame(pj);
@@ -349,103 +976,476 @@ static int PJContext_Update(PJContext *pj)
 static void PrintHelp(void)
 {
     printf("Key:\r\n");
-    printf("  t        FPS printing\r\n");
+    printf("  t        profiling ON/OFF (frame time, per-layer GPU time)\r\n");
+    printf("  p        print profile histogram\r\n");
     printf("  f        switch to fullscreen mode\r\n");
     printf("  < or >   layout change\r\n");
     printf("  [ or ]   offscreen scaling\r\n");
+    printf("  g        scaling governor ON/OFF\r\n");
     printf("  b        backbuffer ON/OFF\r\n");
+    printf("  k or K   next or previous @knob\r\n");
+    printf("  + or -   adjust the knob, 0 back to its value in the source\r\n");
+    printf("  c        knobs frozen into constants ON/OFF\r\n");
     printf("  q        exit\r\n");
 }
 
-#if 0
-static int PJContext_HandleKeyboadEvent(PJContext *pj)
+/* return 1 to exit */
+static int PJContext_HandleKeyboardEvent(PJContext *pj, int c)
 {
-    /* TODO */
+    switch (c) {
+    case 'Q':
+    case 'q':
+    case VEOF:      /* Ctrl+d */
+    case VINTR:     /* Ctrl+c */
+    case 0x7f:      /* Ctrl+c */
+    case 0x03:      /* Ctrl+c */
+    case 0x1b:      /* ESC */
+        printf("\r\nexit\r\n");
+        return 1;
+    case 'f':
+    case 'F':
+        if (PJContext_SwitchFullscreen(pj)) {
+            printf("error\r\n");
+            return 1;
+        }
+        break;
+    case '>':
+        if (PJContext_NextLayout(pj)) {
+            printf("error\r\n");
+            return 1;
+        }
+        break;
+    case '<':
+        if (PJContext_PreviousLayout(pj)) {
+            printf("error\r\n");
+            return 1;
+        }
+        break;
+    case ']':
+        PJContext_ChangeScaling(pj, 1);
+        break;
+    case '[':
+        PJContext_ChangeScaling(pj, -1);
+        break;
+    case 'g':
+    case 'G':
+        PJContext_SwitchGovernor(pj);
+        break;
+    case 't':
+    case 'T':
+        PJContext_SwitchProfiling(pj);
+        break;
+    case 'p':
+    case 'P':
+        PJContext_PrintProfile(pj);
+        break;
+    case 'b':
+        PJContext_SwitchBackbuffer(pj);
+        printf("backbuffer %s\r\n", pj->use_backbuffer ? "ON": "OFF");
+        break;
+    case 'k':
+        PJContext_SelectKnob(pj, 1);
+        break;
+    case 'K':
+        PJContext_SelectKnob(pj, -1);
+        break;
+    case '+':
+    case '=':
+        PJContext_AdjustKnob(pj, 1);
+        break;
+    case '-':
+        PJContext_AdjustKnob(pj, -1);
+        break;
+    case '0':
+        PJContext_AdjustKnob(pj, 0);
+        break;
+    case 'c':
+    case 'C':
+        PJContext_SwitchKnobs(pj, !pj->knob.live);
+        break;
+    case '?':
+        PrintHelp();
+    default:
+        break;
+    }
     return 0;
 }
-#endif
 
-static int PJContext_PrepareMainLoop(PJContext *pj)
+static int PJContext_OnKeyboardReadable(void *aux, int fd)
 {
-    return Graphics_AllocateOffscreen(pj->graphics);    
+    PJContext *pj = aux;
+    for (;;) {
+        unsigned char buf[64];
+        ssize_t i, len;
+        len = read(fd, buf, sizeof(buf));
+        if (len == 0) {
+            /* EOF: stdin is gone, keep running without keyboard */
+            EventLoop_RemoveWatch(pj->loop, fd);
+            return 0;
+        }
+        if (len < 0) {
+            /* EAGAIN: drained */
+            return 0;
+        }
+        for (i = 0; i < len; i++) {
+            if (PJContext_HandleKeyboardEvent(pj, buf[i])) {
+                return 1;
+            }
+        }
+    }
 }
 
-static void PJContext_MainLoop(PJContext *pj)
+/* "NAME VALUE" sets the knob in every layer having it, "freeze" or "live" */
+static void PJContext_HandleControl(PJContext *pj, const char *line)
+{
+    SourceObject *so;
+    char name[64];
+    float value;
+    int found;
+    int i;
+
+    if (line[0] == '\0') {
+        return;
+    }
+    if (strcmp(line, "freeze") == 0 || strcmp(line, "live") == 0) {
+        PJContext_SwitchKnobs(pj, strcmp(line, "live") == 0);
+        return;
+    }
+    if (sscanf(line, "%63s %f", name, &value) != 2) {
+        printf("control: expected NAME VALUE, freeze or live: %s\r\n", line);
+        return;
+    }
+    found = 0;
+    for (i = 0; (so = PJContext_GetLayerSource(pj, i)) != NULL; i++) {
+        int index = KnobSet_Find(so->knobs, name);
+        if (index >= 0) {
+            KnobSet_SetValue(so->knobs, index, value);
+            PJContext_ApplyKnob(pj, so, index);
+            found = 1;
+        }
+    }
+    if (!found) {
+        printf("control: no knob %s\r\n", name);
+    }
+}
+
+static int PJContext_OnControlReadable(void *aux, int fd)
 {
+    PJContext *pj = aux;
     for (;;) {
-        switch (getchar()) {
-        case 'Q':
-        case 'q':
-        case VEOF:      /* Ctrl+d */
-        case VINTR:     /* Ctrl+c */
-        case 0x7f:      /* Ctrl+c */
-        case 0x03:      /* Ctrl+c */
-        case 0x1b:      /* ESC */
-            printf("\r\nexit\r\n");
-            goto goal;
-        case 'f':
-        case 'F':
-            if (PJContext_SwitchFullscreen(pj)) {
-                printf("error\r\n");
-                goto goal;
-            }
-            break;
-        case '>':
-            if (PJContext_NextLayout(pj)) {
-                printf("error\r\n");
-                goto goal;
-            }
-            break;
-        case '<':
-            if (PJContext_PreviousLayout(pj)) {
-                printf("error\r\n");
-                goto goal;
+        char buf[256];
+        ssize_t i, len;
+        len = read(fd, buf, sizeof(buf));
+        if (len <= 0) {
+            /* EAGAIN: drained. never EOF, we are a writer too */
+            return 0;
+        }
+        for (i = 0; i < len; i++) {
+            if (buf[i] == '\n') {
+                if (pj->control.length >= 0) {
+                    pj->control.line[pj->control.length] = '\0';
+                    PJContext_HandleControl(pj, pj->control.line);
+                }
+                pj->control.length = 0;
+            } else if (pj->control.length >= 0
+                       && pj->control.length + 1 < (int)sizeof(pj->control.line)) {
+                pj->control.line[pj->control.length++] = buf[i];
+            } else {
+                pj->control.length = -1;
             }
-            break;
-        case ']':
-            PJContext_ChangeScaling(pj, 1);
-            break;
-        case '[':
-            PJContext_ChangeScaling(pj, -1);
-            break;
-        case 't':
-        case 'T':
-            pj->verbose.render_time ^= 1;
-            printf("\r\n");
-            break;
-        case 'b':
-            PJContext_SwitchBackbuffer(pj);
-            printf("backbuffer %s\r\n", pj->use_backbuffer ? "ON": "OFF");
-            break;
-        case '?':
-            PrintHelp();
-        default:
-            break;
         }
+    }
+}
+
+/* a FIFO, made when missing. opened read-write so that writers coming and
+ * going never make it read EOF */
+static int PJContext_OpenControl(PJContext *pj)
+{
+    const char *path = pj->control.path;
+    struct stat st;
+
+    if (stat(path, &st) != 0 && mkfifo(path, 0600) != 0) {
+        printf("control: %s: %s\r\n", path, strerror(errno));
+        return 1;
+    }
+    pj->control.fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (pj->control.fd < 0) {
+        printf("control: %s: %s\r\n", path, strerror(errno));
+        return 2;
+    }
+    if (EventLoop_AddWatch(pj->loop, pj->control.fd, PJContext_OnControlReadable, pj)) {
+        printf("control: %s is not pollable\r\n", path);
+        close(pj->control.fd);
+        pj->control.fd = -1;
+        return 3;
+    }
+    return 0;
+}
+
+static int PJContext_OnMouseReadable(void *aux, int fd)
+{
+    PJContext *pj = aux;
+    (void)fd;
+    PJContext_UpdateMousePosition(pj);
+    return 0;
+}
+
+static int PJContext_OnDisplayReadable(void *aux, int fd)
+{
+    PJContext *pj = aux;
+    double present_ms;
+    (void)fd;
+    if (Graphics_HandleDisplayEvents(pj->graphics, &present_ms)) {
+        /* interval on screen, what the audience sees */
+        if (pj->profile.last_frame_ms > 0.0) {
+            PJContext_RecordFrameTime(pj, present_ms - pj->profile.last_frame_ms);
+        }
+        pj->profile.last_frame_ms = present_ms;
+    }
+    EventLoop_HoldFrame(pj->loop, Graphics_IsSwapPending(pj->graphics));
+    return 0;
+}
+
+static int PJContext_OnFileWatchReadable(void *aux, int fd)
+{
+    PJContext *pj = aux;
+    (void)fd;
+    FileWatch_ReadEvents(pj->watch, GetCurrentTimeInMilliSecond());
+    return 0;
+}
+
+static int PJContext_PrepareMainLoop(PJContext *pj)
+{
+    int i;
+    SourceObject *so;
+
+    /* knobs are for live coding, bench and render take the files as written */
+    pj->knob.live = 1;
+    for (i = 0; (so = PJContext_GetLayerSource(pj, i)) != NULL; i++) {
+        if (KnobSet_GetCount(so->knobs) > 0) {
+            printf("layer %d: %d knobs, live\r\n", i, KnobSet_GetCount(so->knobs));
+            PJContext_SpecializeLayer(pj, so);
+        }
+        Graphics_BuildRenderLayer(pj->graphics, i);
+    }
+    /* later rebuilds are asynchronous, but start with every layer ready */
+    Graphics_FinishBuild(pj->graphics);
+    Graphics_FinishImageLoads(pj->graphics);
+    Graphics_PrintBuildStats(pj->graphics);
+    if (pj->watch) {
+        EventLoop_AddWatch(pj->loop, FileWatch_GetFd(pj->watch), PJContext_OnFileWatchReadable, pj);
+    }
+    if (EventLoop_AddWatch(pj->loop, STDIN_FILENO, PJContext_OnKeyboardReadable, pj)) {
+        printf("stdin is not pollable, keyboard disabled\r\n");
+    }
+    if (pj->mouse.fd >= 0) {
+        EventLoop_AddWatch(pj->loop, pj->mouse.fd, PJContext_OnMouseReadable, pj);
+    }
+    if (pj->control.path) {
+        PJContext_OpenControl(pj);
+    }
+    if (Graphics_GetDisplayFd(pj->graphics) >= 0
+        && EventLoop_AddWatch(pj->loop, Graphics_GetDisplayFd(pj->graphics),
+                              PJContext_OnDisplayReadable, pj) == 0) {
+        pj->is_display_paced = 1;
+    }
+    if (pj->governor_fps > 0.0) {
+        PJContext_EnableGovernor(pj, pj->governor_fps);
+    }
+    return Graphics_AllocateOffscreen(pj->graphics);
+}
+
+static void PJContext_MainLoop(PJContext *pj)
+{
+    /* every pending key/mouse event is handled before each frame */
+    while (EventLoop_WaitFrame(pj->loop) == 0) {
         if (PJContext_Update(pj)) {
             break;
         }
     }
-  goal:
-    return;
 }
 
-static int PJContext_AppendLayer(PJContext *pj, const char *path)
+/* "effects/blur.glsl" -> "blur" */
+static void LayerNameFromPath(const char *path, char *out, size_t out_size)
 {
-    SourceObject *so;
-    FILE *fp;
-    char code[MAX_SOURCE_BUF];
+    const char *base;
+    const char *dot;
     size_t len;
+
+    base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    dot = strrchr(base, '.');
+    len = dot ? (size_t)(dot - base) : strlen(base);
+    if (len >= out_size) {
+        len = out_size - 1;
+    }
+    memcpy(out, base, len);
+    out[len] = '\0';
+}
+
+static int PJContext_AppendLayer(PJContext *pj, const char *path, int layer_index)
+{
+    SourceObject *so;
+    Source *source;
     PJDebug(pj, ("PJContext_AppendLayer: %s\r\n", path));
-    fp = fopen(path, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "file open failed: %s\r\n", path);
+    if (Preprocessor_Process(pj->preprocessor, path, &source)) {
+        fprintf(stderr, "layer load failed: %s\r\n", path);
         return 1;
     }
-    len = fread(code, 1, sizeof(code), fp);
-    fclose(fp);
-    so = SourceObject_Create(path);
-    Graphics_AppendRenderLayer(pj->graphics, code, (int)len, (void *)so);
+    so = SourceObject_Create(path, layer_index);
+    so->hash = Hash_Update(Hash_INITIAL, Source_GetText(source), (size_t)Source_GetLength(source));
+    so->knobs = KnobSet_Create();
+    if (so->knobs) {
+        PJContext_ParseKnobs(pj, so, source);
+    }
+    /* as written, the knobs go live with the main loop */
+    if (!so->knobs || Graphics_AppendRenderLayer(pj->graphics, source, (void *)so)) {
+        fprintf(stderr, "layer append failed: %s\r\n", path);
+        Source_Release(source);
+        SourceObject_Delete(so);
+        return 2;
+    }
+    Source_Release(source);
+    {
+        char name[64];
+        LayerNameFromPath(path, name, sizeof(name));
+        RenderLayer_SetName(Graphics_GetRenderLayer(pj->graphics, layer_index), name);
+    }
+    if (pj->watch && FileWatch_Add(pj->watch, path, so)) {
+        fprintf(stderr, "file watch failed: %s\r\n", path);
+    }
+    PJContext_WatchIncludes(pj, so);
+    PJContext_PrintIncludes(pj, so);
+    return 0;
+}
+
+/* "<sampler>=<path>". NULL: malformed */
+static const char *SplitNameAndPath(const char *arg, char *out_name, size_t name_size)
+{
+    const char *path = strchr(arg, '=');
+    if (path == NULL || path == arg || (size_t)(path - arg) >= name_size || path[1] == '\0') {
+        return NULL;
+    }
+    memcpy(out_name, arg, (size_t)(path - arg));
+    out_name[path - arg] = '\0';
+    return path + 1;
+}
+
+static int PJContext_AddImage(PJContext *pj, const char *arg, int image_index)
+{
+    SourceObject *so;
+    const char *path;
+    char name[64];
+
+    path = SplitNameAndPath(arg, name, sizeof(name));
+    if (path == NULL) {
+        fprintf(stderr, "invalid image: %s (expected NAME=PATH)\r\n", arg);
+        return 1;
+    }
+
+    so = SourceObject_Create(path, -1);
+    so->image_index = image_index;
+    if (Graphics_AddImage(pj->graphics, name, path, so)) {
+        fprintf(stderr, "image add failed: %s\r\n", arg);
+        SourceObject_Delete(so);
+        return 2;
+    }
+    if (pj->watch && FileWatch_Add(pj->watch, path, so)) {
+        fprintf(stderr, "file watch failed: %s\r\n", path);
+    }
+    return 0;
+}
+
+/* not watched: a file being rewritten is read as it goes */
+static int PJContext_AddMovie(PJContext *pj, const char *arg)
+{
+    const char *path;
+    char name[64];
+
+    path = SplitNameAndPath(arg, name, sizeof(name));
+    if (path == NULL) {
+        fprintf(stderr, "invalid video: %s (expected NAME=PATH)\r\n", arg);
+        return 1;
+    }
+    if (Graphics_AddMovie(pj->graphics, name, path)) {
+        fprintf(stderr, "video add failed: %s\r\n", arg);
+        return 2;
+    }
+    return 0;
+}
+
+static const char *PixelFormatName(Graphics_PIXELFORMAT format)
+{
+    switch (format) {
+    case Graphics_PIXELFORMAT_RGB888:
+        return "RGB888";
+    case Graphics_PIXELFORMAT_RGBA8888:
+        return "RGBA8888";
+    case Graphics_PIXELFORMAT_RGB565:
+        return "RGB565";
+    case Graphics_PIXELFORMAT_RGBA5551:
+        return "RGBA5551";
+    case Graphics_PIXELFORMAT_RGBA4444:
+        return "RGBA4444";
+    default:
+        assert(0);
+        return "?";
+    }
+}
+
+static const char *InterpolationModeName(Graphics_INTERPOLATION_MODE mode)
+{
+    switch (mode) {
+    case Graphics_INTERPOLATION_MODE_NEARESTNEIGHBOR:
+        return "nearestneighbor";
+    case Graphics_INTERPOLATION_MODE_BILINEAR:
+        return "bilinear";
+    default:
+        assert(0);
+        return "?";
+    }
+}
+
+/* the last one on the command line wins, benchmark measures all of them */
+static void PJContext_SelectPixelFormat(PJContext *pj, Graphics_PIXELFORMAT format)
+{
+    int i;
+    Graphics_SetOffscreenPixelFormat(pj->graphics, format);
+    for (i = 0; i < pj->bench.num_format; i++) {
+        if (pj->bench.format[i] == format) {
+            return;
+        }
+    }
+    pj->bench.format[pj->bench.num_format++] = format;
+}
+
+static void PJContext_SelectInterpolationMode(PJContext *pj, Graphics_INTERPOLATION_MODE mode)
+{
+    int i;
+    Graphics_SetOffscreenInterpolationMode(pj->graphics, mode);
+    for (i = 0; i < pj->bench.num_interpolation; i++) {
+        if (pj->bench.interpolation[i] == mode) {
+            return;
+        }
+    }
+    pj->bench.interpolation[pj->bench.num_interpolation++] = mode;
+}
+
+static int PJContext_SelectScaling(PJContext *pj, const char *arg)
+{
+    int numer, denom;
+    if (sscanf(arg, "%d/%d", &numer, &denom) != 2
+        || numer <= 0 || denom <= 0 || numer > denom) {
+        fprintf(stderr, "invalid scaling: %s (expected N/D, N <= D)\r\n", arg);
+        return 1;
+    }
+    pj->scaling.numer = numer;
+    pj->scaling.denom = denom;
+    if (pj->bench.num_scaling < MAX_BENCH_SCALING) {
+        pj->bench.scaling[pj->bench.num_scaling].numer = numer;
+        pj->bench.scaling[pj->bench.num_scaling].denom = denom;
+        pj->bench.num_scaling += 1;
+    }
     return 0;
 }
 
@@ -453,24 +1453,33 @@ int PJContext_ParseArgs(PJContext *pj, int argc, const char *argv[])
 {
     int i;
     int layer;
+    int image;
     Graphics *g;
 
     g = pj->graphics;
     layer = 0;
+    image = 0;
+    /* every layer sees the whole search path */
+    for (i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--include-path") == 0) {
+            i += 1;
+            Preprocessor_AddSearchPath(pj->preprocessor, argv[i]);
+        }
+    }
     for (i = 1; i < argc; i++) {
         const char *arg = argv[i];
         if (strcmp(arg, "--debug") == 0) {
             pj->verbose.debug = 1;
         } else if (strcmp(arg, "--RGB888") == 0) {
-            Graphics_SetOffscreenPixelFormat(g, Graphics_PIXELFORMAT_RGB888);
+            PJContext_SelectPixelFormat(pj, Graphics_PIXELFORMAT_RGB888);
         } else if (strcmp(arg, "--RGBA8888") == 0) {
-            Graphics_SetOffscreenPixelFormat(g, Graphics_PIXELFORMAT_RGBA8888);
+            PJContext_SelectPixelFormat(pj, Graphics_PIXELFORMAT_RGBA8888);
         } else if (strcmp(arg, "--RGB565") == 0) {
-            Graphics_SetOffscreenPixelFormat(g, Graphics_PIXELFORMAT_RGB565);
+            PJContext_SelectPixelFormat(pj, Graphics_PIXELFORMAT_RGB565);
         } else if (strcmp(arg, "--nearestneighbor") == 0) {
-            Graphics_SetOffscreenInterpolationMode(g, Graphics_INTERPOLATION_MODE_NEARESTNEIGHBOR);
+            PJContext_SelectInterpolationMode(pj, Graphics_INTERPOLATION_MODE_NEARESTNEIGHBOR);
         } else if (strcmp(arg, "--bilinear") == 0) {
-            Graphics_SetOffscreenInterpolationMode(g, Graphics_INTERPOLATION_MODE_BILINEAR);
+            PJContext_SelectInterpolationMode(pj, Graphics_INTERPOLATION_MODE_BILINEAR);
         } else if (strcmp(arg, "--wrap-clamp_to_edge") == 0) {
             Graphics_SetOffscreenWrapMode(g, Graphics_WRAP_MODE_CLAMP_TO_EDGE);
         } else if (strcmp(arg, "--wrap-repeat") == 0) {
@@ -479,17 +1488,413 @@ int PJContext_ParseArgs(PJContext *pj, int argc, const char *argv[])
             Graphics_SetOffscreenWrapMode(g, Graphics_WRAP_MODE_MIRRORED_REPEAT);
         } else if (strcmp(arg, "--backbuffer") == 0) {
             pj->use_backbuffer = 1;
+        } else if (strcmp(arg, "--no-program-cache") == 0) {
+            Graphics_SetProgramCache(g, 0);
+        } else if (strcmp(arg, "--fps") == 0 && i + 1 < argc) {
+            int numer, denom = 1;
+            i += 1;
+            /* N/D is for --render, the timer takes whole fps */
+            if (sscanf(argv[i], "%d/%d", &numer, &denom) < 1 || numer < 0 || denom <= 0) {
+                fprintf(stderr, "invalid fps: %s (expected N or N/D)\r\n", argv[i]);
+                return 1;
+            }
+            EventLoop_SetFrameRate(pj->loop, (numer + denom / 2) / denom);
+            if (numer > 0) {
+                pj->render.fps_numer = numer;
+                pj->render.fps_denom = denom;
+            }
+        } else if (strcmp(arg, "--governor") == 0 && i + 1 < argc) {
+            i += 1;
+            pj->governor_fps = atof(argv[i]);
+            if (pj->governor_fps <= 0.0) {
+                fprintf(stderr, "invalid governor target: %s\r\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(arg, "--scaling") == 0 && i + 1 < argc) {
+            i += 1;
+            if (PJContext_SelectScaling(pj, argv[i])) {
+                return 1;
+            }
+        } else if (strcmp(arg, "--layer-scale") == 0 && i + 1 < argc) {
+            i += 1;
+            if (sscanf(argv[i], "%d/%d", &pj->layer_scale.numer, &pj->layer_scale.denom) != 2
+                || pj->layer_scale.numer <= 0 || pj->layer_scale.denom <= 0
+                || pj->layer_scale.numer > pj->layer_scale.denom) {
+                fprintf(stderr, "invalid layer scale: %s (expected N/D, N <= D)\r\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(arg, "--image") == 0 && i + 1 < argc) {
+            i += 1;
+            if (PJContext_AddImage(pj, argv[i], image)) {
+                return 1;
+            }
+            image += 1;
+        } else if ((strcmp(arg, "--audio") == 0 || strcmp(arg, "--audio-capture") == 0)
+                   && i + 1 < argc) {
+            i += 1;
+            if (pj->audio) {
+                Audio_Close(pj->audio);
+            }
+            pj->audio = (strcmp(arg, "--audio") == 0)
+                ? Audio_OpenFile(argv[i]) : Audio_OpenCapture(argv[i]);
+            if (pj->audio == NULL) {
+                return 1;
+            }
+        } else if (strcmp(arg, "--video") == 0 && i + 1 < argc) {
+            i += 1;
+            if (PJContext_AddMovie(pj, argv[i])) {
+                return 1;
+            }
+        } else if (strcmp(arg, "--render") == 0 && i + 1 < argc) {
+            i += 1;
+            pj->render.output = argv[i];
+        } else if (strcmp(arg, "--frames") == 0 && i + 1 < argc) {
+            i += 1;
+            pj->render.frames = MAX(1, atoi(argv[i]));
+        } else if (strcmp(arg, "--size") == 0 && i + 1 < argc) {
+            i += 1;
+            if (sscanf(argv[i], "%dx%d", &pj->render.width, &pj->render.height) != 2
+                || pj->render.width <= 0 || pj->render.height <= 0) {
+                fprintf(stderr, "invalid size: %s (expected WxH)\r\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(arg, "--bench") == 0 && i + 1 < argc) {
+            i += 1;
+            pj->bench.frames = MAX(1, atoi(argv[i]));
+        } else if (strcmp(arg, "--include-path") == 0 && i + 1 < argc) {
+            i += 1;             /* taken before the layers */
+        } else if (strcmp(arg, "--control") == 0 && i + 1 < argc) {
+            i += 1;
+            pj->control.path = argv[i];
+        } else if ((strcmp(arg, "--display") == 0
+                    || strcmp(arg, "--swap-interval") == 0
+                    || strcmp(arg, "--buffers") == 0
+                    || strcmp(arg, "--window-format") == 0) && i + 1 < argc) {
+            i += 1;             /* taken before construction */
+        } else if (strcmp(arg, "--bench-output") == 0 && i + 1 < argc) {
+            i += 1;
+            pj->bench.output = argv[i];
+        } else if (strcmp(arg, "--bench-size") == 0 && i + 1 < argc) {
+            i += 1;
+            if (sscanf(argv[i], "%dx%d", &pj->bench.width, &pj->bench.height) != 2
+                || pj->bench.width <= 0 || pj->bench.height <= 0) {
+                fprintf(stderr, "invalid size: %s (expected WxH)\r\n", argv[i]);
+                return 1;
+            }
         } else {
             printf("layer %d: %s\r\n", layer, arg);
-            PJContext_AppendLayer(pj, arg);
-            layer += 1;
+            if (PJContext_AppendLayer(pj, arg, layer) == 0) {
+                if (pj->layer_scale.denom > 0) {
+                    RenderLayer_SetScale(Graphics_GetRenderLayer(g, layer),
+                                         pj->layer_scale.numer, pj->layer_scale.denom);
+                }
+                layer += 1;
+            }
+            pj->layer_scale.denom = 0;
         }
     }
     Graphics_SetBackbuffer(g, pj->use_backbuffer);
-    Graphics_ApplyOffscreenChange(pj->graphics);
+    Graphics_SetWindowScaling(g, pj->scaling.numer, pj->scaling.denom);
+    Graphics_ApplyWindowScalingChange(pj->graphics);
     return (layer == 0) ? 1 : 0;
 }
 
+static void WriteJSONString(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (; *str; str++) {
+        unsigned char c = (unsigned char)*str;
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void WriteJSONSummary(FILE *fp, const Histogram_Summary *hs)
+{
+    fprintf(fp, "{\"min\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"samples\": %d}",
+            hs->min, hs->p50, hs->p95, hs->p99, hs->max, hs->count);
+}
+
+static int PJContext_BenchmarkRun(PJContext *pj, FILE *fp, Histogram *frame_time,
+                                  Graphics_PIXELFORMAT format, BenchScaling scaling,
+                                  Graphics_INTERPOLATION_MODE interpolation)
+{
+    Graphics *g = pj->graphics;
+    Histogram_Summary hs;
+    RenderLayer *layer;
+    int width, height;
+    int issued, elided;
+    int i;
+
+    Graphics_SetOffscreenPixelFormat(g, format);
+    Graphics_SetOffscreenInterpolationMode(g, interpolation);
+    Graphics_SetWindowScaling(g, scaling.numer, scaling.denom);
+    if (Graphics_ApplyWindowScalingChange(g)) {
+        /* the run stays in the list, the JSON stays valid */
+        fprintf(fp, "    {\"format\": \"%s\", \"scaling\": \"%d/%d\", \"interpolation\": \"%s\", "
+                "\"error\": \"surface allocation failed\"}",
+                PixelFormatName(format), scaling.numer, scaling.denom,
+                InterpolationModeName(interpolation));
+        return 1;
+    }
+    Graphics_GetSourceSize(g, &width, &height);
+    printf("bench: %s %d/%d %s, %dx%d px\r\n",
+           PixelFormatName(format), scaling.numer, scaling.denom,
+           InterpolationModeName(interpolation), width, height);
+
+    srand48(BENCH_SEED);
+    pj->frame = 0;
+    for (i = 0; i < BENCH_WARMUP_FRAMES; i++) {
+        PJContext_SetUniforms(pj);
+        Graphics_Render(g);
+        PJContext_AdvanceFrame(pj);
+    }
+    Graphics_Finish(g);
+
+    Histogram_Clear(frame_time);
+    if (Graphics_SetProfiling(g, 1)) {
+        printf("bench: per-layer gpu timing unavailable\r\n");
+    }
+    for (i = 0; i < pj->bench.frames; i++) {
+        double t = GetCurrentTimeInMilliSecond();
+        PJContext_SetUniforms(pj);
+        Graphics_Render(g);
+        Graphics_Finish(g);
+        Histogram_Push(frame_time, GetCurrentTimeInMilliSecond() - t);
+        PJContext_AdvanceFrame(pj);
+    }
+
+    fprintf(fp, "    {\n");
+    fprintf(fp, "      \"format\": \"%s\",\n", PixelFormatName(format));
+    fprintf(fp, "      \"scaling\": \"%d/%d\",\n", scaling.numer, scaling.denom);
+    fprintf(fp, "      \"interpolation\": \"%s\",\n", InterpolationModeName(interpolation));
+    fprintf(fp, "      \"offscreen_size\": [%d, %d],\n", width, height);
+    fprintf(fp, "      \"offscreen_bytes\": %lu,\n", (unsigned long)Graphics_GetOffscreenMemorySize(g));
+    fprintf(fp, "      \"gpu_timing\": \"%s\",\n", Graphics_GetProfilingMethod(g));
+    Graphics_GetGLCallStats(g, &issued, &elided);
+    fprintf(fp, "      \"gl_calls\": {\"issued\": %d, \"elided\": %d},\n", issued, elided);
+    fprintf(fp, "      \"frame_ms\": ");
+    if (Histogram_Summarize(frame_time, &hs) == 0) {
+        WriteJSONSummary(fp, &hs);
+    } else {
+        fprintf(fp, "null");
+    }
+    fprintf(fp, ",\n      \"layers\": [\n");
+    for (i = 0; (layer = Graphics_GetRenderLayer(g, i)) != NULL; i++) {
+        SourceObject *so = RenderLayer_GetAux(layer);
+        fprintf(fp, "        {\"source\": ");
+        WriteJSONString(fp, so->path);
+        RenderLayer_GetSize(layer, &width, &height);
+        fprintf(fp, ", \"culled\": %s", RenderLayer_IsCulled(layer) ? "true" : "false");
+        fprintf(fp, ", \"size\": [%d, %d]", width, height);
+        fprintf(fp, ", \"gpu_ms\": ");
+        if (Graphics_GetLayerProfile(g, i, &hs) == 0) {
+            WriteJSONSummary(fp, &hs);
+        } else {
+            fprintf(fp, "null");
+        }
+        fprintf(fp, "}%s\n", (Graphics_GetRenderLayer(g, i + 1) != NULL) ? "," : "");
+    }
+    fprintf(fp, "      ]\n    }");
+
+    Graphics_SetProfiling(g, 0);
+    return 0;
+}
+
+static int PJContext_Benchmark(PJContext *pj)
+{
+    Graphics *g = pj->graphics;
+    Histogram *frame_time;
+    FILE *fp;
+    double *compile_ms;
+    double total_ms;
+    int num_layer;
+    int f, s, m;
+    int i;
+    int is_first;
+    int result;
+
+    /* nothing on the command line: measure the current setting only */
+    if (pj->bench.num_format == 0) {
+        PJContext_SelectPixelFormat(pj, Graphics_PIXELFORMAT_RGBA8888);
+    }
+    if (pj->bench.num_interpolation == 0) {
+        PJContext_SelectInterpolationMode(pj, Graphics_INTERPOLATION_MODE_NEARESTNEIGHBOR);
+    }
+    if (pj->bench.num_scaling == 0) {
+        pj->bench.scaling[0].numer = pj->scaling.numer;
+        pj->bench.scaling[0].denom = pj->scaling.denom;
+        pj->bench.num_scaling = 1;
+    }
+    Graphics_SetHeadlessSize(g, pj->bench.width, pj->bench.height);
+    pj->fixed_step_ms = 1000.0 / BENCH_FRAME_RATE;
+
+    /* one layer at a time, without the binary cache, so each build is real */
+    num_layer = 0;
+    while (Graphics_GetRenderLayer(g, num_layer) != NULL) {
+        num_layer += 1;
+    }
+    compile_ms = malloc(sizeof(*compile_ms) * (size_t)num_layer);
+    if (!compile_ms) {
+        return EXIT_FAILURE;
+    }
+    Graphics_SetProgramCache(g, 0);
+    for (i = 0; i < num_layer; i++) {
+        double t = GetCurrentTimeInMilliSecond();
+        Graphics_BuildRenderLayer(g, i);
+        Graphics_FinishBuild(g);
+        compile_ms[i] = GetCurrentTimeInMilliSecond() - t;
+        if (!Graphics_IsLayerBuilt(g, i)) {
+            /* timings of a program that is not there mean nothing */
+            fprintf(stderr, "bench: layer %d build failed, no results written\r\n", i);
+            free(compile_ms);
+            return EXIT_FAILURE;
+        }
+    }
+
+    fp = fopen(pj->bench.output, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "bench: cannot open %s: %s\r\n", pj->bench.output, strerror(errno));
+        free(compile_ms);
+        return EXIT_FAILURE;
+    }
+    frame_time = Histogram_Create(pj->bench.frames);
+    if (!frame_time) {
+        fclose(fp);
+        free(compile_ms);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"renderer\": ");
+    WriteJSONString(fp, Graphics_GetRenderer(g));
+    fprintf(fp, ",\n  \"frames\": %d,\n", pj->bench.frames);
+    fprintf(fp, "  \"frame_rate\": %.1f,\n", BENCH_FRAME_RATE);
+    fprintf(fp, "  \"window_size\": [%d, %d],\n", pj->bench.width, pj->bench.height);
+    fprintf(fp, "  \"backbuffer\": %s,\n", pj->use_backbuffer ? "true" : "false");
+
+    fprintf(fp, "  \"compile_ms\": [");
+    total_ms = 0.0;
+    for (i = 0; i < num_layer; i++) {
+        total_ms += compile_ms[i];
+        fprintf(fp, "%s%.3f", (i > 0) ? ", " : "", compile_ms[i]);
+    }
+    fprintf(fp, "],\n  \"compile_total_ms\": %.3f,\n", total_ms);
+    free(compile_ms);
+    Graphics_FinishImageLoads(g);
+    /* same frames on every run, whatever the disk does */
+    Graphics_SetMovieWait(g, 1);
+    fprintf(fp, "  \"runs\": [\n");
+
+    is_first = 1;
+    result = EXIT_SUCCESS;
+    for (f = 0; f < pj->bench.num_format; f++) {
+        for (s = 0; s < pj->bench.num_scaling; s++) {
+            for (m = 0; m < pj->bench.num_interpolation; m++) {
+                if (!is_first) {
+                    fprintf(fp, ",\n");
+                }
+                is_first = 0;
+                if (PJContext_BenchmarkRun(pj, fp, frame_time, pj->bench.format[f],
+                                           pj->bench.scaling[s], pj->bench.interpolation[m])) {
+                    fprintf(stderr, "bench: surface allocation failed\r\n");
+                    result = EXIT_FAILURE;
+                }
+            }
+        }
+    }
+    fprintf(fp, "\n  ]\n}\n");
+
+    Histogram_Delete(frame_time);
+    fclose(fp);
+    printf("bench: results written to %s\r\n", pj->bench.output);
+    return result;
+}
+
+/* whatever is ready goes to the writer. flush: everything captured */
+static void PJContext_WriteCaptured(PJContext *pj, FrameWriter *w, int flush)
+{
+    for (;;) {
+        unsigned char *pixels = FrameWriter_GetBuffer(w);
+        if (!Graphics_ReadCapture(pj->graphics, flush, pixels)) {
+            break;
+        }
+        FrameWriter_Submit(w);
+    }
+}
+
+/* fixed timestep to disk. rendering, readback and writing overlap: a frame
+ * is read a few frames after it was drawn, and written on another thread */
+static int PJContext_RenderToFile(PJContext *pj)
+{
+    Graphics *g = pj->graphics;
+    FrameWriter *w;
+    RenderLayer *layer;
+    double start_ms, elapsed_ms;
+    int width, height;
+    int i, error;
+
+    Graphics_SetHeadlessSize(g, pj->render.width, pj->render.height);
+    Graphics_SetWindowScaling(g, 1, 1);
+    if (Graphics_ApplyWindowScalingChange(g)) {
+        fprintf(stderr, "render: surface allocation failed\r\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; (layer = Graphics_GetRenderLayer(g, i)) != NULL; i++) {
+        Graphics_BuildRenderLayer(g, i);
+    }
+    Graphics_FinishBuild(g);
+    for (i = 0; Graphics_GetRenderLayer(g, i) != NULL; i++) {
+        if (!Graphics_IsLayerBuilt(g, i)) {
+            /* the errors are printed above, no file is written */
+            fprintf(stderr, "render: layer %d did not build\r\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+    Graphics_FinishImageLoads(g);
+    Graphics_SetMovieWait(g, 1);
+
+    Graphics_GetSourceSize(g, &width, &height);
+    if (Graphics_SetCapture(g, RENDER_READBACK_DEPTH)) {
+        fprintf(stderr, "render: readback allocation failed\r\n");
+        return EXIT_FAILURE;
+    }
+    w = FrameWriter_Create(pj->render.output, width, height,
+                           pj->render.fps_numer, pj->render.fps_denom);
+    if (w == NULL) {
+        Graphics_SetCapture(g, 0);
+        return EXIT_FAILURE;
+    }
+    printf("render: %d frames, %dx%d at %d/%d fps to %s (readback: %s)\r\n",
+           pj->render.frames, width, height, pj->render.fps_numer, pj->render.fps_denom,
+           pj->render.output, Graphics_GetCaptureMethod(g));
+
+    pj->fixed_step_ms = 1000.0 * pj->render.fps_denom / pj->render.fps_numer;
+    srand48(BENCH_SEED);
+    pj->frame = 0;
+    start_ms = GetCurrentTimeInMilliSecond();
+    for (i = 0; i < pj->render.frames; i++) {
+        PJContext_SetUniforms(pj);
+        Graphics_Render(g);
+        PJContext_AdvanceFrame(pj);
+        PJContext_WriteCaptured(pj, w, 0);
+    }
+    PJContext_WriteCaptured(pj, w, 1);
+    error = FrameWriter_Close(w);
+    elapsed_ms = GetCurrentTimeInMilliSecond() - start_ms;
+    Graphics_SetCapture(g, 0);
+
+    printf("render: %d frames in %.2f s, %.1f fps\r\n", pj->render.frames,
+           elapsed_ms / 1000.0, pj->render.frames * 1000.0 / MAX(elapsed_ms, 1.0));
+    return error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int PJContext_HostInitialize(void)
 {
     Graphics_HostInitialize();
@@ -508,8 +1913,22 @@ size_t PJContext_InstanceSize(void)
 
 int PJContext_Main(PJContext *pj)
 {
-    PJContext_PrepareMainLoop(pj);
+    if (pj->render.output) {
+        return PJContext_RenderToFile(pj);
+    }
+    if (pj->bench.frames > 0) {
+        return PJContext_Benchmark(pj);
+    }
+    if (PJContext_PrepareMainLoop(pj)) {
+        fprintf(stderr, "offscreen allocation failed\r\n");
+        return EXIT_FAILURE;
+    }
     PJContext_MainLoop(pj);
+    if (pj->verbose.render_time) {
+        PJContext_PrintProfile(pj);
+    }
+    Graphics_PrintBuildStats(pj->graphics);
+    Graphics_PrintMovieStats(pj->graphics);
     return EXIT_SUCCESS;
 }
 
@@ -9,7 +9,11 @@ int PJContext_HostInitialize(void);
 void PJContext_HostDeinitialize(void);
 
 size_t PJContext_InstanceSize(void);
-int PJContext_Construct(PJContext *pj);
+/* window per the display options in argv (--display, --swap-interval,
+ * --buffers, --window-format) */
+int PJContext_Construct(PJContext *pj, int argc, const char *argv[]);
+/* no window, no terminal: for --bench */
+int PJContext_ConstructHeadless(PJContext *pj);
 void PJContext_Destruct(PJContext *pj);
 int PJContext_ParseArgs(PJContext *pj, int argc, const char *argv[]);
 int PJContext_Main(PJContext *pj);
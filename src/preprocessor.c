@@ -0,0 +1,523 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "config.h"
+#include "base.h"
+#include "source_store.h"
+#include "preprocessor.h"
+
+
+typedef struct {
+    char *path;                 /* canonical, the key */
+    Source *text;               /* mapping, during Process only */
+} SourceFile;
+
+/* a shader: a file given to Process and everything it includes */
+typedef struct {
+    int root;                   /* file index */
+    Source *output;             /* NULL: stale */
+    int *source;                /* file index by source string number */
+    int num_source;
+    int max_source;
+} Unit;
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} Buffer;
+
+struct Preprocessor_ {
+    SourceStore *store;
+    char **search_path;
+    int num_search_path;
+    SourceFile *file;
+    int num_file;
+    int max_file;
+    Unit *unit;
+    int num_unit;
+    int max_unit;
+};
+
+
+static int Buffer_Append(Buffer *b, const char *data, size_t length)
+{
+    if (b->length + length + 1 > b->capacity) {
+        size_t n = (b->capacity == 0) ? 4096 : b->capacity;
+        char *p;
+        while (b->length + length + 1 > n) {
+            n *= 2;
+        }
+        p = realloc(b->data, n);
+        if (!p) {
+            return 1;
+        }
+        b->data = p;
+        b->capacity = n;
+    }
+    memcpy(b->data + b->length, data, length);
+    b->length += length;
+    b->data[b->length] = '\0';
+    return 0;
+}
+
+static int Buffer_AppendLine(Buffer *b, int line, int source_string)
+{
+    char directive[32];
+    int n = snprintf(directive, sizeof(directive), "#line %d %d\n", line, source_string);
+    return Buffer_Append(b, directive, (size_t)n);
+}
+
+Preprocessor *Preprocessor_Create(void)
+{
+    Preprocessor *pp = malloc(sizeof(*pp));
+    if (!pp) {
+        return NULL;
+    }
+    memset(pp, 0, sizeof(*pp));
+    pp->store = SourceStore_Create();
+    if (!pp->store) {
+        free(pp);
+        return NULL;
+    }
+    return pp;
+}
+
+void Preprocessor_Delete(Preprocessor *pp)
+{
+    int i;
+    for (i = 0; i < pp->num_search_path; i++) {
+        free(pp->search_path[i]);
+    }
+    free(pp->search_path);
+    for (i = 0; i < pp->num_file; i++) {
+        free(pp->file[i].path);
+        if (pp->file[i].text) {
+            Source_Release(pp->file[i].text);
+        }
+    }
+    free(pp->file);
+    for (i = 0; i < pp->num_unit; i++) {
+        if (pp->unit[i].output) {
+            Source_Release(pp->unit[i].output);
+        }
+        free(pp->unit[i].source);
+    }
+    free(pp->unit);
+    SourceStore_Delete(pp->store);
+    free(pp);
+}
+
+int Preprocessor_AddSearchPath(Preprocessor *pp, const char *directory)
+{
+    char **p;
+    char *dir;
+
+    dir = strdup(directory);
+    if (!dir) {
+        return 1;
+    }
+    p = realloc(pp->search_path, sizeof(*p) * (pp->num_search_path + 1));
+    if (!p) {
+        free(dir);
+        return 2;
+    }
+    pp->search_path = p;
+    pp->search_path[pp->num_search_path++] = dir;
+    return 0;
+}
+
+/* -1: unknown. a file gone in the middle of a save is still found by the
+ * path it was known as */
+static int Preprocessor_FindFile(Preprocessor *pp, const char *path)
+{
+    char canonical[PATH_MAX];
+    int i;
+
+    if (realpath(path, canonical) != NULL) {
+        path = canonical;
+    }
+    for (i = 0; i < pp->num_file; i++) {
+        if (strcmp(pp->file[i].path, path) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* 'canonical' from realpath. -1: out of memory */
+static int Preprocessor_AddFile(Preprocessor *pp, const char *canonical)
+{
+    SourceFile *f;
+    int i;
+
+    for (i = 0; i < pp->num_file; i++) {
+        if (strcmp(pp->file[i].path, canonical) == 0) {
+            return i;
+        }
+    }
+    if (pp->num_file == pp->max_file) {
+        int n = (pp->max_file == 0) ? 8 : pp->max_file * 2;
+        SourceFile *p = realloc(pp->file, sizeof(*p) * n);
+        if (!p) {
+            return -1;
+        }
+        pp->file = p;
+        pp->max_file = n;
+    }
+    f = &pp->file[pp->num_file];
+    f->path = strdup(canonical);
+    if (!f->path) {
+        return -1;
+    }
+    f->text = NULL;
+    return pp->num_file++;
+}
+
+static Unit *Preprocessor_FindUnit(Preprocessor *pp, const char *path)
+{
+    int file;
+    int i;
+
+    file = Preprocessor_FindFile(pp, path);
+    for (i = 0; i < pp->num_unit && file >= 0; i++) {
+        if (pp->unit[i].root == file) {
+            return &pp->unit[i];
+        }
+    }
+    return NULL;
+}
+
+static Unit *Preprocessor_AddUnit(Preprocessor *pp, int root)
+{
+    Unit *u;
+    int i;
+
+    for (i = 0; i < pp->num_unit; i++) {
+        if (pp->unit[i].root == root) {
+            return &pp->unit[i];
+        }
+    }
+    if (pp->num_unit == pp->max_unit) {
+        int n = (pp->max_unit == 0) ? 8 : pp->max_unit * 2;
+        Unit *p = realloc(pp->unit, sizeof(*p) * n);
+        if (!p) {
+            return NULL;
+        }
+        pp->unit = p;
+        pp->max_unit = n;
+    }
+    u = &pp->unit[pp->num_unit++];
+    memset(u, 0, sizeof(*u));
+    u->root = root;
+    return u;
+}
+
+/* source string number of 'file', -1: not in the unit */
+static int Unit_FindSource(const Unit *u, int file)
+{
+    int i;
+    for (i = 0; i < u->num_source; i++) {
+        if (u->source[i] == file) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int Unit_AddSource(Unit *u, int file)
+{
+    if (u->num_source == u->max_source) {
+        int n = (u->max_source == 0) ? 8 : u->max_source * 2;
+        int *p = realloc(u->source, sizeof(*p) * n);
+        if (!p) {
+            return -1;
+        }
+        u->source = p;
+        u->max_source = n;
+    }
+    u->source[u->num_source] = file;
+    return u->num_source++;
+}
+
+static int Preprocessor_Load(Preprocessor *pp, int file)
+{
+    SourceFile *f = &pp->file[file];
+    if (f->text) {
+        return 0;
+    }
+    f->text = SourceStore_Open(pp->store, f->path);
+    return f->text ? 0 : 1;
+}
+
+/* 1: '#include "name"' or '#include <name>', 0: any other line, -1: malformed */
+static int ParseInclude(const char *line, const char *end,
+                        char *out_name, size_t name_size, int *out_is_system)
+{
+    const char *p = line;
+    const char *name;
+    char close;
+
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    if (p == end || *p != '#') {
+        return 0;
+    }
+    p++;
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    if (end - p < 7 || strncmp(p, "include", 7) != 0) {
+        return 0;
+    }
+    p += 7;
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    if (p == end || (*p != '"' && *p != '<')) {
+        return -1;
+    }
+    close = (*p == '"') ? '"' : '>';
+    *out_is_system = (*p == '<');
+    name = ++p;
+    while (p < end && *p != close) {
+        p++;
+    }
+    if (p == end || p == name || (size_t)(p - name) >= name_size) {
+        return -1;
+    }
+    memcpy(out_name, name, (size_t)(p - name));
+    out_name[p - name] = '\0';
+    return 1;
+}
+
+/* any #include line, well-formed or not */
+static int HasInclude(const Source *text)
+{
+    const char *line = Source_GetText(text);
+    const char *end = line + Source_GetLength(text);
+    char name[256];
+    int is_system;
+
+    while (line < end) {
+        const char *eol = memchr(line, '\n', (size_t)(end - line));
+        if (ParseInclude(line, eol ? eol : end, name, sizeof(name), &is_system) != 0) {
+            return 1;
+        }
+        line = eol ? eol + 1 : end;
+    }
+    return 0;
+}
+
+/* file index, -1: not found */
+static int Preprocessor_Resolve(Preprocessor *pp, int including, const char *name, int is_system)
+{
+    char candidate[PATH_MAX];
+    char canonical[PATH_MAX];
+    int i;
+
+    if (name[0] == '/') {
+        return (realpath(name, canonical) != NULL) ? Preprocessor_AddFile(pp, canonical) : -1;
+    }
+    if (!is_system) {
+        const char *dir = pp->file[including].path;
+        const char *slash = strrchr(dir, '/');
+        int dir_length = (int)(slash - dir);
+        snprintf(candidate, sizeof(candidate), "%.*s/%s", dir_length, dir, name);
+        if (realpath(candidate, canonical) != NULL) {
+            return Preprocessor_AddFile(pp, canonical);
+        }
+    }
+    for (i = 0; i < pp->num_search_path; i++) {
+        snprintf(candidate, sizeof(candidate), "%s/%s", pp->search_path[i], name);
+        if (realpath(candidate, canonical) != NULL) {
+            return Preprocessor_AddFile(pp, canonical);
+        }
+    }
+    return -1;
+}
+
+static int Preprocessor_Expand(Preprocessor *pp, Unit *u, int file, int source_string, Buffer *b)
+{
+    const char *text;
+    const char *line;
+    const char *end;
+    int line_number;
+
+    if (Preprocessor_Load(pp, file)) {
+        return 1;
+    }
+    /* the mapping stays put, the file table may grow under it */
+    text = Source_GetText(pp->file[file].text);
+    end = text + Source_GetLength(pp->file[file].text);
+    line_number = 1;
+    for (line = text; line < end; line_number++) {
+        const char *eol = memchr(line, '\n', (size_t)(end - line));
+        const char *next = eol ? eol + 1 : end;
+        char name[256];
+        int is_system;
+        int include;
+        int n;
+
+        switch (ParseInclude(line, eol ? eol : end, name, sizeof(name), &is_system)) {
+        case 0:
+            if (Buffer_Append(b, line, (size_t)(next - line))) {
+                return 2;
+            }
+            break;
+        case 1:
+            include = Preprocessor_Resolve(pp, file, name, is_system);
+            if (include < 0) {
+                printf("%s:%d: #include %s not found\r\n", pp->file[file].path, line_number, name);
+                return 3;
+            }
+            if (Unit_FindSource(u, include) >= 0) {
+                /* once per shader, the line is kept for the numbering */
+                if (Buffer_Append(b, "\n", 1)) {
+                    return 2;
+                }
+                break;
+            }
+            n = Unit_AddSource(u, include);
+            if (n < 0 || Buffer_AppendLine(b, 1, n)) {
+                return 2;
+            }
+            if (Preprocessor_Expand(pp, u, include, n, b)) {
+                return 4;
+            }
+            if (b->length > 0 && b->data[b->length - 1] != '\n' && Buffer_Append(b, "\n", 1)) {
+                return 2;
+            }
+            if (Buffer_AppendLine(b, line_number + 1, source_string)) {
+                return 2;
+            }
+            break;
+        default:
+            printf("%s:%d: malformed #include\r\n", pp->file[file].path, line_number);
+            return 3;
+        }
+        line = next;
+    }
+    return 0;
+}
+
+/* mappings are read while expanding, then let go: the output is a copy */
+static void Preprocessor_Unload(Preprocessor *pp)
+{
+    int i;
+    for (i = 0; i < pp->num_file; i++) {
+        if (pp->file[i].text) {
+            Source_Release(pp->file[i].text);
+            pp->file[i].text = NULL;
+        }
+    }
+}
+
+static int Preprocessor_Build(Preprocessor *pp, Unit *u, int root)
+{
+    Buffer b;
+
+    u->num_source = 0;
+    if (Unit_AddSource(u, root) < 0 || Preprocessor_Load(pp, root)) {
+        return 3;
+    }
+    if (!HasInclude(pp->file[root].text)) {
+        /* one copy, out of the mapping */
+        u->output = Source_Snapshot(pp->file[root].text);
+        return u->output ? 0 : 2;
+    }
+    memset(&b, 0, sizeof(b));
+    if (Preprocessor_Expand(pp, u, root, 0, &b)) {
+        free(b.data);
+        return 3;
+    }
+    u->output = Source_CreateFromBuffer(b.data, b.length);
+    if (!u->output) {
+        free(b.data);
+        return 2;
+    }
+    return 0;
+}
+
+int Preprocessor_Process(Preprocessor *pp, const char *path, Source **out_source)
+{
+    char canonical[PATH_MAX];
+    Unit *u;
+    int root;
+    int ret;
+
+    if (realpath(path, canonical) == NULL) {
+        printf("%s: %s\r\n", path, strerror(errno));
+        return 1;
+    }
+    root = Preprocessor_AddFile(pp, canonical);
+    u = (root >= 0) ? Preprocessor_AddUnit(pp, root) : NULL;
+    if (!u) {
+        return 2;
+    }
+    if (!u->output) {
+        ret = Preprocessor_Build(pp, u, root);
+        Preprocessor_Unload(pp);
+        if (ret) {
+            return ret;
+        }
+    }
+    *out_source = Source_Retain(u->output);
+    return 0;
+}
+
+void Preprocessor_Invalidate(Preprocessor *pp, const char *path)
+{
+    int file;
+    int i;
+
+    file = Preprocessor_FindFile(pp, path);
+    if (file < 0) {
+        return;
+    }
+    if (pp->file[file].text) {
+        Source_Release(pp->file[file].text);
+        pp->file[file].text = NULL;
+    }
+    SourceStore_Invalidate(pp->store, pp->file[file].path);
+    for (i = 0; i < pp->num_unit; i++) {
+        Unit *u = &pp->unit[i];
+        if (u->output && Unit_FindSource(u, file) >= 0) {
+            Source_Release(u->output);
+            u->output = NULL;
+        }
+    }
+}
+
+int Preprocessor_DependsOn(Preprocessor *pp, const char *path, const char *dependency)
+{
+    Unit *u;
+    int file;
+
+    u = Preprocessor_FindUnit(pp, path);
+    file = Preprocessor_FindFile(pp, dependency);
+    return (u && file >= 0 && Unit_FindSource(u, file) >= 0) ? 1 : 0;
+}
+
+int Preprocessor_GetSourceCount(Preprocessor *pp, const char *path)
+{
+    Unit *u = Preprocessor_FindUnit(pp, path);
+    return u ? u->num_source : 0;
+}
+
+const char *Preprocessor_GetSourceName(Preprocessor *pp, const char *path, int source_string)
+{
+    Unit *u = Preprocessor_FindUnit(pp, path);
+    if (!u || source_string < 0 || source_string >= u->num_source) {
+        return NULL;
+    }
+    assert(u->source[source_string] < pp->num_file);
+    return pp->file[u->source[source_string]].path;
+}
@@ -0,0 +1,42 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* #include for shader sources, in front of the GLSL compiler.
+ * "name" is looked up next to the including file, then on the search path,
+ * <name> on the search path only. a file is included once per shader, so
+ * shared uniform declarations need no guards and cycles end by themselves.
+ * included text is framed by "#line 1 N" / "#line L M", N being the source
+ * string number of the file (Preprocessor_GetSourceName) */
+
+#ifndef INCLUDED_PREPROCESSOR_H
+#define INCLUDED_PREPROCESSOR_H
+
+
+#include <stddef.h>
+#include "base.h"
+#include "source_store.h"
+
+typedef struct Preprocessor_ Preprocessor;
+
+
+Preprocessor *Preprocessor_Create(void);
+void Preprocessor_Delete(Preprocessor *pp);
+
+/* searched in the order added */
+int Preprocessor_AddSearchPath(Preprocessor *pp, const char *directory);
+
+/* new reference to 'path' with every #include resolved, a copy that stays
+ * as it is whatever happens to the files. kept until one of them is
+ * invalidated. error printed */
+int Preprocessor_Process(Preprocessor *pp, const char *path, Source **out_source);
+/* 'path' changed on disk: read it again, and the shaders including it */
+void Preprocessor_Invalidate(Preprocessor *pp, const char *path);
+
+/* after Process: 'dependency' is a source string of 'path' */
+int Preprocessor_DependsOn(Preprocessor *pp, const char *path, const char *dependency);
+/* source strings of 'path', 0 is itself */
+int Preprocessor_GetSourceCount(Preprocessor *pp, const char *path);
+/* canonical path, stable while pp lives. NULL: no such */
+const char *Preprocessor_GetSourceName(Preprocessor *pp, const char *path, int source_string);
+
+
+#endif
@@ -0,0 +1,289 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "config.h"
+#include "base.h"
+#include "hash.h"
+#include "gl_ext.h"
+#include "program_cache.h"
+
+
+#ifndef GL_PROGRAM_BINARY_LENGTH_OES
+#define GL_PROGRAM_BINARY_LENGTH_OES 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS_OES
+#define GL_NUM_PROGRAM_BINARY_FORMATS_OES 0x87FE
+#endif
+typedef void (GL_APIENTRY *GetProgramBinaryOESProc)(GLuint program, GLsizei buf_size, GLsizei *length,
+                                                    GLenum *binary_format, void *binary);
+typedef void (GL_APIENTRY *ProgramBinaryOESProc)(GLuint program, GLenum binary_format,
+                                                 const void *binary, GLint length);
+
+enum {
+    CACHE_FILE_VERSION = 1,
+    MAX_BINARY_LENGTH = 64 * 1024 * 1024
+};
+
+typedef struct {
+    char magic[4];              /* "PJPB" */
+    uint32_t version;
+    uint32_t format;
+    uint32_t length;
+    uint64_t key;
+    double build_ms;            /* what a real compile cost, for time saved */
+} CacheFileHeader;
+
+struct ProgramCache_ {
+    char directory[512];
+    uint64_t base_key;
+    GetProgramBinaryOESProc get_program_binary;
+    ProgramBinaryOESProc program_binary;
+    pthread_mutex_t mutex;      /* stats are updated from the build thread */
+    struct {
+        int hit;
+        int miss;
+        int reject;
+        double saved_ms;
+    } stats;
+};
+
+
+static double GetMonotonicTimeInMilliSecond(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* mkdir -p */
+static int MakeDirectories(char *path)
+{
+    char *p;
+    for (p = path + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+                *p = '/';
+                return 1;
+            }
+            *p = '/';
+        }
+    }
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        return 1;
+    }
+    return 0;
+}
+
+static int DetermineDirectory(char *out, size_t size, OPTIONAL const char *directory)
+{
+    const char *env;
+    int n;
+    if (directory) {
+        n = snprintf(out, size, "%s", directory);
+    } else if ((env = getenv("PJ_CACHE_DIR")) != NULL) {
+        n = snprintf(out, size, "%s", env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) != NULL) {
+        n = snprintf(out, size, "%s/pj", env);
+    } else if ((env = getenv("HOME")) != NULL) {
+        n = snprintf(out, size, "%s/.cache/pj", env);
+    } else {
+        return 1;
+    }
+    return (n <= 0 || (size_t)n >= size) ? 1 : 0;
+}
+
+static void ProgramCache_MakePath(ProgramCache *pc, uint64_t key, char *out, size_t size)
+{
+    snprintf(out, size, "%s/%016llx.bin", pc->directory, (unsigned long long)key);
+}
+
+
+size_t ProgramCache_InstanceSize(void)
+{
+    return sizeof(ProgramCache);
+}
+
+int ProgramCache_Construct(ProgramCache *pc, OPTIONAL const char *directory,
+                           const char *vertex_source)
+{
+    GLint num_formats;
+    uint64_t h;
+
+    memset(pc, 0, sizeof(*pc));
+    if (!GLExt_Has("GL_OES_get_program_binary")) {
+        return 1;
+    }
+    num_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &num_formats);
+    if (num_formats <= 0) {
+        return 2;
+    }
+    pc->get_program_binary = (GetProgramBinaryOESProc)GLExt_GetProcAddress("glGetProgramBinaryOES");
+    pc->program_binary = (ProgramBinaryOESProc)GLExt_GetProcAddress("glProgramBinaryOES");
+    if (!pc->get_program_binary || !pc->program_binary) {
+        return 3;
+    }
+    if (DetermineDirectory(pc->directory, sizeof(pc->directory), directory)
+        || MakeDirectories(pc->directory)) {
+        printf("program cache: no usable directory\r\n");
+        return 4;
+    }
+
+    /* a driver update invalidates every entry */
+    h = Hash_INITIAL;
+    h = Hash_String(h, (const char *)glGetString(GL_VENDOR));
+    h = Hash_String(h, (const char *)glGetString(GL_RENDERER));
+    h = Hash_String(h, (const char *)glGetString(GL_VERSION));
+    h = Hash_String(h, vertex_source);
+    pc->base_key = h;
+    pthread_mutex_init(&pc->mutex, NULL);
+    return 0;
+}
+
+void ProgramCache_Destruct(ProgramCache *pc)
+{
+    pthread_mutex_destroy(&pc->mutex);
+    memset(pc, 0, sizeof(*pc));
+}
+
+uint64_t ProgramCache_MakeKey(ProgramCache *pc, const char *fragment_source, int source_length)
+{
+    return Hash_Update(pc->base_key, fragment_source, (size_t)source_length);
+}
+
+unsigned int ProgramCache_Load(ProgramCache *pc, uint64_t key)
+{
+    char path[600];
+    FILE *fp;
+    CacheFileHeader header;
+    void *data;
+    GLuint program;
+    GLint param;
+    double t;
+
+    t = GetMonotonicTimeInMilliSecond();
+    ProgramCache_MakePath(pc, key, path, sizeof(path));
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        pthread_mutex_lock(&pc->mutex);
+        pc->stats.miss += 1;
+        pthread_mutex_unlock(&pc->mutex);
+        return 0;
+    }
+    data = NULL;
+    if (fread(&header, sizeof(header), 1, fp) != 1
+        || memcmp(header.magic, "PJPB", 4) != 0
+        || header.version != CACHE_FILE_VERSION
+        || header.key != key
+        || header.length > MAX_BINARY_LENGTH
+        || (data = malloc(header.length)) == NULL
+        || fread(data, 1, header.length, fp) != header.length) {
+        fclose(fp);
+        free(data);
+        goto reject;
+    }
+    fclose(fp);
+
+    program = glCreateProgram();
+    pc->program_binary(program, header.format, data, (GLint)header.length);
+    free(data);
+    glGetProgramiv(program, GL_LINK_STATUS, &param);
+    if (param != GL_TRUE) {
+        glDeleteProgram(program);
+        goto reject;
+    }
+
+    t = GetMonotonicTimeInMilliSecond() - t;
+    pthread_mutex_lock(&pc->mutex);
+    pc->stats.hit += 1;
+    if (header.build_ms > t) {
+        pc->stats.saved_ms += header.build_ms - t;
+    }
+    pthread_mutex_unlock(&pc->mutex);
+    return program;
+
+  reject:
+    /* stale or foreign binary, recompile and overwrite */
+    unlink(path);
+    pthread_mutex_lock(&pc->mutex);
+    pc->stats.reject += 1;
+    pc->stats.miss += 1;
+    pthread_mutex_unlock(&pc->mutex);
+    return 0;
+}
+
+int ProgramCache_Store(ProgramCache *pc, uint64_t key, unsigned int program, double build_ms)
+{
+    char path[600];
+    char tmp_path[620];
+    CacheFileHeader header;
+    GLint length;
+    GLsizei written;
+    GLenum format;
+    void *data;
+    FILE *fp;
+    int ok;
+
+    length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (length <= 0) {
+        return 1;
+    }
+    data = malloc((size_t)length);
+    if (!data) {
+        return 2;
+    }
+    written = 0;
+    pc->get_program_binary(program, length, &written, &format, data);
+    if (written <= 0) {
+        free(data);
+        return 3;
+    }
+
+    memcpy(header.magic, "PJPB", 4);
+    header.version = CACHE_FILE_VERSION;
+    header.format = format;
+    header.length = (uint32_t)written;
+    header.key = key;
+    header.build_ms = build_ms;
+
+    /* rename makes a half written entry invisible to other instances */
+    ProgramCache_MakePath(pc, key, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+    fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        free(data);
+        return 4;
+    }
+    ok = (fwrite(&header, sizeof(header), 1, fp) == 1
+          && fwrite(data, 1, (size_t)written, fp) == (size_t)written);
+    ok = (fclose(fp) == 0) && ok;
+    free(data);
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return 5;
+    }
+    return 0;
+}
+
+void ProgramCache_PrintStats(ProgramCache *pc)
+{
+    pthread_mutex_lock(&pc->mutex);
+    printf("program cache: %d hit, %d miss (%d rejected), %.1f ms saved\r\n",
+           pc->stats.hit, pc->stats.miss, pc->stats.reject, pc->stats.saved_ms);
+    pthread_mutex_unlock(&pc->mutex);
+}
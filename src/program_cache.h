@@ -0,0 +1,34 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* on-disk cache of linked programs (OES_get_program_binary) */
+
+#ifndef INCLUDED_PROGRAM_CACHE_H
+#define INCLUDED_PROGRAM_CACHE_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include "base.h"
+
+typedef struct ProgramCache_ ProgramCache;
+
+
+size_t ProgramCache_InstanceSize(void);
+
+/* needs a current context. directory NULL: $PJ_CACHE_DIR, $XDG_CACHE_HOME/pj or ~/.cache/pj
+ * return non-zero when program binaries are not supported */
+int ProgramCache_Construct(ProgramCache *pc, OPTIONAL const char *directory,
+                           const char *vertex_source);
+void ProgramCache_Destruct(ProgramCache *pc);
+
+/* driver strings and vertex shader are part of the key */
+uint64_t ProgramCache_MakeKey(ProgramCache *pc, const char *fragment_source, int source_length);
+
+/* linked program, or 0 on miss or when the driver rejected the binary */
+unsigned int ProgramCache_Load(ProgramCache *pc, uint64_t key);
+int ProgramCache_Store(ProgramCache *pc, uint64_t key, unsigned int program, double build_ms);
+
+void ProgramCache_PrintStats(ProgramCache *pc);
+
+
+#endif
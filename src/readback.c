@@ -0,0 +1,176 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <GLES2/gl2.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "config.h"
+#include "base.h"
+#include "gl_ext.h"
+#include "gl_state.h"
+#include "readback.h"
+
+
+typedef struct {
+    GLuint texture;             /* RGB: a copy source without alpha is fine */
+    GLuint framebuffer;
+    EGLSyncKHR sync;            /* EGL_NO_SYNC_KHR: no fence */
+} Slot;
+
+struct Readback_ {
+    GLState *gl;
+    int width;
+    int height;
+    int depth;
+    Slot *slot;
+    int head;                   /* oldest copy not read yet */
+    int count;
+    struct {
+        EGLDisplay display;     /* EGL_NO_DISPLAY: no fences, reads block */
+        PFNEGLCREATESYNCKHRPROC create;
+        PFNEGLDESTROYSYNCKHRPROC destroy;
+        PFNEGLCLIENTWAITSYNCKHRPROC client_wait;
+    } fence;
+};
+
+
+static void Readback_SetupFence(Readback *rb)
+{
+    rb->fence.display = EGL_NO_DISPLAY;
+    if (!GLExt_HasEGL("EGL_KHR_fence_sync")) {
+        return;
+    }
+    rb->fence.create = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+    rb->fence.destroy = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+    rb->fence.client_wait = (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+    if (rb->fence.create && rb->fence.destroy && rb->fence.client_wait) {
+        rb->fence.display = eglGetCurrentDisplay();
+    }
+}
+
+/* the slot texture on some unit, made active */
+static void Readback_BindTexture(Readback *rb, GLuint texture)
+{
+    GLState_BeginTextureSet(rb->gl);
+    GLState_ActiveTexture(rb->gl, GLState_AcquireTextureUnit(rb->gl, texture));
+}
+
+Readback *Readback_Create(GLState *gl, int width, int height, int depth)
+{
+    Readback *rb;
+    int i;
+
+    rb = malloc(sizeof(*rb));
+    if (!rb) {
+        return NULL;
+    }
+    rb->slot = calloc((size_t)depth, sizeof(Slot));
+    if (!rb->slot) {
+        free(rb);
+        return NULL;
+    }
+    rb->gl = gl;
+    rb->width = width;
+    rb->height = height;
+    rb->depth = depth;
+    rb->head = 0;
+    rb->count = 0;
+    Readback_SetupFence(rb);
+    for (i = 0; i < depth; i++) {
+        Slot *s = &rb->slot[i];
+        GLenum status;
+        s->sync = EGL_NO_SYNC_KHR;
+        glGenTextures(1, &s->texture);
+        Readback_BindTexture(rb, s->texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glGenFramebuffers(1, &s->framebuffer);
+        GLState_BindFramebuffer(gl, s->framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, s->texture, 0);
+        status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            printf("readback %dx%d incomplete: 0x%x\r\n", width, height, status);
+            GLState_BindFramebuffer(gl, 0);
+            rb->depth = i + 1;
+            Readback_Delete(rb);
+            return NULL;
+        }
+    }
+    GLState_BindFramebuffer(gl, 0);
+    return rb;
+}
+
+void Readback_Delete(Readback *rb)
+{
+    int i;
+    for (i = 0; i < rb->depth; i++) {
+        Slot *s = &rb->slot[i];
+        if (s->sync != EGL_NO_SYNC_KHR) {
+            rb->fence.destroy(rb->fence.display, s->sync);
+        }
+        GLState_DeleteFramebuffer(rb->gl, s->framebuffer);
+        GLState_DeleteTexture(rb->gl, s->texture);
+    }
+    free(rb->slot);
+    free(rb);
+}
+
+int Readback_IsFull(Readback *rb)
+{
+    return (rb->count == rb->depth) ? 1 : 0;
+}
+
+void Readback_Capture(Readback *rb)
+{
+    Slot *s;
+    assert(rb->count < rb->depth);
+    s = &rb->slot[(rb->head + rb->count) % rb->depth];
+    Readback_BindTexture(rb, s->texture);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, rb->width, rb->height);
+    GLState_CountCall(rb->gl);
+    if (rb->fence.display != EGL_NO_DISPLAY) {
+        s->sync = rb->fence.create(rb->fence.display, EGL_SYNC_FENCE_KHR, NULL);
+    }
+    rb->count += 1;
+}
+
+int Readback_Read(Readback *rb, int wait, void *out)
+{
+    Slot *s;
+    if (rb->count == 0) {
+        return 0;
+    }
+    s = &rb->slot[rb->head];
+    if (s->sync != EGL_NO_SYNC_KHR) {
+        /* flushed, or a fence polled with timeout 0 would never signal */
+        EGLint status = rb->fence.client_wait(rb->fence.display, s->sync,
+                                              EGL_SYNC_FLUSH_COMMANDS_BIT_KHR,
+                                              wait ? EGL_FOREVER_KHR : 0);
+        if (status == EGL_TIMEOUT_EXPIRED_KHR) {
+            return 0;
+        }
+        rb->fence.destroy(rb->fence.display, s->sync);
+        s->sync = EGL_NO_SYNC_KHR;
+    } else if (!wait) {
+        return 0;               /* no way to know, read only when made to */
+    }
+    GLState_BindFramebuffer(rb->gl, s->framebuffer);
+    glReadPixels(0, 0, rb->width, rb->height, GL_RGBA, GL_UNSIGNED_BYTE, out);
+    GLState_CountCall(rb->gl);
+    rb->head = (rb->head + 1) % rb->depth;
+    rb->count -= 1;
+    return 1;
+}
+
+const char *Readback_GetMethodName(Readback *rb)
+{
+    return (rb->fence.display != EGL_NO_DISPLAY) ? "EGL_KHR_fence_sync" : "blocking";
+}
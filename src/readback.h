@@ -0,0 +1,29 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* frames copied on the GPU into a ring, read back when their copy is done,
+ * so glReadPixels does not wait for the frame just submitted */
+
+#ifndef INCLUDED_READBACK_H
+#define INCLUDED_READBACK_H
+
+
+#include "base.h"
+#include "gl_state.h"
+
+typedef struct Readback_ Readback;
+
+
+Readback *Readback_Create(GLState *gl, int width, int height, int depth);
+void Readback_Delete(Readback *rb);
+
+int Readback_IsFull(Readback *rb);
+/* copy of the bound framebuffer (0, 0, width, height), queued on the GPU.
+ * the ring must not be full */
+void Readback_Capture(Readback *rb);
+/* oldest copy into 'out' (RGBA, width * height * 4, rows bottom up) when it
+ * is done, or 'wait'. return 1 when read, 0 when nothing is ready */
+int Readback_Read(Readback *rb, int wait, void *out);
+const char *Readback_GetMethodName(Readback *rb);
+
+
+#endif
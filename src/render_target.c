@@ -0,0 +1,188 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <GLES2/gl2.h>
+
+#include "config.h"
+#include "base.h"
+#include "gl_state.h"
+#include "render_target.h"
+
+
+struct RenderTarget_ {
+    RenderTarget_Desc desc;
+    GLuint texture;
+    GLuint framebuffer;
+    int alive;                  /* between Acquire and Release */
+    int acquired;               /* since the last trim */
+    RenderTarget *next;
+};
+
+struct RenderTargetPool_ {
+    GLState *gl;
+    RenderTarget *head;
+};
+
+
+static size_t BytesOfDesc(const RenderTarget_Desc *desc)
+{
+    size_t bytes_per_pixel;
+    switch (desc->type) {
+    case GL_UNSIGNED_BYTE:
+        bytes_per_pixel = (desc->format == GL_RGB) ? 3 : 4;
+        break;
+    default:
+        bytes_per_pixel = 2;    /* packed 16bpp */
+        break;
+    }
+    return (size_t)desc->width * desc->height * bytes_per_pixel;
+}
+
+static RenderTarget *RenderTarget_Create(GLState *gl, const RenderTarget_Desc *desc)
+{
+    RenderTarget *rt;
+    GLenum status;
+
+    rt = calloc(1, sizeof(*rt));
+    if (!rt) {
+        return NULL;
+    }
+    rt->desc = *desc;
+
+    glGenTextures(1, &rt->texture);
+    GLState_BindTexture(gl, 0, rt->texture);
+    GLState_ActiveTexture(gl, 0);
+    glTexImage2D(GL_TEXTURE_2D,
+                 0,             /* level */
+                 desc->internal_format,
+                 desc->width, desc->height,
+                 0,             /* border */
+                 desc->format,
+                 desc->type,
+                 NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, desc->filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, desc->filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, desc->wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, desc->wrap);
+
+    glGenFramebuffers(1, &rt->framebuffer);
+    GLState_BindFramebuffer(gl, rt->framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, rt->texture, 0);
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        printf("render target %dx%d incomplete: 0x%x\r\n", desc->width, desc->height, status);
+        GLState_DeleteFramebuffer(gl, rt->framebuffer);
+        GLState_DeleteTexture(gl, rt->texture);
+        free(rt);
+        return NULL;
+    }
+    return rt;
+}
+
+static void RenderTarget_Delete(GLState *gl, RenderTarget *rt)
+{
+    GLState_DeleteFramebuffer(gl, rt->framebuffer);
+    GLState_DeleteTexture(gl, rt->texture);
+    free(rt);
+}
+
+
+RenderTargetPool *RenderTargetPool_Create(GLState *gl)
+{
+    RenderTargetPool *pool;
+    pool = malloc(sizeof(*pool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->gl = gl;
+    pool->head = NULL;
+    return pool;
+}
+
+void RenderTargetPool_Delete(RenderTargetPool *pool)
+{
+    RenderTarget *rt, *next;
+    for (rt = pool->head; rt; rt = next) {
+        next = rt->next;
+        RenderTarget_Delete(pool->gl, rt);
+    }
+    free(pool);
+}
+
+RenderTarget *RenderTargetPool_Acquire(RenderTargetPool *pool, const RenderTarget_Desc *desc)
+{
+    RenderTarget *rt;
+
+    for (rt = pool->head; rt; rt = rt->next) {
+        if (!rt->alive && memcmp(&rt->desc, desc, sizeof(*desc)) == 0) {
+            break;
+        }
+    }
+    if (!rt) {
+        rt = RenderTarget_Create(pool->gl, desc);
+        if (!rt) {
+            return NULL;
+        }
+        rt->next = pool->head;
+        pool->head = rt;
+    }
+    rt->alive = 1;
+    rt->acquired = 1;
+    return rt;
+}
+
+void RenderTargetPool_Release(RenderTargetPool *pool, RenderTarget *rt)
+{
+    (void)pool;
+    assert(rt->alive);
+    rt->alive = 0;
+}
+
+void RenderTargetPool_ReleaseAll(RenderTargetPool *pool)
+{
+    RenderTarget *rt;
+    for (rt = pool->head; rt; rt = rt->next) {
+        rt->alive = 0;
+    }
+}
+
+void RenderTargetPool_Trim(RenderTargetPool *pool)
+{
+    RenderTarget **link;
+    link = &pool->head;
+    while (*link) {
+        RenderTarget *rt = *link;
+        if (!rt->acquired && !rt->alive) {
+            *link = rt->next;
+            RenderTarget_Delete(pool->gl, rt);
+            continue;
+        }
+        rt->acquired = 0;
+        link = &rt->next;
+    }
+}
+
+size_t RenderTargetPool_GetMemorySize(RenderTargetPool *pool)
+{
+    RenderTarget *rt;
+    size_t bytes;
+    bytes = 0;
+    for (rt = pool->head; rt; rt = rt->next) {
+        bytes += BytesOfDesc(&rt->desc);
+    }
+    return bytes;
+}
+
+GLuint RenderTarget_GetTexture(RenderTarget *rt)
+{
+    return rt->texture;
+}
+
+GLuint RenderTarget_GetFramebuffer(RenderTarget *rt)
+{
+    return rt->framebuffer;
+}
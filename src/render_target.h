@@ -0,0 +1,46 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* pool of texture+framebuffer pairs, reused across reallocations and
+ * shared between layers whose outputs are not alive at the same time */
+
+#ifndef INCLUDED_RENDER_TARGET_H
+#define INCLUDED_RENDER_TARGET_H
+
+
+#include <stddef.h>
+#include <GLES2/gl2.h>
+#include "gl_state.h"
+
+typedef struct RenderTarget_ RenderTarget;
+typedef struct RenderTargetPool_ RenderTargetPool;
+
+typedef struct {
+    int width;
+    int height;
+    GLint internal_format;
+    GLenum format;
+    GLenum type;
+    GLint filter;               /* min and mag */
+    GLint wrap;                 /* s and t */
+} RenderTarget_Desc;
+
+
+/* GL objects are made and bound through 'gl', it must outlive the pool */
+RenderTargetPool *RenderTargetPool_Create(GLState *gl);
+void RenderTargetPool_Delete(RenderTargetPool *pool);
+
+/* a target of the same desc that is not alive, or a new one. NULL on failure */
+RenderTarget *RenderTargetPool_Acquire(RenderTargetPool *pool, const RenderTarget_Desc *desc);
+/* end of its lifetime: the next Acquire may hand out the same target */
+void RenderTargetPool_Release(RenderTargetPool *pool, RenderTarget *rt);
+/* end of every lifetime, GL objects are kept for the next allocation */
+void RenderTargetPool_ReleaseAll(RenderTargetPool *pool);
+/* delete targets neither alive nor acquired since the previous trim */
+void RenderTargetPool_Trim(RenderTargetPool *pool);
+size_t RenderTargetPool_GetMemorySize(RenderTargetPool *pool);
+
+GLuint RenderTarget_GetTexture(RenderTarget *rt);
+GLuint RenderTarget_GetFramebuffer(RenderTarget *rt);
+
+
+#endif
@@ -0,0 +1,574 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <GLES2/gl2.h>
+
+#include "config.h"
+#include "base.h"
+#include "video_egl.h"
+#include "gl_ext.h"
+#include "program_cache.h"
+#include "source_store.h"
+#include "shader_builder.h"
+
+
+/* from GL_KHR_parallel_shader_compile, old gl2ext.h may not have it */
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (GL_APIENTRY *MaxShaderCompilerThreadsKHRProc)(GLuint count);
+
+typedef struct Job_ {
+    struct Job_ *next;
+    int id;
+    unsigned int generation;
+    Source *source;
+    GLuint fragment_shader;     /* in-flight objects of parallel mode */
+    GLuint program;
+    uint64_t cache_key;
+    double start_ms;
+} Job;
+
+typedef struct {
+    Job *head;
+    Job *tail;
+} JobQueue;
+
+struct ShaderBuilder_ {
+    ShaderBuilder_MODE mode;
+    const char *vertex_source;
+    GLuint vertex_shader;       /* of the calling thread context, not for worker */
+    ProgramCache *cache;        /* NULL: disabled */
+    JobQueue pending;           /* worker: not started yet */
+    JobQueue inflight;          /* parallel: compiling in driver */
+    JobQueue done;
+    struct {
+        VideoEGL *egl;
+        pthread_t thread;
+        pthread_mutex_t mutex;
+        pthread_cond_t cond_job;
+        pthread_cond_t cond_idle;
+        int busy;
+        int quit;
+    } worker;
+};
+
+
+static double GetMonotonicTimeInMilliSecond(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void JobQueue_Init(JobQueue *q)
+{
+    q->head = NULL;
+    q->tail = NULL;
+}
+
+static void JobQueue_Push(JobQueue *q, Job *job)
+{
+    job->next = NULL;
+    if (q->tail) {
+        q->tail->next = job;
+    } else {
+        q->head = job;
+    }
+    q->tail = job;
+}
+
+static Job *JobQueue_Pop(JobQueue *q)
+{
+    Job *job = q->head;
+    if (job) {
+        q->head = job->next;
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+        job->next = NULL;
+    }
+    return job;
+}
+
+static Job *JobQueue_Find(JobQueue *q, int id)
+{
+    Job *job;
+    for (job = q->head; job; job = job->next) {
+        if (job->id == id) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void Job_Delete(Job *job)
+{
+    Source_Release(job->source);
+    free(job);
+}
+
+
+static void PrintShaderLog(const char *message, GLuint shader)
+{
+    GLchar build_log[512];
+    glGetShaderInfoLog(shader, sizeof(build_log), NULL, build_log);
+    printf("%s %d: %s\r\n", message, shader, build_log);
+}
+
+static void PrintProgramLog(const char *message, GLuint program)
+{
+    GLchar build_log[512];
+    glGetProgramInfoLog(program, sizeof(build_log), NULL, build_log);
+    printf("%s %d: %s\r\n", message, program, build_log);
+}
+
+static GLuint CompileShader(GLenum type, const char *source, int source_length)
+{
+    GLuint shader;
+    GLint param;
+
+    shader = glCreateShader(type);
+    if (shader == 0) {
+        return 0;
+    }
+    glShaderSource(shader, 1, &source, (source_length > 0) ? &source_length : NULL);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &param);
+    if (param != GL_TRUE) {
+        PrintShaderLog((type == GL_VERTEX_SHADER) ? "vertex_shader" : "fragment_shader", shader);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+/* every program shares attribute 0, so the quad setup does not depend on program */
+static GLuint StartLink(GLuint vertex_shader, GLuint fragment_shader)
+{
+    GLuint program;
+    program = glCreateProgram();
+    glBindAttribLocation(program, 0, "vertex_coord");
+    glAttachShader(program, vertex_shader);
+    glAttachShader(program, fragment_shader);
+    glLinkProgram(program);
+    return program;
+}
+
+static GLuint FinishLink(GLuint program)
+{
+    GLint param;
+    glGetProgramiv(program, GL_LINK_STATUS, &param);
+    if (param != GL_TRUE) {
+        PrintProgramLog("program", program);
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+static GLuint BuildProgram(GLuint vertex_shader, const char *source, int source_length)
+{
+    GLuint fragment_shader;
+    GLuint program;
+
+    fragment_shader = CompileShader(GL_FRAGMENT_SHADER, source, source_length);
+    if (fragment_shader == 0) {
+        return 0;
+    }
+    program = FinishLink(StartLink(vertex_shader, fragment_shader));
+    /* stays alive while attached */
+    glDeleteShader(fragment_shader);
+    return program;
+}
+
+
+/* cache lookup first, real compile only on miss or rejected binary */
+static GLuint ShaderBuilder_BuildCached(ShaderBuilder *sb, GLuint vertex_shader,
+                                        const char *source, int source_length)
+{
+    GLuint program;
+    uint64_t key;
+    double t;
+
+    key = 0;
+    if (sb->cache) {
+        key = ProgramCache_MakeKey(sb->cache, source, source_length);
+        program = ProgramCache_Load(sb->cache, key);
+        if (program) {
+            return program;
+        }
+    }
+    t = GetMonotonicTimeInMilliSecond();
+    program = BuildProgram(vertex_shader, source, source_length);
+    if (program && sb->cache) {
+        ProgramCache_Store(sb->cache, key, program, GetMonotonicTimeInMilliSecond() - t);
+    }
+    return program;
+}
+
+
+/* worker thread */
+static void *ShaderBuilder_WorkerMain(void *arg)
+{
+    ShaderBuilder *sb = arg;
+    GLuint vertex_shader;
+
+    VideoEGL_MakeCurrent(sb->worker.egl);
+    vertex_shader = CompileShader(GL_VERTEX_SHADER, sb->vertex_source, -1);
+
+    pthread_mutex_lock(&sb->worker.mutex);
+    for (;;) {
+        Job *job;
+        while (!sb->worker.quit && sb->pending.head == NULL) {
+            pthread_cond_wait(&sb->worker.cond_job, &sb->worker.mutex);
+        }
+        if (sb->worker.quit) {
+            break;
+        }
+        job = JobQueue_Pop(&sb->pending);
+        sb->worker.busy = 1;
+        pthread_mutex_unlock(&sb->worker.mutex);
+
+        job->program = (vertex_shader) ? ShaderBuilder_BuildCached(sb, vertex_shader, Source_GetText(job->source), Source_GetLength(job->source)) : 0;
+        /* objects must be complete before the render context uses them */
+        glFinish();
+
+        pthread_mutex_lock(&sb->worker.mutex);
+        JobQueue_Push(&sb->done, job);
+        sb->worker.busy = 0;
+        pthread_cond_broadcast(&sb->worker.cond_idle);
+    }
+    pthread_mutex_unlock(&sb->worker.mutex);
+
+    if (vertex_shader) {
+        glDeleteShader(vertex_shader);
+    }
+    VideoEGL_UnmakeCurrent(sb->worker.egl);
+    return NULL;
+}
+
+static int ShaderBuilder_StartWorker(ShaderBuilder *sb, VideoEGL *share)
+{
+    sb->worker.egl = malloc(VideoEGL_InstanceSize());
+    if (!sb->worker.egl) {
+        return 1;
+    }
+    if (VideoEGL_ConstructShared(sb->worker.egl, share)) {
+        free(sb->worker.egl);
+        sb->worker.egl = NULL;
+        return 2;
+    }
+    sb->worker.busy = 0;
+    sb->worker.quit = 0;
+    pthread_mutex_init(&sb->worker.mutex, NULL);
+    pthread_cond_init(&sb->worker.cond_job, NULL);
+    pthread_cond_init(&sb->worker.cond_idle, NULL);
+    if (pthread_create(&sb->worker.thread, NULL, ShaderBuilder_WorkerMain, sb)) {
+        pthread_cond_destroy(&sb->worker.cond_idle);
+        pthread_cond_destroy(&sb->worker.cond_job);
+        pthread_mutex_destroy(&sb->worker.mutex);
+        VideoEGL_Destruct(sb->worker.egl);
+        free(sb->worker.egl);
+        sb->worker.egl = NULL;
+        return 3;
+    }
+    return 0;
+}
+
+static void ShaderBuilder_StopWorker(ShaderBuilder *sb)
+{
+    pthread_mutex_lock(&sb->worker.mutex);
+    sb->worker.quit = 1;
+    pthread_cond_signal(&sb->worker.cond_job);
+    pthread_mutex_unlock(&sb->worker.mutex);
+    pthread_join(sb->worker.thread, NULL);
+
+    pthread_cond_destroy(&sb->worker.cond_idle);
+    pthread_cond_destroy(&sb->worker.cond_job);
+    pthread_mutex_destroy(&sb->worker.mutex);
+    VideoEGL_Destruct(sb->worker.egl);
+    free(sb->worker.egl);
+    sb->worker.egl = NULL;
+}
+
+
+/* ShaderBuilder */
+size_t ShaderBuilder_InstanceSize(void)
+{
+    return sizeof(ShaderBuilder);
+}
+
+int ShaderBuilder_Construct(ShaderBuilder *sb, VideoEGL *share, const char *vertex_source)
+{
+    memset(sb, 0, sizeof(*sb));
+    sb->vertex_source = vertex_source;
+    JobQueue_Init(&sb->pending);
+    JobQueue_Init(&sb->inflight);
+    JobQueue_Init(&sb->done);
+
+    if (GLExt_Has("GL_KHR_parallel_shader_compile")) {
+        MaxShaderCompilerThreadsKHRProc max_threads;
+        max_threads = (MaxShaderCompilerThreadsKHRProc)GLExt_GetProcAddress("glMaxShaderCompilerThreadsKHR");
+        if (max_threads) {
+            max_threads(0xffffffffu); /* implementation decides */
+        }
+        sb->mode = ShaderBuilder_MODE_PARALLEL;
+    } else if (ShaderBuilder_StartWorker(sb, share) == 0) {
+        sb->mode = ShaderBuilder_MODE_WORKER;
+    } else {
+        sb->mode = ShaderBuilder_MODE_SYNC;
+    }
+
+    if (sb->mode != ShaderBuilder_MODE_WORKER) {
+        sb->vertex_shader = CompileShader(GL_VERTEX_SHADER, vertex_source, -1);
+        if (sb->vertex_shader == 0) {
+            return 1;
+        }
+    }
+    ShaderBuilder_SetProgramCache(sb, 1);
+    return 0;
+}
+
+void ShaderBuilder_Destruct(ShaderBuilder *sb)
+{
+    Job *job;
+
+    if (sb->mode == ShaderBuilder_MODE_WORKER) {
+        ShaderBuilder_StopWorker(sb);
+    }
+    ShaderBuilder_SetProgramCache(sb, 0);
+    while ((job = JobQueue_Pop(&sb->pending)) != NULL) {
+        Job_Delete(job);
+    }
+    while ((job = JobQueue_Pop(&sb->inflight)) != NULL) {
+        glDeleteShader(job->fragment_shader);
+        glDeleteProgram(job->program);
+        Job_Delete(job);
+    }
+    while ((job = JobQueue_Pop(&sb->done)) != NULL) {
+        glDeleteProgram(job->program);
+        Job_Delete(job);
+    }
+    if (sb->vertex_shader) {
+        glDeleteShader(sb->vertex_shader);
+    }
+    memset(sb, 0, sizeof(*sb));
+}
+
+ShaderBuilder_MODE ShaderBuilder_GetMode(ShaderBuilder *sb)
+{
+    return sb->mode;
+}
+
+int ShaderBuilder_SetProgramCache(ShaderBuilder *sb, int enable)
+{
+    ProgramCache *pc;
+
+    if (!enable) {
+        if (sb->cache) {
+            ProgramCache_Destruct(sb->cache);
+            free(sb->cache);
+            sb->cache = NULL;
+        }
+        return 0;
+    }
+    if (sb->cache) {
+        return 0;
+    }
+    pc = malloc(ProgramCache_InstanceSize());
+    if (!pc) {
+        return 1;
+    }
+    if (ProgramCache_Construct(pc, NULL, sb->vertex_source)) {
+        free(pc);
+        return 2;               /* no driver support */
+    }
+    sb->cache = pc;
+    return 0;
+}
+
+void ShaderBuilder_PrintStats(ShaderBuilder *sb)
+{
+    if (sb->cache) {
+        ProgramCache_PrintStats(sb->cache);
+    } else {
+        printf("program cache: disabled\r\n");
+    }
+}
+
+const char *ShaderBuilder_GetModeName(ShaderBuilder_MODE mode)
+{
+    switch (mode) {
+    case ShaderBuilder_MODE_SYNC:
+        return "sync";
+    case ShaderBuilder_MODE_WORKER:
+        return "worker thread";
+    case ShaderBuilder_MODE_PARALLEL:
+        return "KHR_parallel_shader_compile";
+    default:
+        assert(0);
+        return "?";
+    }
+}
+
+int ShaderBuilder_Submit(ShaderBuilder *sb, int id, unsigned int generation, Source *source)
+{
+    const GLchar *text;
+    GLint length;
+    Job *job;
+
+    if (sb->mode == ShaderBuilder_MODE_WORKER) {
+        pthread_mutex_lock(&sb->worker.mutex);
+        job = JobQueue_Find(&sb->pending, id);
+        if (job) {
+            /* not started yet: compile only the latest source */
+            Source_Release(job->source);
+            job->source = Source_Retain(source);
+            job->generation = generation;
+            pthread_mutex_unlock(&sb->worker.mutex);
+            return 0;
+        }
+        pthread_mutex_unlock(&sb->worker.mutex);
+    }
+
+    job = malloc(sizeof(*job));
+    if (!job) {
+        return 2;
+    }
+    job->next = NULL;
+    job->id = id;
+    job->generation = generation;
+    job->source = Source_Retain(source);
+    job->fragment_shader = 0;
+    job->program = 0;
+    job->cache_key = 0;
+    job->start_ms = 0.0;
+
+    switch (sb->mode) {
+    case ShaderBuilder_MODE_WORKER:
+        pthread_mutex_lock(&sb->worker.mutex);
+        JobQueue_Push(&sb->pending, job);
+        pthread_cond_signal(&sb->worker.cond_job);
+        pthread_mutex_unlock(&sb->worker.mutex);
+        break;
+    case ShaderBuilder_MODE_PARALLEL:
+        if (sb->cache) {
+            job->cache_key = ProgramCache_MakeKey(sb->cache, Source_GetText(job->source), Source_GetLength(job->source));
+            job->program = ProgramCache_Load(sb->cache, job->cache_key);
+            if (job->program) {
+                JobQueue_Push(&sb->done, job);
+                break;
+            }
+        }
+        /* status queries are deferred to Poll, so these calls do not block */
+        job->start_ms = GetMonotonicTimeInMilliSecond();
+        job->fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+        text = Source_GetText(job->source);
+        length = Source_GetLength(job->source);
+        glShaderSource(job->fragment_shader, 1, &text, &length);
+        glCompileShader(job->fragment_shader);
+        job->program = StartLink(sb->vertex_shader, job->fragment_shader);
+        JobQueue_Push(&sb->inflight, job);
+        break;
+    case ShaderBuilder_MODE_SYNC:
+    default:
+        job->program = ShaderBuilder_BuildCached(sb, sb->vertex_shader, Source_GetText(job->source), Source_GetLength(job->source));
+        JobQueue_Push(&sb->done, job);
+        break;
+    }
+    return 0;
+}
+
+static void ShaderBuilder_CompleteInflight(ShaderBuilder *sb, int blocking)
+{
+    Job *job, *next;
+    JobQueue rest;
+
+    JobQueue_Init(&rest);
+    for (job = sb->inflight.head; job; job = next) {
+        GLint param;
+        next = job->next;
+        param = GL_TRUE;
+        if (!blocking) {
+            glGetProgramiv(job->program, GL_COMPLETION_STATUS_KHR, &param);
+        }
+        if (param != GL_TRUE) {
+            JobQueue_Push(&rest, job);
+            continue;
+        }
+        glGetShaderiv(job->fragment_shader, GL_COMPILE_STATUS, &param);
+        if (param != GL_TRUE) {
+            PrintShaderLog("fragment_shader", job->fragment_shader);
+            glDeleteProgram(job->program);
+            job->program = 0;
+        } else {
+            job->program = FinishLink(job->program);
+            if (job->program && sb->cache) {
+                /* includes time waiting for Poll, an upper bound */
+                ProgramCache_Store(sb->cache, job->cache_key, job->program,
+                                   GetMonotonicTimeInMilliSecond() - job->start_ms);
+            }
+        }
+        glDeleteShader(job->fragment_shader);
+        job->fragment_shader = 0;
+        JobQueue_Push(&sb->done, job);
+    }
+    sb->inflight = rest;
+}
+
+int ShaderBuilder_Poll(ShaderBuilder *sb, int *out_id, unsigned int *out_generation,
+                       unsigned int *out_program)
+{
+    Job *job;
+
+    switch (sb->mode) {
+    case ShaderBuilder_MODE_WORKER:
+        pthread_mutex_lock(&sb->worker.mutex);
+        job = JobQueue_Pop(&sb->done);
+        pthread_mutex_unlock(&sb->worker.mutex);
+        break;
+    case ShaderBuilder_MODE_PARALLEL:
+        if (sb->inflight.head) {
+            ShaderBuilder_CompleteInflight(sb, 0);
+        }
+        job = JobQueue_Pop(&sb->done);
+        break;
+    default:
+        job = JobQueue_Pop(&sb->done);
+        break;
+    }
+    if (job == NULL) {
+        return 0;
+    }
+    *out_id = job->id;
+    *out_generation = job->generation;
+    *out_program = job->program;
+    Job_Delete(job);
+    return 1;
+}
+
+void ShaderBuilder_Wait(ShaderBuilder *sb)
+{
+    switch (sb->mode) {
+    case ShaderBuilder_MODE_WORKER:
+        pthread_mutex_lock(&sb->worker.mutex);
+        while (sb->pending.head || sb->worker.busy) {
+            pthread_cond_wait(&sb->worker.cond_idle, &sb->worker.mutex);
+        }
+        pthread_mutex_unlock(&sb->worker.mutex);
+        break;
+    case ShaderBuilder_MODE_PARALLEL:
+        ShaderBuilder_CompleteInflight(sb, 1);
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,51 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* compile/link of layer programs off the render path */
+
+#ifndef INCLUDED_SHADER_BUILDER_H
+#define INCLUDED_SHADER_BUILDER_H
+
+
+#include <stddef.h>
+#include "base.h"
+#include "video_egl.h"
+#include "source_store.h"
+
+typedef struct ShaderBuilder_ ShaderBuilder;
+
+typedef enum {
+    ShaderBuilder_MODE_SYNC,        /* compile in Submit, fallback */
+    ShaderBuilder_MODE_WORKER,      /* worker thread with shared EGL context */
+    ShaderBuilder_MODE_PARALLEL,    /* KHR_parallel_shader_compile */
+    ShaderBuilder_MODE_ENUMS
+} ShaderBuilder_MODE;
+
+
+size_t ShaderBuilder_InstanceSize(void);
+
+/* picks the best available mode. 'share' must be current on the calling thread,
+ * and all other calls must come from this thread */
+int ShaderBuilder_Construct(ShaderBuilder *sb, VideoEGL *share, const char *vertex_source);
+void ShaderBuilder_Destruct(ShaderBuilder *sb);
+ShaderBuilder_MODE ShaderBuilder_GetMode(ShaderBuilder *sb);
+const char *ShaderBuilder_GetModeName(ShaderBuilder_MODE mode);
+
+/* on-disk program binary cache, enabled by default when the driver supports it.
+ * change only while no build is running */
+int ShaderBuilder_SetProgramCache(ShaderBuilder *sb, int enable);
+void ShaderBuilder_PrintStats(ShaderBuilder *sb);
+
+/* source is retained until the job is done. a job of the same id still
+ * waiting in queue is superseded */
+int ShaderBuilder_Submit(ShaderBuilder *sb, int id, unsigned int generation, Source *source);
+
+/* non-blocking. return 1 and fill outputs when a job is finished.
+ * out_program is 0 when compile or link failed, otherwise owned by caller */
+int ShaderBuilder_Poll(ShaderBuilder *sb, int *out_id, unsigned int *out_generation,
+                       unsigned int *out_program);
+
+/* block until every submitted job is finished (results still come from Poll) */
+void ShaderBuilder_Wait(ShaderBuilder *sb);
+
+
+#endif
@@ -0,0 +1,248 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "base.h"
+#include "source_store.h"
+
+
+struct Source_ {
+    int refs;
+    const char *text;
+    size_t length;
+    void *map;                  /* NULL: not a mapping */
+    char *heap;                 /* NULL: not from Source_CreateFromBuffer */
+};
+
+typedef struct {
+    char *path;
+    Source *source;             /* the store's reference */
+    struct stat st;             /* of the file mapped */
+} StoreEntry;
+
+struct SourceStore_ {
+    StoreEntry *entry;
+    int num_entry;
+    int max_entry;
+};
+
+
+static Source *Source_Allocate(void)
+{
+    Source *s = malloc(sizeof(*s));
+    if (!s) {
+        return NULL;
+    }
+    memset(s, 0, sizeof(*s));
+    s->refs = 1;
+    s->text = "";
+    return s;
+}
+
+/* an empty file cannot be mapped, it is an empty text */
+static Source *Source_Map(const char *path, struct stat *out_st)
+{
+    struct stat st;
+    Source *s;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        printf("%s: %s\r\n", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0) {
+        printf("%s: %s\r\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        printf("%s: not a regular file\r\n", path);
+        close(fd);
+        return NULL;
+    }
+    if ((size_t)st.st_size > (size_t)0x7fffffff) {
+        printf("%s: too large for a shader\r\n", path);
+        close(fd);
+        return NULL;
+    }
+    s = Source_Allocate();
+    if (!s) {
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size > 0) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            printf("%s: mmap: %s\r\n", path, strerror(errno));
+            free(s);
+            close(fd);
+            return NULL;
+        }
+        s->map = map;
+        s->text = map;
+        s->length = (size_t)st.st_size;
+    }
+    /* the mapping outlives the fd */
+    close(fd);
+    *out_st = st;
+    return s;
+}
+
+Source *Source_CreateFromBuffer(char *text, size_t length)
+{
+    Source *s = Source_Allocate();
+    if (!s) {
+        return NULL;
+    }
+    s->heap = text;
+    s->text = text;
+    s->length = length;
+    return s;
+}
+
+Source *Source_Snapshot(Source *s)
+{
+    char *copy;
+    Source *result;
+
+    if (s->map == NULL) {
+        return Source_Retain(s);    /* in memory, it does not change */
+    }
+    copy = malloc(s->length + 1);
+    if (!copy) {
+        return NULL;
+    }
+    memcpy(copy, s->text, s->length);
+    copy[s->length] = '\0';
+    result = Source_CreateFromBuffer(copy, s->length);
+    if (!result) {
+        free(copy);
+    }
+    return result;
+}
+
+Source *Source_Retain(Source *s)
+{
+    __atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+    return s;
+}
+
+void Source_Release(Source *s)
+{
+    if (__atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    if (s->map) {
+        munmap(s->map, s->length);
+    }
+    free(s->heap);
+    free(s);
+}
+
+const char *Source_GetText(const Source *s)
+{
+    return s->text;
+}
+
+int Source_GetLength(const Source *s)
+{
+    return (int)s->length;
+}
+
+SourceStore *SourceStore_Create(void)
+{
+    SourceStore *ss = malloc(sizeof(*ss));
+    if (!ss) {
+        return NULL;
+    }
+    memset(ss, 0, sizeof(*ss));
+    return ss;
+}
+
+void SourceStore_Delete(SourceStore *ss)
+{
+    int i;
+    for (i = 0; i < ss->num_entry; i++) {
+        free(ss->entry[i].path);
+        if (ss->entry[i].source) {
+            Source_Release(ss->entry[i].source);
+        }
+    }
+    free(ss->entry);
+    free(ss);
+}
+
+static StoreEntry *SourceStore_Find(SourceStore *ss, const char *path)
+{
+    int i;
+    for (i = 0; i < ss->num_entry; i++) {
+        if (strcmp(ss->entry[i].path, path) == 0) {
+            return &ss->entry[i];
+        }
+    }
+    return NULL;
+}
+
+Source *SourceStore_Open(SourceStore *ss, const char *path)
+{
+    StoreEntry *e;
+
+    e = SourceStore_Find(ss, path);
+    if (e == NULL) {
+        char *copy;
+        if (ss->num_entry == ss->max_entry) {
+            int n = (ss->max_entry == 0) ? 8 : ss->max_entry * 2;
+            StoreEntry *p = realloc(ss->entry, sizeof(*p) * n);
+            if (!p) {
+                return NULL;
+            }
+            ss->entry = p;
+            ss->max_entry = n;
+        }
+        copy = strdup(path);
+        if (!copy) {
+            return NULL;
+        }
+        e = &ss->entry[ss->num_entry++];
+        e->path = copy;
+        e->source = NULL;
+    }
+    if (e->source) {
+        struct stat st;
+        /* written in place since: the pages under the mapping are not the
+         * text it was mapped with, or gone */
+        if (stat(path, &st) != 0 || st.st_ino != e->st.st_ino || st.st_dev != e->st.st_dev
+            || st.st_size != e->st.st_size || st.st_mtim.tv_sec != e->st.st_mtim.tv_sec
+            || st.st_mtim.tv_nsec != e->st.st_mtim.tv_nsec) {
+            Source_Release(e->source);
+            e->source = NULL;
+        }
+    }
+    if (e->source == NULL) {
+        e->source = Source_Map(path, &e->st);
+        if (e->source == NULL) {
+            return NULL;
+        }
+    }
+    return Source_Retain(e->source);
+}
+
+void SourceStore_Invalidate(SourceStore *ss, const char *path)
+{
+    StoreEntry *e = SourceStore_Find(ss, path);
+    if (e && e->source) {
+        Source_Release(e->source);
+        e->source = NULL;
+    }
+}
@@ -0,0 +1,44 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* shader text by reference count: a file is mapped read-only and read from
+ * the mapping, without read() copies. the text is not NUL terminated, use its
+ * length.
+ * a file written in place changes the pages under its mapping, and one cut
+ * short faults past its new end. a mapping is only read right after Open,
+ * which maps the file again when it changed; what is kept is a snapshot */
+
+#ifndef INCLUDED_SOURCE_STORE_H
+#define INCLUDED_SOURCE_STORE_H
+
+
+#include <stddef.h>
+#include "base.h"
+
+typedef struct Source_ Source;
+typedef struct SourceStore_ SourceStore;
+
+
+SourceStore *SourceStore_Create(void);
+/* sources handed out keep their own reference */
+void SourceStore_Delete(SourceStore *ss);
+
+/* new reference to the mapping of 'path', the same one while the file is not
+ * invalidated nor changed on disk. for immediate reading only. NULL: error
+ * printed */
+Source *SourceStore_Open(SourceStore *ss, const char *path);
+/* 'path' changed on disk: the next Open maps it again */
+void SourceStore_Invalidate(SourceStore *ss, const char *path);
+
+/* text generated in memory, 'text' from malloc is taken. NULL: out of memory */
+Source *Source_CreateFromBuffer(char *text, size_t length);
+/* a copy of a mapping in memory, to be kept. 's' itself (new reference)
+ * when it is in memory already. NULL: out of memory */
+Source *Source_Snapshot(Source *s);
+Source *Source_Retain(Source *s);
+/* from any thread, the last reference unmaps or frees */
+void Source_Release(Source *s);
+const char *Source_GetText(const Source *s);
+int Source_GetLength(const Source *s);
+
+
+#endif
@@ -3,163 +3,242 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <assert.h>
 
-#include <bcm_host.h>
-
 #include "config.h"
 #include "base.h"
+#include "video_egl.h"
+#include "video_backend.h"
 #include "video.h"
+#include "histogram.h"
+
+enum {
+    LATENCY_SAMPLES = 512
+};
+
+/* first one is the default */
+static const VideoBackend *const backends[] = {
+#ifdef USE_DISPMANX
+    &VideoBackend_Dispmanx,
+#endif
+#ifdef USE_KMS
+    &VideoBackend_Kms,
+#endif
+    &VideoBackend_Headless
+};
 
 struct Video_ {
-    struct {
-        DISPMANX_DISPLAY_HANDLE_T display;
-        DISPMANX_ELEMENT_HANDLE_T element;
-    } dispmanx;
-    struct {
-        VC_RECT_T rect;
-    } window, source;
+    const VideoBackend *backend;
+    void *impl;
+    VideoPlacement placement;   /* of the current surface */
+    Video_Config config;
+    Histogram *latency;         /* submit to present */
 };
 
 
-static int VideoDeviceIdToDispmanxId(Video_DEVICE_ID device_id)
+static double GetMonotonicTimeInMilliSecond(void)
 {
-    return device_id;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
 }
 
-static DISPMANX_UPDATE_HANDLE_T StartUpdate(void)
+/* page flip events carry the present time, a blocking swap is its own */
+static int Video_IsPresentTimed(Video *v)
 {
-    return vc_dispmanx_update_start(sched_get_priority_max(SCHED_OTHER));
+    return (v->backend->HandleEvents != NULL) ? 1 : 0;
 }
 
-static void EndUpdate(DISPMANX_UPDATE_HANDLE_T update)
+
+Video *Video_Open(OPTIONAL const char *backend_name, const Video_Config *config)
 {
-    vc_dispmanx_update_submit_sync(update);
+    const VideoBackend *backend;
+    Video *v;
+    size_t i;
+
+    backend = NULL;
+    for (i = 0; i < ARRAY_SIZEOF(backends); i++) {
+        if (backend_name == NULL || strcmp(backend_name, backends[i]->name) == 0) {
+            backend = backends[i];
+            break;
+        }
+    }
+    if (backend == NULL) {
+        printf("unknown display: %s (built with: %s)\r\n", backend_name, Video_GetBackendNames());
+        return NULL;
+    }
+    v = malloc(sizeof(*v));
+    if (!v) {
+        return NULL;
+    }
+    memset(v, 0, sizeof(*v));
+    v->backend = backend;
+    v->config = *config;
+    v->latency = Histogram_Create(LATENCY_SAMPLES);
+    if (v->latency == NULL) {
+        free(v);
+        return NULL;
+    }
+    v->impl = backend->Open(config);
+    if (v->impl == NULL) {
+        Histogram_Delete(v->latency);
+        free(v);
+        return NULL;
+    }
+    return v;
 }
 
-
-int Video_GetScreenSize(Video_DEVICE_ID device_id, int *out_width, int *out_height)
+void Video_Close(Video *v)
 {
-    uint32_t width;
-    uint32_t height;
-    graphics_get_display_size(VideoDeviceIdToDispmanxId(device_id),
-                              &width, &height);
-    *out_width = (int)width;
-    *out_height = (int)height;
-    return 0;
+    v->backend->Close(v->impl);
+    Histogram_Delete(v->latency);
+    free(v);
 }
 
-size_t Video_InstanceSize(void)
+const char *Video_GetBackendName(Video *v)
 {
-    return sizeof(Video);
+    return v->backend->name;
 }
 
-int Video_ConstructWindow(Video *v,
-                          Video_DEVICE_ID device_id,
-                          int x, int y, int width, int height,
-                          int layer)
+const char *Video_GetBackendNames(void)
 {
-    int dispmanx_device_id;
-    VC_RECT_T dest_rect;
-    VC_RECT_T src_rect;
-    DISPMANX_DISPLAY_HANDLE_T display;
-    DISPMANX_ELEMENT_HANDLE_T element;
-    DISPMANX_UPDATE_HANDLE_T update;
+    static char names[64];
+    size_t i;
+    if (names[0] == '\0') {
+        for (i = 0; i < ARRAY_SIZEOF(backends); i++) {
+            if (i > 0) {
+                strncat(names, " ", sizeof(names) - strlen(names) - 1);
+            }
+            strncat(names, backends[i]->name, sizeof(names) - strlen(names) - 1);
+        }
+    }
+    return names;
+}
 
-    vc_dispmanx_rect_set(&dest_rect, x, y, width, height);
-    vc_dispmanx_rect_set(&src_rect, 0, 0, width << 16, height << 16);
+void Video_GetScreenSize(Video *v, int *out_width, int *out_height)
+{
+    v->backend->GetScreenSize(v->impl, out_width, out_height);
+}
 
-    update = StartUpdate();
-    if (update == DISPMANX_NO_HANDLE) {
+int Video_SetScreenSize(Video *v, int width, int height)
+{
+    if (v->backend->SetScreenSize == NULL) {
         return 1;
     }
-    dispmanx_device_id = VideoDeviceIdToDispmanxId(device_id);
-    display = vc_dispmanx_display_open(dispmanx_device_id);
-    element = vc_dispmanx_element_add(update,
-                                      display,
-                                      layer,
-                                      &dest_rect,
-                                      (DISPMANX_RESOURCE_HANDLE_T)0,
-                                      &src_rect,
-                                      DISPMANX_PROTECTION_NONE,
-                                      (VC_DISPMANX_ALPHA_T *)NULL,
-                                      (DISPMANX_CLAMP_T *)NULL,
-                                      DISPMANX_NO_ROTATE);
-    EndUpdate(update);
-
-    v->dispmanx.display = display;
-    v->dispmanx.element = element;
-    v->window.rect = dest_rect;
-    v->source.rect = src_rect;
-    return 0;
+    return v->backend->SetScreenSize(v->impl, width, height);
 }
 
-void Video_DestructWindow(Video *v)
+int Video_ConstructEGL(Video *v, VideoEGL *ve)
 {
-    DISPMANX_UPDATE_HANDLE_T update;
+    return v->backend->ConstructEGL(v->impl, ve);
+}
 
-    update = StartUpdate();
-    if (update == DISPMANX_NO_HANDLE) {
-        assert(0);
+int Video_CreateSurface(Video *v, VideoEGL *ve,
+                        int x, int y, int width, int height,
+                        int source_width, int source_height)
+{
+    VideoPlacement placement;
+    placement.x = x;
+    placement.y = y;
+    placement.width = width;
+    placement.height = height;
+    placement.source_width = source_width;
+    placement.source_height = source_height;
+    if (v->backend->CreateSurface(v->impl, ve, &placement)) {
+        return 1;
     }
-    vc_dispmanx_element_remove(update, v->dispmanx.element);
-    vc_dispmanx_display_close(v->dispmanx.display);
-    EndUpdate(update);
-
-    memset(v, 0, sizeof(*v));
+    if (VideoEGL_MakeCurrent(ve)) {
+        v->backend->DestroySurface(v->impl, ve);
+        return 2;
+    }
+    /* backends with their own swap pace it themselves */
+    if (v->backend->SwapBuffers == NULL
+        && VideoEGL_SetSwapInterval(ve, v->config.swap_interval)) {
+        printf("%s: swap interval %d not supported\r\n", v->backend->name, v->config.swap_interval);
+    }
+    v->placement = placement;
+    return 0;
 }
 
-unsigned int Video_GetNativeWindowElement(Video *v)
+void Video_DestroySurface(Video *v, VideoEGL *ve)
 {
-    return (unsigned int)v->dispmanx.element;
+    v->backend->DestroySurface(v->impl, ve);
 }
 
-void Video_SetSourceRect(Video *v, int x, int y, int width, int height)
+int Video_SwapBuffers(Video *v, VideoEGL *ve)
 {
-    vc_dispmanx_rect_set(&v->source.rect, x << 16, y << 16, width << 16, height << 16);
+    double submit_ms;
+    int ret;
+
+    if (Video_IsPresentTimed(v)) {
+        return v->backend->SwapBuffers(v->impl, ve);
+    }
+    submit_ms = GetMonotonicTimeInMilliSecond();
+    if (v->backend->SwapBuffers) {
+        ret = v->backend->SwapBuffers(v->impl, ve);
+    } else {
+        ret = VideoEGL_SwapBuffers(ve);
+    }
+    if (ret == 0) {
+        Histogram_Push(v->latency, GetMonotonicTimeInMilliSecond() - submit_ms);
+    }
+    return ret;
 }
 
-void Video_SetWindowRect(Video *v, int x, int y, int width, int height)
+int Video_GetEventFd(Video *v)
 {
-    vc_dispmanx_rect_set(&v->window.rect, x, y, width, height);
+    if (v->backend->GetEventFd == NULL) {
+        return -1;
+    }
+    return v->backend->GetEventFd(v->impl);
 }
 
-int Video_ApplyChange(Video *v)
+int Video_HandleEvents(Video *v, double *out_present_ms)
 {
-    int ret;
-    DISPMANX_UPDATE_HANDLE_T update;
+    double latency_ms;
 
-    /* value from interface/vmcs_host/vc_vchi_dispmanx.h */
-    const uint32_t ELEMENT_CHANGE_DEST_RECT = (1 << 2);
-    const uint32_t ELEMENT_CHANGE_SRC_RECT  = (1 << 3);
-    const uint32_t mode = ELEMENT_CHANGE_SRC_RECT | ELEMENT_CHANGE_DEST_RECT;
+    if (v->backend->HandleEvents == NULL) {
+        return 0;
+    }
+    if (v->backend->HandleEvents(v->impl, out_present_ms, &latency_ms) == 0) {
+        return 0;
+    }
+    Histogram_Push(v->latency, latency_ms);
+    return 1;
+}
 
-    update = StartUpdate();
-    if (update == DISPMANX_NO_HANDLE) {
-        return 1;
+int Video_IsSwapPending(Video *v)
+{
+    if (v->backend->IsSwapPending == NULL) {
+        return 0;
     }
-    ret = vc_dispmanx_element_change_attributes(update,
-                                                v->dispmanx.element,
-                                                mode,
-                                                0, /* layer */
-                                                0xff, /* opacity */
-                                                &v->window.rect,
-                                                &v->source.rect,
-                                                (DISPMANX_RESOURCE_HANDLE_T)0, /* mask */
-                                                DISPMANX_NO_ROTATE);
-    EndUpdate(update);
-    return ret;
+    return v->backend->IsSwapPending(v->impl);
 }
 
 void Video_GetWindowSize(Video *v, int *out_width, int *out_height)
 {
-    *out_width = (int)v->window.rect.width;
-    *out_height = (int)v->window.rect.height;
+    *out_width = v->placement.width;
+    *out_height = v->placement.height;
 }
 
 void Video_GetSourceSize(Video *v, int *out_width, int *out_height)
 {
-    *out_width = (int)(v->source.rect.width >> 16);
-    *out_height = (int)(v->source.rect.height >> 16);
+    *out_width = v->placement.source_width;
+    *out_height = v->placement.source_height;
+}
+
+int Video_GetLatency(Video *v, Histogram_Summary *out)
+{
+    return Histogram_Summarize(v->latency, out);
+}
+
+const char *Video_GetLatencyMethod(Video *v)
+{
+    return Video_IsPresentTimed(v) ? "submit to page flip" : "submit to swap return";
 }
 
+void Video_ClearLatency(Video *v)
+{
+    Histogram_Clear(v->latency);
+}
@@ -1,6 +1,8 @@
 /* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
 
-/* undocumented-dispmanx wrapper */
+/* display backend: the screen, where the window sits on it and the EGL surface
+ * shown there. dispmanx on the Pi firmware, DRM/KMS with GBM on a plain Linux
+ * console, headless pbuffer wherever EGL is */
 
 #ifndef INCLUDED_VIDEO_H
 #define INCLUDED_VIDEO_H
@@ -8,30 +10,62 @@
 
 #include <stddef.h>
 
+#include "base.h"
+#include "video_egl.h"
+#include "histogram.h"
+
 typedef struct Video_ Video;
 
-typedef enum {
-	Video_DEVICE_ID_MAIN_LCD = 0,
-	Video_DEVICE_ID_AUX_LCD = 1,
-	Video_DEVICE_ID_HDMI = 2,
-	Video_DEVICE_ID_SDTV = 3,
-	Video_DEVICE_ID_ENUMS
-} Video_DEVICE_ID;
+/* what the window surface should be. a backend that cannot do it says so
+ * and does the nearest thing */
+typedef struct {
+    VideoEGL_FORMAT format;
+    int swap_interval;          /* vsyncs per frame, 0: do not wait */
+    int buffers;                /* 2: double, 3: triple (KMS only) */
+} Video_Config;
+
+
+/* backend by name, NULL: the first one built in. NULL on failure */
+Video *Video_Open(OPTIONAL const char *backend_name, const Video_Config *config);
+/* surface must be destroyed */
+void Video_Close(Video *v);
+const char *Video_GetBackendName(Video *v);
+/* space separated, for usage and errors */
+const char *Video_GetBackendNames(void);
+
+void Video_GetScreenSize(Video *v, int *out_width, int *out_height); /* the unit is 'pixel' */
+/* backends without a real screen only (headless). nonzero: not supported */
+int Video_SetScreenSize(Video *v, int width, int height);
 
+/* display, config and context for this backend's surfaces */
+int Video_ConstructEGL(Video *v, VideoEGL *ve);
+/* window at (x, y, width, height) on the screen, showing a surface of
+ * source_width x source_height scaled to fit. the backend may settle for
+ * less (no scaler), the sizes are read back with Video_Get*Size.
+ * the surface is made current with the configured swap interval */
+int Video_CreateSurface(Video *v, VideoEGL *ve,
+                        int x, int y, int width, int height,
+                        int source_width, int source_height);
+void Video_DestroySurface(Video *v, VideoEGL *ve);
+int Video_SwapBuffers(Video *v, VideoEGL *ve);
 
-size_t Video_InstanceSize(void); /* you need pre-allocate this size */
-int Video_GetScreenSize(Video_DEVICE_ID device_id, int *out_width, int *out_height); /* the unit is 'pixel' */
+/* asynchronous presentation (KMS page flips): poll this fd, -1 when the swap
+ * itself paces frames */
+int Video_GetEventFd(Video *v);
+/* drain the fd. 1 when a frame reached the screen, at *out_present_ms
+ * (CLOCK_MONOTONIC) */
+int Video_HandleEvents(Video *v, double *out_present_ms);
+/* no room for another swap, the next one would block */
+int Video_IsSwapPending(Video *v);
 
-int Video_ConstructWindow(Video *v,
-                          Video_DEVICE_ID device_id,
-                          int x, int y, int width, int height,
-                          int layer);
-void Video_DestructWindow(Video *v);
+/* submit-to-present latency in milliseconds: Video_SwapBuffers called to
+ * the page flip with KMS, to eglSwapBuffers returning elsewhere (the swap
+ * blocks until the previous frame is shown). 1: no samples */
+int Video_GetLatency(Video *v, Histogram_Summary *out);
+/* how the latency is measured, for the report */
+const char *Video_GetLatencyMethod(Video *v);
+void Video_ClearLatency(Video *v);
 
-unsigned int Video_GetNativeWindowElement(Video *v);
-void Video_SetSourceRect(Video *v, int x, int y, int width, int height);
-void Video_SetWindowRect(Video *v, int x, int y, int width, int height);
-int Video_ApplyChange(Video *v);
 void Video_GetWindowSize(Video *v, int *out_width, int *out_height);
 void Video_GetSourceSize(Video *v, int *out_width, int *out_height);
 
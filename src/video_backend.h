@@ -0,0 +1,52 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+/* what a display backend implements, for video.c only */
+
+#ifndef INCLUDED_VIDEO_BACKEND_H
+#define INCLUDED_VIDEO_BACKEND_H
+
+
+#include "base.h"
+#include "video_egl.h"
+#include "video.h"
+
+typedef struct {
+    int x, y, width, height;    /* window on the screen */
+    int source_width;           /* surface, scaled to the window */
+    int source_height;
+} VideoPlacement;
+
+typedef struct {
+    const char *name;
+    /* backend state, NULL: not usable on this machine (reason printed).
+     * a config it cannot follow is reported and approximated */
+    void *(*Open)(const Video_Config *config);
+    void (*Close)(void *impl);
+    void (*GetScreenSize)(void *impl, int *out_width, int *out_height);
+    OPTIONAL int (*SetScreenSize)(void *impl, int width, int height);
+    /* config in the format given to Open */
+    int (*ConstructEGL)(void *impl, VideoEGL *ve);
+    /* called again on every layout or scaling change, after DestroySurface.
+     * may change the placement to what the hardware can show */
+    int (*CreateSurface)(void *impl, VideoEGL *ve, VideoPlacement *inout_placement);
+    void (*DestroySurface)(void *impl, VideoEGL *ve);
+    /* NULL: eglSwapBuffers */
+    OPTIONAL int (*SwapBuffers)(void *impl, VideoEGL *ve);
+    /* backends presenting asynchronously (page flips), with their own
+     * SwapBuffers. NULL otherwise */
+    OPTIONAL int (*GetEventFd)(void *impl);
+    /* *out_latency_ms: from the SwapBuffers call of that frame */
+    OPTIONAL int (*HandleEvents)(void *impl, double *out_present_ms, double *out_latency_ms);
+    OPTIONAL int (*IsSwapPending)(void *impl);
+} VideoBackend;
+
+#ifdef USE_DISPMANX
+extern const VideoBackend VideoBackend_Dispmanx;
+#endif
+#ifdef USE_KMS
+extern const VideoBackend VideoBackend_Kms;
+#endif
+extern const VideoBackend VideoBackend_Headless;
+
+
+#endif
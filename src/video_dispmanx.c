@@ -0,0 +1,181 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <bcm_host.h>
+#include <EGL/egl.h>
+
+#include "config.h"
+#include "base.h"
+#include "video_egl.h"
+#include "video_backend.h"
+
+/* undocumented-dispmanx: one element on the main LCD, the EGL window surface
+ * is its resource and the hardware scaler stretches it to the element */
+
+typedef enum {
+	DEVICE_ID_MAIN_LCD = 0,
+	DEVICE_ID_AUX_LCD = 1,
+	DEVICE_ID_HDMI = 2,
+	DEVICE_ID_SDTV = 3
+} DEVICE_ID;
+
+typedef struct {
+    DISPMANX_DISPLAY_HANDLE_T display;
+    DISPMANX_ELEMENT_HANDLE_T element; /* DISPMANX_NO_HANDLE: no surface yet */
+    EGL_DISPMANX_WINDOW_T native_window;
+    VideoEGL_FORMAT format;
+} Dispmanx;
+
+
+static DISPMANX_UPDATE_HANDLE_T StartUpdate(void)
+{
+    return vc_dispmanx_update_start(sched_get_priority_max(SCHED_OTHER));
+}
+
+static void EndUpdate(DISPMANX_UPDATE_HANDLE_T update)
+{
+    vc_dispmanx_update_submit_sync(update);
+}
+
+
+static void *Dispmanx_Open(const Video_Config *config)
+{
+    static int is_host_initialized = 0;
+    Dispmanx *d;
+
+    if (!is_host_initialized) {
+        bcm_host_init();
+        is_host_initialized = 1;
+    }
+    d = malloc(sizeof(*d));
+    if (!d) {
+        return NULL;
+    }
+    memset(d, 0, sizeof(*d));
+    d->display = vc_dispmanx_display_open(DEVICE_ID_MAIN_LCD);
+    if (d->display == DISPMANX_NO_HANDLE) {
+        printf("dispmanx: cannot open the main LCD\r\n");
+        free(d);
+        return NULL;
+    }
+    d->element = DISPMANX_NO_HANDLE;
+    d->format = config->format;
+    if (config->buffers != 2) {
+        printf("dispmanx: buffering is up to the firmware, --buffers ignored\r\n");
+    }
+    return d;
+}
+
+static void Dispmanx_Close(void *impl)
+{
+    Dispmanx *d = impl;
+    DISPMANX_UPDATE_HANDLE_T update;
+
+    update = StartUpdate();
+    if (update == DISPMANX_NO_HANDLE) {
+        assert(0);
+    }
+    if (d->element != DISPMANX_NO_HANDLE) {
+        vc_dispmanx_element_remove(update, d->element);
+    }
+    EndUpdate(update);
+    vc_dispmanx_display_close(d->display);
+    free(d);
+}
+
+static void Dispmanx_GetScreenSize(void *impl, int *out_width, int *out_height)
+{
+    uint32_t width;
+    uint32_t height;
+    (void)impl;
+    graphics_get_display_size(DEVICE_ID_MAIN_LCD, &width, &height);
+    *out_width = (int)width;
+    *out_height = (int)height;
+}
+
+static int Dispmanx_ConstructEGL(void *impl, VideoEGL *ve)
+{
+    Dispmanx *d = impl;
+    return VideoEGL_Construct(ve, eglGetDisplay(EGL_DEFAULT_DISPLAY), EGL_WINDOW_BIT, d->format);
+}
+
+/* the element is added once, later changes move and rescale it */
+static int Dispmanx_PlaceElement(Dispmanx *d, VC_RECT_T *dest_rect, VC_RECT_T *src_rect)
+{
+    int ret;
+    DISPMANX_UPDATE_HANDLE_T update;
+
+    /* value from interface/vmcs_host/vc_vchi_dispmanx.h */
+    const uint32_t ELEMENT_CHANGE_DEST_RECT = (1 << 2);
+    const uint32_t ELEMENT_CHANGE_SRC_RECT  = (1 << 3);
+    const uint32_t mode = ELEMENT_CHANGE_SRC_RECT | ELEMENT_CHANGE_DEST_RECT;
+
+    update = StartUpdate();
+    if (update == DISPMANX_NO_HANDLE) {
+        return 1;
+    }
+    ret = 0;
+    if (d->element == DISPMANX_NO_HANDLE) {
+        d->element = vc_dispmanx_element_add(update,
+                                             d->display,
+                                             0, /* layer */
+                                             dest_rect,
+                                             (DISPMANX_RESOURCE_HANDLE_T)0,
+                                             src_rect,
+                                             DISPMANX_PROTECTION_NONE,
+                                             (VC_DISPMANX_ALPHA_T *)NULL,
+                                             (DISPMANX_CLAMP_T *)NULL,
+                                             DISPMANX_NO_ROTATE);
+        ret = (d->element == DISPMANX_NO_HANDLE) ? 1 : 0;
+    } else {
+        ret = vc_dispmanx_element_change_attributes(update,
+                                                    d->element,
+                                                    mode,
+                                                    0, /* layer */
+                                                    0xff, /* opacity */
+                                                    dest_rect,
+                                                    src_rect,
+                                                    (DISPMANX_RESOURCE_HANDLE_T)0, /* mask */
+                                                    DISPMANX_NO_ROTATE);
+    }
+    EndUpdate(update);
+    return ret;
+}
+
+static int Dispmanx_CreateSurface(void *impl, VideoEGL *ve, VideoPlacement *inout_placement)
+{
+    Dispmanx *d = impl;
+    VideoPlacement *p = inout_placement;
+    VC_RECT_T dest_rect;
+    VC_RECT_T src_rect;
+
+    vc_dispmanx_rect_set(&dest_rect, p->x, p->y, p->width, p->height);
+    vc_dispmanx_rect_set(&src_rect, 0, 0, p->source_width << 16, p->source_height << 16);
+    if (Dispmanx_PlaceElement(d, &dest_rect, &src_rect)) {
+        return 1;
+    }
+    d->native_window.element = d->element;
+    d->native_window.width = p->source_width;
+    d->native_window.height = p->source_height;
+    return VideoEGL_CreateWindowSurface(ve, (EGLNativeWindowType)&d->native_window);
+}
+
+static void Dispmanx_DestroySurface(void *impl, VideoEGL *ve)
+{
+    (void)impl;
+    VideoEGL_DestroySurface(ve);
+}
+
+const VideoBackend VideoBackend_Dispmanx = {
+    .name = "dispmanx",
+    .Open = Dispmanx_Open,
+    .Close = Dispmanx_Close,
+    .GetScreenSize = Dispmanx_GetScreenSize,
+    .ConstructEGL = Dispmanx_ConstructEGL,
+    .CreateSurface = Dispmanx_CreateSurface,
+    .DestroySurface = Dispmanx_DestroySurface
+};
@@ -19,7 +19,16 @@ struct VideoEGL_ {
     EGLSurface surface;
     EGLContext context;
     EGLConfig config;
-    EGL_DISPMANX_WINDOW_T native_window;
+    int is_shared;              /* display is borrowed, do not terminate */
+};
+
+static const struct {
+    const char *name;
+    EGLint red, green, blue, alpha;
+} formats[VideoEGL_FORMAT_ENUMS] = {
+    { "RGBA8888", 8, 8, 8, 8 },
+    { "RGB888",   8, 8, 8, 0 },
+    { "RGB565",   5, 6, 5, 0 }
 };
 
 static void PrintEGLConfigAttrib(EGLDisplay display)
@@ -67,14 +76,52 @@ size_t VideoEGL_InstanceSize(void)
     return sizeof(VideoEGL);
 }
 
-int VideoEGL_Construct(VideoEGL *ve)
+/* eglChooseConfig only has minimum sizes and sorts deeper configs first,
+ * so RGB565 would get an 8888 config. pick the exact match by hand */
+static int ChooseConfig(EGLDisplay display, EGLint surface_type, VideoEGL_FORMAT format,
+                        EGLConfig *out_config)
+{
+    EGLConfig configs[64];
+    EGLint num;
+    EGLint i;
+    const EGLint config_attrib_list[] = {
+        EGL_RED_SIZE, formats[format].red,
+        EGL_GREEN_SIZE, formats[format].green,
+        EGL_BLUE_SIZE, formats[format].blue,
+        EGL_ALPHA_SIZE, formats[format].alpha,
+        EGL_SURFACE_TYPE, surface_type,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+        EGL_NONE
+    };
+
+    if (eglChooseConfig(display, config_attrib_list, configs, (EGLint)ARRAY_SIZEOF(configs), &num) != EGL_TRUE
+        || num == 0) {
+        return 1;
+    }
+    for (i = 0; i < num; i++) {
+        EGLint red, green, blue, alpha;
+        eglGetConfigAttrib(display, configs[i], EGL_RED_SIZE, &red);
+        eglGetConfigAttrib(display, configs[i], EGL_GREEN_SIZE, &green);
+        eglGetConfigAttrib(display, configs[i], EGL_BLUE_SIZE, &blue);
+        eglGetConfigAttrib(display, configs[i], EGL_ALPHA_SIZE, &alpha);
+        if (red == formats[format].red && green == formats[format].green
+            && blue == formats[format].blue && alpha == formats[format].alpha) {
+            *out_config = configs[i];
+            return 0;
+        }
+    }
+    printf("egl: no exact %s config, using the closest one\r\n", formats[format].name);
+    *out_config = configs[0];
+    return 0;
+}
+
+int VideoEGL_Construct(VideoEGL *ve, EGLDisplay display, EGLint surface_type,
+                       VideoEGL_FORMAT format)
 {
-    EGLDisplay display;
     EGLContext context;
     EGLConfig config;
     EGLBoolean r;
 
-    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
     if (display == EGL_NO_DISPLAY) {
         return 1;
     }
@@ -95,23 +142,49 @@ int VideoEGL_Construct(VideoEGL *ve)
 
     PrintEGLConfigAttrib(display);
 
+    if (ChooseConfig(display, surface_type, format, &config)) {
+        eglTerminate(display);
+        return 5;
+    }
+
+    {
+        static const EGLint context_attrib_list[] = {
+            EGL_CONTEXT_CLIENT_VERSION, 2,
+            EGL_NONE
+        };
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attrib_list);
+        if (context == 0) {
+            eglTerminate(display);
+            return 6;
+        }
+    }
+
+    ve->display = display;
+    ve->context = context;
+    ve->surface = 0;
+    ve->config = config;
+    ve->is_shared = 0;
+    return 0;
+}
+
+int VideoEGL_ConstructShared(VideoEGL *ve, VideoEGL *share)
+{
+    EGLConfig config;
+    EGLContext context;
+    EGLSurface surface;
+    EGLBoolean r;
+
     {
         EGLint num;
         static const EGLint config_attrib_list[] = {
-            EGL_RED_SIZE, 8,
-            EGL_GREEN_SIZE, 8,
-            EGL_BLUE_SIZE, 8,
-            EGL_ALPHA_SIZE, 8,
-            EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
             EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
             EGL_NONE
         };
-        r = eglChooseConfig(display, config_attrib_list, &config, 1, &num);
-        if (r != EGL_TRUE) {
-            eglTerminate(ve->display);
-            return 5;
+        r = eglChooseConfig(share->display, config_attrib_list, &config, 1, &num);
+        if (r != EGL_TRUE || num == 0) {
+            return 1;
         }
-        /* printf("eglChooseConfig: %d\r\n", num); */
     }
 
     {
@@ -119,37 +192,68 @@ int VideoEGL_Construct(VideoEGL *ve)
             EGL_CONTEXT_CLIENT_VERSION, 2,
             EGL_NONE
         };
-        context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attrib_list);
-        if (context == 0) {
-            eglTerminate(ve->display);
-            return 6;
+        context = eglCreateContext(share->display, config, share->context, context_attrib_list);
+        if (context == EGL_NO_CONTEXT) {
+            return 2;
         }
     }
 
-    ve->display = display;
+    {
+        static const EGLint pbuffer_attrib_list[] = {
+            EGL_WIDTH, 1,
+            EGL_HEIGHT, 1,
+            EGL_NONE
+        };
+        surface = eglCreatePbufferSurface(share->display, config, pbuffer_attrib_list);
+        if (surface == EGL_NO_SURFACE) {
+            eglDestroyContext(share->display, context);
+            return 3;
+        }
+    }
+
+    ve->display = share->display;
     ve->context = context;
-    ve->surface = 0;
+    ve->surface = surface;
     ve->config = config;
-    memset(&ve->native_window, 0, sizeof(ve->native_window));
+    ve->is_shared = 1;
     return 0;
 }
 
 void VideoEGL_Destruct(VideoEGL *ve)
 {
     eglDestroyContext(ve->display, ve->context);
-    eglTerminate(ve->display);
+    if (ve->is_shared) {
+        eglDestroySurface(ve->display, ve->surface);
+    } else {
+        eglTerminate(ve->display);
+    }
     memset(ve, 0, sizeof(*ve));
 }
 
-int VideoEGL_CreateSurface(VideoEGL *ve, unsigned int native_window_element, int width, int height)
+EGLint VideoEGL_GetNativeVisualID(VideoEGL *ve)
 {
-    EGL_DISPMANX_WINDOW_T *nw;
-    nw = &ve->native_window;
-    nw->element = (DISPMANX_ELEMENT_HANDLE_T)native_window_element;
-    nw->width = width;
-    nw->height = height;
-    ve->surface = eglCreateWindowSurface(ve->display, ve->config, nw, NULL);
-    return 0;
+    EGLint id;
+    if (eglGetConfigAttrib(ve->display, ve->config, EGL_NATIVE_VISUAL_ID, &id) != EGL_TRUE) {
+        return 0;
+    }
+    return id;
+}
+
+int VideoEGL_CreateWindowSurface(VideoEGL *ve, EGLNativeWindowType window)
+{
+    ve->surface = eglCreateWindowSurface(ve->display, ve->config, window, NULL);
+    return (ve->surface == EGL_NO_SURFACE) ? 1 : 0;
+}
+
+int VideoEGL_CreatePbufferSurface(VideoEGL *ve, int width, int height)
+{
+    const EGLint pbuffer_attrib_list[] = {
+        EGL_WIDTH, width,
+        EGL_HEIGHT, height,
+        EGL_NONE
+    };
+    ve->surface = eglCreatePbufferSurface(ve->display, ve->config, pbuffer_attrib_list);
+    return (ve->surface == EGL_NO_SURFACE) ? 1 : 0;
 }
 
 void VideoEGL_DestroySurface(VideoEGL *ve)
@@ -191,3 +295,12 @@ int VideoEGL_SwapBuffers(VideoEGL *ve)
     }
 }
 
+int VideoEGL_SetSwapInterval(VideoEGL *ve, int interval)
+{
+    return (eglSwapInterval(ve->display, interval) == EGL_TRUE) ? 0 : 1;
+}
+
+const char *VideoEGL_GetFormatName(VideoEGL_FORMAT format)
+{
+    return formats[format].name;
+}
@@ -5,23 +5,45 @@
 
 
 #include <stddef.h>
+#include <EGL/egl.h>
 
 
 typedef struct VideoEGL_ VideoEGL;
 
+/* window surface channel sizes */
+typedef enum {
+    VideoEGL_FORMAT_RGBA8888,
+    VideoEGL_FORMAT_RGB888,
+    VideoEGL_FORMAT_RGB565,
+    VideoEGL_FORMAT_ENUMS
+} VideoEGL_FORMAT;
+
 
 size_t VideoEGL_InstanceSize(void);
 
-int VideoEGL_Construct(VideoEGL *ve);
+/* initialize 'display' (from the display backend), ES2 context for
+ * 'surface_type' surfaces (EGL_WINDOW_BIT, EGL_PBUFFER_BIT). the config with
+ * exactly the channel sizes of 'format', else the closest the driver offers */
+int VideoEGL_Construct(VideoEGL *ve, EGLDisplay display, EGLint surface_type,
+                       VideoEGL_FORMAT format);
+/* context in the same share group as 'share' on a 1x1 pbuffer, for worker threads */
+int VideoEGL_ConstructShared(VideoEGL *ve, VideoEGL *share);
 void VideoEGL_Destruct(VideoEGL *ve);
 
-int VideoEGL_CreateSurface(VideoEGL *ve, unsigned int native_window_element, int width, int height);
+/* EGL_NATIVE_VISUAL_ID of the config, e.g. the GBM format. 0: none */
+EGLint VideoEGL_GetNativeVisualID(VideoEGL *ve);
+int VideoEGL_CreateWindowSurface(VideoEGL *ve, EGLNativeWindowType window);
+int VideoEGL_CreatePbufferSurface(VideoEGL *ve, int width, int height);
 void VideoEGL_DestroySurface(VideoEGL *ve);
 
 int VideoEGL_MakeCurrent(VideoEGL *ve);
 int VideoEGL_UnmakeCurrent(VideoEGL *ve);
 
 int VideoEGL_SwapBuffers(VideoEGL *ve);
+/* for the current surface: 0 tearing, 1 every vsync, 2 every other */
+int VideoEGL_SetSwapInterval(VideoEGL *ve, int interval);
+
+const char *VideoEGL_GetFormatName(VideoEGL_FORMAT format);
 
 
 #endif
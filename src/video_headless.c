@@ -0,0 +1,107 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "config.h"
+#include "base.h"
+#include "video_egl.h"
+#include "video_backend.h"
+
+/* no window system: the screen is a size, the window a pbuffer of the source
+ * size. runs anywhere EGL does, Mesa llvmpipe included */
+
+enum {
+    DEFAULT_SCREEN_WIDTH = 1280,
+    DEFAULT_SCREEN_HEIGHT = 720
+};
+
+typedef struct {
+    int width;
+    int height;
+    VideoEGL_FORMAT format;
+} Headless;
+
+
+/* nothing is shown: swap interval and buffering do not apply */
+static void *Headless_Open(const Video_Config *config)
+{
+    Headless *h = malloc(sizeof(*h));
+    if (!h) {
+        return NULL;
+    }
+    h->format = config->format;
+    h->width = DEFAULT_SCREEN_WIDTH;
+    h->height = DEFAULT_SCREEN_HEIGHT;
+    return h;
+}
+
+static void Headless_Close(void *impl)
+{
+    free(impl);
+}
+
+static void Headless_GetScreenSize(void *impl, int *out_width, int *out_height)
+{
+    Headless *h = impl;
+    *out_width = h->width;
+    *out_height = h->height;
+}
+
+static int Headless_SetScreenSize(void *impl, int width, int height)
+{
+    Headless *h = impl;
+    h->width = width;
+    h->height = height;
+    return 0;
+}
+
+static int Headless_ConstructEGL(void *impl, VideoEGL *ve)
+{
+    Headless *h = impl;
+    EGLDisplay display;
+    const char *client_extensions;
+
+    /* Mesa: render without any window system or DRM master */
+    display = EGL_NO_DISPLAY;
+    client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (client_extensions && strstr(client_extensions, "EGL_MESA_platform_surfaceless")) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+        get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (get_platform_display) {
+            display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        }
+    }
+    if (display == EGL_NO_DISPLAY) {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    return VideoEGL_Construct(ve, display, EGL_PBUFFER_BIT, h->format);
+}
+
+static int Headless_CreateSurface(void *impl, VideoEGL *ve, VideoPlacement *inout_placement)
+{
+    (void)impl;
+    return VideoEGL_CreatePbufferSurface(ve, inout_placement->source_width,
+                                         inout_placement->source_height);
+}
+
+static void Headless_DestroySurface(void *impl, VideoEGL *ve)
+{
+    (void)impl;
+    VideoEGL_DestroySurface(ve);
+}
+
+const VideoBackend VideoBackend_Headless = {
+    .name = "headless",
+    .Open = Headless_Open,
+    .Close = Headless_Close,
+    .GetScreenSize = Headless_GetScreenSize,
+    .SetScreenSize = Headless_SetScreenSize,
+    .ConstructEGL = Headless_ConstructEGL,
+    .CreateSurface = Headless_CreateSurface,
+    .DestroySurface = Headless_DestroySurface
+};
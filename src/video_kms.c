@@ -0,0 +1,626 @@
+/* -*- Mode: c; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <gbm.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "config.h"
+#include "base.h"
+#include "video_egl.h"
+#include "video_backend.h"
+
+/* DRM/KMS without a window system: a GBM surface on the primary plane of the
+ * first connected output, shown by atomic commits. a commit returns at once,
+ * its page flip event on the DRM fd tells when the frame is on screen.
+ * PJ_DRM_DEVICE picks the card (e.g. the vkms one), the first usable otherwise.
+ * double buffered: a swap waits for the previous flip. triple: one more
+ * frame queues behind it and is committed from the flip event, with swap
+ * interval 0 a newer frame replaces the queued one (mailbox) */
+
+enum {
+    MAX_CARD = 8
+};
+
+typedef struct {
+    int drm_fd;
+    uint32_t id;
+} Framebuffer;                  /* user data of a GBM buffer, removed with it */
+
+typedef struct {
+    int fd;
+    struct gbm_device *gbm;
+    struct gbm_surface *surface; /* NULL: none */
+    uint32_t format;            /* of the surface, from the EGL config */
+    uint32_t connector_id;
+    uint32_t crtc_id;
+    uint32_t plane_id;
+    drmModeModeInfo mode;
+    uint32_t mode_blob_id;
+    drmModeCrtc *saved_crtc;    /* console state, restored on close */
+    struct {
+        uint32_t connector_crtc_id;
+        uint32_t crtc_mode_id;
+        uint32_t crtc_active;
+        uint32_t fb_id;
+        uint32_t crtc_id;
+        uint32_t src_x, src_y, src_w, src_h;
+        uint32_t crtc_x, crtc_y, crtc_w, crtc_h;
+    } prop;
+    VideoPlacement placement;
+    Video_Config config;        /* swap_interval 0 only as mailbox */
+    int needs_modeset;          /* first commit, or the CRTC went dark */
+    struct gbm_bo *scanout_bo;  /* on screen */
+    struct gbm_bo *pending_bo;  /* committed, flip not done yet */
+    struct gbm_bo *queued_bo;   /* triple buffering: next after pending */
+    double pending_submit_ms;   /* SwapBuffers called, CLOCK_MONOTONIC */
+    double queued_submit_ms;
+    double present_ms;
+    double latency_ms;
+    int is_presented;           /* flipped since the last HandleEvents */
+} Kms;
+
+
+static double GetMonotonicTimeInMilliSecond(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+/* property id by name, and its current value. 0: none */
+static uint32_t FindProperty(int fd, uint32_t object_id, uint32_t object_type,
+                             const char *name, OPTIONAL uint64_t *out_value)
+{
+    drmModeObjectProperties *props;
+    uint32_t id = 0;
+    uint32_t i;
+
+    props = drmModeObjectGetProperties(fd, object_id, object_type);
+    if (!props) {
+        return 0;
+    }
+    for (i = 0; i < props->count_props && id == 0; i++) {
+        drmModePropertyRes *p = drmModeGetProperty(fd, props->props[i]);
+        if (!p) {
+            continue;
+        }
+        if (strcmp(p->name, name) == 0) {
+            id = p->prop_id;
+            if (out_value) {
+                *out_value = props->prop_values[i];
+            }
+        }
+        drmModeFreeProperty(p);
+    }
+    drmModeFreeObjectProperties(props);
+    return id;
+}
+
+static int Kms_SelectPlane(Kms *k, int crtc_index)
+{
+    drmModePlaneRes *planes;
+    uint32_t i;
+
+    planes = drmModeGetPlaneResources(k->fd);
+    if (!planes) {
+        return 1;
+    }
+    k->plane_id = 0;
+    for (i = 0; i < planes->count_planes && k->plane_id == 0; i++) {
+        drmModePlane *p = drmModeGetPlane(k->fd, planes->planes[i]);
+        uint64_t type = 0;
+        if (!p) {
+            continue;
+        }
+        if ((p->possible_crtcs & (1u << crtc_index))
+            && FindProperty(k->fd, p->plane_id, DRM_MODE_OBJECT_PLANE, "type", &type)
+            && type == DRM_PLANE_TYPE_PRIMARY) {
+            k->plane_id = p->plane_id;
+        }
+        drmModeFreePlane(p);
+    }
+    drmModeFreePlaneResources(planes);
+    return (k->plane_id == 0) ? 1 : 0;
+}
+
+/* first connected connector, its preferred mode, a CRTC it can drive */
+static int Kms_SelectOutput(Kms *k)
+{
+    drmModeRes *res;
+    drmModeConnector *conn;
+    int crtc_index;
+    int i, j;
+
+    res = drmModeGetResources(k->fd);
+    if (!res) {
+        return 1;
+    }
+    conn = NULL;
+    for (i = 0; i < res->count_connectors; i++) {
+        conn = drmModeGetConnector(k->fd, res->connectors[i]);
+        if (conn && conn->connection == DRM_MODE_CONNECTED && conn->count_modes > 0) {
+            break;
+        }
+        if (conn) {
+            drmModeFreeConnector(conn);
+            conn = NULL;
+        }
+    }
+    if (!conn) {
+        drmModeFreeResources(res);
+        return 2;
+    }
+    k->connector_id = conn->connector_id;
+    k->mode = conn->modes[0];
+    for (i = 0; i < conn->count_modes; i++) {
+        if (conn->modes[i].type & DRM_MODE_TYPE_PREFERRED) {
+            k->mode = conn->modes[i];
+            break;
+        }
+    }
+    crtc_index = -1;
+    for (i = 0; i < conn->count_encoders && crtc_index < 0; i++) {
+        drmModeEncoder *enc = drmModeGetEncoder(k->fd, conn->encoders[i]);
+        if (!enc) {
+            continue;
+        }
+        for (j = 0; j < res->count_crtcs; j++) {
+            if (enc->possible_crtcs & (1u << j)) {
+                crtc_index = j;
+                break;
+            }
+        }
+        drmModeFreeEncoder(enc);
+    }
+    drmModeFreeConnector(conn);
+    if (crtc_index < 0) {
+        drmModeFreeResources(res);
+        return 3;
+    }
+    k->crtc_id = res->crtcs[crtc_index];
+    drmModeFreeResources(res);
+    return Kms_SelectPlane(k, crtc_index) ? 4 : 0;
+}
+
+static int Kms_FindProperties(Kms *k)
+{
+    const uint32_t plane = DRM_MODE_OBJECT_PLANE;
+    k->prop.connector_crtc_id = FindProperty(k->fd, k->connector_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", NULL);
+    k->prop.crtc_mode_id = FindProperty(k->fd, k->crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID", NULL);
+    k->prop.crtc_active = FindProperty(k->fd, k->crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE", NULL);
+    k->prop.fb_id = FindProperty(k->fd, k->plane_id, plane, "FB_ID", NULL);
+    k->prop.crtc_id = FindProperty(k->fd, k->plane_id, plane, "CRTC_ID", NULL);
+    k->prop.src_x = FindProperty(k->fd, k->plane_id, plane, "SRC_X", NULL);
+    k->prop.src_y = FindProperty(k->fd, k->plane_id, plane, "SRC_Y", NULL);
+    k->prop.src_w = FindProperty(k->fd, k->plane_id, plane, "SRC_W", NULL);
+    k->prop.src_h = FindProperty(k->fd, k->plane_id, plane, "SRC_H", NULL);
+    k->prop.crtc_x = FindProperty(k->fd, k->plane_id, plane, "CRTC_X", NULL);
+    k->prop.crtc_y = FindProperty(k->fd, k->plane_id, plane, "CRTC_Y", NULL);
+    k->prop.crtc_w = FindProperty(k->fd, k->plane_id, plane, "CRTC_W", NULL);
+    k->prop.crtc_h = FindProperty(k->fd, k->plane_id, plane, "CRTC_H", NULL);
+    return (k->prop.connector_crtc_id && k->prop.crtc_mode_id && k->prop.crtc_active
+            && k->prop.fb_id && k->prop.crtc_id
+            && k->prop.src_x && k->prop.src_y && k->prop.src_w && k->prop.src_h
+            && k->prop.crtc_x && k->prop.crtc_y && k->prop.crtc_w && k->prop.crtc_h) ? 0 : 1;
+}
+
+/* atomic modesetting and an output on this card */
+static int Kms_Probe(Kms *k, const char *path)
+{
+    k->fd = open(path, O_RDWR | O_CLOEXEC);
+    if (k->fd < 0) {
+        return 1;
+    }
+    if (drmSetClientCap(k->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) == 0
+        && drmSetClientCap(k->fd, DRM_CLIENT_CAP_ATOMIC, 1) == 0
+        && Kms_SelectOutput(k) == 0
+        && Kms_FindProperties(k) == 0) {
+        return 0;
+    }
+    close(k->fd);
+    k->fd = -1;
+    return 2;
+}
+
+static void *Kms_Open(const Video_Config *config)
+{
+    Kms *k;
+    const char *path;
+    char card[32];
+    int i;
+
+    k = malloc(sizeof(*k));
+    if (!k) {
+        return NULL;
+    }
+    memset(k, 0, sizeof(*k));
+    k->fd = -1;
+    path = getenv("PJ_DRM_DEVICE");
+    if (path) {
+        Kms_Probe(k, path);
+    } else {
+        for (i = 0; i < MAX_CARD; i++) {
+            snprintf(card, sizeof(card), "/dev/dri/card%d", i);
+            if (Kms_Probe(k, card) == 0) {
+                path = card;
+                break;
+            }
+        }
+    }
+    if (k->fd < 0) {
+        printf("kms: no DRM device with atomic modesetting and a connected output\r\n");
+        free(k);
+        return NULL;
+    }
+    k->gbm = gbm_create_device(k->fd);
+    if (!k->gbm) {
+        printf("kms: gbm_create_device failed\r\n");
+        close(k->fd);
+        free(k);
+        return NULL;
+    }
+    if (drmModeCreatePropertyBlob(k->fd, &k->mode, sizeof(k->mode), &k->mode_blob_id)) {
+        gbm_device_destroy(k->gbm);
+        close(k->fd);
+        free(k);
+        return NULL;
+    }
+    k->saved_crtc = drmModeGetCrtc(k->fd, k->crtc_id);
+    k->needs_modeset = 1;
+    k->config = *config;
+    /* a flip always waits for vblank, and there is no target vblank in atomic */
+    if (k->config.swap_interval > 1) {
+        printf("kms: swap interval %d not supported, using 1\r\n", k->config.swap_interval);
+        k->config.swap_interval = 1;
+    } else if (k->config.swap_interval == 0 && k->config.buffers < 3) {
+        printf("kms: swap interval 0 needs 3 buffers, using 1\r\n");
+        k->config.swap_interval = 1;
+    }
+    printf("kms: %s %dx%d@%d, %d buffers%s\r\n", path, k->mode.hdisplay, k->mode.vdisplay,
+           k->mode.vrefresh, k->config.buffers, (k->config.swap_interval == 0) ? ", mailbox" : "");
+    return k;
+}
+
+static void Kms_Close(void *impl)
+{
+    Kms *k = impl;
+    if (k->saved_crtc) {
+        /* back to the console */
+        if (k->saved_crtc->buffer_id) {
+            drmModeSetCrtc(k->fd, k->saved_crtc->crtc_id, k->saved_crtc->buffer_id,
+                           k->saved_crtc->x, k->saved_crtc->y,
+                           &k->connector_id, 1, &k->saved_crtc->mode);
+        }
+        drmModeFreeCrtc(k->saved_crtc);
+    }
+    drmModeDestroyPropertyBlob(k->fd, k->mode_blob_id);
+    gbm_device_destroy(k->gbm);
+    close(k->fd);
+    free(k);
+}
+
+static void Kms_GetScreenSize(void *impl, int *out_width, int *out_height)
+{
+    Kms *k = impl;
+    *out_width = k->mode.hdisplay;
+    *out_height = k->mode.vdisplay;
+}
+
+static int Kms_ConstructEGL(void *impl, VideoEGL *ve)
+{
+    Kms *k = impl;
+    EGLDisplay display;
+    EGLint visual;
+    const char *client_extensions;
+
+    display = EGL_NO_DISPLAY;
+    client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (client_extensions && (strstr(client_extensions, "EGL_KHR_platform_gbm")
+                              || strstr(client_extensions, "EGL_MESA_platform_gbm"))) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+        get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (get_platform_display) {
+            display = get_platform_display(EGL_PLATFORM_GBM_KHR, k->gbm, NULL);
+        }
+    }
+    if (display == EGL_NO_DISPLAY) {
+        display = eglGetDisplay((EGLNativeDisplayType)k->gbm);
+    }
+    if (VideoEGL_Construct(ve, display, EGL_WINDOW_BIT, k->config.format)) {
+        return 1;
+    }
+    /* the surface must be the config's format, or the window surface fails */
+    visual = VideoEGL_GetNativeVisualID(ve);
+    k->format = (visual != 0) ? (uint32_t)visual : GBM_FORMAT_XRGB8888;
+    return 0;
+}
+
+static void DestroyFramebuffer(struct gbm_bo *bo, void *data)
+{
+    Framebuffer *fb = data;
+    (void)bo;
+    drmModeRmFB(fb->drm_fd, fb->id);
+    free(fb);
+}
+
+/* 0: failed */
+static uint32_t Kms_GetFramebuffer(Kms *k, struct gbm_bo *bo)
+{
+    Framebuffer *fb;
+    uint32_t handles[4] = { 0, 0, 0, 0 };
+    uint32_t pitches[4] = { 0, 0, 0, 0 };
+    uint32_t offsets[4] = { 0, 0, 0, 0 };
+
+    fb = gbm_bo_get_user_data(bo);
+    if (fb) {
+        return fb->id;
+    }
+    fb = malloc(sizeof(*fb));
+    if (!fb) {
+        return 0;
+    }
+    handles[0] = gbm_bo_get_handle(bo).u32;
+    pitches[0] = gbm_bo_get_stride(bo);
+    if (drmModeAddFB2(k->fd, gbm_bo_get_width(bo), gbm_bo_get_height(bo),
+                      gbm_bo_get_format(bo), handles, pitches, offsets, &fb->id, 0)) {
+        free(fb);
+        return 0;
+    }
+    fb->drm_fd = k->fd;
+    gbm_bo_set_user_data(bo, fb, DestroyFramebuffer);
+    return fb->id;
+}
+
+/* return 0 or -errno */
+static int Kms_Commit(Kms *k, uint32_t fb_id, const VideoPlacement *p, uint32_t flags)
+{
+    drmModeAtomicReq *req;
+    int ret;
+
+    req = drmModeAtomicAlloc();
+    if (!req) {
+        return -ENOMEM;
+    }
+    if (k->needs_modeset || (flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
+        drmModeAtomicAddProperty(req, k->connector_id, k->prop.connector_crtc_id, k->crtc_id);
+        drmModeAtomicAddProperty(req, k->crtc_id, k->prop.crtc_mode_id, k->mode_blob_id);
+        drmModeAtomicAddProperty(req, k->crtc_id, k->prop.crtc_active, 1);
+        flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+    }
+    drmModeAtomicAddProperty(req, k->plane_id, k->prop.fb_id, fb_id);
+    drmModeAtomicAddProperty(req, k->plane_id, k->prop.crtc_id, k->crtc_id);
+    drmModeAtomicAddProperty(req, k->plane_id, k->prop.src_x, 0);
+    drmModeAtomicAddProperty(req, k->plane_id, k->prop.src_y, 0);
+    drmModeAtomicAddProperty(req, k->plane_id, k->prop.src_w, (uint64_t)p->source_width << 16);
+    drmModeAtomicAddProperty(req, k->plane_id, k->prop.src_h, (uint64_t)p->source_height << 16);
+    drmModeAtomicAddProperty(req, k->plane_id, k->prop.crtc_x, (uint64_t)p->x);
+    drmModeAtomicAddProperty(req, k->plane_id, k->prop.crtc_y, (uint64_t)p->y);
+    drmModeAtomicAddProperty(req, k->plane_id, k->prop.crtc_w, (uint64_t)p->width);
+    drmModeAtomicAddProperty(req, k->plane_id, k->prop.crtc_h, (uint64_t)p->height);
+    ret = drmModeAtomicCommit(k->fd, req, flags, k);
+    drmModeAtomicFree(req);
+    return ret;
+}
+
+/* scaling and positioning are optional for a primary plane, vkms has neither */
+static int Kms_TestPlacement(Kms *k, const VideoPlacement *p)
+{
+    struct gbm_bo *bo;
+    uint32_t fb_id;
+    int ret;
+
+    bo = gbm_bo_create(k->gbm, p->source_width, p->source_height, k->format, GBM_BO_USE_SCANOUT);
+    if (!bo) {
+        return 1;
+    }
+    fb_id = Kms_GetFramebuffer(k, bo);
+    ret = fb_id ? Kms_Commit(k, fb_id, p, DRM_MODE_ATOMIC_TEST_ONLY) : 1;
+    gbm_bo_destroy(bo);
+    return ret ? 1 : 0;
+}
+
+/* commit a locked front buffer, pending until its flip. the buffer is
+ * released on failure */
+static int Kms_Present(Kms *k, struct gbm_bo *bo, double submit_ms)
+{
+    uint32_t fb_id;
+    int ret;
+
+    fb_id = Kms_GetFramebuffer(k, bo);
+    ret = fb_id ? Kms_Commit(k, fb_id, &k->placement,
+                             DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK) : -EINVAL;
+    if (ret) {
+        printf("kms: commit failed: %s\r\n", strerror(-ret));
+        gbm_surface_release_buffer(k->surface, bo);
+        return 1;
+    }
+    k->needs_modeset = 0;
+    k->pending_bo = bo;
+    k->pending_submit_ms = submit_ms;
+    return 0;
+}
+
+static void OnPageFlip(int fd, unsigned int sequence,
+                       unsigned int tv_sec, unsigned int tv_usec, void *user_data)
+{
+    Kms *k = user_data;
+    struct gbm_bo *queued_bo;
+    (void)fd;
+    (void)sequence;
+    if (k->scanout_bo) {
+        gbm_surface_release_buffer(k->surface, k->scanout_bo);
+    }
+    k->scanout_bo = k->pending_bo;
+    k->pending_bo = NULL;
+    /* the event is timestamped with CLOCK_MONOTONIC */
+    k->present_ms = tv_sec * 1000.0 + tv_usec / 1000.0;
+    k->latency_ms = k->present_ms - k->pending_submit_ms;
+    k->is_presented = 1;
+    if (k->queued_bo) {
+        queued_bo = k->queued_bo;
+        k->queued_bo = NULL;
+        Kms_Present(k, queued_bo, k->queued_submit_ms);
+    }
+}
+
+/* the fd must be readable, drmHandleEvent blocks otherwise */
+static void Kms_DispatchEvents(Kms *k)
+{
+    drmEventContext context;
+    memset(&context, 0, sizeof(context));
+    context.version = 2;
+    context.page_flip_handler = OnPageFlip;
+    drmHandleEvent(k->fd, &context);
+}
+
+/* until the flip events empty 'slot' */
+static void Kms_WaitFlip(Kms *k, struct gbm_bo *const *slot)
+{
+    while (*slot) {
+        struct pollfd pfd;
+        pfd.fd = k->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("kms: poll: %s\r\n", strerror(errno));
+            return;
+        }
+        Kms_DispatchEvents(k);
+    }
+}
+
+static int Kms_CreateSurface(void *impl, VideoEGL *ve, VideoPlacement *inout_placement)
+{
+    Kms *k = impl;
+    VideoPlacement *p = inout_placement;
+
+    if (Kms_TestPlacement(k, p)) {
+        /* no scaler: the whole screen, 1:1 */
+        p->x = 0;
+        p->y = 0;
+        p->width = p->source_width = k->mode.hdisplay;
+        p->height = p->source_height = k->mode.vdisplay;
+        printf("kms: plane cannot scale or move, window is the screen\r\n");
+    }
+    k->surface = gbm_surface_create(k->gbm, p->source_width, p->source_height, k->format,
+                                    GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+    if (!k->surface) {
+        return 1;
+    }
+    if (VideoEGL_CreateWindowSurface(ve, (EGLNativeWindowType)k->surface)) {
+        gbm_surface_destroy(k->surface);
+        k->surface = NULL;
+        return 2;
+    }
+    k->placement = *p;
+    return 0;
+}
+
+static void Kms_DestroySurface(void *impl, VideoEGL *ve)
+{
+    Kms *k = impl;
+    Kms_WaitFlip(k, &k->queued_bo);
+    Kms_WaitFlip(k, &k->pending_bo);
+    VideoEGL_DestroySurface(ve);
+    if (k->scanout_bo) {
+        gbm_surface_release_buffer(k->surface, k->scanout_bo);
+        k->scanout_bo = NULL;
+    }
+    /* its framebuffers go with it, and the CRTC goes dark */
+    gbm_surface_destroy(k->surface);
+    k->surface = NULL;
+    k->needs_modeset = 1;
+}
+
+static int Kms_SwapBuffers(void *impl, VideoEGL *ve)
+{
+    Kms *k = impl;
+    struct gbm_bo *bo;
+    double submit_ms;
+
+    /* the main loop waits for the flip event before rendering, others block here */
+    if (k->config.buffers < 3) {
+        Kms_WaitFlip(k, &k->pending_bo);
+    } else if (k->config.swap_interval != 0) {
+        Kms_WaitFlip(k, &k->queued_bo);
+    }
+    submit_ms = GetMonotonicTimeInMilliSecond();
+    if (VideoEGL_SwapBuffers(ve)) {
+        return 1;
+    }
+    bo = gbm_surface_lock_front_buffer(k->surface);
+    if (!bo) {
+        return 2;
+    }
+    if (k->pending_bo == NULL) {
+        return Kms_Present(k, bo, submit_ms) ? 3 : 0;
+    }
+    if (k->queued_bo) {
+        /* mailbox: the newer frame takes the place, this one is never shown */
+        gbm_surface_release_buffer(k->surface, k->queued_bo);
+    }
+    k->queued_bo = bo;
+    k->queued_submit_ms = submit_ms;
+    return 0;
+}
+
+static int Kms_GetEventFd(void *impl)
+{
+    Kms *k = impl;
+    return k->fd;
+}
+
+static int Kms_HandleEvents(void *impl, double *out_present_ms, double *out_latency_ms)
+{
+    Kms *k = impl;
+    Kms_DispatchEvents(k);
+    if (!k->is_presented) {
+        return 0;
+    }
+    k->is_presented = 0;
+    *out_present_ms = k->present_ms;
+    *out_latency_ms = k->latency_ms;
+    return 1;
+}
+
+static int Kms_IsSwapPending(void *impl)
+{
+    Kms *k = impl;
+    if (k->config.buffers < 3) {
+        return (k->pending_bo != NULL) ? 1 : 0;
+    }
+    if (k->config.swap_interval == 0) {
+        return 0;               /* mailbox never blocks */
+    }
+    return (k->queued_bo != NULL) ? 1 : 0;
+}
+
+const VideoBackend VideoBackend_Kms = {
+    .name = "kms",
+    .Open = Kms_Open,
+    .Close = Kms_Close,
+    .GetScreenSize = Kms_GetScreenSize,
+    .ConstructEGL = Kms_ConstructEGL,
+    .CreateSurface = Kms_CreateSurface,
+    .DestroySurface = Kms_DestroySurface,
+    .SwapBuffers = Kms_SwapBuffers,
+    .GetEventFd = Kms_GetEventFd,
+    .HandleEvents = Kms_HandleEvents,
+    .IsSwapPending = Kms_IsSwapPending
+};